@@ -0,0 +1,141 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2014 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "bench.h"
+#include <typelib/typelib.h>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+static int strEq(const void *a, size_t na, const void *b, size_t nb)
+{
+    return na == nb && memcmp(a, b, na) == 0;
+}
+
+/*
+ * Each thread performs its share of a fixed number of operations on random
+ * keys: 90% lookups and 10% updates. The sharded table is compared with a
+ * single tl_HASHTABLE behind a global mutex.
+ */
+namespace {
+const size_t NKEYS = 1000000;
+const size_t NOPS = 4000000;
+
+class Workload {
+public:
+    virtual ~Workload() {}
+    virtual size_t find(const std::string &k) = 0;
+    virtual void update(const std::string &k, size_t v) = 0;
+};
+
+class Sharded : public Workload {
+public:
+    Sharded(unsigned nshards) {
+        struct tl_HASHOPS ops = { NULL, strEq, NULL, NULL, NULL, NULL, tl_hash_fast64 };
+        struct tl_HASHCONF conf = { 0, 0, 0, TL_HT_ENGINE_OPEN, 16, sizeof(size_t) };
+        h = tl_cht_new(NKEYS, ops, &conf, nshards);
+    }
+    ~Sharded() { tl_cht_free(h); }
+    size_t find(const std::string &k) {
+        return (size_t)tl_cht_find(h, k.c_str(), k.size(), NULL, NULL);
+    }
+    void update(const std::string &k, size_t v) {
+        tl_cht_update(h, k.c_str(), k.size(), &v, sizeof(v));
+    }
+    tl_CHASHTABLE *h;
+};
+
+class Locked : public Workload {
+public:
+    Locked() {
+        struct tl_HASHOPS ops = { NULL, strEq, NULL, NULL, NULL, NULL, tl_hash_fast64 };
+        struct tl_HASHCONF conf = { 0, 0, 0, TL_HT_ENGINE_OPEN, 16, sizeof(size_t) };
+        h = tl_ht_new_ex(NKEYS, ops, &conf);
+    }
+    ~Locked() { tl_ht_free(h); }
+    size_t find(const std::string &k) {
+        std::lock_guard<std::mutex> guard(mutex);
+        return tl_ht_find(h, k.c_str(), k.size()) != NULL;
+    }
+    void update(const std::string &k, size_t v) {
+        std::lock_guard<std::mutex> guard(mutex);
+        tl_ht_update(h, k.c_str(), k.size(), &v, sizeof(v));
+    }
+    tl_HASHTABLE *h;
+    std::mutex mutex;
+};
+}
+
+static void runThreads(const char *name, Workload &w,
+                       const std::vector<std::string> &keys)
+{
+    const size_t counts[] = { 1, 2, 4, 8, 16, 32, 64 };
+    char what[128];
+
+    for (size_t ii = 0; ii < keys.size(); ii++) {
+        w.update(keys[ii], ii);
+    }
+
+    for (size_t cc = 0; cc < sizeof(counts) / sizeof(counts[0]); cc++) {
+        size_t nthreads = counts[cc];
+        std::vector<std::thread> threads;
+        tlbench::Timer t;
+        for (size_t tt = 0; tt < nthreads; tt++) {
+            threads.push_back(std::thread([&, tt]() {
+                size_t x = tt * 0x9E3779B97F4A7C15ULL + 1, found = 0;
+                for (size_t ii = 0; ii < NOPS / nthreads; ii++) {
+                    /* xorshift */
+                    x ^= x << 13;
+                    x ^= x >> 7;
+                    x ^= x << 17;
+                    const std::string &k = keys[x % keys.size()];
+                    if (x % 10 == 0) {
+                        w.update(k, ii);
+                    } else {
+                        found += w.find(k);
+                    }
+                }
+                tlbench::keep(found);
+            }));
+        }
+        for (size_t tt = 0; tt < nthreads; tt++) {
+            threads[tt].join();
+        }
+        sprintf(what, "%s: %lu threads", name, (unsigned long)nthreads);
+        tlbench::report(what, NOPS / nthreads * nthreads, t.elapsed());
+    }
+}
+
+TL_BENCHMARK(chashtable_threads)
+{
+    std::vector<std::string> keys;
+    char buf[64];
+    for (size_t ii = 0; ii < NKEYS; ii++) {
+        sprintf(buf, "key_%lu", (unsigned long)ii);
+        keys.push_back(buf);
+    }
+    {
+        Locked w;
+        runThreads("tl_HASHTABLE + mutex", w, keys);
+    }
+    {
+        Sharded w(64);
+        runThreads("tl_CHASHTABLE (64 shards)", w, keys);
+    }
+}
@@ -0,0 +1,110 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2014 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "bench.h"
+#include <typelib/typelib.h>
+#include <algorithm>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+/*
+ * Lookups in a frozen table against the open addressing table it was made
+ * from, both hashing with tl_hash64(), and in a snapshot of the frozen table
+ * mapped back from a file.
+ */
+
+static int strEq(const void *a, size_t na, const void *b, size_t nb)
+{
+    return na == nb && memcmp(a, b, na) == 0;
+}
+
+TL_BENCHMARK(fhashtable)
+{
+    size_t sizes[] = { 1000, 100000, 2000000 };
+    struct tl_HASHOPS ops = { NULL, strEq, NULL, NULL, NULL, NULL, tl_hash64 };
+    struct tl_HASHCONF conf = { 0, 0, 0, TL_HT_ENGINE_OPEN };
+
+    for (size_t ss = 0; ss < sizeof(sizes) / sizeof(sizes[0]); ss++) {
+        std::vector<std::string> keys, missing;
+        char buf[64];
+        size_t found = 0;
+
+        for (size_t ii = 0; ii < sizes[ss]; ii++) {
+            sprintf(buf, "key_%lu", (unsigned long)ii);
+            keys.push_back(buf);
+            sprintf(buf, "missing_%lu", (unsigned long)ii);
+            missing.push_back(buf);
+        }
+        printf(" %lu keys\n", (unsigned long)keys.size());
+
+        tl_pHASHTABLE ht = tl_ht_new_ex(1, ops, &conf);
+        for (size_t ii = 0; ii < keys.size(); ii++) {
+            tl_ht_store(ht, keys[ii].c_str(), keys[ii].size(), &keys[ii], sizeof(size_t));
+        }
+        tlbench::Timer tfreeze;
+        tl_FHASHTABLE *f = tl_ht_freeze(ht);
+        tlbench::report("tl_ht_freeze", keys.size(), tfreeze.elapsed());
+        std::shuffle(keys.begin(), keys.end(), std::mt19937(42));
+
+        tlbench::Timer thit;
+        for (size_t ii = 0; ii < keys.size(); ii++) {
+            found += tl_ht_find(ht, keys[ii].c_str(), keys[ii].size()) != NULL;
+        }
+        tlbench::report("tl_ht_find (hit)", keys.size(), thit.elapsed());
+
+        tlbench::Timer tfhit;
+        for (size_t ii = 0; ii < keys.size(); ii++) {
+            found += tl_fht_find(f, keys[ii].c_str(), keys[ii].size()) != NULL;
+        }
+        tlbench::report("tl_fht_find (hit)", keys.size(), tfhit.elapsed());
+
+        tlbench::Timer tmiss;
+        for (size_t ii = 0; ii < missing.size(); ii++) {
+            found += tl_ht_find(ht, missing[ii].c_str(), missing[ii].size()) != NULL;
+        }
+        tlbench::report("tl_ht_find (miss)", missing.size(), tmiss.elapsed());
+
+        tlbench::Timer tfmiss;
+        for (size_t ii = 0; ii < missing.size(); ii++) {
+            found += tl_fht_find(f, missing[ii].c_str(), missing[ii].size()) != NULL;
+        }
+        tlbench::report("tl_fht_find (miss)", missing.size(), tfmiss.elapsed());
+
+        const char *path = "b_fhashtable.snapshot";
+        tl_fht_save(f, path);
+        tlbench::Timer topen;
+        tl_FHASHTABLE *mapped = tl_fht_open(path);
+        tlbench::report("tl_fht_open", 1, topen.elapsed());
+        tlbench::Timer tmhit;
+        for (size_t ii = 0; ii < keys.size(); ii++) {
+            found += tl_fht_find(mapped, keys[ii].c_str(), keys[ii].size()) != NULL;
+        }
+        tlbench::report("tl_fht_find (hit, mapped)", keys.size(), tmhit.elapsed());
+        tl_fht_free(mapped);
+        remove(path);
+
+        struct tl_HTALLOCSTATS stats;
+        tl_ht_allocstats(ht, &stats);
+        printf("  bytes: table %lu, frozen %lu\n", (unsigned long)stats.bytes,
+               (unsigned long)tl_fht_bytes(f));
+        tlbench::keep(found);
+        tl_fht_free(f);
+        tl_ht_free(ht);
+    }
+}
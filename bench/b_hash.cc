@@ -0,0 +1,67 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2014 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "bench.h"
+#include <typelib/typelib.h>
+#include <vector>
+
+/* The byte-at-a-time djb2 variant tl_ht_strhash() used to be */
+static uint64_t djb2(const void *k, size_t n, uint64_t seed)
+{
+    const char *p = (const char *)k;
+    int rv = 5381;
+    (void)seed;
+    for (size_t ii = 0; ii < n; ii++) {
+        rv = ((rv << 5) + rv) ^ p[ii];
+    }
+    return (uint64_t)rv;
+}
+
+static void runHash(const char *name, uint64_t (*fn)(const void *, size_t, uint64_t))
+{
+    static const size_t lengths[] = { 8, 16, 32, 64, 256, 1024, 4096 };
+    std::vector<char> buf(4096 + 64);
+    for (size_t ii = 0; ii < buf.size(); ii++) {
+        buf[ii] = (char)(ii * 131);
+    }
+
+    for (size_t ii = 0; ii < sizeof(lengths) / sizeof(lengths[0]); ii++) {
+        size_t len = lengths[ii];
+        size_t nops = (1 << 26) / len;
+        uint64_t sum = 0;
+        char what[128];
+
+        /* Vary the alignment so unaligned loads are included */
+        tlbench::Timer t;
+        for (size_t jj = 0; jj < nops; jj++) {
+            sum += fn(&buf[jj & 63], len, jj);
+        }
+        sprintf(what, "%s: %lu bytes", name, (unsigned long)len);
+        tlbench::report_bytes(what, nops, nops * len, t.elapsed());
+        tlbench::keep((size_t)sum);
+    }
+}
+
+TL_BENCHMARK(hash_functions)
+{
+    runHash("djb2", djb2);
+    runHash("tl_hash64", tl_hash64);
+    if (tl_hash_select(TL_HASH_IMPL_AES) != -1) {
+        runHash("tl_hash_fast64 (aes)", tl_hash_fast64);
+    }
+    tl_hash_select(-1);
+}
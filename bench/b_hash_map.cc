@@ -0,0 +1,138 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2014 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "bench.h"
+#include <typelib/typelib.h>
+#include <typelib/tl_hash_map.hpp>
+#include <algorithm>
+#include <cstring>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+ * tl::hash_map against the open addressing C table and std::unordered_map.
+ * All three hash strings with tl_hash64(), so the difference is in the
+ * table: the C table reaches the hash and key comparison through function
+ * pointers, std::unordered_map chases a node pointer per element.
+ */
+
+static int strEq(const void *a, size_t na, const void *b, size_t nb)
+{
+    return na == nb && memcmp(a, b, na) == 0;
+}
+
+static uint64_t strHash64(const void *k, size_t n, uint64_t seed)
+{
+    (void)seed;
+    return tl_hash64(k, n, 0);
+}
+
+struct StringKeys {
+    std::vector<std::string> keys;
+    std::vector<std::string> lookups;
+    std::vector<std::string> missing;
+
+    explicit StringKeys(size_t n) {
+        char buf[64];
+        for (size_t ii = 0; ii < n; ii++) {
+            sprintf(buf, "key_%lu", (unsigned long)ii);
+            keys.push_back(buf);
+            sprintf(buf, "missing_%lu", (unsigned long)ii);
+            missing.push_back(buf);
+        }
+        lookups = keys;
+        std::shuffle(lookups.begin(), lookups.end(), std::mt19937(42));
+        std::shuffle(missing.begin(), missing.end(), std::mt19937(43));
+    }
+};
+
+static void runC(const StringKeys &k)
+{
+    struct tl_HASHOPS ops = { NULL, strEq, NULL, NULL, NULL, NULL, strHash64 };
+    struct tl_HASHCONF conf = { 0, 0, 0, TL_HT_ENGINE_OPEN };
+    size_t found = 0;
+
+    tl_pHASHTABLE ht = tl_ht_new_ex(1, ops, &conf);
+
+    tlbench::Timer tstore;
+    for (size_t ii = 0; ii < k.keys.size(); ii++) {
+        tl_ht_store(ht, k.keys[ii].c_str(), k.keys[ii].size(), (void *)ii, 0);
+    }
+    tlbench::report("C API: store", k.keys.size(), tstore.elapsed());
+
+    tlbench::Timer thit;
+    for (size_t ii = 0; ii < k.lookups.size(); ii++) {
+        found += tl_ht_find(ht, k.lookups[ii].c_str(), k.lookups[ii].size()) != NULL;
+    }
+    tlbench::report("C API: find (hit)", k.lookups.size(), thit.elapsed());
+
+    tlbench::Timer tmiss;
+    for (size_t ii = 0; ii < k.missing.size(); ii++) {
+        found += tl_ht_find(ht, k.missing[ii].c_str(), k.missing[ii].size()) != NULL;
+    }
+    tlbench::report("C API: find (miss)", k.missing.size(), tmiss.elapsed());
+
+    tlbench::keep(found);
+    tl_ht_free(ht);
+}
+
+template <class Map>
+static void runMap(const char *name, const StringKeys &k)
+{
+    char what[128];
+    size_t found = 0;
+    Map m;
+
+    tlbench::Timer tstore;
+    for (size_t ii = 0; ii < k.keys.size(); ii++) {
+        m.emplace(k.keys[ii], ii);
+    }
+    sprintf(what, "%s: store", name);
+    tlbench::report(what, k.keys.size(), tstore.elapsed());
+
+    tlbench::Timer thit;
+    for (size_t ii = 0; ii < k.lookups.size(); ii++) {
+        found += m.find(k.lookups[ii]) != m.end();
+    }
+    sprintf(what, "%s: find (hit)", name);
+    tlbench::report(what, k.lookups.size(), thit.elapsed());
+
+    tlbench::Timer tmiss;
+    for (size_t ii = 0; ii < k.missing.size(); ii++) {
+        found += m.find(k.missing[ii]) != m.end();
+    }
+    sprintf(what, "%s: find (miss)", name);
+    tlbench::report(what, k.missing.size(), tmiss.elapsed());
+
+    tlbench::keep(found);
+}
+
+TL_BENCHMARK(hash_map)
+{
+    size_t sizes[] = { 1000, 100000, 2000000 };
+
+    for (size_t ii = 0; ii < sizeof(sizes) / sizeof(sizes[0]); ii++) {
+        StringKeys k(sizes[ii]);
+        printf(" %lu keys\n", (unsigned long)sizes[ii]);
+        runC(k);
+        runMap<tl::hash_map<std::string, size_t> >("tl::hash_map", k);
+        runMap<std::unordered_map<std::string, size_t, tl::hash<std::string> > >(
+                "std::unordered_map", k);
+    }
+}
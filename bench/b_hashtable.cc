@@ -0,0 +1,491 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2014 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "bench.h"
+#include <typelib/typelib.h>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+static int strEq(const void *a, size_t na, const void *b, size_t nb)
+{
+    return na == nb && memcmp(a, b, na) == 0;
+}
+
+static void genKeys(std::vector<std::string> &keys, size_t n, const char *pfx)
+{
+    char buf[64];
+    for (size_t ii = 0; ii < n; ii++) {
+        sprintf(buf, "%s_%lu", pfx, (unsigned long)ii);
+        keys.push_back(buf);
+    }
+}
+
+/* Lookups are done in random order; walking the keys in insertion order
+ * would let the chained engine's entries stream through the prefetcher */
+static std::vector<std::string> shuffled(const std::vector<std::string> &keys)
+{
+    std::vector<std::string> rv(keys);
+    std::shuffle(rv.begin(), rv.end(), std::mt19937(42));
+    return rv;
+}
+
+static void runEngine(int engine, const char *ename,
+                      const std::vector<std::string> &keys,
+                      const std::vector<std::string> &lookups,
+                      const std::vector<std::string> &missing)
+{
+    struct tl_HASHOPS ops = { tl_ht_strhash, strEq, NULL, NULL, NULL, NULL };
+    struct tl_HASHCONF conf = { 0, 0, 0, engine };
+    char what[128];
+    size_t found = 0;
+
+    tl_pHASHTABLE ht = tl_ht_new_ex(1, ops, &conf);
+
+    tlbench::Timer tstore;
+    for (size_t ii = 0; ii < keys.size(); ii++) {
+        tl_ht_store(ht, keys[ii].c_str(), keys[ii].size(),
+                    keys[ii].c_str(), keys[ii].size());
+    }
+    sprintf(what, "%s: store %lu", ename, (unsigned long)keys.size());
+    tlbench::report(what, keys.size(), tstore.elapsed());
+
+    tlbench::Timer thit;
+    for (size_t ii = 0; ii < lookups.size(); ii++) {
+        found += tl_ht_find(ht, lookups[ii].c_str(), lookups[ii].size()) != NULL;
+    }
+    sprintf(what, "%s: find (hit)", ename);
+    tlbench::report(what, lookups.size(), thit.elapsed());
+
+    tlbench::Timer tmiss;
+    for (size_t ii = 0; ii < missing.size(); ii++) {
+        found += tl_ht_find(ht, missing[ii].c_str(), missing[ii].size()) != NULL;
+    }
+    sprintf(what, "%s: find (miss)", ename);
+    tlbench::report(what, missing.size(), tmiss.elapsed());
+
+    tlbench::Timer tdel;
+    for (size_t ii = 0; ii < lookups.size(); ii++) {
+        found += tl_ht_del(ht, lookups[ii].c_str(), lookups[ii].size());
+    }
+    sprintf(what, "%s: delete", ename);
+    tlbench::report(what, lookups.size(), tdel.elapsed());
+
+    tlbench::keep(found);
+    tl_ht_free(ht);
+}
+
+TL_BENCHMARK(hashtable_engines)
+{
+    size_t sizes[] = { 1000, 100000, 2000000 };
+
+    for (size_t ii = 0; ii < sizeof(sizes) / sizeof(sizes[0]); ii++) {
+        std::vector<std::string> keys, missing;
+        genKeys(keys, sizes[ii], "key");
+        genKeys(missing, sizes[ii], "missing");
+        std::vector<std::string> lookups = shuffled(keys);
+        missing = shuffled(missing);
+        runEngine(TL_HT_ENGINE_CHAINED, "chained", keys, lookups, missing);
+        runEngine(TL_HT_ENGINE_OPEN, "open", keys, lookups, missing);
+        runEngine(TL_HT_ENGINE_COMPACT, "compact", keys, lookups, missing);
+    }
+}
+
+static const char *engineNames[] = { "chained", "open", "compact" };
+
+static void countItem(const void *, size_t nk, const void *, size_t, void *arg)
+{
+    *(size_t *)arg += nk;
+}
+
+/* Full scans with tl_ht_iter() after a third of the keys were deleted, and
+ * the memory taken per item, for one large table and for many small ones */
+TL_BENCHMARK(hashtable_iter)
+{
+    struct tl_HASHOPS ops = { tl_ht_strhash, strEq, NULL, NULL, NULL, NULL };
+    size_t sizes[] = { 8, 64, 1000000 };
+
+    for (size_t ss = 0; ss < sizeof(sizes) / sizeof(sizes[0]); ss++) {
+        size_t ntables = 2000000 / sizes[ss];
+        std::vector<std::string> keys;
+        genKeys(keys, sizes[ss], "key");
+
+        for (int engine = 0; engine < 3; engine++) {
+            struct tl_HASHCONF conf = { 0, 0, 0, engine };
+            std::vector<tl_pHASHTABLE> tables(ntables);
+            size_t bytes = 0, nitems = 0, total = 0;
+            char what[128];
+
+            for (size_t tt = 0; tt < ntables; tt++) {
+                struct tl_HTALLOCSTATS stats;
+                tables[tt] = tl_ht_new_ex(1, ops, &conf);
+                for (size_t ii = 0; ii < keys.size(); ii++) {
+                    tl_ht_store(tables[tt], keys[ii].c_str(), keys[ii].size(), NULL, 0);
+                }
+                for (size_t ii = 0; ii < keys.size(); ii += 3) {
+                    tl_ht_del(tables[tt], keys[ii].c_str(), keys[ii].size());
+                }
+                tl_ht_allocstats(tables[tt], &stats);
+                bytes += stats.bytes;
+                nitems += tl_ht_size(tables[tt]);
+            }
+
+            tlbench::Timer titer;
+            for (int round = 0; round < 5; round++) {
+                for (size_t tt = 0; tt < ntables; tt++) {
+                    tl_ht_iter(tables[tt], countItem, &total);
+                }
+            }
+            sprintf(what, "%s: iterate %lu x %lu items (%.1f bytes/item)",
+                    engineNames[engine], (unsigned long)ntables,
+                    (unsigned long)(nitems / ntables), (double)bytes / nitems);
+            tlbench::report(what, nitems * 5, titer.elapsed());
+            tlbench::keep(total);
+            for (size_t tt = 0; tt < ntables; tt++) {
+                tl_ht_free(tables[tt]);
+            }
+        }
+    }
+}
+
+/* Tables several times the size of the last level cache, so nearly every
+ * lookup misses; batches let those misses overlap */
+static void runBatch(int engine, const char *ename,
+                     const std::vector<std::string> &keys,
+                     const std::vector<std::string> &lookups)
+{
+    struct tl_HASHOPS ops = { tl_ht_strhash, strEq, NULL, NULL, NULL, NULL };
+    struct tl_HASHCONF conf = { 0, 0, 0, engine };
+    const size_t batches[] = { 1, 32, 256 };
+    std::vector<const void *> kptrs;
+    std::vector<size_t> klens;
+    std::vector<void *> values(256);
+    char what[128];
+
+    tl_pHASHTABLE ht = tl_ht_new_ex(keys.size(), ops, &conf);
+    for (size_t ii = 0; ii < keys.size(); ii++) {
+        tl_ht_store(ht, keys[ii].c_str(), keys[ii].size(),
+                    keys[ii].c_str(), keys[ii].size());
+    }
+    for (size_t ii = 0; ii < lookups.size(); ii++) {
+        kptrs.push_back(lookups[ii].c_str());
+        klens.push_back(lookups[ii].size());
+    }
+
+    for (size_t bb = 0; bb < sizeof(batches) / sizeof(batches[0]); bb++) {
+        size_t found = 0, nb = batches[bb];
+        tlbench::Timer t;
+        if (nb == 1) {
+            for (size_t ii = 0; ii < lookups.size(); ii++) {
+                found += tl_ht_find(ht, kptrs[ii], klens[ii]) != NULL;
+            }
+            sprintf(what, "%s: tl_ht_find", ename);
+        } else {
+            for (size_t ii = 0; ii + nb <= lookups.size(); ii += nb) {
+                found += tl_ht_find_batch(ht, &kptrs[ii], &klens[ii], nb, &values[0]);
+            }
+            sprintf(what, "%s: tl_ht_find_batch (%lu keys)", ename, (unsigned long)nb);
+        }
+        tlbench::report(what, lookups.size() / nb * nb, t.elapsed());
+        tlbench::keep(found);
+    }
+    tl_ht_free(ht);
+}
+
+TL_BENCHMARK(hashtable_batch)
+{
+    std::vector<std::string> keys;
+    genKeys(keys, 4000000, "key");
+    std::vector<std::string> lookups = shuffled(keys);
+    lookups.resize(2000000);
+    runBatch(TL_HT_ENGINE_CHAINED, "chained", keys, lookups);
+    runBatch(TL_HT_ENGINE_OPEN, "open", keys, lookups);
+}
+
+static void *incrCounter(const void *k, const void *oldv, size_t *ns, void *arg)
+{
+    uint64_t *rv = (uint64_t *)malloc(sizeof(*rv));
+    (void)k;
+    (void)arg;
+    *rv = *(const uint64_t *)oldv + 1;
+    *ns = sizeof(*rv);
+    return rv;
+}
+
+/* Counting occurrences of keys: each key is seen 8 times on average */
+TL_BENCHMARK(hashtable_counters)
+{
+    struct tl_HASHOPS ops = { tl_ht_strhash, strEq, NULL, NULL, NULL, NULL };
+    std::vector<std::string> keys, stream;
+    const uint64_t zero = 0;
+    genKeys(keys, 100000, "key");
+    std::mt19937 rng(42);
+    for (size_t ii = 0; ii < keys.size() * 8; ii++) {
+        stream.push_back(keys[rng() % keys.size()]);
+    }
+
+    for (int engine = TL_HT_ENGINE_CHAINED; engine <= TL_HT_ENGINE_OPEN; engine++) {
+        const char *ename = engine == TL_HT_ENGINE_OPEN ? "open" : "chained";
+        struct tl_HASHCONF conf = { 0, 0, 0, engine, 0, sizeof(uint64_t) };
+        char what[128];
+
+        tl_pHASHTABLE ht = tl_ht_new_ex(1, ops, &conf);
+        tlbench::Timer tfun;
+        for (size_t ii = 0; ii < stream.size(); ii++) {
+            tl_ht_funupdate(ht, stream[ii].c_str(), stream[ii].size(),
+                            incrCounter, free, NULL, &zero, sizeof(zero));
+        }
+        sprintf(what, "%s: tl_ht_funupdate", ename);
+        tlbench::report(what, stream.size(), tfun.elapsed());
+        tl_ht_free(ht);
+
+        ht = tl_ht_new_ex(1, ops, &conf);
+        tlbench::Timer tupd;
+        for (size_t ii = 0; ii < stream.size(); ii++) {
+            const std::string &k = stream[ii];
+            uint64_t *cur = (uint64_t *)tl_ht_find(ht, k.c_str(), k.size());
+            uint64_t v = cur ? *cur + 1 : 1;
+            tl_ht_update(ht, k.c_str(), k.size(), &v, sizeof(v));
+        }
+        sprintf(what, "%s: tl_ht_find + tl_ht_update", ename);
+        tlbench::report(what, stream.size(), tupd.elapsed());
+        tl_ht_free(ht);
+
+        ht = tl_ht_new_ex(1, ops, &conf);
+        tlbench::Timer tups;
+        for (size_t ii = 0; ii < stream.size(); ii++) {
+            const std::string &k = stream[ii];
+            ++*(uint64_t *)*tl_ht_upsert(ht, k.c_str(), k.size(), NULL);
+        }
+        sprintf(what, "%s: tl_ht_upsert", ename);
+        tlbench::report(what, stream.size(), tups.elapsed());
+        tl_ht_free(ht);
+    }
+}
+
+/* Keys with many values each: duplicates stored as separate entries against
+ * TL_HT_F_MULTI, which keeps one entry per key */
+TL_BENCHMARK(hashtable_multimap)
+{
+    struct tl_HASHOPS ops = { tl_ht_strhash, strEq, NULL, NULL, NULL, NULL };
+    std::vector<std::string> keys, single;
+    const size_t fanout = 64;
+    genKeys(keys, 2000, "multi");
+    genKeys(single, 100000, "single");
+    std::vector<std::string> lookups = shuffled(single);
+
+    for (int engine = TL_HT_ENGINE_CHAINED; engine <= TL_HT_ENGINE_OPEN; engine++) {
+        for (int multi = 0; multi < 2; multi++) {
+            struct tl_HASHCONF conf = { multi ? TL_HT_F_MULTI : 0u, 0, 0, engine };
+            char what[128], name[64];
+            size_t n = 0;
+
+            sprintf(name, "%s%s", engine == TL_HT_ENGINE_OPEN ? "open" : "chained",
+                    multi ? " multi" : "");
+            tl_pHASHTABLE ht = tl_ht_new_ex(1, ops, &conf);
+            for (size_t ii = 0; ii < single.size(); ii++) {
+                tl_ht_store(ht, single[ii].c_str(), single[ii].size(), NULL, 0);
+            }
+            tlbench::Timer tstore;
+            for (size_t jj = 0; jj < fanout; jj++) {
+                for (size_t ii = 0; ii < keys.size(); ii++) {
+                    tl_ht_store(ht, keys[ii].c_str(), keys[ii].size(), NULL, jj);
+                }
+            }
+            sprintf(what, "%s: store", name);
+            tlbench::report(what, keys.size() * fanout, tstore.elapsed());
+
+            tlbench::Timer tfind;
+            for (size_t ii = 0; ii < lookups.size(); ii++) {
+                tl_ht_findn(ht, lookups[ii].c_str(), lookups[ii].size(), &n);
+            }
+            sprintf(what, "%s: find (other keys)", name);
+            tlbench::report(what, lookups.size(), tfind.elapsed());
+
+            tlbench::Timer tsize;
+            for (size_t ii = 0; ii < keys.size(); ii++) {
+                n += tl_ht_sizekey(ht, keys[ii].c_str(), keys[ii].size());
+            }
+            sprintf(what, "%s: sizekey", name);
+            tlbench::report(what, keys.size(), tsize.elapsed());
+
+            tlbench::Timer tdel;
+            for (size_t ii = 0; ii < keys.size(); ii++) {
+                n += tl_ht_delall(ht, keys[ii].c_str(), keys[ii].size());
+            }
+            sprintf(what, "%s: delall", name);
+            tlbench::report(what, keys.size(), tdel.elapsed());
+            tlbench::keep(n);
+            tl_ht_free(ht);
+        }
+    }
+}
+
+/* Lookups of mostly absent keys, with and without TL_HT_F_FILTER */
+static void runFilter(int engine, const char *ename, unsigned flags,
+                      const std::vector<std::string> &keys,
+                      const std::vector<std::string> &lookups)
+{
+    struct tl_HASHOPS ops = { tl_ht_strhash, strEq, NULL, NULL, NULL, NULL };
+    struct tl_HASHCONF conf = { flags, 0, 0, engine };
+    struct tl_HTFILTERSTATS stats;
+    char what[128];
+    size_t found = 0;
+
+    tl_pHASHTABLE ht = tl_ht_new_ex(1, ops, &conf);
+    for (size_t ii = 0; ii < keys.size(); ii++) {
+        tl_ht_store(ht, keys[ii].c_str(), keys[ii].size(),
+                    keys[ii].c_str(), keys[ii].size());
+    }
+
+    tlbench::Timer t;
+    for (size_t ii = 0; ii < lookups.size(); ii++) {
+        found += tl_ht_find(ht, lookups[ii].c_str(), lookups[ii].size()) != NULL;
+    }
+    if (tl_ht_filterstats(ht, &stats) == 0) {
+        sprintf(what, "%s, filter (%.1f bits/key): find", ename,
+                stats.bytes * 8.0 / keys.size());
+    } else {
+        sprintf(what, "%s: find", ename);
+    }
+    tlbench::report(what, lookups.size(), t.elapsed());
+    tlbench::keep(found);
+    tl_ht_free(ht);
+}
+
+TL_BENCHMARK(hashtable_filter)
+{
+    size_t sizes[] = { 1000, 100000, 2000000 };
+
+    for (size_t ii = 0; ii < sizeof(sizes) / sizeof(sizes[0]); ii++) {
+        std::vector<std::string> keys, lookups;
+        genKeys(keys, sizes[ii], "key");
+        /* One lookup in ten is for a present key */
+        genKeys(lookups, 2000000, "missing");
+        for (size_t jj = 0; jj < lookups.size(); jj += 10) {
+            lookups[jj] = keys[jj % keys.size()];
+        }
+        lookups = shuffled(lookups);
+        printf(" %lu keys, 90%% misses\n", (unsigned long)sizes[ii]);
+        runFilter(TL_HT_ENGINE_CHAINED, "chained", 0, keys, lookups);
+        runFilter(TL_HT_ENGINE_CHAINED, "chained", TL_HT_F_FILTER, keys, lookups);
+        runFilter(TL_HT_ENGINE_OPEN, "open", 0, keys, lookups);
+        runFilter(TL_HT_ENGINE_OPEN, "open", TL_HT_F_FILTER, keys, lookups);
+    }
+}
+
+/* Cost of tl_ht_stats() on a 2M item table with a full walk and with the
+ * sample size a metrics exporter would poll with, and of counting probes
+ * (TL_HT_F_STATS) on lookups */
+TL_BENCHMARK(hashtable_stats)
+{
+    struct tl_HASHOPS ops = { tl_ht_strhash, strEq, NULL, NULL, NULL, NULL };
+    std::vector<std::string> keys;
+    genKeys(keys, 2000000, "key");
+    std::vector<std::string> lookups = shuffled(keys);
+
+    for (int engine = 0; engine < 3; engine++) {
+        for (unsigned flags = 0; flags <= TL_HT_F_STATS; flags += TL_HT_F_STATS) {
+            struct tl_HASHCONF conf = { flags, 0, 0, engine };
+            struct tl_HTSTATS stats;
+            size_t found = 0;
+            char what[128];
+            tl_pHASHTABLE ht = tl_ht_new_ex(keys.size(), ops, &conf);
+            for (size_t ii = 0; ii < keys.size(); ii++) {
+                tl_ht_store(ht, keys[ii].c_str(), keys[ii].size(), NULL, 0);
+            }
+
+            tlbench::Timer tfind;
+            for (size_t ii = 0; ii < lookups.size(); ii++) {
+                found += tl_ht_find(ht, lookups[ii].c_str(), lookups[ii].size()) != NULL;
+            }
+            sprintf(what, "%s: find%s", engineNames[engine],
+                    flags ? ", counting probes" : "");
+            tlbench::report(what, lookups.size(), tfind.elapsed());
+            tlbench::keep(found);
+            if (flags) {
+                tl_ht_free(ht);
+                continue;
+            }
+
+            tlbench::Timer tfull;
+            tl_ht_stats(ht, &stats, 0);
+            sprintf(what, "%s: tl_ht_stats, all %lu buckets", engineNames[engine],
+                    (unsigned long)stats.nsampled);
+            tlbench::report(what, 1, tfull.elapsed());
+
+            tlbench::Timer tsample;
+            for (int ii = 0; ii < 100; ii++) {
+                tl_ht_stats(ht, &stats, 4096);
+            }
+            sprintf(what, "%s: tl_ht_stats, 4096 buckets (p99 %lu, max %lu)",
+                    engineNames[engine], (unsigned long)stats.p99_probe,
+                    (unsigned long)stats.max_probe);
+            tlbench::report(what, 100, tsample.elapsed());
+            tl_ht_free(ht);
+        }
+    }
+}
+
+/* Building a table of 4M items with tl_ht_new_bulk() on 1, 2, 4... threads
+ * (up to the number of cores), against storing them one at a time into a
+ * presized table. The rate per thread shows how well the build scales */
+TL_BENCHMARK(hashtable_bulk)
+{
+    struct tl_HASHOPS ops = { tl_ht_strhash, strEq, NULL, NULL, NULL, NULL };
+    std::vector<std::string> keys;
+    std::vector<const void *> kptrs;
+    std::vector<size_t> klens;
+    unsigned ncores = std::thread::hardware_concurrency();
+    genKeys(keys, 4000000, "key");
+    keys = shuffled(keys);
+    for (size_t ii = 0; ii < keys.size(); ii++) {
+        kptrs.push_back(keys[ii].c_str());
+        klens.push_back(keys[ii].size());
+    }
+
+    for (int engine = TL_HT_ENGINE_CHAINED; engine <= TL_HT_ENGINE_OPEN; engine++) {
+        const char *ename = engine == TL_HT_ENGINE_OPEN ? "open" : "chained";
+        struct tl_HASHCONF conf = { 0, 0, 0, engine };
+        char what[128];
+
+        tlbench::Timer tstore;
+        tl_pHASHTABLE ht = tl_ht_new_ex(keys.size(), ops, &conf);
+        for (size_t ii = 0; ii < keys.size(); ii++) {
+            tl_ht_store(ht, kptrs[ii], klens[ii], kptrs[ii], klens[ii]);
+        }
+        sprintf(what, "%s: tl_ht_store", ename);
+        tlbench::report(what, keys.size(), tstore.elapsed());
+        tl_ht_free(ht);
+
+        for (unsigned nthreads = 1; nthreads == 1 || nthreads <= ncores; nthreads *= 2) {
+            tlbench::Timer tbulk;
+            ht = tl_ht_new_bulk(ops, &conf, &kptrs[0], &klens[0], &kptrs[0],
+                                &klens[0], keys.size(), nthreads);
+            double ns = tbulk.elapsed();
+            sprintf(what, "%s: tl_ht_new_bulk, %u threads", ename, nthreads);
+            tlbench::report(what, keys.size(), ns);
+            sprintf(what, "%s: tl_ht_new_bulk, per thread", ename);
+            tlbench::report(what, keys.size() / nthreads, ns);
+            tl_ht_free(ht);
+        }
+    }
+}
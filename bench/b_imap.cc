@@ -0,0 +1,200 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2014 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "bench.h"
+#include <typelib/typelib.h>
+#include <typelib/tl_int_map.hpp>
+#include <algorithm>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+/*
+ * Integer keys mapped to pointers: tl_ht_szt_new(), tl_IMAP_u64,
+ * tl::int_map and std::unordered_map, with a plain array indexed by the
+ * key's position as the lower bound.
+ */
+
+struct IntKeys {
+    std::vector<uint64_t> keys;
+    std::vector<uint64_t> lookups;
+    std::vector<uint64_t> missing;
+
+    explicit IntKeys(size_t n) {
+        std::mt19937_64 rng(42);
+        for (size_t ii = 0; ii < n; ii++) {
+            /* Even keys are stored, odd ones are missing */
+            keys.push_back(rng() & ~1ULL);
+            missing.push_back(rng() | 1);
+        }
+        lookups = keys;
+        std::shuffle(lookups.begin(), lookups.end(), std::mt19937(43));
+    }
+};
+
+static void report(const char *name, const char *op, size_t nops, double ns)
+{
+    char what[128];
+    sprintf(what, "%s: %s", name, op);
+    tlbench::report(what, nops, ns);
+}
+
+static void runHashtable(const IntKeys &k)
+{
+    const char *name = "tl_ht_szt_new";
+    size_t found = 0;
+    tl_pHASHTABLE ht = tl_ht_szt_new(1);
+
+    tlbench::Timer tstore;
+    for (size_t ii = 0; ii < k.keys.size(); ii++) {
+        tl_ht_store(ht, NULL, k.keys[ii], (void *)&k.keys[ii], 0);
+    }
+    report(name, "store", k.keys.size(), tstore.elapsed());
+
+    tlbench::Timer thit;
+    for (size_t ii = 0; ii < k.lookups.size(); ii++) {
+        found += tl_ht_find(ht, NULL, k.lookups[ii]) != NULL;
+    }
+    report(name, "find (hit)", k.lookups.size(), thit.elapsed());
+
+    tlbench::Timer tmiss;
+    for (size_t ii = 0; ii < k.missing.size(); ii++) {
+        found += tl_ht_find(ht, NULL, k.missing[ii]) != NULL;
+    }
+    report(name, "find (miss)", k.missing.size(), tmiss.elapsed());
+
+    tlbench::keep(found);
+    tl_ht_free(ht);
+}
+
+static void runIMap(const IntKeys &k)
+{
+    const char *name = "tl_IMAP_u64";
+    size_t found = 0;
+    tl_IMAP_u64 m;
+    tl_imap_u64_init(&m);
+
+    tlbench::Timer tstore;
+    for (size_t ii = 0; ii < k.keys.size(); ii++) {
+        tl_imap_u64_store(&m, k.keys[ii], (void *)&k.keys[ii]);
+    }
+    report(name, "store", k.keys.size(), tstore.elapsed());
+
+    tlbench::Timer thit;
+    for (size_t ii = 0; ii < k.lookups.size(); ii++) {
+        found += tl_imap_u64_find(&m, k.lookups[ii]) != NULL;
+    }
+    report(name, "find (hit)", k.lookups.size(), thit.elapsed());
+
+    tlbench::Timer tmiss;
+    for (size_t ii = 0; ii < k.missing.size(); ii++) {
+        found += tl_imap_u64_find(&m, k.missing[ii]) != NULL;
+    }
+    report(name, "find (miss)", k.missing.size(), tmiss.elapsed());
+
+    tlbench::keep(found);
+    tl_imap_u64_cleanup(&m);
+}
+
+static void runIntMap(const IntKeys &k)
+{
+    const char *name = "tl::int_map";
+    size_t found = 0;
+    tl::int_map<uint64_t, const void *> m;
+
+    tlbench::Timer tstore;
+    for (size_t ii = 0; ii < k.keys.size(); ii++) {
+        m[k.keys[ii]] = &k.keys[ii];
+    }
+    report(name, "store", k.keys.size(), tstore.elapsed());
+
+    tlbench::Timer thit;
+    for (size_t ii = 0; ii < k.lookups.size(); ii++) {
+        found += m.find(k.lookups[ii]) != NULL;
+    }
+    report(name, "find (hit)", k.lookups.size(), thit.elapsed());
+
+    tlbench::Timer tmiss;
+    for (size_t ii = 0; ii < k.missing.size(); ii++) {
+        found += m.find(k.missing[ii]) != NULL;
+    }
+    report(name, "find (miss)", k.missing.size(), tmiss.elapsed());
+
+    tlbench::keep(found);
+}
+
+static void runUnordered(const IntKeys &k)
+{
+    const char *name = "std::unordered_map";
+    size_t found = 0;
+    std::unordered_map<uint64_t, const void *> m;
+
+    tlbench::Timer tstore;
+    for (size_t ii = 0; ii < k.keys.size(); ii++) {
+        m[k.keys[ii]] = &k.keys[ii];
+    }
+    report(name, "store", k.keys.size(), tstore.elapsed());
+
+    tlbench::Timer thit;
+    for (size_t ii = 0; ii < k.lookups.size(); ii++) {
+        found += m.find(k.lookups[ii]) != m.end();
+    }
+    report(name, "find (hit)", k.lookups.size(), thit.elapsed());
+
+    tlbench::Timer tmiss;
+    for (size_t ii = 0; ii < k.missing.size(); ii++) {
+        found += m.find(k.missing[ii]) != m.end();
+    }
+    report(name, "find (miss)", k.missing.size(), tmiss.elapsed());
+
+    tlbench::keep(found);
+}
+
+/* Lookups by index in random order, touching the same amount of memory as
+ * a map at its maximum load */
+static void runArray(const IntKeys &k)
+{
+    std::vector<const void *> arr(k.keys.size() * 100 / TL_IMAP_MAX_LOAD);
+    std::vector<size_t> idx(k.lookups.size());
+    size_t found = 0;
+
+    for (size_t ii = 0; ii < idx.size(); ii++) {
+        idx[ii] = (size_t)(k.lookups[ii] % arr.size());
+        arr[idx[ii]] = &k.lookups[ii];
+    }
+    tlbench::Timer t;
+    for (size_t ii = 0; ii < idx.size(); ii++) {
+        found += arr[idx[ii]] != NULL;
+    }
+    report("array", "index", idx.size(), t.elapsed());
+    tlbench::keep(found);
+}
+
+TL_BENCHMARK(imap)
+{
+    size_t sizes[] = { 1000, 100000, 2000000 };
+
+    for (size_t ii = 0; ii < sizeof(sizes) / sizeof(sizes[0]); ii++) {
+        IntKeys k(sizes[ii]);
+        printf(" %lu keys\n", (unsigned long)sizes[ii]);
+        runHashtable(k);
+        runIMap(k);
+        runIntMap(k);
+        runUnordered(k);
+        runArray(k);
+    }
+}
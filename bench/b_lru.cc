@@ -0,0 +1,137 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2014 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "bench.h"
+#include <typelib/typelib.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <list>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+ * Cache-aside lookups (get, and put on a miss) of a skewed key stream mixed
+ * with a scan of keys requested once, against an LRU built from
+ * std::unordered_map and std::list. Both hash with tl_hash64(); the hit rate
+ * shows what TinyLFU admission keeps through the scan.
+ */
+
+/* Key stream: Zipf distributed requests over `nkeys` keys, and every other
+ * request a key which is never requested again */
+static std::vector<std::string> lruRequests(size_t nkeys, size_t nreqs)
+{
+    std::vector<double> cdf(nkeys);
+    std::vector<std::string> rv;
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<double> u(0, 1);
+    double sum = 0;
+    char buf[64];
+
+    for (size_t ii = 0; ii < nkeys; ii++) {
+        sum += 1 / std::pow((double)(ii + 1), 0.9);
+        cdf[ii] = sum;
+    }
+    for (size_t ii = 0; ii < nreqs; ii++) {
+        if (ii % 2) {
+            sprintf(buf, "scan_%lu", (unsigned long)ii);
+        } else {
+            size_t n = std::lower_bound(cdf.begin(), cdf.end(), u(rng) * sum) - cdf.begin();
+            sprintf(buf, "key_%lu", (unsigned long)n);
+        }
+        rv.push_back(buf);
+    }
+    return rv;
+}
+
+static void runLru(const char *name, const std::vector<std::string> &reqs,
+                   size_t capacity, unsigned flags)
+{
+    struct tl_LRUCONF conf;
+    size_t hits = 0;
+    char what[128];
+
+    memset(&conf, 0, sizeof(conf));
+    conf.max_items = capacity;
+    conf.flags = flags;
+    conf.inline_key = 24;
+    tl_LRU *c = tl_lru_new(&conf);
+
+    tlbench::Timer t;
+    for (size_t ii = 0; ii < reqs.size(); ii++) {
+        const std::string &k = reqs[ii];
+        if (tl_lru_get(c, k.c_str(), k.size()) != NULL) {
+            hits++;
+        } else {
+            tl_lru_put(c, k.c_str(), k.size(), (void *)&k, 1);
+        }
+    }
+    sprintf(what, "%s (%.1f%% hits)", name, hits * 100.0 / reqs.size());
+    tlbench::report(what, reqs.size(), t.elapsed());
+    tl_lru_free(c);
+}
+
+struct StdLruHash {
+    size_t operator()(const std::string &s) const {
+        return (size_t)tl_hash64(s.data(), s.size(), 0);
+    }
+};
+
+static void runStdLru(const std::vector<std::string> &reqs, size_t capacity)
+{
+    typedef std::list<std::pair<std::string, const void *> > List;
+    std::unordered_map<std::string, List::iterator, StdLruHash> map;
+    List order;
+    size_t hits = 0;
+    char what[128];
+
+    tlbench::Timer t;
+    for (size_t ii = 0; ii < reqs.size(); ii++) {
+        const std::string &k = reqs[ii];
+        auto it = map.find(k);
+        if (it != map.end()) {
+            order.splice(order.begin(), order, it->second);
+            hits++;
+            continue;
+        }
+        if (map.size() == capacity) {
+            map.erase(order.back().first);
+            order.pop_back();
+        }
+        order.emplace_front(k, &k);
+        map.emplace(k, order.begin());
+    }
+    sprintf(what, "std LRU (%.1f%% hits)", hits * 100.0 / reqs.size());
+    tlbench::report(what, reqs.size(), t.elapsed());
+}
+
+TL_BENCHMARK(lru)
+{
+    size_t capacities[] = { 1000, 100000 };
+
+    for (size_t cc = 0; cc < sizeof(capacities) / sizeof(capacities[0]); cc++) {
+        size_t cap = capacities[cc];
+        std::vector<std::string> reqs = lruRequests(cap * 10, 4000000);
+        printf(" capacity %lu, %lu distinct keys\n", (unsigned long)cap,
+               (unsigned long)cap * 10);
+        runStdLru(reqs, cap);
+        runLru("tl_LRU", reqs, cap, 0);
+        runLru("tl_LRU, TinyLFU", reqs, cap, TL_LRU_F_TINYLFU);
+    }
+}
@@ -0,0 +1,241 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2014 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "bench.h"
+#include <typelib/typelib.h>
+#include <cstdint>
+#include <cstdlib>
+#include <random>
+#include <thread>
+#include <vector>
+
+/* Building a set of 16M integers with tl_nset_new_bulk() on 1, 2, 4...
+ * threads (up to the number of cores), against tl_nset_add() */
+TL_BENCHMARK(nset_bulk)
+{
+    std::vector<void *> items;
+    std::mt19937_64 rng(42);
+    unsigned ncores = std::thread::hardware_concurrency();
+    char what[128];
+
+    for (size_t ii = 0; ii < 16000000; ii++) {
+        items.push_back((void *)(size_t)(rng() | 2));
+    }
+
+    tlbench::Timer tadd;
+    tl_pNSET set = tl_nset_new();
+    for (size_t ii = 0; ii < items.size(); ii++) {
+        tl_nset_add(set, items[ii]);
+    }
+    tlbench::report("tl_nset_add", items.size(), tadd.elapsed());
+    tl_nset_free(set);
+
+    for (unsigned nthreads = 1; nthreads == 1 || nthreads <= ncores; nthreads *= 2) {
+        tlbench::Timer tbulk;
+        set = tl_nset_new_bulk(&items[0], items.size(), nthreads);
+        double ns = tbulk.elapsed();
+        sprintf(what, "tl_nset_new_bulk, %u threads", nthreads);
+        tlbench::report(what, items.size(), ns);
+        tlbench::report("tl_nset_new_bulk, per thread", items.size() / nthreads, ns);
+        tl_nset_free(set);
+    }
+}
+
+/* Pointer-like items: random, with the low 4 bits clear */
+static size_t nsetItem(size_t i)
+{
+    uint64_t z = (uint64_t)i + 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z ^= z >> 31;
+    return (size_t)(z & ~(uint64_t)15) | 16;
+}
+
+static size_t nsetGcd(size_t a, size_t b)
+{
+    while (b) {
+        size_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+/* Adds, then hits and misses in random order, on sets of 1K to 100M items.
+ * Lookups on the small sets repeat so that each line times 10M of them */
+TL_BENCHMARK(nset_sizes)
+{
+    size_t sizes[] = { 1000, 10000, 100000, 1000000, 10000000, 100000000 };
+    char what[128];
+
+    for (size_t ss = 0; ss < sizeof(sizes) / sizeof(sizes[0]); ss++) {
+        size_t n = sizes[ss], nlookups = 10000000, found = 0;
+        /* Steps of `stride` visit every index below `n`, in scattered
+         * order */
+        size_t stride = n / 2 + n / 9;
+        while (nsetGcd(n, stride) != 1) {
+            stride++;
+        }
+
+        tlbench::Timer tadd;
+        tl_pNSET set = tl_nset_new();
+        for (size_t ii = 0; ii < n; ii++) {
+            tl_nset_add(set, (void *)nsetItem(ii));
+        }
+        sprintf(what, "%lu items: add", (unsigned long)n);
+        tlbench::report(what, n, tadd.elapsed());
+
+        tlbench::Timer thit;
+        for (size_t ii = 0, jj = 0; ii < nlookups; ii++) {
+            found += tl_nset_contains(set, (void *)nsetItem(jj));
+            jj += stride;
+            jj -= jj >= n ? n : 0;
+        }
+        sprintf(what, "%lu items: contains (hit)", (unsigned long)n);
+        tlbench::report(what, nlookups, thit.elapsed());
+
+        tlbench::Timer tmiss;
+        for (size_t ii = 0; ii < nlookups; ii++) {
+            found += tl_nset_contains(set, (void *)nsetItem(n + ii));
+        }
+        sprintf(what, "%lu items: contains (miss)", (unsigned long)n);
+        tlbench::report(what, nlookups, tmiss.elapsed());
+        tlbench::keep(found);
+        tl_nset_free(set);
+    }
+}
+
+/* A sliding window of in-flight IDs, as a request tracker would keep: each
+ * new ID is added, checked for, and replaces the oldest one. Every million
+ * steps is timed on its own, so growing probes would show as a trend */
+TL_BENCHMARK(nset_churn)
+{
+    size_t windows[] = { 1000, 100000 };
+    char what[128];
+
+    for (size_t ww = 0; ww < sizeof(windows) / sizeof(windows[0]); ww++) {
+        size_t window = windows[ww], id = 2, found = 0;
+        tl_pNSET set = tl_nset_new();
+
+        for (int round = 0; round < 5; round++) {
+            tlbench::Timer t;
+            for (size_t ii = 0; ii < 1000000; ii++, id++) {
+                tl_nset_add(set, (void *)nsetItem(id));
+                found += tl_nset_contains(set, (void *)nsetItem(id - window / 2));
+                if (id >= window + 2) {
+                    tl_nset_del(set, (void *)nsetItem(id - window));
+                }
+            }
+            sprintf(what, "window %lu, steps %dM-%dM (%lu slots)",
+                    (unsigned long)window, round, round + 1,
+                    (unsigned long)set->capacity);
+            tlbench::report(what, 1000000, t.elapsed());
+        }
+        tlbench::keep(found);
+        tl_nset_free(set);
+    }
+}
+
+/* One round of nset_algebra: `a` holds `n` items and `b` holds `nb`, half
+ * of which are also in `a` */
+static void runAlgebra(size_t n, size_t nb)
+{
+    tl_pNSET a = tl_nset_new(), b = tl_nset_new(), r;
+    std::vector<void *> keep;
+    size_t found = 0, step = n / nb * 2;
+    char what[128];
+
+    for (size_t ii = 0; ii < n; ii++) {
+        tl_nset_add(a, (void *)nsetItem(ii));
+    }
+    for (size_t ii = 0; ii < nb; ii++) {
+        tl_nset_add(b, (void *)nsetItem(ii * step + step / 2));
+    }
+    printf(" %lu and %lu items\n", (unsigned long)n, (unsigned long)nb);
+
+    tlbench::Timer tloop;
+    void **items = tl_nset_items(a, NULL);
+    for (size_t ii = 0; ii < n; ii++) {
+        if (tl_nset_contains(b, items[ii])) {
+            keep.push_back(items[ii]);
+        }
+    }
+    free(items);
+    r = tl_nset_new_bulk(&keep[0], keep.size(), 1);
+    tlbench::report("intersect, lookup loop", n, tloop.elapsed());
+    found += tl_nset_count(r);
+    tl_nset_free(r);
+
+    tlbench::Timer tinter;
+    r = tl_nset_intersect_new(a, b);
+    tlbench::report("tl_nset_intersect_new", n, tinter.elapsed());
+    found += tl_nset_count(r);
+    tl_nset_free(r);
+
+    tlbench::Timer tuloop;
+    items = tl_nset_items(a, NULL);
+    keep.assign(items, items + n);
+    free(items);
+    items = tl_nset_items(b, NULL);
+    keep.insert(keep.end(), items, items + nb);
+    free(items);
+    r = tl_nset_new_bulk(&keep[0], keep.size(), 1);
+    tlbench::report("union, items and bulk", n, tuloop.elapsed());
+    found += tl_nset_count(r);
+    tl_nset_free(r);
+
+    tlbench::Timer tunion;
+    r = tl_nset_union_new(a, b);
+    tlbench::report("tl_nset_union_new", n, tunion.elapsed());
+    found += tl_nset_count(r);
+    tl_nset_free(r);
+
+    tlbench::Timer tdloop;
+    items = tl_nset_items(b, NULL);
+    for (size_t ii = 0; ii < nb; ii++) {
+        tl_nset_del(a, items[ii]);
+    }
+    free(items);
+    tlbench::report("difference in place, delete loop", n, tdloop.elapsed());
+    for (size_t ii = 0; ii < n; ii++) {
+        tl_nset_add(a, (void *)nsetItem(ii));
+    }
+
+    tlbench::Timer tdiff;
+    tl_nset_difference(a, b);
+    tlbench::report("tl_nset_difference", n, tdiff.elapsed());
+    found += tl_nset_count(a);
+
+    tlbench::keep(found);
+    tl_nset_free(a);
+    tl_nset_free(b);
+}
+
+/* Intersection, union and difference of two sets, against the same
+ * operations written over tl_nset_items(), with results built by
+ * tl_nset_new_bulk(). Sets of the same size share half their items; a
+ * small set has half its items in a large one. Per-item figures are over
+ * the larger set */
+TL_BENCHMARK(nset_algebra)
+{
+    size_t sizes[] = { 10000, 1000000, 10000000 };
+
+    for (size_t ss = 0; ss < sizeof(sizes) / sizeof(sizes[0]); ss++) {
+        runAlgebra(sizes[ss], sizes[ss]);
+        runAlgebra(sizes[ss], sizes[ss] / 16);
+    }
+}
@@ -0,0 +1,184 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2014 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "bench.h"
+#include <typelib/typelib.h>
+#include <cstdint>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+/* One round of the roaring benchmark over a set of IDs: memory and lookups
+ * against a tl_SET of the same IDs, then rank, select and serialization */
+static void runRoaring(const char *name, const std::vector<uint32_t> &ids)
+{
+    tl_ROARING *r = tl_roaring_new();
+    tl_pNSET set = tl_nset_new();
+    size_t n = ids.size(), nlookups = 10000000, found = 0;
+    std::mt19937 rng(42);
+
+    printf(" %s: %lu IDs\n", name, (unsigned long)n);
+    tlbench::Timer tadd;
+    for (size_t ii = 0; ii < n; ii++) {
+        tl_roaring_add(r, ids[ii]);
+    }
+    tlbench::report("tl_roaring_add", n, tadd.elapsed());
+    tlbench::Timer topt;
+    tl_roaring_optimize(r);
+    tlbench::report("tl_roaring_optimize", n, topt.elapsed());
+
+    tlbench::Timer tsadd;
+    for (size_t ii = 0; ii < n; ii++) {
+        tl_nset_add(set, (void *)((size_t)ids[ii] + 2));
+    }
+    tlbench::report("tl_nset_add", n, tsadd.elapsed());
+    printf("  %-48s %12lu bytes %8.2f bytes/ID\n", "tl_ROARING",
+           (unsigned long)tl_roaring_bytes(r), (double)tl_roaring_bytes(r) / n);
+    printf("  %-48s %12lu bytes %8.2f bytes/ID\n", "tl_SET",
+           (unsigned long)(set->capacity * sizeof(size_t)),
+           (double)set->capacity * sizeof(size_t) / n);
+
+    /* Half hits and half (mostly) misses, in random order */
+    std::vector<uint32_t> probes;
+    uint32_t top = ids.back() + ids.back() / 4 + 1;
+    for (size_t ii = 0; ii < 1000000; ii++) {
+        probes.push_back(ii % 2 ? ids[rng() % n] : rng() % top);
+    }
+
+    tlbench::Timer tcont;
+    for (size_t ii = 0; ii < nlookups; ii++) {
+        found += tl_roaring_contains(r, probes[ii % probes.size()]);
+    }
+    tlbench::report("tl_roaring_contains", nlookups, tcont.elapsed());
+    tlbench::Timer tscont;
+    for (size_t ii = 0; ii < nlookups; ii++) {
+        found += tl_nset_contains(set, (void *)((size_t)probes[ii % probes.size()] + 2));
+    }
+    tlbench::report("tl_nset_contains", nlookups, tscont.elapsed());
+
+    tlbench::Timer trank;
+    for (size_t ii = 0; ii < probes.size(); ii++) {
+        found += tl_roaring_rank(r, probes[ii]);
+    }
+    tlbench::report("tl_roaring_rank", probes.size(), trank.elapsed());
+    tlbench::Timer tselect;
+    for (size_t ii = 0; ii < probes.size(); ii++) {
+        uint32_t v;
+        found += tl_roaring_select(r, rng() % n, &v) + v;
+    }
+    tlbench::report("tl_roaring_select", probes.size(), tselect.elapsed());
+
+    tl_STRING str;
+    tl_str_init(&str);
+    tlbench::Timer tser;
+    tl_roaring_serialize(r, &str);
+    tlbench::report_bytes("tl_roaring_serialize", 1, str.nused, tser.elapsed());
+    tlbench::Timer tdeser;
+    tl_ROARING *copy = tl_roaring_deserialize(str.base, str.nused, NULL);
+    tlbench::report_bytes("tl_roaring_deserialize", 1, str.nused, tdeser.elapsed());
+    printf("  %-48s %12lu bytes\n", "serialized", (unsigned long)str.nused);
+    found += tl_roaring_count(copy);
+    tl_roaring_free(copy);
+    tl_str_cleanup(&str);
+
+    tlbench::keep(found);
+    tl_nset_free(set);
+    tl_roaring_free(r);
+}
+
+/* Two sets of IDs: 10M sequence numbers with a few gaps, as runs, and 2M
+ * IDs scattered over 0-20M, as bitmaps and arrays */
+TL_BENCHMARK(roaring)
+{
+    std::vector<uint32_t> ids;
+    std::mt19937 rng(42);
+
+    for (uint32_t ii = 0; ii < 10000000; ii++) {
+        if (rng() % 1000) {
+            ids.push_back(ii);
+        }
+    }
+    runRoaring("sequence numbers", ids);
+
+    ids.clear();
+    for (uint32_t ii = 0; ii < 20000000; ii++) {
+        if (rng() % (ii < 10000000 ? 6 : 60) == 0) {
+            ids.push_back(ii);
+        }
+    }
+    runRoaring("scattered IDs", ids);
+}
+
+/* Set algebra on the sets of 2M scattered IDs, against the same on tl_SET */
+TL_BENCHMARK(roaring_algebra)
+{
+    tl_ROARING *a = tl_roaring_new(), *b = tl_roaring_new(), *r;
+    tl_pNSET sa = tl_nset_new(), sb = tl_nset_new(), s;
+    std::mt19937 rng(42);
+    size_t found = 0;
+
+    for (uint32_t ii = 0; ii < 20000000; ii++) {
+        if (rng() % 10 == 0) {
+            tl_roaring_add(a, ii);
+            tl_nset_add(sa, (void *)((size_t)ii + 2));
+        }
+        if (rng() % 10 == 0) {
+            tl_roaring_add(b, ii);
+            tl_nset_add(sb, (void *)((size_t)ii + 2));
+        }
+    }
+    size_t n = (size_t)tl_roaring_count(a);
+
+    tlbench::Timer tinter;
+    r = tl_roaring_intersect_new(a, b);
+    tlbench::report("tl_roaring_intersect_new", n, tinter.elapsed());
+    found += tl_roaring_count(r);
+    tl_roaring_free(r);
+    tlbench::Timer tsinter;
+    s = tl_nset_intersect_new(sa, sb);
+    tlbench::report("tl_nset_intersect_new", n, tsinter.elapsed());
+    found += tl_nset_count(s);
+    tl_nset_free(s);
+
+    tlbench::Timer tunion;
+    r = tl_roaring_union_new(a, b);
+    tlbench::report("tl_roaring_union_new", n, tunion.elapsed());
+    found += tl_roaring_count(r);
+    tl_roaring_free(r);
+    tlbench::Timer tsunion;
+    s = tl_nset_union_new(sa, sb);
+    tlbench::report("tl_nset_union_new", n, tsunion.elapsed());
+    found += tl_nset_count(s);
+    tl_nset_free(s);
+
+    tlbench::Timer tdiff;
+    r = tl_roaring_difference_new(a, b);
+    tlbench::report("tl_roaring_difference_new", n, tdiff.elapsed());
+    found += tl_roaring_count(r);
+    tl_roaring_free(r);
+    tlbench::Timer tsdiff;
+    s = tl_nset_difference_new(sa, sb);
+    tlbench::report("tl_nset_difference_new", n, tsdiff.elapsed());
+    found += tl_nset_count(s);
+    tl_nset_free(s);
+
+    tlbench::keep(found);
+    tl_roaring_free(a);
+    tl_roaring_free(b);
+    tl_nset_free(sa);
+    tl_nset_free(sb);
+}
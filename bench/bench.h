@@ -0,0 +1,94 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2014 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#ifndef TL_BENCH_H
+#define TL_BENCH_H
+
+#include <chrono>
+#include <cstdio>
+#include <cstddef>
+
+/**
+ * @file
+ * Minimal benchmark harness. Each benchmark is a function registered with
+ * TL_BENCHMARK(); `tlbench [substring...]` runs the ones whose name contains
+ * any of the arguments (or all of them).
+ */
+
+namespace tlbench {
+
+typedef void (*Function)(void);
+
+struct Registrar {
+    Registrar(const char *name, Function fn);
+};
+
+class Timer {
+public:
+    Timer() : begin(std::chrono::steady_clock::now()) {}
+
+    /** Nanoseconds since construction */
+    double elapsed() const {
+        std::chrono::duration<double, std::nano> d =
+                std::chrono::steady_clock::now() - begin;
+        return d.count();
+    }
+
+private:
+    std::chrono::steady_clock::time_point begin;
+};
+
+/**
+ * Print one result line.
+ * @param what description of the operation being timed
+ * @param nops number of operations performed
+ * @param ns total time taken, in nanoseconds
+ */
+inline void report(const char *what, size_t nops, double ns)
+{
+    printf("  %-48s %12lu ops %10.2f ns/op %10.2f Mops/s\n",
+           what, (unsigned long)nops, ns / nops, nops * 1000.0 / ns);
+}
+
+/**
+ * Print one result line for an operation over a number of bytes.
+ * @param what description of the operation being timed
+ * @param nops number of operations performed
+ * @param nbytes total number of bytes processed
+ * @param ns total time taken, in nanoseconds
+ */
+inline void report_bytes(const char *what, size_t nops, size_t nbytes, double ns)
+{
+    printf("  %-48s %12lu ops %10.2f ns/op %10.2f GB/s\n",
+           what, (unsigned long)nops, ns / nops, nbytes / ns);
+}
+
+/** Keep the optimizer from discarding a computed value */
+inline void keep(size_t v)
+{
+    static volatile size_t sink;
+    sink = v;
+}
+
+}
+
+#define TL_BENCHMARK(name) \
+    static void tlbench_##name(void); \
+    static tlbench::Registrar tlbench_reg_##name(#name, tlbench_##name); \
+    static void tlbench_##name(void)
+
+#endif
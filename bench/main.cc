@@ -0,0 +1,52 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2014 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "bench.h"
+#include <cstring>
+#include <utility>
+#include <vector>
+
+typedef std::pair<const char *, tlbench::Function> Entry;
+
+static std::vector<Entry> &registry(void)
+{
+    static std::vector<Entry> benchmarks;
+    return benchmarks;
+}
+
+tlbench::Registrar::Registrar(const char *name, Function fn)
+{
+    registry().push_back(Entry(name, fn));
+}
+
+int main(int argc, char **argv)
+{
+    std::vector<Entry> &benchmarks = registry();
+
+    for (size_t ii = 0; ii < benchmarks.size(); ii++) {
+        bool selected = argc < 2;
+        for (int jj = 1; jj < argc && !selected; jj++) {
+            selected = strstr(benchmarks[ii].first, argv[jj]) != NULL;
+        }
+        if (!selected) {
+            continue;
+        }
+        printf("%s:\n", benchmarks[ii].first);
+        benchmarks[ii].second();
+    }
+    return 0;
+}
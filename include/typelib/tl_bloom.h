@@ -0,0 +1,106 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2014 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#ifndef TL_BLOOM_H
+#define TL_BLOOM_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @file
+ * Cache line blocked Bloom filter over 64 bit hashes.
+ *
+ * Each hash selects one 64 byte block and sets (or tests) all of its bits
+ * within that block, so a test reads a single cache line whatever the
+ * number of bits per key. Keys are not spread as evenly as with a plain
+ * Bloom filter, which costs a few extra bits per key for the same false
+ * positive rate; the sizing accounts for this.
+ *
+ * The filter only sees hashes, so it can sit in front of any container: add
+ * the hash of each key stored, and skip the container's lookup when
+ * tl_bloom_maybe() says the key is absent. Keys cannot be removed; rebuild
+ * the filter once enough have been deleted. tl_HASHTABLE does all of this
+ * itself when created with TL_HT_F_FILTER.
+ */
+
+typedef struct tl_BLOOM_st tl_BLOOM;
+
+/** Filter geometry, as chosen for a false positive rate */
+struct tl_BLOOMPARAMS {
+    /** Bits of filter per key */
+    double bits_per_key;
+    /** Number of bits set for each key */
+    unsigned k;
+};
+
+/**
+ * Choose the geometry which reaches a false positive rate with the fewest
+ * bits. This takes some computation, so it is worth doing once for filters
+ * which are often created with the same rate.
+ *
+ * @param fpr the false positive rate, clamped to [0.000001, 0.5]
+ * @param[out] params the geometry
+ */
+void tl_bloom_params(double fpr, struct tl_BLOOMPARAMS *params);
+
+/**
+ * Create a filter for a number of keys with a given geometry
+ * @param nkeys the number of keys the filter is sized for. More may be added,
+ *        at the cost of a higher false positive rate
+ * @param params the geometry, from tl_bloom_params()
+ * @return the filter, or NULL if memory cannot be allocated
+ */
+tl_BLOOM *tl_bloom_new_params(size_t nkeys, const struct tl_BLOOMPARAMS *params);
+
+/** Like tl_bloom_new_params(), with the geometry for a false positive rate */
+tl_BLOOM *tl_bloom_new(size_t nkeys, double fpr);
+
+/** Free a filter (which may be NULL) */
+void tl_bloom_free(tl_BLOOM *b);
+
+/** Add a key's hash */
+void tl_bloom_add(tl_BLOOM *b, uint64_t hash);
+
+/**
+ * Test a key's hash
+ * @return 0 if the key was never added, nonzero if it may have been
+ */
+int tl_bloom_maybe(const tl_BLOOM *b, uint64_t hash);
+
+/** Remove all keys */
+void tl_bloom_clear(tl_BLOOM *b);
+
+/** @return the number of hashes added since the filter was created or
+ *  cleared (hashes added twice count twice) */
+size_t tl_bloom_count(const tl_BLOOM *b);
+
+/** @return the number of bytes taken by the filter's bits */
+size_t tl_bloom_bytes(const tl_BLOOM *b);
+
+/** @return the expected false positive rate for the number of hashes added
+ *  so far */
+double tl_bloom_fpr(const tl_BLOOM *b);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
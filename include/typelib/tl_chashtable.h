@@ -0,0 +1,133 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2014 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#ifndef TL_CHASHTABLE_H
+#define TL_CHASHTABLE_H 1
+
+#include "tl_hashtable.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @file
+ * A hash table which may be used from several threads at once.
+ *
+ * The table is split into a power-of-two number of shards, each a
+ * tl_HASHTABLE with its own reader/writer lock; the key's hash selects the
+ * shard. Lookups and iteration take the shard's lock shared, every other
+ * call takes it exclusively, so operations on different shards never
+ * contend and lookups on the same shard run in parallel.
+ *
+ * Values are only accessed while the shard is locked: lookups pass them to a
+ * callback rather than returning a pointer which another thread could free.
+ */
+
+typedef struct tl_CHASHTABLE_st tl_CHASHTABLE;
+
+/** Number of shards used if 0 is passed to tl_cht_new() */
+#define TL_CHT_DEFAULT_SHARDS 16
+
+/** Maximum number of shards */
+#define TL_CHT_MAX_SHARDS 4096
+
+/**
+ * Create a new concurrent hash table.
+ *
+ * @param est the estimated number of items to store (must be > 0)
+ * @param ops the key and value operations. They may be called from any
+ *        thread, but never concurrently for the same shard unless they are
+ *        lookups
+ * @param conf settings for each shard, may be NULL (see tl_ht_new_ex())
+ * @param nshards number of shards; must be a power of two no greater than
+ *        TL_CHT_MAX_SHARDS, or 0 for TL_CHT_DEFAULT_SHARDS
+ *
+ * @return the new table, or NULL if it cannot be created or the settings
+ *         are invalid
+ */
+tl_CHASHTABLE *
+tl_cht_new(size_t est, struct tl_HASHOPS ops, const struct tl_HASHCONF *conf,
+           unsigned nshards);
+
+/**
+ * Free the table. No other thread may be using it.
+ * @param h the table (may be NULL)
+ */
+void tl_cht_free(tl_CHASHTABLE *h);
+
+/** Like tl_ht_store() */
+int tl_cht_store(tl_CHASHTABLE *h, const void *k, size_t klen,
+                 const void *v, size_t vlen);
+
+/**
+ * Look up the most recent value stored for a key.
+ *
+ * @param h the table
+ * @param k the key
+ * @param klen the length of the key
+ * @param cb called with the key and the value if the key is found, while
+ *        the shard is locked for reading. The callback must not call into
+ *        the table. May be NULL
+ * @param arg passed to the callback
+ *
+ * @return 1 if the key was found, 0 otherwise
+ */
+int tl_cht_find(tl_CHASHTABLE *h, const void *k, size_t klen,
+                tl_HASHITER_cb cb, void *arg);
+
+/** Like tl_ht_del() */
+int tl_cht_del(tl_CHASHTABLE *h, const void *k, size_t klen);
+
+/** Like tl_ht_delall() */
+int tl_cht_delall(tl_CHASHTABLE *h, const void *k, size_t klen);
+
+/**
+ * Like tl_ht_update(). The lookup and the store (or update) happen under the
+ * same lock, so no other thread can store the key in between.
+ */
+enum tl_UPDATETYPE tl_cht_update(tl_CHASHTABLE *h, const void *k, size_t klen,
+                                 const void *v, size_t vlen);
+
+/**
+ * Like tl_ht_funupdate(), atomically: `upd` is called with the shard locked,
+ * and no other thread may modify the key until its result has been stored.
+ * `upd` and `fr` must not call into the table.
+ */
+enum tl_UPDATETYPE
+tl_cht_funupdate(tl_CHASHTABLE *h,
+                 const void *key, size_t klen,
+                 void * (*upd)(const void *k, const void *oldv, size_t *ns, void *a),
+                 void (*fr)(void *), void *arg, const void *def, size_t deflen);
+
+/**
+ * Iterate all items, one shard at a time. Each shard is locked for reading
+ * while its items are visited, so the iteration is not a snapshot of the
+ * whole table. The callback must not call into the table.
+ */
+void tl_cht_iter(tl_CHASHTABLE *h, tl_HASHITER_cb iterfunc, void *arg);
+
+/** Total number of items, summed over the shards one at a time */
+int tl_cht_size(tl_CHASHTABLE *h);
+
+/** Remove all items, one shard at a time. Returns the number removed */
+int tl_cht_clear(tl_CHASHTABLE *h);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
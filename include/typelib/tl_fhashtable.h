@@ -0,0 +1,158 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2014 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#ifndef TL_FHASHTABLE_H
+#define TL_FHASHTABLE_H 1
+
+#include "tl_hashtable.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @file
+ * Frozen hash tables: immutable copies of a tl_HASHTABLE for data which is
+ * built once and then only read.
+ *
+ * Keys are placed with a minimal perfect hash (CHD: keys are hashed into
+ * small buckets, and each bucket stores the displacement which moves all of
+ * its keys to free slots), so every key has a slot of its own and a lookup
+ * never probes. The table is a single block of memory: a displacement per
+ * four keys, a 16 byte slot per key and the keys and values themselves,
+ * stored in slot order. A lookup reads one displacement (these take two
+ * bytes per key, so they tend to stay cached), one slot and one record; a
+ * miss usually stops at the slot, which holds part of the key's hash.
+ *
+ * Nothing is modified after tl_ht_freeze() returns, so any number of threads
+ * may use a frozen table at once without locking.
+ *
+ * The block only refers to its parts by offset, so it doubles as a snapshot
+ * format: tl_fht_save() writes it to a file as it is, and tl_fht_open() maps
+ * such a file read-only and looks keys up in the mapped pages, without
+ * reading or copying the table first. Opening takes the same time whatever
+ * the table's size, and processes which open the same file share one copy
+ * of it in the page cache.
+ */
+
+typedef struct tl_FHASHTABLE_st tl_FHASHTABLE;
+
+/**
+ * Version of the snapshot format, stored in each snapshot. Snapshots of
+ * other versions, or written on a host of different byte order, are
+ * rejected.
+ */
+#define TL_FHT_FORMAT_VERSION 1
+
+/**
+ * Create a frozen copy of a table.
+ *
+ * Keys and values are copied and their lengths kept; keys are hashed with
+ * tl_hash64() and compared bytewise, so the table's own hash and comparison
+ * functions are not used after this (tables whose keys are not the bytes
+ * they point to, such as those from tl_ht_szt_new(), cannot be frozen). A
+ * value of length 0 is kept as the pointer itself. Each key maps to the
+ * value tl_ht_find() returns for it.
+ *
+ * The source table is not otherwise modified, and may be freed afterwards.
+ *
+ * @param h the table
+ * @return the frozen table, or NULL if memory cannot be allocated
+ */
+tl_FHASHTABLE *tl_ht_freeze(tl_HASHTABLE *h);
+
+/**
+ * Free a frozen table, unmapping it if it was opened from a snapshot.
+ *
+ * @param f the table (may be NULL)
+ */
+void tl_fht_free(tl_FHASHTABLE *f);
+
+/**
+ * Write a snapshot of a frozen table to a file, which is replaced.
+ *
+ * Values of length 0 are pointers (see tl_ht_freeze()); they are written as
+ * they are, so they mean nothing to another process.
+ *
+ * @param f the table
+ * @param path name of the file
+ * @return 0, or -1 if the file cannot be written
+ */
+int tl_fht_save(const tl_FHASHTABLE *f, const char *path);
+
+/**
+ * Open a snapshot written by tl_fht_save(), mapping the file read-only.
+ *
+ * Only the snapshot's header is checked; lookups trust the rest of the file,
+ * so it must come from tl_fht_save() and must not be modified while it is
+ * open.
+ *
+ * @param path name of the file
+ * @return the table, or NULL if the file cannot be mapped or is not a
+ *         snapshot of this version
+ */
+tl_FHASHTABLE *tl_fht_open(const char *path);
+
+/**
+ * Use a snapshot which is already in memory (for example, mapped by the
+ * caller) without copying it. As for tl_fht_open(), only the header is
+ * checked.
+ *
+ * @param buf the snapshot, aligned to 8 bytes. It must remain valid and
+ *        unmodified until the table is freed
+ * @param len the length of the buffer
+ * @return the table, or NULL if `buf` does not hold a snapshot of this
+ *         version
+ */
+tl_FHASHTABLE *tl_fht_view(const void *buf, size_t len);
+
+/**
+ * Look up a key.
+ *
+ * @param f the table
+ * @param k the key
+ * @param klen the length of the key
+ * @param[out] nvalue the length of the value, if found
+ * @return the value, or NULL if the key is not present. The value lives as
+ *         long as the table, and must not be modified
+ */
+const void *tl_fht_findn(const tl_FHASHTABLE *f, const void *k, size_t klen,
+                         size_t *nvalue);
+
+/** Like tl_fht_findn(), without the value's length */
+const void *tl_fht_find(const tl_FHASHTABLE *f, const void *k, size_t klen);
+
+/** @return the number of keys */
+size_t tl_fht_size(const tl_FHASHTABLE *f);
+
+/** @return the number of bytes taken by the table's data, i.e. the size of
+ *  its snapshot */
+size_t tl_fht_bytes(const tl_FHASHTABLE *f);
+
+/**
+ * Call `iterfunc` for every key and its value, in slot order
+ *
+ * @param f the table
+ * @param iterfunc the function to call
+ * @param arg passed to iterfunc
+ */
+void tl_fht_iter(const tl_FHASHTABLE *f, tl_HASHITER_cb iterfunc, void *arg);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,83 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2014 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#ifndef TL_HASH_H
+#define TL_HASH_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @file
+ * Seeded 64 bit hash functions for arbitrary byte strings. Both functions
+ * have the signature of tl_HASHOPS::hashfunc64.
+ */
+
+/**
+ * Portable hash, consuming 32 bytes per step. This is the XXH64 algorithm,
+ * so its output is the same on every platform and may be stored.
+ *
+ * @param k the data to hash
+ * @param n length of the data
+ * @param seed seed value; different seeds give unrelated hash values
+ * @return the hash
+ */
+uint64_t tl_hash64(const void *k, size_t n, uint64_t seed);
+
+/**
+ * Fastest hash available on the running CPU, consuming up to 64 bytes per
+ * step. The implementation is chosen the first time this is called (see
+ * tl_hash_select()), so its output differs between machines and must not be
+ * stored.
+ */
+uint64_t tl_hash_fast64(const void *k, size_t n, uint64_t seed);
+
+/** Implementations of tl_hash_fast64() */
+enum tl_HASHIMPL {
+    /** Same as tl_hash64() */
+    TL_HASH_IMPL_PORTABLE = 0,
+    /** AES-NI rounds over 16 byte lanes (x86-64) */
+    TL_HASH_IMPL_AES
+};
+
+/**
+ * Select the implementation used by tl_hash_fast64().
+ *
+ * This is done automatically; it is only needed to test or benchmark a
+ * specific implementation. It must not be called while the hash values of
+ * existing tables are in use.
+ *
+ * @param impl one of tl_HASHIMPL, or -1 for the best one supported
+ * @return the selected implementation, or -1 if `impl` is not supported by
+ *         this CPU or build
+ */
+int tl_hash_select(int impl);
+
+/**
+ * Generate a seed which is hard to predict from outside the process, for use
+ * with the functions above.
+ */
+uint64_t tl_hash_randseed(void);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
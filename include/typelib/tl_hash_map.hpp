@@ -0,0 +1,930 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2014 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#ifndef TL_HASH_MAP_HPP
+#define TL_HASH_MAP_HPP 1
+
+/**
+ * @file
+ * tl::hash_map, a C++ map with unique keys laid out like a
+ * TL_HT_ENGINE_OPEN tl_HASHTABLE: one control byte per slot, 16 slot groups
+ * whose control bytes are matched at once, and linear probing over groups
+ * starting at the group selected by the high bits of the mixed hash.
+ *
+ * Unlike the C table, the hash and equality functions are template
+ * parameters, so they are inlined into the probe loop instead of being
+ * called through tl_HASHOPS, and elements are stored in the slots
+ * themselves. The table is rebuilt in one step when it fills up rather than
+ * incrementally.
+ *
+ * Rebuilding moves the elements, so it invalidates iterators, pointers and
+ * references; inserting may rebuild the table. Erasing only invalidates the
+ * erased element.
+ *
+ * The header needs C++11. Only the default hash for strings (tl::hash) calls
+ * into the library, through tl_hash64().
+ */
+
+#if __cplusplus < 201103L && !(defined(_MSVC_LANG) && _MSVC_LANG >= 201103L)
+#error "tl_hash_map.hpp requires C++11"
+#endif
+
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <initializer_list>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "tl_hash.h"
+
+#if __cplusplus >= 201703L || (defined(_MSVC_LANG) && _MSVC_LANG >= 201703L)
+#include <string_view>
+#define TL_HASH_MAP_STRING_VIEW 1
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TL_HASH_MAP_SSE2 1
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace tl {
+
+namespace detail {
+
+/**
+ * Hash for every string type, so that a map keyed by std::string can be
+ * searched with a `const char *` or std::string_view without constructing
+ * a std::string.
+ */
+struct string_hash {
+    typedef void is_transparent;
+
+    size_t operator()(const char *s) const noexcept {
+        return static_cast<size_t>(tl_hash64(s, std::strlen(s), 0));
+    }
+    size_t operator()(const std::string &s) const noexcept {
+        return static_cast<size_t>(tl_hash64(s.data(), s.size(), 0));
+    }
+#ifdef TL_HASH_MAP_STRING_VIEW
+    size_t operator()(std::string_view s) const noexcept {
+        return static_cast<size_t>(tl_hash64(s.data(), s.size(), 0));
+    }
+#endif
+};
+
+/** Equality across string types, for use with string_hash */
+struct string_equal {
+    typedef void is_transparent;
+
+    template <class A, class B>
+    bool operator()(const A &a, const B &b) const {
+        return a == b;
+    }
+};
+
+template <class T>
+struct make_void {
+    typedef void type;
+};
+
+template <class T, class = void>
+struct is_transparent : std::false_type {};
+
+template <class T>
+struct is_transparent<T, typename make_void<typename T::is_transparent>::type>
+        : std::true_type {};
+
+/**
+ * Type of the key parameter of lookups: any type if the hash and equality
+ * functions are transparent, otherwise the map's key type. Resolving to
+ * `KK` itself keeps it deducible.
+ */
+template <bool Transparent>
+struct key_arg {
+    template <class KK, class Key> using type = KK;
+};
+
+template <>
+struct key_arg<false> {
+    template <class KK, class Key> using type = Key;
+};
+
+} // namespace detail
+
+/**
+ * Default hash for tl::hash_map: std::hash, except for strings, which are
+ * hashed with tl_hash64() by a transparent function. std::hash is often the
+ * identity for integers; this is fine as the map mixes every hash before
+ * using it.
+ */
+template <class K>
+struct hash : std::hash<K> {};
+
+template <>
+struct hash<std::string> : detail::string_hash {};
+
+#ifdef TL_HASH_MAP_STRING_VIEW
+template <>
+struct hash<std::string_view> : detail::string_hash {};
+#endif
+
+/** Default equality for tl::hash_map, transparent for strings */
+template <class K>
+struct equal_to : std::equal_to<K> {};
+
+template <>
+struct equal_to<std::string> : detail::string_equal {};
+
+#ifdef TL_HASH_MAP_STRING_VIEW
+template <>
+struct equal_to<std::string_view> : detail::string_equal {};
+#endif
+
+template <class K, class V, class Hash = tl::hash<K>, class Eq = tl::equal_to<K>,
+          class Alloc = std::allocator<std::pair<const K, V> > >
+class hash_map {
+public:
+    typedef K key_type;
+    typedef V mapped_type;
+    typedef std::pair<const K, V> value_type;
+    typedef size_t size_type;
+    typedef ptrdiff_t difference_type;
+    typedef Hash hasher;
+    typedef Eq key_equal;
+    typedef Alloc allocator_type;
+    typedef value_type &reference;
+    typedef const value_type &const_reference;
+
+private:
+    typedef std::allocator_traits<Alloc> alloc_traits;
+    typedef typename alloc_traits::template rebind_alloc<value_type> slot_alloc_type;
+    typedef typename alloc_traits::template rebind_alloc<unsigned char> ctrl_alloc_type;
+    typedef typename alloc_traits::template rebind_alloc<size_type> index_alloc_type;
+    typedef std::allocator_traits<slot_alloc_type> slot_traits;
+    typedef std::allocator_traits<ctrl_alloc_type> ctrl_traits;
+
+    enum { GROUP_BITS = 4, GROUP_SIZE = 1 << GROUP_BITS };
+    enum { SIZE_BITS = sizeof(size_t) * CHAR_BIT };
+    /* Same as DEFAULT_OPEN_MAX_LOAD in hashtable.c */
+    enum { MAX_LOAD = 87 };
+    static const unsigned char CTRL_EMPTY = 0x80;
+    static const unsigned char CTRL_DELETED = 0xfe;
+    static const size_type npos = static_cast<size_type>(-1);
+
+    static const bool transparent =
+            detail::is_transparent<Hash>::value && detail::is_transparent<Eq>::value;
+
+    template <class KK>
+    using key_arg = typename detail::key_arg<transparent>::template type<KK, K>;
+
+    template <bool Const>
+    class iter_impl {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef typename hash_map::value_type value_type;
+        typedef typename hash_map::difference_type difference_type;
+        typedef typename std::conditional<Const, const value_type *, value_type *>::type pointer;
+        typedef typename std::conditional<Const, const value_type &, value_type &>::type reference;
+
+        iter_impl() : ctrl(NULL), end(NULL), slot(NULL) {}
+
+        /** iterator converts to const_iterator */
+        template <bool C, class = typename std::enable_if<Const && !C>::type>
+        iter_impl(const iter_impl<C> &other)
+                : ctrl(other.ctrl), end(other.end), slot(other.slot) {}
+
+        reference operator*() const { return *slot; }
+        pointer operator->() const { return slot; }
+
+        iter_impl &operator++() {
+            ++ctrl;
+            ++slot;
+            skip();
+            return *this;
+        }
+        iter_impl operator++(int) {
+            iter_impl rv(*this);
+            ++*this;
+            return rv;
+        }
+
+        friend bool operator==(const iter_impl &a, const iter_impl &b) {
+            return a.ctrl == b.ctrl;
+        }
+        friend bool operator!=(const iter_impl &a, const iter_impl &b) {
+            return a.ctrl != b.ctrl;
+        }
+
+    private:
+        friend class hash_map;
+        template <bool C> friend class iter_impl;
+
+        iter_impl(const unsigned char *ctrl_, const unsigned char *end_, pointer slot_)
+                : ctrl(ctrl_), end(end_), slot(slot_) {}
+
+        /** Advance to the next full slot, or to the end */
+        void skip() {
+            while (ctrl != end && (*ctrl & 0x80)) {
+                ++ctrl;
+                ++slot;
+            }
+        }
+
+        const unsigned char *ctrl;
+        const unsigned char *end;
+        pointer slot;
+    };
+
+public:
+    typedef iter_impl<false> iterator;
+    typedef iter_impl<true> const_iterator;
+
+    hash_map() : ctrl_(NULL), slots_(NULL), nbits_(0), size_(0), count_(0), growth_left_(0) {}
+
+    /**
+     * @param n number of elements to reserve space for
+     */
+    explicit hash_map(size_type n, const Hash &hf = Hash(), const Eq &eq = Eq(),
+                      const Alloc &alloc = Alloc())
+            : hash_(hf), eq_(eq), slot_alloc_(alloc), ctrl_alloc_(alloc),
+              ctrl_(NULL), slots_(NULL), nbits_(0), size_(0), count_(0), growth_left_(0) {
+        reserve(n);
+    }
+
+    explicit hash_map(const Alloc &alloc)
+            : slot_alloc_(alloc), ctrl_alloc_(alloc),
+              ctrl_(NULL), slots_(NULL), nbits_(0), size_(0), count_(0), growth_left_(0) {}
+
+    template <class InputIt>
+    hash_map(InputIt first, InputIt last, size_type n = 0,
+             const Hash &hf = Hash(), const Eq &eq = Eq(), const Alloc &alloc = Alloc())
+            : hash_(hf), eq_(eq), slot_alloc_(alloc), ctrl_alloc_(alloc),
+              ctrl_(NULL), slots_(NULL), nbits_(0), size_(0), count_(0), growth_left_(0) {
+        reserve(n);
+        insert(first, last);
+    }
+
+    hash_map(std::initializer_list<value_type> il, size_type n = 0,
+             const Hash &hf = Hash(), const Eq &eq = Eq(), const Alloc &alloc = Alloc())
+            : hash_(hf), eq_(eq), slot_alloc_(alloc), ctrl_alloc_(alloc),
+              ctrl_(NULL), slots_(NULL), nbits_(0), size_(0), count_(0), growth_left_(0) {
+        reserve(n > il.size() ? n : il.size());
+        insert(il.begin(), il.end());
+    }
+
+    /** The copy has the same layout as `other`, so no element is rehashed */
+    hash_map(const hash_map &other)
+            : hash_(other.hash_), eq_(other.eq_),
+              slot_alloc_(slot_traits::select_on_container_copy_construction(other.slot_alloc_)),
+              ctrl_alloc_(ctrl_traits::select_on_container_copy_construction(other.ctrl_alloc_)),
+              ctrl_(NULL), slots_(NULL), nbits_(0), size_(0), count_(0), growth_left_(0) {
+        if (other.size_ == 0) {
+            return;
+        }
+        allocate(other.nbits_);
+        size_type n = 0;
+        try {
+            for (; n < size_; n++) {
+                if (!(other.ctrl_[n] & 0x80)) {
+                    slot_traits::construct(slot_alloc_, slots_ + n, other.slots_[n]);
+                }
+            }
+        } catch (...) {
+            while (n--) {
+                if (!(other.ctrl_[n] & 0x80)) {
+                    slot_traits::destroy(slot_alloc_, slots_ + n);
+                }
+            }
+            deallocate(ctrl_, slots_, size_);
+            throw;
+        }
+        std::memcpy(ctrl_, other.ctrl_, size_);
+        count_ = other.count_;
+        growth_left_ = other.growth_left_;
+    }
+
+    hash_map(hash_map &&other)
+            : hash_(std::move(other.hash_)), eq_(std::move(other.eq_)),
+              slot_alloc_(std::move(other.slot_alloc_)), ctrl_alloc_(std::move(other.ctrl_alloc_)),
+              ctrl_(other.ctrl_), slots_(other.slots_), nbits_(other.nbits_),
+              size_(other.size_), count_(other.count_), growth_left_(other.growth_left_) {
+        other.ctrl_ = NULL;
+        other.slots_ = NULL;
+        other.nbits_ = other.size_ = other.count_ = other.growth_left_ = 0;
+    }
+
+    hash_map &operator=(const hash_map &other) {
+        if (this != &other) {
+            hash_map tmp(other);
+            swap(tmp);
+        }
+        return *this;
+    }
+
+    hash_map &operator=(hash_map &&other) {
+        if (this != &other) {
+            hash_map tmp(std::move(other));
+            swap(tmp);
+        }
+        return *this;
+    }
+
+    hash_map &operator=(std::initializer_list<value_type> il) {
+        hash_map tmp(il, 0, hash_, eq_, get_allocator());
+        swap(tmp);
+        return *this;
+    }
+
+    ~hash_map() {
+        destroy_all();
+        deallocate(ctrl_, slots_, size_);
+    }
+
+    allocator_type get_allocator() const { return allocator_type(slot_alloc_); }
+    hasher hash_function() const { return hash_; }
+    key_equal key_eq() const { return eq_; }
+
+    iterator begin() {
+        iterator rv(ctrl_, ctrl_ + size_, slots_);
+        rv.skip();
+        return rv;
+    }
+    const_iterator begin() const {
+        const_iterator rv(ctrl_, ctrl_ + size_, slots_);
+        rv.skip();
+        return rv;
+    }
+    const_iterator cbegin() const { return begin(); }
+    iterator end() { return iterator_at(size_); }
+    const_iterator end() const { return iterator_at(size_); }
+    const_iterator cend() const { return end(); }
+
+    bool empty() const { return count_ == 0; }
+    size_type size() const { return count_; }
+    /** Number of slots */
+    size_type bucket_count() const { return size_; }
+    float load_factor() const { return size_ ? static_cast<float>(count_) / size_ : 0; }
+
+    /** Destroy all elements, keeping the slots allocated */
+    void clear() {
+        destroy_all();
+        if (size_) {
+            std::memset(ctrl_, CTRL_EMPTY, size_);
+        }
+        count_ = 0;
+        growth_left_ = max_growth(size_);
+    }
+
+    /** Make room for `n` elements in total without rebuilding the table */
+    void reserve(size_type n) {
+        size_type bits = GROUP_BITS;
+        while (max_growth(static_cast<size_type>(1) << bits) < n) {
+            bits++;
+        }
+        if (bits > nbits_) {
+            rebuild(bits);
+        }
+    }
+
+    std::pair<iterator, bool> insert(const value_type &v) {
+        return emplace_key(v.first, v.second);
+    }
+
+    /** The key is copied, as it is const; the value is moved */
+    std::pair<iterator, bool> insert(value_type &&v) {
+        return emplace_key(v.first, std::move(v.second));
+    }
+
+    template <class InputIt>
+    void insert(InputIt first, InputIt last) {
+        for (; first != last; ++first) {
+            emplace_key(first->first, first->second);
+        }
+    }
+
+    void insert(std::initializer_list<value_type> il) {
+        insert(il.begin(), il.end());
+    }
+
+    /**
+     * Construct a key and value from `args` as std::pair<K, V> would, and
+     * insert them if the key is not present. Both are moved into the slot.
+     */
+    template <class... Args>
+    std::pair<iterator, bool> emplace(Args &&... args) {
+        std::pair<K, V> tmp(std::forward<Args>(args)...);
+        return emplace_key(std::move(tmp.first), std::move(tmp.second));
+    }
+
+    /**
+     * Insert the key with a value constructed from `args` if the key is not
+     * present. Otherwise neither the key nor `args` are moved from.
+     */
+    template <class... Args>
+    std::pair<iterator, bool> try_emplace(const key_type &k, Args &&... args) {
+        return emplace_key(k, std::forward<Args>(args)...);
+    }
+
+    template <class... Args>
+    std::pair<iterator, bool> try_emplace(key_type &&k, Args &&... args) {
+        return emplace_key(std::move(k), std::forward<Args>(args)...);
+    }
+
+    template <class M>
+    std::pair<iterator, bool> insert_or_assign(const key_type &k, M &&obj) {
+        std::pair<iterator, bool> rv = emplace_key(k, std::forward<M>(obj));
+        if (!rv.second) {
+            rv.first->second = std::forward<M>(obj);
+        }
+        return rv;
+    }
+
+    template <class M>
+    std::pair<iterator, bool> insert_or_assign(key_type &&k, M &&obj) {
+        std::pair<iterator, bool> rv = emplace_key(std::move(k), std::forward<M>(obj));
+        if (!rv.second) {
+            rv.first->second = std::forward<M>(obj);
+        }
+        return rv;
+    }
+
+    mapped_type &operator[](const key_type &k) {
+        return emplace_key(k).first->second;
+    }
+
+    mapped_type &operator[](key_type &&k) {
+        return emplace_key(std::move(k)).first->second;
+    }
+
+    /**
+     * Lookups take any key type if both the hash and equality functions
+     * declare `is_transparent`, as tl::hash and tl::equal_to do for strings.
+     */
+    template <class KK = key_type>
+    iterator find(const key_arg<KK> &k) {
+        return iterator_at(find_index(k));
+    }
+
+    template <class KK = key_type>
+    const_iterator find(const key_arg<KK> &k) const {
+        return iterator_at(find_index(k));
+    }
+
+    template <class KK = key_type>
+    size_type count(const key_arg<KK> &k) const {
+        return find_index(k) != npos;
+    }
+
+    template <class KK = key_type>
+    bool contains(const key_arg<KK> &k) const {
+        return find_index(k) != npos;
+    }
+
+    template <class KK = key_type>
+    mapped_type &at(const key_arg<KK> &k) {
+        size_type n = find_index(k);
+        if (n == npos) {
+            throw std::out_of_range("tl::hash_map::at");
+        }
+        return slots_[n].second;
+    }
+
+    template <class KK = key_type>
+    const mapped_type &at(const key_arg<KK> &k) const {
+        size_type n = find_index(k);
+        if (n == npos) {
+            throw std::out_of_range("tl::hash_map::at");
+        }
+        return slots_[n].second;
+    }
+
+    /** @return an iterator to the element following `pos` */
+    iterator erase(const_iterator pos) {
+        size_type n = static_cast<size_type>(pos.slot - slots_);
+        erase_at(n);
+        iterator rv = iterator_at(n);
+        rv.skip();
+        return rv;
+    }
+
+    iterator erase(iterator pos) {
+        return erase(const_iterator(pos));
+    }
+
+    template <class KK = key_type>
+    size_type erase(const key_arg<KK> &k) {
+        size_type n = find_index(k);
+        if (n == npos) {
+            return 0;
+        }
+        erase_at(n);
+        return 1;
+    }
+
+    void swap(hash_map &other) {
+        using std::swap;
+        swap(hash_, other.hash_);
+        swap(eq_, other.eq_);
+        swap(slot_alloc_, other.slot_alloc_);
+        swap(ctrl_alloc_, other.ctrl_alloc_);
+        swap(ctrl_, other.ctrl_);
+        swap(slots_, other.slots_);
+        swap(nbits_, other.nbits_);
+        swap(size_, other.size_);
+        swap(count_, other.count_);
+        swap(growth_left_, other.growth_left_);
+    }
+
+    friend void swap(hash_map &a, hash_map &b) {
+        a.swap(b);
+    }
+
+private:
+    iterator iterator_at(size_type n) {
+        if (n == npos) {
+            n = size_;
+        }
+        return iterator(ctrl_ + n, ctrl_ + size_, slots_ + n);
+    }
+
+    const_iterator iterator_at(size_type n) const {
+        if (n == npos) {
+            n = size_;
+        }
+        return const_iterator(ctrl_ + n, ctrl_ + size_, slots_ + n);
+    }
+
+    /** See genhash_mix() in hashtable.c */
+    static size_type mix(size_type v) {
+#if SIZE_MAX > 0xffffffffUL
+        v ^= v >> 33;
+        v *= static_cast<size_type>(0xff51afd7ed558ccdULL);
+        v ^= v >> 33;
+        v *= static_cast<size_type>(0xc4ceb9fe1a85ec53ULL);
+        v ^= v >> 33;
+#else
+        v ^= v >> 16;
+        v *= 0x85ebca6bUL;
+        v ^= v >> 13;
+        v *= 0xc2b2ae35UL;
+        v ^= v >> 16;
+#endif
+        return v;
+    }
+
+    template <class KK>
+    size_type hash_of(const KK &k) const {
+        return mix(static_cast<size_type>(hash_(k)));
+    }
+
+    /** Bitmask of the slots in the group whose control byte is `c` */
+    static unsigned group_match(const unsigned char *g, unsigned char c) {
+#ifdef TL_HASH_MAP_SSE2
+        __m128i ctrl = _mm_loadu_si128(reinterpret_cast<const __m128i *>(g));
+        return static_cast<unsigned>(
+                _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(static_cast<char>(c)))));
+#else
+        unsigned rv = 0;
+        for (unsigned i = 0; i < GROUP_SIZE; i++) {
+            rv |= static_cast<unsigned>(g[i] == c) << i;
+        }
+        return rv;
+#endif
+    }
+
+    /** Bitmask of the EMPTY or DELETED slots in the group */
+    static unsigned group_match_free(const unsigned char *g) {
+#ifdef TL_HASH_MAP_SSE2
+        return static_cast<unsigned>(
+                _mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(g))));
+#else
+        unsigned rv = 0;
+        for (unsigned i = 0; i < GROUP_SIZE; i++) {
+            rv |= static_cast<unsigned>(g[i] >> 7) << i;
+        }
+        return rv;
+#endif
+    }
+
+    static unsigned lowest_bit(unsigned mask) {
+#if defined(__GNUC__)
+        return static_cast<unsigned>(__builtin_ctz(mask));
+#elif defined(_MSC_VER)
+        unsigned long rv;
+        _BitScanForward(&rv, mask);
+        return static_cast<unsigned>(rv);
+#else
+        unsigned rv = 0;
+        while (!(mask & 1)) {
+            mask >>= 1;
+            rv++;
+        }
+        return rv;
+#endif
+    }
+
+    static unsigned char ctrl_of(size_type hv) {
+        return static_cast<unsigned char>(hv & 0x7f);
+    }
+
+    static size_type max_growth(size_type size) {
+        return size / 100 * MAX_LOAD + size % 100 * MAX_LOAD / 100;
+    }
+
+    size_type ngroups() const {
+        return size_ >> GROUP_BITS;
+    }
+
+    size_type group_of(size_type hv) const {
+        size_type gbits = nbits_ - GROUP_BITS;
+        return gbits ? hv >> (SIZE_BITS - gbits) : 0;
+    }
+
+    /** Slot index of the key, or npos. See open_find() in hashtable.c */
+    template <class KK>
+    size_type find_index(const KK &k) const {
+        if (count_ == 0) {
+            return npos;
+        }
+        return find_index(k, hash_of(k));
+    }
+
+    template <class KK>
+    size_type find_index(const KK &k, size_type hv) const {
+        size_type g = group_of(hv), mask_g = ngroups() - 1;
+        unsigned char c = ctrl_of(hv);
+
+        for (size_type i = 0; i < ngroups(); i++, g = (g + 1) & mask_g) {
+            const unsigned char *ctrl = ctrl_ + (g << GROUP_BITS);
+            unsigned mask = group_match(ctrl, c);
+
+            while (mask) {
+                size_type n = (g << GROUP_BITS) + lowest_bit(mask);
+                if (eq_(slots_[n].first, k)) {
+                    return n;
+                }
+                mask &= mask - 1;
+            }
+            if (group_match(ctrl, CTRL_EMPTY)) {
+                break;
+            }
+        }
+        return npos;
+    }
+
+    /** First EMPTY or DELETED slot in the probe sequence for `hv` */
+    size_type free_slot(size_type hv) const {
+        size_type g = group_of(hv), mask_g = ngroups() - 1;
+
+        for (;; g = (g + 1) & mask_g) {
+            unsigned mask = group_match_free(ctrl_ + (g << GROUP_BITS));
+            if (mask) {
+                return (g << GROUP_BITS) + lowest_bit(mask);
+            }
+        }
+    }
+
+    /**
+     * Claim a slot for a new element with hash `hv`, rebuilding the table
+     * if the slot would be EMPTY and the table has reached its maximum load.
+     * As in the C table, a rebuild grows the table if more than half of the
+     * maximum load is live elements, and otherwise only purges DELETED slots.
+     */
+    size_type prepare_insert(size_type hv) {
+        if (size_ == 0) {
+            rebuild(GROUP_BITS);
+        }
+        size_type n = free_slot(hv);
+        if (ctrl_[n] == CTRL_EMPTY) {
+            if (growth_left_ == 0) {
+                size_type bits = nbits_;
+                if (count_ * 200 > size_ * MAX_LOAD) {
+                    bits++;
+                }
+                rebuild(bits);
+                n = free_slot(hv);
+            }
+            growth_left_--;
+        }
+        return n;
+    }
+
+    template <class KK, class... Args>
+    std::pair<iterator, bool> emplace_key(KK &&k, Args &&... args) {
+        size_type hv = hash_of(k);
+        size_type n = count_ ? find_index(k, hv) : npos;
+
+        if (n != npos) {
+            return std::make_pair(iterator_at(n), false);
+        }
+        n = prepare_insert(hv);
+        slot_traits::construct(slot_alloc_, slots_ + n, std::piecewise_construct,
+                               std::forward_as_tuple(std::forward<KK>(k)),
+                               std::forward_as_tuple(std::forward<Args>(args)...));
+        ctrl_[n] = ctrl_of(hv);
+        count_++;
+        return std::make_pair(iterator_at(n), true);
+    }
+
+    /** See open_remove() in hashtable.c */
+    void erase_at(size_type n) {
+        slot_traits::destroy(slot_alloc_, slots_ + n);
+        if (group_match(ctrl_ + (n & ~static_cast<size_type>(GROUP_SIZE - 1)), CTRL_EMPTY)) {
+            ctrl_[n] = CTRL_EMPTY;
+            growth_left_++;
+        } else {
+            ctrl_[n] = CTRL_DELETED;
+        }
+        count_--;
+    }
+
+    void allocate(size_type nbits) {
+        size_type size = static_cast<size_type>(1) << nbits;
+        unsigned char *ctrl = ctrl_traits::allocate(ctrl_alloc_, size);
+        try {
+            slots_ = slot_traits::allocate(slot_alloc_, size);
+        } catch (...) {
+            ctrl_traits::deallocate(ctrl_alloc_, ctrl, size);
+            throw;
+        }
+        ctrl_ = ctrl;
+        std::memset(ctrl_, CTRL_EMPTY, size);
+        nbits_ = nbits;
+        size_ = size;
+        growth_left_ = max_growth(size);
+    }
+
+    void deallocate(unsigned char *ctrl, value_type *slots, size_type size) {
+        if (size) {
+            ctrl_traits::deallocate(ctrl_alloc_, ctrl, size);
+            slot_traits::deallocate(slot_alloc_, slots, size);
+        }
+    }
+
+    void destroy_all() {
+        destroy_all(ctrl_, slots_, size_);
+    }
+
+    void destroy_all(const unsigned char *ctrl, value_type *slots, size_type size) {
+        if (std::is_trivially_destructible<value_type>::value) {
+            return;
+        }
+        for (size_type n = 0; n < size; n++) {
+            if (!(ctrl[n] & 0x80)) {
+                slot_traits::destroy(slot_alloc_, slots + n);
+            }
+        }
+    }
+
+    /**
+     * Elements are moved to a new table if that cannot throw (or they
+     * cannot be copied), and copied otherwise, as std::vector does.
+     */
+    typedef std::integral_constant<bool,
+            std::is_nothrow_move_constructible<K>::value &&
+            std::is_nothrow_move_constructible<V>::value> nothrow_move;
+    typedef std::integral_constant<bool, nothrow_move::value ||
+            !(std::is_copy_constructible<K>::value &&
+              std::is_copy_constructible<V>::value)> relocate_moves;
+    typedef std::integral_constant<bool,
+            noexcept(std::declval<const Hash &>()(std::declval<const K &>()))> nothrow_hash;
+
+    /** The key is moved too: the old element is destroyed once the rebuild
+     * is done, so nothing can observe its const key being modified */
+    void relocate(value_type *dst, value_type &v, std::true_type) {
+        slot_traits::construct(slot_alloc_, dst,
+                               std::move(const_cast<key_type &>(v.first)),
+                               std::move(v.second));
+    }
+
+    void relocate(value_type *dst, value_type &v, std::false_type) {
+        slot_traits::construct(slot_alloc_, dst, v);
+    }
+
+    /**
+     * Undo a failed rebuild which moved the first `n` live elements of the
+     * old table to the slots listed in `moved`. An element whose move back
+     * throws as well is dropped, leaving the old table consistent.
+     */
+    void move_back(unsigned char *octrl, value_type *oslots,
+                   const size_type *moved, size_type n) {
+        for (size_type i = 0, k = 0; k < n; i++) {
+            if (octrl[i] & 0x80) {
+                continue;
+            }
+            value_type &v = slots_[moved[k++]];
+            slot_traits::destroy(slot_alloc_, oslots + i);
+            try {
+                relocate(oslots + i, v, std::true_type());
+            } catch (...) {
+                octrl[i] = CTRL_DELETED;
+                count_--;
+            }
+        }
+    }
+
+    /**
+     * Move or copy every element into a new table of 2^nbits slots. The old
+     * elements are only destroyed once all of them have been placed, so if
+     * an element or the hash function throws, the new table is discarded
+     * and the map is left as it was.
+     *
+     * Elements which are moved could not be restored if hashing one of
+     * them threw halfway, so unless neither can throw, every key is hashed
+     * before anything moves and each hash is then replaced by where its
+     * element went, for move_back().
+     */
+    void rebuild(size_type nbits) {
+        unsigned char *octrl = ctrl_;
+        value_type *oslots = slots_;
+        size_type osize = size_, onbits = nbits_, ogrowth = growth_left_;
+        bool undo = relocate_moves::value &&
+                !(nothrow_move::value && nothrow_hash::value);
+        std::vector<size_type, index_alloc_type> moved((index_alloc_type(slot_alloc_)));
+        size_type nmoved = 0;
+
+        if (undo) {
+            moved.reserve(count_);
+            for (size_type n = 0; n < osize; n++) {
+                if (!(octrl[n] & 0x80)) {
+                    moved.push_back(hash_of(oslots[n].first));
+                }
+            }
+        }
+        allocate(nbits);
+        try {
+            for (size_type n = 0; n < osize; n++) {
+                if (octrl[n] & 0x80) {
+                    continue;
+                }
+                value_type &v = oslots[n];
+                size_type hv = undo ? moved[nmoved] : hash_of(v.first);
+                size_type dst = free_slot(hv);
+                relocate(slots_ + dst, v, relocate_moves());
+                ctrl_[dst] = ctrl_of(hv);
+                if (undo) {
+                    moved[nmoved++] = dst;
+                }
+            }
+        } catch (...) {
+            if (undo) {
+                move_back(octrl, oslots, moved.data(), nmoved);
+            }
+            destroy_all();
+            deallocate(ctrl_, slots_, size_);
+            ctrl_ = octrl;
+            slots_ = oslots;
+            size_ = osize;
+            nbits_ = onbits;
+            growth_left_ = ogrowth;
+            throw;
+        }
+        growth_left_ -= count_;
+        destroy_all(octrl, oslots, osize);
+        deallocate(octrl, oslots, osize);
+    }
+
+    hasher hash_;
+    key_equal eq_;
+    slot_alloc_type slot_alloc_;
+    ctrl_alloc_type ctrl_alloc_;
+    /** One control byte per slot: EMPTY, DELETED or the low 7 hash bits */
+    unsigned char *ctrl_;
+    value_type *slots_;
+    /** log2 of size_, or 0 before anything is allocated */
+    size_type nbits_;
+    size_type size_;
+    size_type count_;
+    /** EMPTY slots which may still be filled before the table is rebuilt */
+    size_type growth_left_;
+};
+
+} // namespace tl
+
+#endif
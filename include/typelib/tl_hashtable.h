@@ -7,6 +7,8 @@
 #ifndef GENHASH_H
 #define GENHASH_H 1
 #include <stddef.h>
+#include <stdint.h>
+#include "tl_bloom.h"
 
 /*! \mainpage genhash
  *
@@ -34,11 +36,14 @@
  */
 struct tl_HASHOPS {
     /**
-     * Function to compute a hash for the given value.
+     * Function to compute a hash for the given value. Not used (and may be
+     * NULL) if hashfunc64 is set.
      */
     int (*hashfunc)(const void *, size_t);
     /**
-     * Function that returns true if the given keys are equal.
+     * Function that returns true if the given keys are equal. Entries keep
+     * the hash of their key, so this is only called for entries whose hash
+     * matches the key being looked up.
      */
     int (*hasheq)(const void *, size_t, const void *, size_t);
     /**
@@ -57,6 +62,12 @@ struct tl_HASHOPS {
      * Function to free a value.
      */
     void (*free_value)(void *);
+    /**
+     * Function to compute a 64 bit hash for the given value, using the
+     * table's seed (see tl_HASHCONF::seed). tl_hash64() and tl_hash_fast64()
+     * are suitable. If set, this is used instead of hashfunc.
+     */
+    uint64_t (*hashfunc64)(const void *, size_t, uint64_t seed);
 };
 
 /**
@@ -73,6 +84,155 @@ enum tl_UPDATETYPE {
     ALLOC_FAILURE
 };
 
+/**
+ * Storage engines for a hash table
+ */
+enum tl_HTENGINE {
+    /** Buckets of linked entries. Each entry is allocated separately */
+    TL_HT_ENGINE_CHAINED = 0,
+    /**
+     * Open addressing. Entries are stored in a flat array of slots, each
+     * having a control byte holding 7 bits of the entry's hash. Control
+     * bytes are matched 16 at a time, so a lookup usually touches a single
+     * control group and the slot holding the entry.
+     */
+    TL_HT_ENGINE_OPEN,
+    /**
+     * Entries are appended to a dense array, in insertion order, and found
+     * through an index holding 1, 2, 4 or 8 byte entry numbers (as the
+     * table's size requires) probed linearly. tl_ht_iter() sweeps the array,
+     * visiting entries in insertion order, and small tables take little
+     * more than their entries' own memory.
+     *
+     * Deleted entries are reclaimed when the table is rebuilt, which happens
+     * in a single step rather than incrementally: the live entries are moved
+     * to a new array, in order, and the index is rebuilt from their stored
+     * hashes.
+     */
+    TL_HT_ENGINE_COMPACT
+};
+
+/**
+ * Never resize the table; its bucket count is fixed by `est`. The chained
+ * engine accepts any number of entries, but the open and compact engines
+ * hold at most max_load percent of the bucket count (which is at least
+ * `est` entries): once that many are live, storing another fails as if
+ * memory could not be allocated, until one is deleted.
+ */
+#define TL_HT_F_FIXED 0x01
+
+/** Shrink the table when its load drops below tl_HASHCONF::min_load */
+#define TL_HT_F_SHRINK 0x02
+
+/** Seed tl_HASHOPS::hashfunc64 with tl_HASHCONF::seed rather than a random
+ * value */
+#define TL_HT_F_SEED 0x04
+
+/**
+ * Lookups (tl_ht_find(), tl_ht_find_batch(), tl_ht_iterkey() and
+ * tl_ht_sizekey()) never modify the table, so several threads may perform
+ * them at once as long as no other call runs concurrently. A resize then
+ * only advances on stores and deletes.
+ */
+#define TL_HT_F_CONST_FIND 0x08
+
+/**
+ * Multimap: each key has a single entry, and every value stored for it is
+ * kept in a vector hanging off that entry. Storing a key which is present
+ * appends to its vector (at the cost of a lookup), tl_ht_find(),
+ * tl_ht_update(), tl_ht_funupdate() and tl_ht_upsert() act on its newest
+ * value and tl_ht_del() removes that value; the entry goes once its last
+ * value has been deleted.
+ *
+ * tl_ht_delall(), tl_ht_sizekey() and tl_ht_iterkey() then cost a single
+ * lookup however many values a key has (newest values are visited first),
+ * and keys with many values do not lengthen the probes for other keys.
+ * The table's load counts keys rather than values.
+ *
+ * Values cannot be stored inline: tl_HASHCONF::inline_value must be 0.
+ */
+#define TL_HT_F_MULTI 0x10
+
+/**
+ * Keep a Bloom filter (see tl_bloom.h) of the keys in front of the table, so
+ * that most lookups of absent keys return without touching a bucket. This
+ * pays off for tables much larger than the cache which are mostly probed for
+ * keys they don't hold; each store also sets the key's bits, and the filter
+ * takes about 10 bits per key at the default rate of 1%
+ * (tl_HASHCONF::filter_fpr).
+ *
+ * Keys cannot be removed from a Bloom filter. Instead, a new filter is
+ * built as entries migrate whenever the table resizes, and the table is
+ * rehashed at its current size once many keys have been deleted since the
+ * filter was built. See tl_ht_filterstats().
+ */
+#define TL_HT_F_FILTER 0x20
+
+/**
+ * Count lookups and the probes they make, for tl_ht_stats(). Every lookup
+ * by key counts, including those made by deletes and updates (plain stores
+ * make none, unless the table is a multimap). This adds a few increments to
+ * each lookup, and cannot be combined with TL_HT_F_CONST_FIND since lookups
+ * then write to the table.
+ */
+#define TL_HT_F_STATS 0x40
+
+/**
+ * Optional table settings. A zeroed structure selects the defaults.
+ *
+ * Tables grow (and optionally shrink) by doubling (halving) their bucket
+ * count. Resizing is incremental: entries are moved to the new buckets a few
+ * at a time by each subsequent store, lookup or delete, so no single
+ * operation pays for rehashing the whole table (except with
+ * TL_HT_ENGINE_COMPACT, which keeps its entries in insertion order).
+ */
+struct tl_HASHCONF {
+    /** Combination of TL_HT_F_* flags */
+    unsigned flags;
+    /**
+     * Load (entries per 100 buckets) above which the table grows.
+     * Defaults to 100, or 87 for TL_HT_ENGINE_OPEN and 66 for
+     * TL_HT_ENGINE_COMPACT, where it must be below 100
+     */
+    unsigned max_load;
+    /**
+     * Load below which the table shrinks, if TL_HT_F_SHRINK is set. Must be
+     * less than half of max_load. Defaults to 10
+     */
+    unsigned min_load;
+    /** One of tl_HTENGINE. Defaults to TL_HT_ENGINE_CHAINED */
+    int engine;
+    /**
+     * Keys of up to this many bytes are copied into the entry itself rather
+     * than being passed to tl_HASHOPS::dup_key. Defaults to 0
+     */
+    unsigned inline_key;
+    /**
+     * Values of up to this many bytes (rounded up to a multiple of 8) are
+     * copied into the entry itself rather than being passed to
+     * tl_HASHOPS::dup_value. Defaults to 0.
+     *
+     * Pointers to inline values (as returned by tl_ht_find()) remain valid
+     * until the entry is deleted with chained tables; open addressed and
+     * compact tables move entries when they resize, so such pointers are
+     * only valid until the next store, update, find or delete.
+     */
+    unsigned inline_value;
+    /**
+     * Seed passed to tl_HASHOPS::hashfunc64, if TL_HT_F_SEED is set.
+     * Otherwise each table uses a seed from tl_hash_randseed(), so the
+     * bucket (and iteration) order of keys cannot be predicted and the table
+     * cannot be flooded with colliding keys.
+     */
+    uint64_t seed;
+    /**
+     * False positive rate of the filter kept with TL_HT_F_FILTER: the
+     * fraction of lookups of absent keys which still search the table.
+     * Defaults to 0.01
+     */
+    double filter_fpr;
+};
+
 /**
  * Create a new generic hashtable.
  *
@@ -84,9 +244,58 @@ enum tl_UPDATETYPE {
 tl_pHASHTABLE
 tl_ht_new(size_t est, struct tl_HASHOPS ops);
 
+/**
+ * Create a new generic hashtable with non-default settings.
+ *
+ * @param est the estimated number of items to store (must be > 0). The table
+ *        will not shrink below the size required for this many items
+ * @param ops the key and value operations
+ * @param conf settings for the table, may be NULL
+ *
+ * @return the new tl_HASHTABLE or NULL if one cannot be created or `conf`
+ *         is invalid
+ */
+tl_pHASHTABLE
+tl_ht_new_ex(size_t est, struct tl_HASHOPS ops, const struct tl_HASHCONF *conf);
+
+/**
+ * Create a table holding a set of items, using several threads. The result
+ * is the same as storing each item with tl_ht_store(), in order, into a
+ * table created for `n` items; with TL_HT_F_MULTI the items are stored
+ * that way, on the calling thread.
+ *
+ * Items are partitioned by hash, and each thread fills the buckets (or
+ * slots) of its partitions, in storage allocated up front. The hash
+ * function, tl_HASHOPS::dup_key and tl_HASHOPS::dup_value are called from
+ * all threads at once.
+ *
+ * @param ops the key and value operations
+ * @param conf settings for the table, may be NULL
+ * @param keys the keys
+ * @param klens the lengths of the keys
+ * @param values the values
+ * @param vlens the lengths of the values
+ * @param n the number of items
+ * @param nthreads the number of threads to use, including the calling one.
+ *        0 is the same as 1
+ *
+ * @return the new tl_HASHTABLE or NULL if one cannot be created or `conf`
+ *         is invalid
+ */
+tl_pHASHTABLE
+tl_ht_new_bulk(struct tl_HASHOPS ops, const struct tl_HASHCONF *conf,
+               const void * const *keys, const size_t *klens,
+               const void * const *values, const size_t *vlens,
+               size_t n, unsigned nthreads);
+
 tl_pHASHTABLE
 tl_ht_stringnc_new(size_t est);
 
+/**
+ * Create a table whose keys are integers passed as the key length (with any
+ * key pointer). Each probe compares lengths through tl_HASHOPS; prefer the
+ * maps in tl_imap.h, which store integer keys and their values inline.
+ */
 tl_pHASHTABLE
 tl_ht_szt_new(size_t est);
 
@@ -141,6 +350,74 @@ tl_ht_del(tl_HASHTABLE *h, const void *k, size_t klen);
 int
 tl_ht_delall(tl_HASHTABLE *h, const void *k, size_t klen);
 
+/**
+ * Like tl_ht_find(), also returning the size of the value.
+ *
+ * @param h the genhash
+ * @param k the key
+ * @param klen the length of the key
+ * @param[out] nvalue receives the size of the value, if found
+ *
+ * @return the value, or NULL if one cannot be found
+ */
+void *
+tl_ht_findn(tl_HASHTABLE *h, const void *k, size_t klen, size_t *nvalue);
+
+/**
+ * Look up several keys at once.
+ *
+ * This is equivalent to calling tl_ht_find() for each key, but the keys are
+ * processed in small groups: all keys of a group are hashed and the memory
+ * holding their buckets, entries and stored keys is prefetched in stages
+ * before any of them is compared. Cache misses for different keys thus
+ * overlap rather than being taken one after the other, which pays off for
+ * tables much larger than the CPU cache.
+ *
+ * @param h the genhash
+ * @param keys the keys
+ * @param klens the lengths of the keys
+ * @param n the number of keys
+ * @param[out] values receives the value for each key, or NULL if not found
+ *
+ * @return the number of keys found
+ */
+int tl_ht_find_batch(tl_HASHTABLE *h, const void * const *keys,
+                     const size_t *klens, size_t n, void **values);
+
+/**
+ * Store several items at once. Equivalent to calling tl_ht_store() for each
+ * item, with the buckets prefetched as in tl_ht_find_batch().
+ *
+ * @param h the genhash
+ * @param keys the keys
+ * @param klens the lengths of the keys
+ * @param values the values
+ * @param vlens the lengths of the values
+ * @param n the number of items
+ *
+ * @return the number of items stored. This is less than `n` if an
+ *         allocation failed, in which case the remaining items were not
+ *         stored
+ */
+size_t tl_ht_store_batch(tl_HASHTABLE *h, const void * const *keys,
+                         const size_t *klens, const void * const *values,
+                         const size_t *vlens, size_t n);
+
+/**
+ * Delete the most recent value stored for several keys. Equivalent to
+ * calling tl_ht_del() for each key, with the memory prefetched as in
+ * tl_ht_find_batch().
+ *
+ * @param h the genhash
+ * @param keys the keys
+ * @param klens the lengths of the keys
+ * @param n the number of keys
+ *
+ * @return the number of items deleted
+ */
+int tl_ht_del_batch(tl_HASHTABLE *h, const void * const *keys,
+                    const size_t *klens, size_t n);
+
 /**
  * Create or update an item in-place.
  *
@@ -174,6 +451,34 @@ tl_ht_funupdate(tl_HASHTABLE *h,
                 void * (*upd)(const void *k, const void *oldv, size_t *ns, void *a),
                 void (*fr)(void *), void *arg, const void *def, size_t deflen);
 
+/**
+ * Find the value of a key, creating the key if it is missing, and return
+ * the location of the value so it can be read or changed in place. The key
+ * is hashed once and no value is copied.
+ *
+ * A new key's value is the entry's inline value area, zero filled, if
+ * tl_HASHCONF::inline_value is set (e.g. a counter can be incremented with
+ * `++*(uint64_t *)*slot`), and NULL otherwise. Its length (as reported by
+ * tl_ht_findn()) is tl_HASHCONF::inline_value, or 0.
+ *
+ * The caller may store any pointer in the returned location; it is passed
+ * to tl_HASHOPS::free_value (which must accept NULL) when the item is
+ * deleted, unless it still points to the inline area. The length is not
+ * changed by doing so.
+ *
+ * The location is valid until the next call on the table.
+ *
+ * @param h the table
+ * @param k the key
+ * @param klen the length of the key
+ * @param created set to 1 if the key was created, 0 if it existed. May be
+ *        NULL
+ *
+ * @return the location of the value, or NULL if the key was missing and
+ *         could not be created
+ */
+void **tl_ht_upsert(tl_HASHTABLE *h, const void *k, size_t klen, int *created);
+
 typedef void (*tl_HASHITER_cb)(const void *k, size_t nk, const void *v, size_t nv,
         void *arg);
 
@@ -186,6 +491,31 @@ typedef void (*tl_HASHITER_cb)(const void *k, size_t nk, const void *v, size_t n
  */
 void tl_ht_iter(tl_HASHTABLE *h, tl_HASHITER_cb iterfunc, void *arg);
 
+/**
+ * Iterate a hash table a piece at a time.
+ *
+ * Start with a cursor of 0 and pass the returned cursor to the next call,
+ * until 0 is returned. The table may be modified (and resized) between
+ * calls, but not by the callback. Every item which is in the table for the
+ * whole scan is visited at least once; items stored or deleted during the
+ * scan may or may not be visited, and items may be visited more than once
+ * if the table shrinks.
+ *
+ * Each call stops once it has visited `max_items` items, finishing the
+ * bucket it is in (so slightly more items may be visited), or after
+ * looking at 10 times `max_items` buckets.
+ *
+ * @param h the genhash
+ * @param cursor 0, or the value returned by the previous call
+ * @param max_items the number of items to visit before returning
+ * @param iterfunc a function that will be called once for every k/v pair
+ * @param arg an argument to be passed to the iterfunc on each iteration
+ *
+ * @return the cursor to continue from, or 0 if the scan is complete
+ */
+size_t tl_ht_scan(tl_HASHTABLE *h, size_t cursor, size_t max_items,
+                  tl_HASHITER_cb iterfunc, void *arg);
+
 /**
  * Iterate all values for a given key in a hash table.
  *
@@ -198,7 +528,9 @@ void tl_ht_iterkey(tl_HASHTABLE *h, const void *key, size_t nkey,
                    tl_HASHITER_cb iterfunc, void *arg);
 
 /**
- * Get the total number of entries in this hash table.
+ * Get the total number of entries in this hash table (of values, for a
+ * multimap). The count is maintained as items are added and removed, so
+ * this takes constant time.
  *
  * @param h the genhash
  *
@@ -207,7 +539,10 @@ void tl_ht_iterkey(tl_HASHTABLE *h, const void *key, size_t nkey,
 int tl_ht_size(tl_HASHTABLE *h);
 
 /**
- * Remove all items from a genhash.
+ * Remove all items from a genhash. The table keeps its current size.
+ *
+ * Entry storage is released in bulk; entries are only visited individually
+ * if the table has free_key or free_value operations.
  *
  * @param h the genhash
  *
@@ -215,6 +550,129 @@ int tl_ht_size(tl_HASHTABLE *h);
  */
 int tl_ht_clear(tl_HASHTABLE *h);
 
+/**
+ * Entry storage statistics.
+ *
+ * Chained tables carve their entries from slabs owned by the table; deleted
+ * entries go onto a free list for reuse, and all slabs are released at once
+ * by tl_ht_clear() and tl_ht_free(). Open addressed tables store entries in
+ * their slot arrays, each of which is reported as one block.
+ */
+struct tl_HTALLOCSTATS {
+    /** Number of slabs (or slot arrays) */
+    size_t nblocks;
+    /** Number of bytes they occupy */
+    size_t bytes;
+    /** Number of entries they can hold */
+    size_t capacity;
+    /** Number of entries holding items */
+    size_t nused;
+    /** Number of deleted entries on the free list */
+    size_t nfree;
+    /** Number of entries in the newest slab never handed out */
+    size_t nunused;
+};
+
+/**
+ * Get entry storage statistics.
+ *
+ * @param h the genhash
+ * @param[out] stats the statistics
+ */
+void tl_ht_allocstats(tl_HASHTABLE *h, struct tl_HTALLOCSTATS *stats);
+
+/** Statistics of the filter kept with TL_HT_F_FILTER */
+struct tl_HTFILTERSTATS {
+    /** Number of bytes taken by the filter (both filters during a resize) */
+    size_t bytes;
+    /** Number of keys the current filter is sized for */
+    size_t capacity;
+    /** Number of keys added to the current filter */
+    size_t nkeys;
+    /** Number of keys deleted since the current filter was built */
+    size_t nstale;
+    /** Bits per key and bits set per key, as chosen for `target_fpr` */
+    double bits_per_key;
+    unsigned k;
+    /** The configured false positive rate */
+    double target_fpr;
+    /** The expected false positive rate with `nkeys` keys */
+    double fpr;
+};
+
+/**
+ * Get filter statistics.
+ *
+ * @param h the genhash
+ * @param[out] stats the statistics
+ * @return 0, or -1 if the table has no filter
+ */
+int tl_ht_filterstats(tl_HASHTABLE *h, struct tl_HTFILTERSTATS *stats);
+
+/** Number of lengths tracked by tl_HTSTATS::hist */
+#define TL_HT_STATS_NHIST 32
+
+/**
+ * Table health statistics, from tl_ht_stats().
+ *
+ * A probe is a step of a lookup: one entry of a chain (chained engine), one
+ * group of 16 slots (open addressing) or one index slot (compact). Probe
+ * lengths are measured on a sample of the buckets (or slots), so they
+ * describe the table as a whole without visiting all of it; long probes on
+ * a healthy table point at a weak hash function or an undersized `est`.
+ */
+struct tl_HTSTATS {
+    /** Number of keys */
+    size_t nitems;
+    /** Number of buckets (or slots), in both tables during a resize */
+    size_t nbuckets;
+    /** nitems / nbuckets */
+    double load;
+    /** Number of buckets (or slots) sampled */
+    size_t nsampled;
+    /** Fraction of the sampled buckets (or slots) holding an entry */
+    double occupancy;
+    /**
+     * Probe lengths within the sample: for the chained engine, number of
+     * non-empty buckets holding `i` entries; otherwise, number of entries
+     * found `i` probes into their probe sequence. The last element counts
+     * all lengths from TL_HT_STATS_NHIST - 1 on
+     */
+    size_t hist[TL_HT_STATS_NHIST];
+    /** Longest and 99th percentile of the lengths in `hist` */
+    size_t max_probe;
+    size_t p99_probe;
+    /** Number of bytes taken by the buckets, entries and filter. This
+     * excludes keys and values not stored inline, and multimap values */
+    size_t bytes;
+    /** Nonzero while a resize is in progress */
+    int resizing;
+    /**
+     * Lookups which found their key, lookups which did not, and the probes
+     * they made, counted since the table was created if it has
+     * TL_HT_F_STATS (0 otherwise). Lookups rejected by the filter make no
+     * probes.
+     */
+    size_t nhits;
+    size_t nmisses;
+    size_t hit_probes;
+    size_t miss_probes;
+    /** Average probes per hit and per miss (0 if there were none) */
+    double probes_per_hit;
+    double probes_per_miss;
+};
+
+/**
+ * Get table health statistics. Their cost is proportional to `nsample`
+ * rather than to the table's size, so they may be polled frequently.
+ *
+ * @param h the genhash
+ * @param[out] stats the statistics
+ * @param nsample the number of buckets (or slots) to sample, evenly spread
+ *        over the table; 0 samples every one of them
+ */
+void tl_ht_stats(tl_HASHTABLE *h, struct tl_HTSTATS *stats, size_t nsample);
+
 /**
  * Get the total number of entries in this hash table that map to the given
  * key.
@@ -227,11 +685,83 @@ int tl_ht_clear(tl_HASHTABLE *h);
 int tl_ht_sizekey(tl_HASHTABLE *h, const void *k, size_t nkey);
 
 /**
- * Convenient hash function for strings.
+ * Compute the hash of a key, for use with the `_hashed` functions below.
+ *
+ * This calls tl_HASHOPS::hashfunc64 with the table's seed, or
+ * tl_HASHOPS::hashfunc. The result may be passed to any table using the same
+ * hash function and seed (for hashfunc64, create the tables with
+ * TL_HT_F_SEED and the same tl_HASHCONF::seed), so a key looked up in
+ * several tables only needs hashing once.
+ *
+ * @param h the genhash
+ * @param k the key
+ * @param klen the length of the key
+ *
+ * @return the hash
+ */
+uint64_t tl_ht_hash(tl_HASHTABLE *h, const void *k, size_t klen);
+
+/**
+ * @name Pre-hashed variants
  *
- * @param k a null-terminated string key.
+ * These behave like the functions of the same name without the `_hashed`
+ * suffix, but take the key's hash as computed by tl_ht_hash() instead of
+ * computing it. Passing a hash which does not match the key is undefined.
+ * @{
+ */
+int tl_ht_store_hashed(tl_HASHTABLE *h, uint64_t hash,
+                       const void *k, size_t klen, const void *v, size_t vlen);
+
+void *tl_ht_find_hashed(tl_HASHTABLE *h, uint64_t hash,
+                        const void *k, size_t klen);
+
+void *tl_ht_findn_hashed(tl_HASHTABLE *h, uint64_t hash,
+                         const void *k, size_t klen, size_t *nvalue);
+
+int tl_ht_del_hashed(tl_HASHTABLE *h, uint64_t hash,
+                     const void *k, size_t klen);
+
+int tl_ht_delall_hashed(tl_HASHTABLE *h, uint64_t hash,
+                        const void *k, size_t klen);
+
+enum tl_UPDATETYPE tl_ht_update_hashed(tl_HASHTABLE *h, uint64_t hash,
+                                       const void *k, size_t klen,
+                                       const void *v, size_t vlen);
+
+enum tl_UPDATETYPE
+tl_ht_funupdate_hashed(tl_HASHTABLE *h, uint64_t hash,
+                       const void *key, size_t klen,
+                       void * (*upd)(const void *k, const void *oldv, size_t *ns, void *a),
+                       void (*fr)(void *), void *arg, const void *def, size_t deflen);
+
+void **tl_ht_upsert_hashed(tl_HASHTABLE *h, uint64_t hash,
+                           const void *k, size_t klen, int *created);
+
+void tl_ht_iterkey_hashed(tl_HASHTABLE *h, uint64_t hash,
+                          const void *key, size_t klen,
+                          tl_HASHITER_cb iterfunc, void *arg);
+/** @} */
+
+/**
+ * Like tl_ht_upsert_hashed(), also setting `*stored` to the table's own copy
+ * of the key: the inline copy, the result of tl_HASHOPS::dup_key, or `k`
+ * itself if keys are not copied. With chained tables this remains valid
+ * until the key is deleted, so it may be kept (e.g. inside the value) and
+ * passed back later to find or delete the key.
+ */
+void **tl_ht_upsert_key_hashed(tl_HASHTABLE *h, uint64_t hash,
+                               const void *k, size_t klen,
+                               const void **stored, int *created);
+
+/**
+ * Convenient hash function for strings, using tl_hash64() with a seed of 0.
+ * Prefer using tl_hash64() or tl_hash_fast64() as tl_HASHOPS::hashfunc64,
+ * which keeps all 64 bits and lets each table have its own seed.
+ *
+ * @param k the key
+ * @param nkey the length of the key
  *
- * @return a hash value for this string.
+ * @return a hash value for this key.
  */
 int tl_ht_strhash(const void *k, size_t nkey);
 
@@ -0,0 +1,329 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2014 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#ifndef TL_IMAP_H
+#define TL_IMAP_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @file
+ * Maps with integer keys, generated for a key and value type by
+ * TL_IMAP_INIT(). Maps from uint32_t and uint64_t keys to pointers are
+ * predefined as tl_IMAP_u32 and tl_IMAP_u64.
+ *
+ * Entries (a key and its value) are stored in one flat array and found by
+ * linear probing from the slot given by a multiplicative hash of the key, so
+ * a lookup usually reads a single cache line and involves no function
+ * pointers. A zero key marks an empty slot; the value for key 0 is kept
+ * outside the array. Deleting shifts the following entries of the probe
+ * sequence back instead of leaving tombstones.
+ *
+ * All functions are static and inline. Pointers to values are valid until
+ * the next insertion or deletion.
+ *
+ * For a map type `tl_IMAP_name` the following are generated:
+ *
+ * - `void tl_imap_name_init(tl_IMAP_name *m)`
+ *    Initialize an empty map. Nothing is allocated until the first store.
+ * - `void tl_imap_name_cleanup(tl_IMAP_name *m)`
+ *    Free the map's memory
+ * - `vtype *tl_imap_name_find(const tl_IMAP_name *m, ktype key)`
+ *    Return the key's value, or NULL if the key is not present
+ * - `vtype *tl_imap_name_put(tl_IMAP_name *m, ktype key, int *created)`
+ *    Return the key's value, inserting the key with a zeroed value if it is
+ *    not present (in which case `*created` is set to 1, otherwise to 0;
+ *    `created` may be NULL). Returns NULL if memory cannot be allocated
+ * - `int tl_imap_name_store(tl_IMAP_name *m, ktype key, vtype value)`
+ *    Set the key's value. Returns 0, or -1 if memory cannot be allocated
+ * - `int tl_imap_name_del(tl_IMAP_name *m, ktype key)`
+ *    Remove the key. Returns 1 if it was present, 0 otherwise
+ * - `int tl_imap_name_reserve(tl_IMAP_name *m, size_t n)`
+ *    Make room for `n` keys. Returns 0, or -1 if memory cannot be allocated
+ * - `void tl_imap_name_clear(tl_IMAP_name *m)`
+ *    Remove all keys, keeping the memory allocated
+ * - `size_t tl_imap_name_size(const tl_IMAP_name *m)`
+ *    Number of keys
+ * - `int tl_imap_name_next(const tl_IMAP_name *m, size_t *pos, ktype *key,
+ *                          vtype **value)`
+ *    Iterate: start with `*pos` set to 0 and call until it returns 0. Each
+ *    call which returns 1 sets `*key` and `*value` to the next entry. The
+ *    map must not be modified during the iteration.
+ */
+
+#ifndef TL_INLINE
+#ifdef _MSC_VER
+#define TL_INLINE __inline
+#elif __GNUC__
+#define TL_INLINE __inline__
+#else
+#define TL_INLINE inline
+#endif
+#endif
+
+/* Tables have at least this many slots, and grow by doubling once more than
+ * TL_IMAP_MAX_LOAD percent of them are in use */
+#define TL_IMAP_MIN_BITS 3
+#define TL_IMAP_MAX_LOAD 75
+
+/**
+ * Slot for a 32 bit key in a table of 2^bits slots. Multiplying by 2^32
+ * divided by the golden ratio carries every bit of the key into the high
+ * bits of the product, which are used as the index; XORing in the high half
+ * first keeps keys which only differ in their high bits apart.
+ */
+static TL_INLINE size_t tl_imap_hash32(uint32_t key, unsigned bits)
+{
+    key ^= key >> 16;
+    return (size_t)((uint32_t)(key * 0x9E3779B9UL) >> (32 - bits));
+}
+
+/** Slot for a 64 bit key, see tl_imap_hash32() */
+static TL_INLINE size_t tl_imap_hash64(uint64_t key, unsigned bits)
+{
+    key ^= key >> 32;
+    return (size_t)((key * 0x9E3779B97F4A7C15ULL) >> (64 - bits));
+}
+
+/**
+ * Generate a map type tl_IMAP_name with keys of the integer type `ktype`
+ * and values of type `vtype`. `hashfn(key, bits)` returns the home slot of
+ * `key` in a table of 2^bits slots: tl_imap_hash32 or tl_imap_hash64.
+ */
+#define TL_IMAP_INIT(name, ktype, vtype, hashfn) \
+    typedef struct { \
+        ktype key; \
+        vtype value; \
+    } tl_IMAP_##name##_ENTRY; \
+    \
+    typedef struct { \
+        tl_IMAP_##name##_ENTRY *entries; \
+        /** Number of slots, 0 or a power of two */ \
+        size_t size; \
+        unsigned bits; \
+        /** Number of entries in `entries` (i.e. excluding key 0) */ \
+        size_t count; \
+        int has_zero; \
+        vtype zero_value; \
+    } tl_IMAP_##name; \
+    \
+    static TL_INLINE void \
+    tl_imap_##name##_init(tl_IMAP_##name *m) \
+    { \
+        memset(m, 0, sizeof(*m)); \
+    } \
+    \
+    static TL_INLINE void \
+    tl_imap_##name##_cleanup(tl_IMAP_##name *m) \
+    { \
+        free(m->entries); \
+        memset(m, 0, sizeof(*m)); \
+    } \
+    \
+    static TL_INLINE size_t \
+    tl_imap_##name##_size(const tl_IMAP_##name *m) \
+    { \
+        return m->count + (m->has_zero ? 1 : 0); \
+    } \
+    \
+    static TL_INLINE vtype * \
+    tl_imap_##name##_find(const tl_IMAP_##name *m, ktype key) \
+    { \
+        size_t i, mask = m->size - 1; \
+        if (key == 0) { \
+            return m->has_zero ? (vtype *)&m->zero_value : NULL; \
+        } \
+        if (m->count == 0) { \
+            return NULL; \
+        } \
+        for (i = hashfn(key, m->bits);; i = (i + 1) & mask) { \
+            tl_IMAP_##name##_ENTRY *e = m->entries + i; \
+            if (e->key == key) { \
+                return &e->value; \
+            } \
+            if (e->key == 0) { \
+                return NULL; \
+            } \
+        } \
+    } \
+    \
+    /* Move every entry into a new array of 2^bits slots */ \
+    static TL_INLINE int \
+    tl_imap_##name##_rehash(tl_IMAP_##name *m, unsigned bits) \
+    { \
+        size_t size = (size_t)1 << bits, mask = size - 1, i, j; \
+        tl_IMAP_##name##_ENTRY *entries; \
+        entries = (tl_IMAP_##name##_ENTRY *)calloc(size, sizeof(*entries)); \
+        if (entries == NULL) { \
+            return -1; \
+        } \
+        for (i = 0; i < m->size; i++) { \
+            if (m->entries[i].key == 0) { \
+                continue; \
+            } \
+            for (j = hashfn(m->entries[i].key, bits); entries[j].key; j = (j + 1) & mask) { \
+            } \
+            entries[j] = m->entries[i]; \
+        } \
+        free(m->entries); \
+        m->entries = entries; \
+        m->size = size; \
+        m->bits = bits; \
+        return 0; \
+    } \
+    \
+    static TL_INLINE int \
+    tl_imap_##name##_reserve(tl_IMAP_##name *m, size_t n) \
+    { \
+        unsigned bits = m->bits > TL_IMAP_MIN_BITS ? m->bits : TL_IMAP_MIN_BITS; \
+        while (n * 100 > ((size_t)1 << bits) * TL_IMAP_MAX_LOAD) { \
+            bits++; \
+        } \
+        if (m->size && bits == m->bits) { \
+            return 0; \
+        } \
+        return tl_imap_##name##_rehash(m, bits); \
+    } \
+    \
+    static TL_INLINE vtype * \
+    tl_imap_##name##_put(tl_IMAP_##name *m, ktype key, int *created) \
+    { \
+        size_t i, mask; \
+        tl_IMAP_##name##_ENTRY *e; \
+        int dummy; \
+        if (created == NULL) { \
+            created = &dummy; \
+        } \
+        *created = 0; \
+        if (key == 0) { \
+            if (!m->has_zero) { \
+                memset(&m->zero_value, 0, sizeof(m->zero_value)); \
+                m->has_zero = 1; \
+                *created = 1; \
+            } \
+            return &m->zero_value; \
+        } \
+        if ((m->count + 1) * 100 > m->size * TL_IMAP_MAX_LOAD) { \
+            vtype *existing = tl_imap_##name##_find(m, key); \
+            if (existing != NULL) { \
+                return existing; \
+            } \
+            if (tl_imap_##name##_rehash(m, m->size ? m->bits + 1 : TL_IMAP_MIN_BITS) != 0) { \
+                return NULL; \
+            } \
+        } \
+        mask = m->size - 1; \
+        for (i = hashfn(key, m->bits);; i = (i + 1) & mask) { \
+            e = m->entries + i; \
+            if (e->key == key) { \
+                return &e->value; \
+            } \
+            if (e->key == 0) { \
+                break; \
+            } \
+        } \
+        e->key = key; \
+        memset(&e->value, 0, sizeof(e->value)); \
+        m->count++; \
+        *created = 1; \
+        return &e->value; \
+    } \
+    \
+    static TL_INLINE int \
+    tl_imap_##name##_store(tl_IMAP_##name *m, ktype key, vtype value) \
+    { \
+        vtype *slot = tl_imap_##name##_put(m, key, NULL); \
+        if (slot == NULL) { \
+            return -1; \
+        } \
+        *slot = value; \
+        return 0; \
+    } \
+    \
+    static TL_INLINE int \
+    tl_imap_##name##_del(tl_IMAP_##name *m, ktype key) \
+    { \
+        size_t i, j, home, mask = m->size - 1; \
+        if (key == 0) { \
+            int rv = m->has_zero; \
+            m->has_zero = 0; \
+            return rv; \
+        } \
+        if (m->count == 0) { \
+            return 0; \
+        } \
+        for (i = hashfn(key, m->bits); m->entries[i].key != key; i = (i + 1) & mask) { \
+            if (m->entries[i].key == 0) { \
+                return 0; \
+            } \
+        } \
+        /* Move back each following entry whose home slot is not between \
+         * the hole and its current slot, so it stays reachable */ \
+        for (j = (i + 1) & mask; m->entries[j].key != 0; j = (j + 1) & mask) { \
+            home = hashfn(m->entries[j].key, m->bits); \
+            if (((j - home) & mask) >= ((j - i) & mask)) { \
+                m->entries[i] = m->entries[j]; \
+                i = j; \
+            } \
+        } \
+        m->entries[i].key = 0; \
+        m->count--; \
+        return 1; \
+    } \
+    \
+    static TL_INLINE void \
+    tl_imap_##name##_clear(tl_IMAP_##name *m) \
+    { \
+        if (m->size) { \
+            memset(m->entries, 0, m->size * sizeof(*m->entries)); \
+        } \
+        m->count = 0; \
+        m->has_zero = 0; \
+    } \
+    \
+    static TL_INLINE int \
+    tl_imap_##name##_next(const tl_IMAP_##name *m, size_t *pos, ktype *key, \
+                          vtype **value) \
+    { \
+        /* Position 0 is key 0; position n > 0 is slot n - 1 */ \
+        if (*pos == 0) { \
+            (*pos)++; \
+            if (m->has_zero) { \
+                *key = 0; \
+                *value = (vtype *)&m->zero_value; \
+                return 1; \
+            } \
+        } \
+        for (; *pos <= m->size; (*pos)++) { \
+            tl_IMAP_##name##_ENTRY *e = m->entries + *pos - 1; \
+            if (e->key != 0) { \
+                (*pos)++; \
+                *key = e->key; \
+                *value = &e->value; \
+                return 1; \
+            } \
+        } \
+        return 0; \
+    }
+
+TL_IMAP_INIT(u32, uint32_t, void *, tl_imap_hash32)
+TL_IMAP_INIT(u64, uint64_t, void *, tl_imap_hash64)
+
+#endif
@@ -0,0 +1,326 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2014 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#ifndef TL_INT_MAP_HPP
+#define TL_INT_MAP_HPP 1
+
+/**
+ * @file
+ * tl::int_map, the C++ counterpart of the maps generated by TL_IMAP_INIT()
+ * (see tl_imap.h), for 32 and 64 bit integer keys and values of any type.
+ *
+ * The layout and algorithms are the same: entries are stored in one flat
+ * array and found by linear probing from a multiplicative hash of the key,
+ * a zero key marks an empty slot (the value of key 0 is kept aside), and
+ * deletion shifts entries back rather than leaving tombstones. Values are
+ * constructed only in occupied slots.
+ *
+ * Insertion and deletion may move other values, invalidating pointers and
+ * references to them.
+ *
+ * The header needs C++11.
+ */
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include "tl_imap.h"
+
+namespace tl {
+
+template <class K, class V>
+class int_map {
+    static_assert(std::is_integral<K>::value && (sizeof(K) == 4 || sizeof(K) == 8),
+                  "int_map keys must be 32 or 64 bit integers");
+
+public:
+    typedef K key_type;
+    typedef V mapped_type;
+    typedef size_t size_type;
+
+    int_map() : entries_(NULL), size_(0), bits_(0), count_(0), has_zero_(false) {}
+
+    explicit int_map(size_type n)
+            : entries_(NULL), size_(0), bits_(0), count_(0), has_zero_(false) {
+        reserve(n);
+    }
+
+    int_map(const int_map &other)
+            : entries_(NULL), size_(0), bits_(0), count_(0), has_zero_(false) {
+        reserve(other.size());
+        other.for_each([this](K k, const V &v) { try_emplace(k, v); });
+    }
+
+    int_map(int_map &&other)
+            : entries_(other.entries_), size_(other.size_), bits_(other.bits_),
+              count_(other.count_), has_zero_(other.has_zero_) {
+        if (has_zero_) {
+            new (zero_value()) V(std::move(*other.zero_value()));
+            other.zero_value()->~V();
+        }
+        other.entries_ = NULL;
+        other.size_ = other.count_ = 0;
+        other.bits_ = 0;
+        other.has_zero_ = false;
+    }
+
+    int_map &operator=(const int_map &other) {
+        if (this != &other) {
+            int_map tmp(other);
+            *this = std::move(tmp);
+        }
+        return *this;
+    }
+
+    int_map &operator=(int_map &&other) {
+        if (this != &other) {
+            clear();
+            std::free(entries_);
+            entries_ = other.entries_;
+            size_ = other.size_;
+            bits_ = other.bits_;
+            count_ = other.count_;
+            has_zero_ = other.has_zero_;
+            if (has_zero_) {
+                new (zero_value()) V(std::move(*other.zero_value()));
+                other.zero_value()->~V();
+            }
+            other.entries_ = NULL;
+            other.size_ = other.count_ = 0;
+            other.bits_ = 0;
+            other.has_zero_ = false;
+        }
+        return *this;
+    }
+
+    ~int_map() {
+        clear();
+        std::free(entries_);
+    }
+
+    size_type size() const { return count_ + (has_zero_ ? 1 : 0); }
+    bool empty() const { return size() == 0; }
+    /** Number of slots */
+    size_type bucket_count() const { return size_; }
+
+    /** @return the key's value, or NULL if the key is not present */
+    V *find(K key) {
+        if (key == 0) {
+            return has_zero_ ? zero_value() : NULL;
+        }
+        if (count_ == 0) {
+            return NULL;
+        }
+        for (size_type i = hash(key, bits_);; i = (i + 1) & (size_ - 1)) {
+            entry *e = entries_ + i;
+            if (e->key == key) {
+                return e->value();
+            }
+            if (e->key == 0) {
+                return NULL;
+            }
+        }
+    }
+
+    const V *find(K key) const {
+        return const_cast<int_map *>(this)->find(key);
+    }
+
+    bool contains(K key) const { return find(key) != NULL; }
+
+    /**
+     * Insert the key with a value constructed from `args` if it is not
+     * present; otherwise `args` are not used.
+     * @return the key's value, and whether it was inserted
+     */
+    template <class... Args>
+    std::pair<V *, bool> try_emplace(K key, Args &&... args) {
+        if (key == 0) {
+            if (has_zero_) {
+                return std::make_pair(zero_value(), false);
+            }
+            new (zero_value()) V(std::forward<Args>(args)...);
+            has_zero_ = true;
+            return std::make_pair(zero_value(), true);
+        }
+        if ((count_ + 1) * 100 > size_ * TL_IMAP_MAX_LOAD) {
+            V *existing = find(key);
+            if (existing != NULL) {
+                return std::make_pair(existing, false);
+            }
+            rehash(size_ ? bits_ + 1 : TL_IMAP_MIN_BITS);
+        }
+        entry *e;
+        for (size_type i = hash(key, bits_);; i = (i + 1) & (size_ - 1)) {
+            e = entries_ + i;
+            if (e->key == key) {
+                return std::make_pair(e->value(), false);
+            }
+            if (e->key == 0) {
+                break;
+            }
+        }
+        new (e->value()) V(std::forward<Args>(args)...);
+        e->key = key;
+        count_++;
+        return std::make_pair(e->value(), true);
+    }
+
+    V &operator[](K key) {
+        return *try_emplace(key).first;
+    }
+
+    /** @return true if the key was present */
+    bool erase(K key) {
+        if (key == 0) {
+            if (!has_zero_) {
+                return false;
+            }
+            zero_value()->~V();
+            has_zero_ = false;
+            return true;
+        }
+        if (count_ == 0) {
+            return false;
+        }
+        size_type mask = size_ - 1, i, j;
+        for (i = hash(key, bits_); entries_[i].key != key; i = (i + 1) & mask) {
+            if (entries_[i].key == 0) {
+                return false;
+            }
+        }
+        /* As in tl_imap_name_del() */
+        entries_[i].value()->~V();
+        for (j = (i + 1) & mask; entries_[j].key != 0; j = (j + 1) & mask) {
+            size_type home = hash(entries_[j].key, bits_);
+            if (((j - home) & mask) >= ((j - i) & mask)) {
+                move_entry(entries_ + i, entries_ + j);
+                i = j;
+            }
+        }
+        entries_[i].key = 0;
+        count_--;
+        return true;
+    }
+
+    /** Remove all keys, keeping the memory allocated */
+    void clear() {
+        if (!std::is_trivially_destructible<V>::value) {
+            for (size_type i = 0; i < size_; i++) {
+                if (entries_[i].key != 0) {
+                    entries_[i].value()->~V();
+                }
+            }
+        }
+        if (size_) {
+            std::memset(static_cast<void *>(entries_), 0, size_ * sizeof(entry));
+        }
+        if (has_zero_) {
+            zero_value()->~V();
+        }
+        count_ = 0;
+        has_zero_ = false;
+    }
+
+    void reserve(size_type n) {
+        unsigned bits = bits_ > TL_IMAP_MIN_BITS ? bits_ : TL_IMAP_MIN_BITS;
+        while (n * 100 > (static_cast<size_type>(1) << bits) * TL_IMAP_MAX_LOAD) {
+            bits++;
+        }
+        if (!size_ || bits != bits_) {
+            rehash(bits);
+        }
+    }
+
+    /** Call `f(key, value)` for every entry. `f` must not modify the map */
+    template <class F>
+    void for_each(F f) {
+        if (has_zero_) {
+            f(K(0), *zero_value());
+        }
+        for (size_type i = 0; i < size_; i++) {
+            if (entries_[i].key != 0) {
+                f(entries_[i].key, *entries_[i].value());
+            }
+        }
+    }
+
+    template <class F>
+    void for_each(F f) const {
+        const_cast<int_map *>(this)->for_each(
+                [&f](K k, V &v) { f(k, static_cast<const V &>(v)); });
+    }
+
+private:
+    struct entry {
+        K key;
+        typename std::aligned_storage<sizeof(V), alignof(V)>::type storage;
+
+        V *value() { return reinterpret_cast<V *>(&storage); }
+    };
+
+    static size_type hash(K key, unsigned bits) {
+        return sizeof(K) == 4
+                ? tl_imap_hash32(static_cast<uint32_t>(key), bits)
+                : tl_imap_hash64(static_cast<uint64_t>(key), bits);
+    }
+
+    V *zero_value() { return reinterpret_cast<V *>(&zero_storage_); }
+
+    /** Move the value of `src` into the empty slot `dst` */
+    static void move_entry(entry *dst, entry *src) {
+        new (dst->value()) V(std::move(*src->value()));
+        src->value()->~V();
+        dst->key = src->key;
+    }
+
+    void rehash(unsigned bits) {
+        size_type size = static_cast<size_type>(1) << bits, mask = size - 1;
+        entry *entries = static_cast<entry *>(std::calloc(size, sizeof(entry)));
+        if (entries == NULL) {
+            throw std::bad_alloc();
+        }
+        for (size_type i = 0; i < size_; i++) {
+            if (entries_[i].key == 0) {
+                continue;
+            }
+            size_type j = hash(entries_[i].key, bits);
+            while (entries[j].key != 0) {
+                j = (j + 1) & mask;
+            }
+            move_entry(entries + j, entries_ + i);
+        }
+        std::free(entries_);
+        entries_ = entries;
+        size_ = size;
+        bits_ = bits;
+    }
+
+    entry *entries_;
+    size_type size_;
+    unsigned bits_;
+    size_type count_;
+    bool has_zero_;
+    typename std::aligned_storage<sizeof(V), alignof(V)>::type zero_storage_;
+};
+
+} // namespace tl
+
+#endif
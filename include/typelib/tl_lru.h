@@ -0,0 +1,169 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2014 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#ifndef TL_LRU_H
+#define TL_LRU_H 1
+
+#include "tl_hashtable.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @file
+ * Least recently used cache, mapping byte string keys to caller owned
+ * values.
+ *
+ * Each item lives in a chained tl_HASHTABLE entry, whose inline value holds
+ * the tl_DLISTNODE linking the items in order of use, the value and the
+ * table's copy of the key. A hit is then a single lookup which also yields
+ * the list node to move to the front, and evicting the least recently used
+ * item takes it from the back of the list and deletes it by its stored key
+ * and hash, so every operation is O(1) and hashes its key once.
+ *
+ * Capacity is given as a number of items, a total "charge" (e.g. bytes) of
+ * the items, or both. Values are not copied: the cache holds the pointer
+ * given to tl_lru_put() until the item leaves, when it is passed to
+ * tl_LRUCONF::release.
+ */
+
+typedef struct tl_LRU_st tl_LRU;
+
+/** Reasons for an item to leave the cache, passed to tl_LRUCONF::release */
+enum tl_LRUREASON {
+    /** Evicted to make room for another item */
+    TL_LRU_EVICTED,
+    /** Its key was stored again with a new value */
+    TL_LRU_REPLACED,
+    /** Removed by tl_lru_del(), or freed with the cache */
+    TL_LRU_DELETED
+};
+
+/**
+ * Admit new items with a TinyLFU filter. Each shard estimates how often keys
+ * are requested (hits and misses alike) with a count-min sketch of 4 bit
+ * counters, which are halved periodically so that the estimate follows
+ * recent use, and a doorkeeper bitmap which keeps keys seen only once out
+ * of the sketch. A new item which would evict another is only stored if
+ * its key has been requested more often than the key it would evict, so a
+ * scan of keys which are never requested again does not flush the cache.
+ */
+#define TL_LRU_F_TINYLFU 0x01
+
+/** Cache settings */
+struct tl_LRUCONF {
+    /** Maximum number of items, or 0 for no limit */
+    size_t max_items;
+    /** Maximum sum of the charges of the items, or 0 for no limit. At least
+     * one of the limits must be set */
+    size_t max_charge;
+    /**
+     * Called for each value which leaves the cache, with the item's key,
+     * charge and the reason. The cache is locked while this runs, so it must
+     * not call into the cache. May be NULL
+     */
+    void (*release)(const void *k, size_t nk, void *value, size_t charge,
+                    enum tl_LRUREASON reason, void *arg);
+    /**
+     * Called with each value returned by tl_lru_get() before the cache is
+     * unlocked, e.g. to take a reference which keeps the value alive if
+     * another thread evicts it. May be NULL
+     */
+    void (*retain)(void *value, void *arg);
+    /** Passed to the callbacks */
+    void *arg;
+    /**
+     * 0 for a cache used by a single thread, which is never locked.
+     * Otherwise the number of independently locked shards (a power of two,
+     * at most 256), each holding its share of the items and of the limits;
+     * as items are evicted from the shard they belong to, a sharded cache
+     * may evict before it is full
+     */
+    unsigned nshards;
+    /** Combination of TL_LRU_F_* flags */
+    unsigned flags;
+    /** Keys of up to this many bytes are copied into the hash table entry
+     * itself (see tl_HASHCONF::inline_key) */
+    unsigned inline_key;
+};
+
+/**
+ * Create a cache
+ * @param conf the settings
+ * @return the new cache, or NULL if it cannot be allocated or the settings
+ *         are invalid
+ */
+tl_LRU *tl_lru_new(const struct tl_LRUCONF *conf);
+
+/**
+ * Free the cache, releasing every item with TL_LRU_DELETED. No other thread
+ * may be using it.
+ * @param c the cache (may be NULL)
+ */
+void tl_lru_free(tl_LRU *c);
+
+/**
+ * Store a value, making it the most recently used item. A value already
+ * stored under the key is released with TL_LRU_REPLACED, and the least
+ * recently used items are evicted until the cache is within its limits.
+ *
+ * @param c the cache
+ * @param k the key, which is copied
+ * @param klen the length of the key
+ * @param value the value
+ * @param charge the item's cost against tl_LRUCONF::max_charge
+ *
+ * @return 1 if the value was stored. 0 if it was not admitted, because its
+ *         charge exceeds a shard's limit or by TL_LRU_F_TINYLFU, and -1 if
+ *         memory cannot be allocated; in both cases the cache is unchanged
+ *         and the value still belongs to the caller.
+ */
+int tl_lru_put(tl_LRU *c, const void *k, size_t klen, void *value,
+               size_t charge);
+
+/**
+ * Look up a key, making its item the most recently used.
+ *
+ * @param c the cache
+ * @param k the key
+ * @param klen the length of the key
+ *
+ * @return the value, or NULL if the key is not cached. In a sharded cache
+ *         another thread may evict the item as soon as this returns, so the
+ *         value may only be used after this if tl_LRUCONF::retain keeps it
+ *         alive.
+ */
+void *tl_lru_get(tl_LRU *c, const void *k, size_t klen);
+
+/**
+ * Remove a key, releasing its value with TL_LRU_DELETED
+ * @return 1 if the key was cached, 0 otherwise
+ */
+int tl_lru_del(tl_LRU *c, const void *k, size_t klen);
+
+/** @return the number of items, summed over the shards one at a time */
+size_t tl_lru_size(tl_LRU *c);
+
+/** @return the sum of the items' charges, summed over the shards one at a
+ *  time */
+size_t tl_lru_charge(tl_LRU *c);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -27,8 +27,22 @@ extern "C" {
         size_t mask;
 
         size_t capacity;
+        /** Slots, aligned on a cache line within `mem` */
         size_t *items;
         size_t nitems;
+        void *mem;
+        /** Number of tombstones left by deletes in `items` */
+        size_t ndeleted;
+
+        /**
+         * Table being moved into `items` while the set is rebuilt, and the
+         * next group of it to be moved. Each add or delete moves a few
+         * groups, so no single call pays for the whole rebuild.
+         */
+        size_t *old_items;
+        void *old_mem;
+        size_t old_nbits;
+        size_t rehashidx;
     };
 
     typedef struct tl_SET *tl_pNSET;
@@ -36,6 +50,20 @@ extern "C" {
     /* create hashset instance */
     tl_pNSET tl_nset_new(void);
 
+    /**
+     * Create a hashset holding a set of items, using several threads. Each
+     * thread adds its share of the items to a table sized for all of them.
+     *
+     * @param items the items, which may contain duplicates
+     * @param n the number of items
+     * @param nthreads the number of threads to use, including the calling
+     *        one. 0 is the same as 1
+     *
+     * @return the hashset, or NULL if memory cannot be allocated or an item
+     *         is 0 or 1 (see tl_nset_add())
+     */
+    tl_pNSET tl_nset_new_bulk(void * const *items, size_t n, unsigned nthreads);
+
     /* destroy hashset instance */
     void tl_nset_free(tl_pNSET set);
 
@@ -79,6 +107,46 @@ extern "C" {
      */
     int tl_nset_contains(tl_pNSET set, void *item);
 
+    /**
+     * Set algebra. The in-place forms change `a` and leave `b` alone; `a`
+     * and `b` may be the same set. They go through the smaller of the two
+     * sets where the operation allows, and probe the other set for a batch
+     * of items at a time so that their cache misses overlap.
+     */
+
+    /**
+     * Add the items of `b` to `a`
+     * @return 0, or -1 if memory cannot be allocated (`a` is then unchanged)
+     */
+    int tl_nset_union(tl_pNSET a, tl_pNSET b);
+
+    /**
+     * Remove the items of `a` which are not in `b`
+     * @return 0, or -1 if memory cannot be allocated (`a` is then unchanged)
+     */
+    int tl_nset_intersect(tl_pNSET a, tl_pNSET b);
+
+    /**
+     * Remove the items of `b` from `a`
+     * @return 0, or -1 if memory cannot be allocated (`a` is then unchanged)
+     */
+    int tl_nset_difference(tl_pNSET a, tl_pNSET b);
+
+    /**
+     * Create a set holding the items in either set, in both sets, or in `a`
+     * but not in `b`
+     * @return the new set, or NULL if memory cannot be allocated
+     */
+    tl_pNSET tl_nset_union_new(tl_pNSET a, tl_pNSET b);
+    tl_pNSET tl_nset_intersect_new(tl_pNSET a, tl_pNSET b);
+    tl_pNSET tl_nset_difference_new(tl_pNSET a, tl_pNSET b);
+
+    /**
+     * Check whether every item of `a` is in `b`
+     * @return non-zero if so, zero otherwise
+     */
+    int tl_nset_is_subset(tl_pNSET a, tl_pNSET b);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,173 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2014 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#ifndef TL_ROARING_H
+#define TL_ROARING_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+#include "tl_string.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @file
+ * Compressed set of 32 bit integers (a Roaring bitmap).
+ *
+ * Values are split into chunks of 65536 by their upper 16 bits, and each
+ * chunk holding any values is stored as whichever of these is smallest:
+ *
+ * - a sorted array of the lower 16 bits of its values, for up to 4096 of
+ *   them (2 bytes per value)
+ * - a bitmap of all 65536 values (8 KB)
+ * - a sorted list of runs of consecutive values (4 bytes per run)
+ *
+ * Dense ranges such as vbucket IDs or sequence numbers thus take a few bytes
+ * per run, or a bit per value, where a tl_SET takes about ten bytes per
+ * value. Single additions and removals only switch between arrays and
+ * bitmaps at 4096 values, and turn runs into whichever is smaller once they
+ * outgrow it; tl_roaring_add_range(), the set algebra and
+ * tl_roaring_optimize() pick the smallest form, runs included.
+ *
+ * Functions which may allocate return -1 (or NULL) if memory cannot be
+ * allocated, and leave the set as it was.
+ */
+
+typedef struct tl_ROARING_st tl_ROARING;
+
+/** @return a new empty set, or NULL if memory cannot be allocated */
+tl_ROARING *tl_roaring_new(void);
+
+/** Free a set (which may be NULL) */
+void tl_roaring_free(tl_ROARING *r);
+
+/**
+ * Add a value
+ * @return 1 if added, 0 if already present, -1 on allocation failure
+ */
+int tl_roaring_add(tl_ROARING *r, uint32_t value);
+
+/**
+ * Add every value from `first` to `last`, inclusive
+ * @return 0, or -1 on allocation failure, in which case the values of the
+ *         chunks before the failing one have been added
+ */
+int tl_roaring_add_range(tl_ROARING *r, uint32_t first, uint32_t last);
+
+/**
+ * Remove a value. Removing a value from the middle of a run splits it, so
+ * this may allocate too
+ * @return 1 if removed, 0 if not present, -1 on allocation failure
+ */
+int tl_roaring_del(tl_ROARING *r, uint32_t value);
+
+/** @return nonzero if the value is in the set */
+int tl_roaring_contains(const tl_ROARING *r, uint32_t value);
+
+/** @return the number of values in the set */
+uint64_t tl_roaring_count(const tl_ROARING *r);
+
+/**
+ * Get the values in the set, in ascending order
+ * @param out an array with room for tl_roaring_count() values, or NULL to
+ *        allocate one with malloc()
+ * @return the array, or NULL if the set is empty or memory cannot be
+ *         allocated
+ */
+uint32_t *tl_roaring_items(const tl_ROARING *r, uint32_t *out);
+
+/** @return the number of values in the set which are less than or equal to
+ *  `value` */
+uint64_t tl_roaring_rank(const tl_ROARING *r, uint32_t value);
+
+/**
+ * Find the value with a given rank
+ * @param n the number of smaller values in the set
+ * @param[out] value the value
+ * @return 0, or -1 if the set holds `n` values or fewer
+ */
+int tl_roaring_select(const tl_ROARING *r, uint64_t n, uint32_t *value);
+
+/**
+ * Set algebra, as with tl_SET. The in-place forms change `a` and leave `b`
+ * alone; `a` and `b` may be the same set.
+ */
+
+/**
+ * Add the values of `b` to `a`
+ * @return 0, or -1 on allocation failure
+ */
+int tl_roaring_union(tl_ROARING *a, const tl_ROARING *b);
+
+/**
+ * Remove the values of `a` which are not in `b`
+ * @return 0, or -1 on allocation failure
+ */
+int tl_roaring_intersect(tl_ROARING *a, const tl_ROARING *b);
+
+/**
+ * Remove the values of `b` from `a`
+ * @return 0, or -1 on allocation failure
+ */
+int tl_roaring_difference(tl_ROARING *a, const tl_ROARING *b);
+
+/**
+ * Create a set holding the values in either set, in both sets, or in `a`
+ * but not in `b`
+ * @return the new set, or NULL on allocation failure
+ */
+tl_ROARING *tl_roaring_union_new(const tl_ROARING *a, const tl_ROARING *b);
+tl_ROARING *tl_roaring_intersect_new(const tl_ROARING *a, const tl_ROARING *b);
+tl_ROARING *tl_roaring_difference_new(const tl_ROARING *a, const tl_ROARING *b);
+
+/** @return nonzero if every value of `a` is in `b` */
+int tl_roaring_is_subset(const tl_ROARING *a, const tl_ROARING *b);
+
+/**
+ * Store each chunk in its smallest form, e.g. after adding runs of values
+ * one at a time
+ * @return 0, or -1 on allocation failure
+ */
+int tl_roaring_optimize(tl_ROARING *r);
+
+/** @return the number of bytes of memory taken by the set */
+size_t tl_roaring_bytes(const tl_ROARING *r);
+
+/**
+ * Append the set to a string, in the portable format shared by the Roaring
+ * implementations of other languages
+ * @return 0, or -1 on allocation failure
+ */
+int tl_roaring_serialize(const tl_ROARING *r, tl_STRING *str);
+
+/**
+ * Read a set written by tl_roaring_serialize() (or another Roaring
+ * implementation) from the start of a buffer
+ * @param data the buffer
+ * @param n the number of bytes in the buffer
+ * @param[out] nread if not NULL, the number of bytes the set took
+ * @return the set, or NULL if the buffer does not start with a valid set or
+ *         memory cannot be allocated
+ */
+tl_ROARING *tl_roaring_deserialize(const void *data, size_t n, size_t *nread);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
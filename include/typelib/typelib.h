@@ -13,10 +13,17 @@
 extern "C" {
 #endif
 
+#include "tl_hash.h"
 #include "tl_hashtable.h"
+#include "tl_chashtable.h"
+#include "tl_fhashtable.h"
+#include "tl_imap.h"
+#include "tl_lru.h"
+#include "tl_bloom.h"
 #include "tl_dlist.h"
 #include "tl_slist.h"
 #include "tl_nset.h"
+#include "tl_roaring.h"
 #include "tl_string.h"
 
 #ifdef __cplusplus
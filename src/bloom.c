@@ -0,0 +1,229 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2014 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "tl_bloom.h"
+
+/** Bits per block: one cache line */
+#define BLOCK_BITS 512
+#define BLOCK_WORDS (BLOCK_BITS / 64)
+#define MAX_K 16
+
+struct tl_BLOOM_st {
+    /** Blocks, aligned to their size */
+    uint64_t *words;
+    void *mem;
+    size_t nblocks;
+    size_t count;
+    unsigned k;
+};
+
+/** x to the power n, by squaring */
+static double ipow(double x, unsigned n)
+{
+    double rv = 1;
+    for (; n; n >>= 1, x *= x) {
+        if (n & 1) {
+            rv *= x;
+        }
+    }
+    return rv;
+}
+
+/**
+ * Expected false positive rate when keys land in blocks as a Poisson process
+ * with `lambda` keys per block on average, each setting `k` bits: the rate
+ * of a Bloom filter of BLOCK_BITS bits holding `j` keys, weighted by the
+ * probability of a block holding `j` keys.
+ */
+static double blocked_fpr(double lambda, unsigned k)
+{
+    double p = exp(-lambda), rv = 0, unset = 1;
+    double qk = ipow(1 - 1.0 / BLOCK_BITS, k);
+    size_t j, end = (size_t)(lambda + 12 * sqrt(lambda) + 20);
+
+    for (j = 0; j <= end; j++) {
+        /* `unset` is the chance of a bit being clear with `j` keys */
+        rv += p * ipow(1 - unset, k);
+        p *= lambda / (j + 1);
+        unset *= qk;
+    }
+    return rv;
+}
+
+/**
+ * The lowest rate reachable with `bits` bits per key, and its `k`. The best
+ * `k` is close to that of a plain Bloom filter, bits * ln 2
+ */
+static double best_fpr(double bits, unsigned *k)
+{
+    double best = 1, fpr;
+    unsigned i, center = (unsigned)(bits * 0.693 + 0.5), lo, hi;
+
+    center = center < MAX_K ? center : MAX_K;
+    lo = center > 3 ? center - 2 : 1;
+    hi = center + 2 < MAX_K ? center + 2 : MAX_K;
+    for (i = lo; i <= hi; i++) {
+        fpr = blocked_fpr(BLOCK_BITS / bits, i);
+        if (fpr < best) {
+            best = fpr;
+            *k = i;
+        }
+    }
+    return best;
+}
+
+void tl_bloom_params(double fpr, struct tl_BLOOMPARAMS *params)
+{
+    double lo = 1, hi = 64;
+    unsigned k = 1;
+    int i;
+
+    if (!(fpr >= 0.000001)) {
+        fpr = 0.000001;
+    } else if (fpr > 0.5) {
+        fpr = 0.5;
+    }
+    /* The rate falls as bits are added; find the fewest bits reaching it */
+    for (i = 0; i < 16; i++) {
+        double mid = (lo + hi) / 2;
+        if (best_fpr(mid, &k) > fpr) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    best_fpr(hi, &k);
+    params->bits_per_key = hi;
+    params->k = k;
+}
+
+tl_BLOOM *tl_bloom_new_params(size_t nkeys, const struct tl_BLOOMPARAMS *params)
+{
+    tl_BLOOM *rv;
+    double nbits = (double)nkeys * params->bits_per_key;
+    size_t nblocks = (size_t)(nbits / BLOCK_BITS) + 1;
+
+    if (params->k < 1 || params->k > MAX_K) {
+        return NULL;
+    }
+    rv = calloc(1, sizeof(*rv));
+    if (rv == NULL) {
+        return NULL;
+    }
+    rv->mem = calloc(nblocks * BLOCK_WORDS + BLOCK_WORDS, sizeof(uint64_t));
+    if (rv->mem == NULL) {
+        free(rv);
+        return NULL;
+    }
+    rv->words = (uint64_t *)((char *)rv->mem +
+                             (BLOCK_BITS / 8 - (size_t)rv->mem % (BLOCK_BITS / 8)));
+    rv->nblocks = nblocks;
+    rv->k = params->k;
+    return rv;
+}
+
+tl_BLOOM *tl_bloom_new(size_t nkeys, double fpr)
+{
+    struct tl_BLOOMPARAMS params;
+    tl_bloom_params(fpr, &params);
+    return tl_bloom_new_params(nkeys, &params);
+}
+
+void tl_bloom_free(tl_BLOOM *b)
+{
+    if (b != NULL) {
+        free(b->mem);
+        free(b);
+    }
+}
+
+/**
+ * Mix the hash, so that weak hashes (e.g. of small integers) are usable, and
+ * find its block, which is selected by the upper half of the result
+ */
+static uint64_t *block_of(const tl_BLOOM *b, uint64_t *hash)
+{
+    uint64_t h = *hash;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    *hash = h;
+    return b->words + (size_t)(((h >> 32) * b->nblocks) >> 32) * BLOCK_WORDS;
+}
+
+/*
+ * Bit `i` of a key within its block is the top 9 bits of its hash times the
+ * i-th power of an odd constant. Deriving the bits from one another (e.g.
+ * `a + i * b`) leaves too few distinct sets of bits among the keys of a
+ * block, which shows as false positives well above the model at low rates.
+ */
+#define BIT_MUL 0x9E3779B97F4A7C15ULL
+#define BIT_OF(x) ((unsigned)((x) >> 55))
+
+void tl_bloom_add(tl_BLOOM *b, uint64_t hash)
+{
+    uint64_t *block = block_of(b, &hash);
+    unsigned i, bit;
+
+    for (i = 0; i < b->k; i++) {
+        hash *= BIT_MUL;
+        bit = BIT_OF(hash);
+        block[bit / 64] |= (uint64_t)1 << (bit % 64);
+    }
+    b->count++;
+}
+
+int tl_bloom_maybe(const tl_BLOOM *b, uint64_t hash)
+{
+    const uint64_t *block = block_of(b, &hash);
+    unsigned i, bit;
+
+    for (i = 0; i < b->k; i++) {
+        hash *= BIT_MUL;
+        bit = BIT_OF(hash);
+        if (!(block[bit / 64] & ((uint64_t)1 << (bit % 64)))) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+void tl_bloom_clear(tl_BLOOM *b)
+{
+    memset(b->words, 0, b->nblocks * BLOCK_BITS / 8);
+    b->count = 0;
+}
+
+size_t tl_bloom_count(const tl_BLOOM *b)
+{
+    return b->count;
+}
+
+size_t tl_bloom_bytes(const tl_BLOOM *b)
+{
+    return b->nblocks * BLOCK_BITS / 8;
+}
+
+double tl_bloom_fpr(const tl_BLOOM *b)
+{
+    return blocked_fpr((double)b->count / b->nblocks, b->k);
+}
@@ -0,0 +1,309 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2014 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <assert.h>
+#include <limits.h>
+#include <string.h>
+#include "tl_chashtable.h"
+#include "tl_hash.h"
+
+#ifdef _WIN32
+#include <windows.h>
+typedef SRWLOCK cht_lock_t;
+#define LOCK_INIT(l) (InitializeSRWLock(l), 0)
+#define LOCK_DESTROY(l) (void)(l)
+#define LOCK_READ(l) AcquireSRWLockShared(l)
+#define UNLOCK_READ(l) ReleaseSRWLockShared(l)
+#define LOCK_WRITE(l) AcquireSRWLockExclusive(l)
+#define UNLOCK_WRITE(l) ReleaseSRWLockExclusive(l)
+#else
+#include <pthread.h>
+typedef pthread_rwlock_t cht_lock_t;
+#define LOCK_INIT(l) pthread_rwlock_init(l, NULL)
+#define LOCK_DESTROY(l) pthread_rwlock_destroy(l)
+#define LOCK_READ(l) pthread_rwlock_rdlock(l)
+#define UNLOCK_READ(l) pthread_rwlock_unlock(l)
+#define LOCK_WRITE(l) pthread_rwlock_wrlock(l)
+#define UNLOCK_WRITE(l) pthread_rwlock_unlock(l)
+#endif
+
+/* Shards are padded to this size so that locking one shard does not bounce
+ * the cache line holding its neighbour's lock between CPUs */
+#define CACHELINE 64
+
+#define SIZE_BITS (sizeof(size_t) * CHAR_BIT)
+
+struct cht_shard {
+    cht_lock_t lock;
+    tl_HASHTABLE *ht;
+};
+
+struct tl_CHASHTABLE_st {
+    /** log2 of the number of shards */
+    unsigned nbits;
+    unsigned nshards;
+    /** Distance between shards, a multiple of CACHELINE */
+    size_t stride;
+    /** Allocated memory; shards start at the first cache line boundary */
+    void *mem;
+    char *shards;
+};
+
+static struct cht_shard *shard_at(tl_CHASHTABLE *h, unsigned n)
+{
+    return (struct cht_shard *)(h->shards + n * h->stride);
+}
+
+/**
+ * Hash a key. All shards have the same hash function and seed, and these
+ * never change, so any shard's table may be used without locking it. The
+ * hash is then passed to the shard's `_hashed` functions, so each key is
+ * hashed once per call.
+ */
+static uint64_t cht_hash(tl_CHASHTABLE *h, const void *k, size_t klen)
+{
+    return tl_ht_hash(shard_at(h, 0)->ht, k, klen);
+}
+
+/**
+ * Select the shard for a hash. Each shard's table takes bucket indexes from
+ * the high bits of its own mix of the hash, so the shard is chosen by
+ * multiplicative hashing instead; using the same bits would leave most of
+ * each shard's buckets empty.
+ */
+static struct cht_shard *shard_for(tl_CHASHTABLE *h, uint64_t hash)
+{
+    size_t hv = (size_t)(hash ^ (hash >> 32));
+
+    if (h->nbits == 0) {
+        return shard_at(h, 0);
+    }
+#if SIZE_MAX > 0xffffffffUL
+    hv *= (size_t)0x9E3779B97F4A7C15ULL;
+#else
+    hv *= 0x9E3779B9UL;
+#endif
+    return shard_at(h, (unsigned)(hv >> (SIZE_BITS - h->nbits)));
+}
+
+tl_CHASHTABLE *
+tl_cht_new(size_t est, struct tl_HASHOPS ops, const struct tl_HASHCONF *conf,
+           unsigned nshards)
+{
+    tl_CHASHTABLE *rv;
+    struct tl_HASHCONF sconf;
+    unsigned i;
+
+    if (nshards == 0) {
+        nshards = TL_CHT_DEFAULT_SHARDS;
+    }
+    if (est < 1 || nshards > TL_CHT_MAX_SHARDS || (nshards & (nshards - 1))) {
+        return NULL;
+    }
+
+    rv = calloc(1, sizeof(*rv));
+    if (rv == NULL) {
+        return NULL;
+    }
+    rv->nshards = nshards;
+    while ((1U << rv->nbits) < nshards) {
+        rv->nbits++;
+    }
+    rv->stride = (sizeof(struct cht_shard) + CACHELINE - 1) & ~(size_t)(CACHELINE - 1);
+    rv->mem = calloc(1, nshards * rv->stride + CACHELINE);
+    if (rv->mem == NULL) {
+        free(rv);
+        return NULL;
+    }
+    rv->shards = (char *)rv->mem + (CACHELINE - (size_t)rv->mem % CACHELINE);
+
+    if (conf != NULL) {
+        sconf = *conf;
+    } else {
+        memset(&sconf, 0, sizeof(sconf));
+    }
+    /* Lookups run under a shared lock, so they must not migrate entries */
+    sconf.flags |= TL_HT_F_CONST_FIND;
+    if (!(sconf.flags & TL_HT_F_SEED)) {
+        sconf.flags |= TL_HT_F_SEED;
+        sconf.seed = tl_hash_randseed();
+    }
+
+    for (i = 0; i < nshards; i++) {
+        struct cht_shard *s = shard_at(rv, i);
+        s->ht = tl_ht_new_ex(est / nshards + 1, ops, &sconf);
+        if (s->ht == NULL) {
+            break;
+        }
+        if (LOCK_INIT(&s->lock) != 0) {
+            tl_ht_free(s->ht);
+            s->ht = NULL;
+            break;
+        }
+    }
+    if (i != nshards) {
+        rv->nshards = i;
+        tl_cht_free(rv);
+        return NULL;
+    }
+    return rv;
+}
+
+void tl_cht_free(tl_CHASHTABLE *h)
+{
+    unsigned i;
+
+    if (h == NULL) {
+        return;
+    }
+    for (i = 0; i < h->nshards; i++) {
+        struct cht_shard *s = shard_at(h, i);
+        tl_ht_free(s->ht);
+        LOCK_DESTROY(&s->lock);
+    }
+    free(h->mem);
+    free(h);
+}
+
+int tl_cht_store(tl_CHASHTABLE *h, const void *k, size_t klen,
+                 const void *v, size_t vlen)
+{
+    uint64_t hash = cht_hash(h, k, klen);
+    struct cht_shard *s = shard_for(h, hash);
+    int rv;
+
+    LOCK_WRITE(&s->lock);
+    rv = tl_ht_store_hashed(s->ht, hash, k, klen, v, vlen);
+    UNLOCK_WRITE(&s->lock);
+    return rv;
+}
+
+int tl_cht_find(tl_CHASHTABLE *h, const void *k, size_t klen,
+                tl_HASHITER_cb cb, void *arg)
+{
+    uint64_t hash = cht_hash(h, k, klen);
+    struct cht_shard *s = shard_for(h, hash);
+    size_t nvalue = 0;
+    void *value;
+    int rv = 0;
+
+    LOCK_READ(&s->lock);
+    value = tl_ht_findn_hashed(s->ht, hash, k, klen, &nvalue);
+    if (value != NULL) {
+        rv = 1;
+        if (cb != NULL) {
+            cb(k, klen, value, nvalue, arg);
+        }
+    }
+    UNLOCK_READ(&s->lock);
+    return rv;
+}
+
+int tl_cht_del(tl_CHASHTABLE *h, const void *k, size_t klen)
+{
+    uint64_t hash = cht_hash(h, k, klen);
+    struct cht_shard *s = shard_for(h, hash);
+    int rv;
+
+    LOCK_WRITE(&s->lock);
+    rv = tl_ht_del_hashed(s->ht, hash, k, klen);
+    UNLOCK_WRITE(&s->lock);
+    return rv;
+}
+
+int tl_cht_delall(tl_CHASHTABLE *h, const void *k, size_t klen)
+{
+    uint64_t hash = cht_hash(h, k, klen);
+    struct cht_shard *s = shard_for(h, hash);
+    int rv;
+
+    LOCK_WRITE(&s->lock);
+    rv = tl_ht_delall_hashed(s->ht, hash, k, klen);
+    UNLOCK_WRITE(&s->lock);
+    return rv;
+}
+
+enum tl_UPDATETYPE tl_cht_update(tl_CHASHTABLE *h, const void *k, size_t klen,
+                                 const void *v, size_t vlen)
+{
+    uint64_t hash = cht_hash(h, k, klen);
+    struct cht_shard *s = shard_for(h, hash);
+    enum tl_UPDATETYPE rv;
+
+    LOCK_WRITE(&s->lock);
+    rv = tl_ht_update_hashed(s->ht, hash, k, klen, v, vlen);
+    UNLOCK_WRITE(&s->lock);
+    return rv;
+}
+
+enum tl_UPDATETYPE
+tl_cht_funupdate(tl_CHASHTABLE *h,
+                 const void *key, size_t klen,
+                 void * (*upd)(const void *k, const void *oldv, size_t *ns, void *a),
+                 void (*fr)(void *), void *arg, const void *def, size_t deflen)
+{
+    uint64_t hash = cht_hash(h, key, klen);
+    struct cht_shard *s = shard_for(h, hash);
+    enum tl_UPDATETYPE rv;
+
+    LOCK_WRITE(&s->lock);
+    rv = tl_ht_funupdate_hashed(s->ht, hash, key, klen, upd, fr, arg,
+                                def, deflen);
+    UNLOCK_WRITE(&s->lock);
+    return rv;
+}
+
+void tl_cht_iter(tl_CHASHTABLE *h, tl_HASHITER_cb iterfunc, void *arg)
+{
+    unsigned i;
+
+    for (i = 0; i < h->nshards; i++) {
+        struct cht_shard *s = shard_at(h, i);
+        LOCK_READ(&s->lock);
+        tl_ht_iter(s->ht, iterfunc, arg);
+        UNLOCK_READ(&s->lock);
+    }
+}
+
+int tl_cht_size(tl_CHASHTABLE *h)
+{
+    unsigned i;
+    int rv = 0;
+
+    for (i = 0; i < h->nshards; i++) {
+        struct cht_shard *s = shard_at(h, i);
+        LOCK_READ(&s->lock);
+        rv += tl_ht_size(s->ht);
+        UNLOCK_READ(&s->lock);
+    }
+    return rv;
+}
+
+int tl_cht_clear(tl_CHASHTABLE *h)
+{
+    unsigned i;
+    int rv = 0;
+
+    for (i = 0; i < h->nshards; i++) {
+        struct cht_shard *s = shard_at(h, i);
+        LOCK_WRITE(&s->lock);
+        rv += tl_ht_clear(s->ht);
+        UNLOCK_WRITE(&s->lock);
+    }
+    return rv;
+}
@@ -0,0 +1,775 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2014 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include "tl_fhashtable.h"
+#include "tl_hash.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/* Average number of keys per bucket, i.e. per displacement */
+#define KEYS_PER_BUCKET 4
+
+/*
+ * Values of d0 tried for a bucket of several keys. Each is tried with every
+ * d1, so running out means the bucket's keys cannot be told apart by their
+ * hashes, and the table is rebuilt with another seed.
+ */
+#define MAX_D0 1024
+#define MAX_SEEDS 8
+#define FIRST_SEED 0x8445d61a4e774912ULL
+
+#define ALIGN8(n) (((n) + 7) & ~(size_t)7)
+
+/*
+ * The table's memory holds, in order: a header, `nbuckets` displacements,
+ * `nkeys` slots and the records. Everything is referred to by offset, so the
+ * block may be copied or stored as it is; this is the snapshot format.
+ */
+#define FHT_MAGIC "tlFHT\r\n\032"
+#define FHT_BYTEORDER 0x01020304UL
+
+struct fht_header {
+    char magic[8];
+    /** TL_FHT_FORMAT_VERSION */
+    uint32_t version;
+    /** FHT_BYTEORDER as written by the host */
+    uint32_t byteorder;
+    /** Seed for tl_hash64() */
+    uint64_t seed;
+    uint64_t nkeys;
+    uint64_t nbuckets;
+    uint64_t disp_off;
+    uint64_t slots_off;
+    uint64_t data_off;
+    uint64_t size;
+};
+
+/** A key whose hash gives f1 and f2 goes to slot (f1 + d0 * f2 + d1) % nkeys */
+struct fht_disp {
+    uint32_t d0;
+    uint32_t d1;
+};
+
+/**
+ * A slot. Records start with the value's length (a uint64_t) followed by
+ * the value, padded to a multiple of 8 bytes, then the key
+ */
+struct fht_slot {
+    /** Offset of the record from the start of the records */
+    uint64_t off;
+    uint32_t klen;
+    /** High half of the key's hash */
+    uint32_t tag;
+};
+
+struct tl_FHASHTABLE_st {
+    /** The header, followed by the rest of the table */
+    const char *base;
+    size_t size;
+    /** Memory allocated by tl_ht_freeze() */
+    char *mem;
+    /** Mapping created by tl_fht_open() */
+    void *map;
+    size_t maplen;
+    uint64_t seed;
+    uint32_t nkeys;
+    uint32_t nbuckets;
+    const struct fht_disp *disp;
+    const struct fht_slot *slots;
+    const char *data;
+};
+
+/** What a key's hash selects */
+struct fht_hash {
+    uint32_t tag;
+    uint32_t bucket;
+    uint32_t f1;
+    uint32_t f2;
+};
+
+/** Source entry while freezing */
+struct fht_key {
+    const char *k;
+    size_t klen;
+    /** The value: a copy in fht_collect::buf, or the pointer itself */
+    const void *v;
+    size_t nvalue;
+    /** Offsets of the key and value copies in fht_collect::buf */
+    size_t koff;
+    size_t voff;
+    /** The key was stored more than once */
+    int dup;
+    struct fht_hash fh;
+    uint32_t pos;
+};
+
+static uint64_t fht_mix(uint64_t v)
+{
+    v ^= v >> 33;
+    v *= 0xff51afd7ed558ccdULL;
+    v ^= v >> 33;
+    v *= 0xc4ceb9fe1a85ec53ULL;
+    v ^= v >> 33;
+    return v;
+}
+
+/** Map `x` onto [0, n) */
+static uint32_t fastrange(uint32_t x, uint32_t n)
+{
+    return (uint32_t)(((uint64_t)x * n) >> 32);
+}
+
+static void fht_hash(uint64_t seed, uint32_t nkeys, uint32_t nbuckets,
+                     const void *k, size_t klen, struct fht_hash *fh)
+{
+    uint64_t h = tl_hash64(k, klen, seed), h2 = fht_mix(h);
+    fh->tag = (uint32_t)(h >> 32);
+    fh->f1 = fastrange((uint32_t)h, nkeys);
+    fh->f2 = fastrange((uint32_t)h2, nkeys);
+    fh->bucket = fastrange((uint32_t)(h2 >> 32), nbuckets);
+}
+
+static uint32_t fht_pos(const struct fht_hash *fh, const struct fht_disp *d,
+                        uint32_t nkeys)
+{
+    return (uint32_t)((fh->f1 + (uint64_t)d->d0 * fh->f2 + d->d1) % nkeys);
+}
+
+static size_t value_area(size_t nvalue)
+{
+    return ALIGN8(nvalue ? nvalue : sizeof(void *));
+}
+
+static size_t record_size(size_t klen, size_t nvalue)
+{
+    return ALIGN8(sizeof(uint64_t) + value_area(nvalue) + klen);
+}
+
+/** Value of a record. A zero length value is the stored pointer */
+static const void *record_value(const char *rec, size_t *nvalue)
+{
+    uint64_t n;
+    memcpy(&n, rec, sizeof(n));
+    *nvalue = (size_t)n;
+    if (n == 0) {
+        const void *p;
+        memcpy(&p, rec + sizeof(n), sizeof(p));
+        return p;
+    }
+    return rec + sizeof(n);
+}
+
+static const char *record_key(const char *rec)
+{
+    uint64_t n;
+    memcpy(&n, rec, sizeof(n));
+    return rec + sizeof(n) + value_area((size_t)n);
+}
+
+/**
+ * Point a table at its memory, after checking that the header describes a
+ * table of this format which fits in `size` bytes. Nothing past the header
+ * is read
+ */
+static int fht_attach(tl_FHASHTABLE *f, const char *base, size_t size)
+{
+    struct fht_header hdr;
+
+    if (size < sizeof(hdr) || ((uintptr_t)base & 7) != 0) {
+        return -1;
+    }
+    memcpy(&hdr, base, sizeof(hdr));
+    if (memcmp(hdr.magic, FHT_MAGIC, sizeof(hdr.magic)) != 0 ||
+            hdr.version != TL_FHT_FORMAT_VERSION ||
+            hdr.byteorder != FHT_BYTEORDER) {
+        return -1;
+    }
+    /* Each area is bounded by the space left after the ones before it
+     * before any offsets are added, so that they cannot wrap around */
+    if (hdr.size > size || hdr.nkeys >= UINT32_MAX ||
+            hdr.disp_off < sizeof(hdr) || (hdr.disp_off & 7) != 0 ||
+            hdr.disp_off > hdr.size ||
+            hdr.nbuckets > (hdr.size - hdr.disp_off) / sizeof(struct fht_disp) ||
+            hdr.nkeys > (hdr.size - hdr.disp_off -
+                         hdr.nbuckets * sizeof(struct fht_disp)) /
+                        sizeof(struct fht_slot) ||
+            hdr.nbuckets != (hdr.nkeys + KEYS_PER_BUCKET - 1) / KEYS_PER_BUCKET ||
+            hdr.slots_off != hdr.disp_off + hdr.nbuckets * sizeof(struct fht_disp) ||
+            hdr.data_off != hdr.slots_off + hdr.nkeys * sizeof(struct fht_slot) ||
+            hdr.data_off > hdr.size) {
+        return -1;
+    }
+    f->base = base;
+    f->size = (size_t)hdr.size;
+    f->seed = hdr.seed;
+    f->nkeys = (uint32_t)hdr.nkeys;
+    f->nbuckets = (uint32_t)hdr.nbuckets;
+    f->disp = (const struct fht_disp *)(base + hdr.disp_off);
+    f->slots = (const struct fht_slot *)(base + hdr.slots_off);
+    f->data = base + hdr.data_off;
+    return 0;
+}
+
+/******************************************************************************
+ * Building
+ ******************************************************************************/
+
+struct fht_collect {
+    /** Copies of the keys and values, back to back */
+    char *buf;
+    size_t used;
+    size_t cap;
+    struct fht_key *keys;
+    size_t nkeys;
+    size_t kcap;
+    int failed;
+};
+
+/* Entries are copied while iterating: looking them up afterwards may move
+ * them (and keys and values stored in them) as part of an incremental
+ * resize */
+static void collect_entry(const void *k, size_t klen, const void *v, size_t nv,
+                          void *arg)
+{
+    struct fht_collect *c = arg;
+    struct fht_key *key;
+
+    if (c->failed) {
+        return;
+    }
+    if (c->nkeys == c->kcap) {
+        size_t cap = c->kcap ? c->kcap * 2 : 64;
+        struct fht_key *keys = realloc(c->keys, cap * sizeof(*keys));
+        if (keys == NULL) {
+            c->failed = 1;
+            return;
+        }
+        c->keys = keys;
+        c->kcap = cap;
+    }
+    if (c->used + klen + nv > c->cap) {
+        size_t cap = c->cap ? c->cap * 2 : 1024;
+        char *buf;
+        while (cap < c->used + klen + nv) {
+            cap *= 2;
+        }
+        if ((buf = realloc(c->buf, cap)) == NULL) {
+            c->failed = 1;
+            return;
+        }
+        c->buf = buf;
+        c->cap = cap;
+    }
+    key = c->keys + c->nkeys++;
+    memset(key, 0, sizeof(*key));
+    key->klen = klen;
+    key->koff = c->used;
+    if (klen) {
+        memcpy(c->buf + c->used, k, klen);
+        c->used += klen;
+    }
+    key->nvalue = nv;
+    key->voff = c->used;
+    if (nv) {
+        memcpy(c->buf + c->used, v, nv);
+        c->used += nv;
+    } else {
+        key->v = v;
+    }
+}
+
+static int cmp_keys(const void *a, const void *b)
+{
+    const struct fht_key *ka = a, *kb = b;
+    if (ka->klen != kb->klen) {
+        return ka->klen < kb->klen ? -1 : 1;
+    }
+    return ka->klen ? memcmp(ka->k, kb->k, ka->klen) : 0;
+}
+
+/**
+ * Find displacements which place every key in a slot of its own, setting
+ * each key's `pos`. Buckets are placed largest first, while most slots are
+ * free; a single key bucket takes the next free slot directly.
+ *
+ * Returns 0, or -1 if memory cannot be allocated or some bucket's keys
+ * cannot be separated with this seed.
+ */
+static int fht_place(struct fht_key *keys, uint32_t n, uint32_t nb,
+                     struct fht_disp *disp)
+{
+    uint32_t *bstart = calloc((size_t)nb + 1, sizeof(*bstart));
+    uint32_t *members = malloc((size_t)n * sizeof(*members));
+    uint32_t *border = malloc((size_t)nb * sizeof(*border));
+    unsigned char *taken = calloc(n, 1);
+    uint32_t *sizes = NULL, base[64];
+    uint32_t i, j, b, maxsize = 0, next_free = 0;
+    int rv = -1;
+
+    if (bstart == NULL || members == NULL || border == NULL || taken == NULL) {
+        goto done;
+    }
+
+    /* Group the keys by bucket */
+    for (i = 0; i < n; i++) {
+        bstart[keys[i].fh.bucket + 1]++;
+    }
+    for (b = 0; b < nb; b++) {
+        uint32_t size = bstart[b + 1];
+        if (size > maxsize) {
+            maxsize = size;
+        }
+        bstart[b + 1] += bstart[b];
+    }
+    if (maxsize > sizeof(base) / sizeof(base[0])) {
+        goto done;
+    }
+    for (i = 0; i < n; i++) {
+        members[bstart[keys[i].fh.bucket]++] = i;
+    }
+    /* bstart[b] is now the end of bucket b */
+    for (b = nb; b > 0; b--) {
+        bstart[b] = bstart[b - 1];
+    }
+    bstart[0] = 0;
+
+    /* Order the buckets by decreasing size */
+    if ((sizes = calloc((size_t)maxsize + 2, sizeof(*sizes))) == NULL) {
+        goto done;
+    }
+    for (b = 0; b < nb; b++) {
+        sizes[maxsize - (bstart[b + 1] - bstart[b]) + 1]++;
+    }
+    for (i = 0; i <= maxsize; i++) {
+        sizes[i + 1] += sizes[i];
+    }
+    for (b = 0; b < nb; b++) {
+        border[sizes[maxsize - (bstart[b + 1] - bstart[b])]++] = b;
+    }
+
+    for (i = 0; i < nb; i++) {
+        uint32_t *m, k, d0, d1;
+        struct fht_disp *d;
+
+        b = border[i];
+        m = members + bstart[b];
+        k = bstart[b + 1] - bstart[b];
+        d = disp + b;
+        d->d0 = d->d1 = 0;
+
+        if (k == 0) {
+            continue;
+        } else if (k == 1) {
+            while (taken[next_free]) {
+                next_free++;
+            }
+            d->d1 = (next_free + n - keys[m[0]].fh.f1) % n;
+            keys[m[0]].pos = next_free;
+            taken[next_free] = 1;
+            continue;
+        }
+
+        for (d0 = 0; d0 < MAX_D0; d0++) {
+            int distinct = 1;
+
+            /* d1 moves every key by the same amount, so keys which collide
+             * with each other for this d0 collide for any d1 */
+            d->d0 = d0;
+            for (j = 0; j < k && distinct; j++) {
+                uint32_t l;
+                base[j] = fht_pos(&keys[m[j]].fh, d, n);
+                for (l = 0; l < j; l++) {
+                    if (base[l] == base[j]) {
+                        distinct = 0;
+                        break;
+                    }
+                }
+            }
+            if (!distinct) {
+                continue;
+            }
+            for (d1 = 0; d1 < n; d1++) {
+                for (j = 0; j < k; j++) {
+                    uint64_t pos = (uint64_t)base[j] + d1;
+                    if (taken[pos >= n ? pos - n : pos]) {
+                        break;
+                    }
+                }
+                if (j == k) {
+                    break;
+                }
+            }
+            if (d1 < n) {
+                d->d1 = d1;
+                for (j = 0; j < k; j++) {
+                    uint32_t pos = fht_pos(&keys[m[j]].fh, d, n);
+                    keys[m[j]].pos = pos;
+                    taken[pos] = 1;
+                }
+                break;
+            }
+        }
+        if (d0 == MAX_D0) {
+            goto done;
+        }
+    }
+    rv = 0;
+
+    done:
+    free(bstart);
+    free(members);
+    free(border);
+    free(taken);
+    free(sizes);
+    return rv;
+}
+
+tl_FHASHTABLE *tl_ht_freeze(tl_HASHTABLE *h)
+{
+    struct fht_collect c;
+    struct fht_header hdr;
+    struct fht_disp *disp = NULL;
+    struct fht_slot *slots;
+    struct fht_key **at = NULL;
+    tl_FHASHTABLE *f = NULL;
+    size_t i, n = 0, nb, off;
+    uint64_t seed = FIRST_SEED;
+    int attempt;
+
+    assert(h != NULL);
+    memset(&c, 0, sizeof(c));
+    tl_ht_iter(h, collect_entry, &c);
+    if (c.failed) {
+        goto fail;
+    }
+
+    /* Merge duplicate keys (from tables holding several values per key);
+     * their value is looked up */
+    for (i = 0; i < c.nkeys; i++) {
+        c.keys[i].k = c.buf + c.keys[i].koff;
+        if (c.keys[i].nvalue) {
+            c.keys[i].v = c.buf + c.keys[i].voff;
+        }
+    }
+    if (c.nkeys) {
+        qsort(c.keys, c.nkeys, sizeof(*c.keys), cmp_keys);
+    }
+    for (i = 0; i < c.nkeys; i++) {
+        if (n == 0 || cmp_keys(&c.keys[n - 1], &c.keys[i]) != 0) {
+            c.keys[n++] = c.keys[i];
+        } else {
+            c.keys[n - 1].dup = 1;
+        }
+    }
+    if (n >= UINT32_MAX) {
+        goto fail;
+    }
+    nb = (n + KEYS_PER_BUCKET - 1) / KEYS_PER_BUCKET;
+
+    off = 0;
+    for (i = 0; i < n; i++) {
+        struct fht_key *k = c.keys + i;
+        if (k->klen > UINT32_MAX) {
+            goto fail;
+        }
+        if (k->dup) {
+            tl_ht_findn(h, k->k, k->klen, &k->nvalue);
+        }
+        off += record_size(k->klen, k->nvalue);
+    }
+
+    if ((disp = malloc((nb ? nb : 1) * sizeof(*disp))) == NULL) {
+        goto fail;
+    }
+    for (attempt = 0; n && attempt < MAX_SEEDS; attempt++, seed++) {
+        for (i = 0; i < n; i++) {
+            fht_hash(seed, (uint32_t)n, (uint32_t)nb, c.keys[i].k, c.keys[i].klen,
+                     &c.keys[i].fh);
+        }
+        if (fht_place(c.keys, (uint32_t)n, (uint32_t)nb, disp) == 0) {
+            break;
+        }
+    }
+    if (attempt == MAX_SEEDS) {
+        goto fail;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, FHT_MAGIC, sizeof(hdr.magic));
+    hdr.version = TL_FHT_FORMAT_VERSION;
+    hdr.byteorder = FHT_BYTEORDER;
+    hdr.seed = seed;
+    hdr.nkeys = n;
+    hdr.nbuckets = nb;
+    hdr.disp_off = ALIGN8(sizeof(hdr));
+    hdr.slots_off = hdr.disp_off + nb * sizeof(*disp);
+    hdr.data_off = hdr.slots_off + n * sizeof(*slots);
+    hdr.size = hdr.data_off + off;
+
+    f = calloc(1, sizeof(*f));
+    at = malloc((n ? n : 1) * sizeof(*at));
+    if (f == NULL || at == NULL || (f->mem = malloc((size_t)hdr.size)) == NULL) {
+        goto fail;
+    }
+    memcpy(f->mem, &hdr, sizeof(hdr));
+    if (nb) {
+        memcpy(f->mem + hdr.disp_off, disp, nb * sizeof(*disp));
+    }
+
+    /* Records are laid out in slot order, so iterating reads them in turn */
+    for (i = 0; i < n; i++) {
+        at[c.keys[i].pos] = c.keys + i;
+    }
+    slots = (struct fht_slot *)(f->mem + hdr.slots_off);
+    for (i = 0, off = 0; i < n; i++) {
+        struct fht_key *k = at[i];
+        char *rec = f->mem + hdr.data_off + off;
+        uint64_t nvalue = k->nvalue;
+        size_t rsize = record_size(k->klen, k->nvalue), vlen;
+        const void *v = k->v;
+
+        if (k->dup) {
+            /* Copied straight away, as the next lookup may move it */
+            v = tl_ht_findn(h, k->k, k->klen, &vlen);
+            assert(vlen == k->nvalue);
+        }
+        memset(rec, 0, rsize);
+        memcpy(rec, &nvalue, sizeof(nvalue));
+        if (nvalue) {
+            memcpy(rec + sizeof(nvalue), v, k->nvalue);
+        } else {
+            memcpy(rec + sizeof(nvalue), &v, sizeof(v));
+        }
+        if (k->klen) {
+            memcpy(rec + sizeof(nvalue) + value_area(k->nvalue), k->k, k->klen);
+        }
+        slots[i].off = off;
+        slots[i].klen = (uint32_t)k->klen;
+        slots[i].tag = k->fh.tag;
+        off += rsize;
+    }
+
+    if (fht_attach(f, f->mem, (size_t)hdr.size) != 0) {
+        goto fail;
+    }
+
+    free(at);
+    free(disp);
+    free(c.keys);
+    free(c.buf);
+    return f;
+
+    fail:
+    tl_fht_free(f);
+    free(at);
+    free(disp);
+    free(c.keys);
+    free(c.buf);
+    return NULL;
+}
+
+/******************************************************************************
+ * Snapshots
+ ******************************************************************************/
+
+int tl_fht_save(const tl_FHASHTABLE *f, const char *path)
+{
+    FILE *fp;
+    int rv = 0;
+
+    assert(f != NULL);
+    if ((fp = fopen(path, "wb")) == NULL) {
+        return -1;
+    }
+    if (fwrite(f->base, 1, f->size, fp) != f->size) {
+        rv = -1;
+    }
+    if (fclose(fp) != 0) {
+        rv = -1;
+    }
+    return rv;
+}
+
+tl_FHASHTABLE *tl_fht_view(const void *buf, size_t len)
+{
+    tl_FHASHTABLE *f = calloc(1, sizeof(*f));
+    if (f == NULL) {
+        return NULL;
+    }
+    if (fht_attach(f, buf, len) != 0) {
+        free(f);
+        return NULL;
+    }
+    return f;
+}
+
+#ifdef _WIN32
+static void *map_file(const char *path, size_t *len)
+{
+    HANDLE file, mapping;
+    LARGE_INTEGER size;
+    void *rv = NULL;
+
+    file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                       OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        return NULL;
+    }
+    if (GetFileSizeEx(file, &size) && size.QuadPart > 0 &&
+            (unsigned long long)size.QuadPart <= (size_t)-1) {
+        mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mapping != NULL) {
+            /* The view keeps the mapping alive */
+            rv = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            *len = (size_t)size.QuadPart;
+            CloseHandle(mapping);
+        }
+    }
+    CloseHandle(file);
+    return rv;
+}
+
+static void unmap_file(void *p, size_t len)
+{
+    (void)len;
+    UnmapViewOfFile(p);
+}
+#else
+static void *map_file(const char *path, size_t *len)
+{
+    struct stat st;
+    void *rv = NULL;
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0) {
+        return NULL;
+    }
+    if (fstat(fd, &st) == 0 && st.st_size > 0 &&
+            (unsigned long long)st.st_size <= (size_t)-1) {
+        rv = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (rv == MAP_FAILED) {
+            rv = NULL;
+        }
+        *len = (size_t)st.st_size;
+    }
+    close(fd);
+    return rv;
+}
+
+static void unmap_file(void *p, size_t len)
+{
+    munmap(p, len);
+}
+#endif
+
+tl_FHASHTABLE *tl_fht_open(const char *path)
+{
+    tl_FHASHTABLE *f;
+    size_t len = 0;
+    void *map = map_file(path, &len);
+
+    if (map == NULL) {
+        return NULL;
+    }
+    if ((f = tl_fht_view(map, len)) == NULL) {
+        unmap_file(map, len);
+        return NULL;
+    }
+    f->map = map;
+    f->maplen = len;
+    return f;
+}
+
+/******************************************************************************
+ * Lookups
+ ******************************************************************************/
+
+void tl_fht_free(tl_FHASHTABLE *f)
+{
+    if (f != NULL) {
+        if (f->map != NULL) {
+            unmap_file(f->map, f->maplen);
+        }
+        free(f->mem);
+        free(f);
+    }
+}
+
+const void *tl_fht_findn(const tl_FHASHTABLE *f, const void *k, size_t klen,
+                         size_t *nvalue)
+{
+    struct fht_hash fh;
+    const struct fht_slot *s;
+    const char *rec;
+
+    assert(f != NULL);
+    if (f->nkeys == 0) {
+        return NULL;
+    }
+    fht_hash(f->seed, f->nkeys, f->nbuckets, k, klen, &fh);
+    s = f->slots + fht_pos(&fh, f->disp + fh.bucket, f->nkeys);
+    if (s->tag != fh.tag || s->klen != klen) {
+        return NULL;
+    }
+    rec = f->data + s->off;
+    if (klen && memcmp(record_key(rec), k, klen) != 0) {
+        return NULL;
+    }
+    return record_value(rec, nvalue);
+}
+
+const void *tl_fht_find(const tl_FHASHTABLE *f, const void *k, size_t klen)
+{
+    size_t nvalue;
+    return tl_fht_findn(f, k, klen, &nvalue);
+}
+
+size_t tl_fht_size(const tl_FHASHTABLE *f)
+{
+    assert(f != NULL);
+    return f->nkeys;
+}
+
+size_t tl_fht_bytes(const tl_FHASHTABLE *f)
+{
+    assert(f != NULL);
+    return f->size;
+}
+
+void tl_fht_iter(const tl_FHASHTABLE *f, tl_HASHITER_cb iterfunc, void *arg)
+{
+    uint32_t i;
+
+    assert(f != NULL);
+    for (i = 0; i < f->nkeys; i++) {
+        const char *rec = f->data + f->slots[i].off;
+        size_t nvalue;
+        const void *v = record_value(rec, &nvalue);
+        iterfunc(record_key(rec), f->slots[i].klen, v, nvalue, arg);
+    }
+}
@@ -0,0 +1,328 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2014 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include <string.h>
+#include <time.h>
+#include "tl_hash.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+/*
+ * The AES implementation is compiled for x86-64 only, with the target
+ * attribute so the rest of the library does not require AES-NI. Whether the
+ * CPU supports it is checked at runtime.
+ */
+#if defined(_M_X64) && defined(_MSC_VER)
+#include <intrin.h>
+#define HASH_AES 1
+#define TARGET_AES
+#elif defined(__x86_64__) && (defined(__clang__) || __GNUC__ >= 5)
+#include <emmintrin.h>
+#include <wmmintrin.h>
+#include <cpuid.h>
+#define HASH_AES 1
+#define TARGET_AES __attribute__((target("sse2,aes")))
+#endif
+
+#define P1 0x9E3779B185EBCA87ULL
+#define P2 0xC2B2AE3D27D4EB4FULL
+#define P3 0x165667B19E3779F9ULL
+#define P4 0x85EBCA77C2B2AE63ULL
+#define P5 0x27D4EB2F165667C5ULL
+
+#define ROTL64(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define TO_LE64(v) __builtin_bswap64(v)
+#define TO_LE32(v) __builtin_bswap32(v)
+#else
+#define TO_LE64(v) (v)
+#define TO_LE32(v) (v)
+#endif
+
+static uint64_t read64(const unsigned char *p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return TO_LE64(v);
+}
+
+static uint32_t read32(const unsigned char *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return TO_LE32(v);
+}
+
+static uint64_t xxh_round(uint64_t acc, uint64_t input)
+{
+    acc += input * P2;
+    acc = ROTL64(acc, 31);
+    return acc * P1;
+}
+
+static uint64_t xxh_merge(uint64_t acc, uint64_t v)
+{
+    acc ^= xxh_round(0, v);
+    return acc * P1 + P4;
+}
+
+uint64_t tl_hash64(const void *k, size_t n, uint64_t seed)
+{
+    const unsigned char *p = k;
+    const unsigned char *end = p + n;
+    uint64_t h;
+
+    if (n >= 32) {
+        const unsigned char *limit = end - 32;
+        uint64_t v1 = seed + P1 + P2;
+        uint64_t v2 = seed + P2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - P1;
+
+        do {
+            v1 = xxh_round(v1, read64(p));
+            v2 = xxh_round(v2, read64(p + 8));
+            v3 = xxh_round(v3, read64(p + 16));
+            v4 = xxh_round(v4, read64(p + 24));
+            p += 32;
+        } while (p <= limit);
+
+        h = ROTL64(v1, 1) + ROTL64(v2, 7) + ROTL64(v3, 12) + ROTL64(v4, 18);
+        h = xxh_merge(h, v1);
+        h = xxh_merge(h, v2);
+        h = xxh_merge(h, v3);
+        h = xxh_merge(h, v4);
+    } else {
+        h = seed + P5;
+    }
+
+    h += (uint64_t)n;
+
+    for (; p + 8 <= end; p += 8) {
+        h ^= xxh_round(0, read64(p));
+        h = ROTL64(h, 27) * P1 + P4;
+    }
+    if (p + 4 <= end) {
+        h ^= (uint64_t)read32(p) * P1;
+        h = ROTL64(h, 23) * P2 + P3;
+        p += 4;
+    }
+    for (; p < end; p++) {
+        h ^= *p * P5;
+        h = ROTL64(h, 11) * P1;
+    }
+
+    h ^= h >> 33;
+    h *= P2;
+    h ^= h >> 29;
+    h *= P3;
+    h ^= h >> 32;
+    return h;
+}
+
+#ifdef HASH_AES
+#define LOAD128(p) _mm_loadu_si128((const __m128i *)(const void *)(p))
+#define AESENC _mm_aesenc_si128
+
+/*
+ * Input is consumed as the round keys of AES rounds over four 16 byte lanes;
+ * the seed and length only go into the initial lane states. Keys of up to 64
+ * bytes are covered by (possibly overlapping) loads from either end; longer
+ * ones are consumed in 64 byte blocks, the last of which is zero padded so no
+ * byte is absorbed twice.
+ *
+ * Each lane goes through two more rounds before the lanes are XORed
+ * together. After a single round, a one byte difference in two lanes would
+ * cancel out whenever the S-box mapped both to the same output difference.
+ *
+ * This is not a cryptographic hash; the seed makes colliding keys depend on
+ * a value the attacker does not know, as with tl_hash64().
+ */
+static TARGET_AES uint64_t aes_hash64(const void *k, size_t n, uint64_t seed)
+{
+    const unsigned char *p = k;
+    const unsigned char *end = p + n;
+    __m128i s0 = _mm_set_epi64x((long long)(seed ^ P1), (long long)(n ^ P2));
+    __m128i s1 = _mm_set_epi64x((long long)(seed ^ P3), (long long)(~seed ^ P4));
+    __m128i x;
+
+    if (n <= 16) {
+        uint64_t lo = 0, hi = 0;
+        if (n >= 8) {
+            lo = read64(p);
+            hi = read64(end - 8);
+        } else if (n >= 4) {
+            lo = read32(p) | ((uint64_t)read32(end - 4) << 32);
+        } else if (n) {
+            lo = p[0] | ((uint64_t)p[n >> 1] << 8) | ((uint64_t)end[-1] << 16);
+        }
+        x = _mm_xor_si128(s0, _mm_set_epi64x((long long)hi, (long long)lo));
+    } else {
+        __m128i a = s0, b = s1;
+        __m128i c = AESENC(s0, s1), d = AESENC(s1, s0);
+
+        if (n > 64) {
+            unsigned char tail[64];
+            for (; end - p > 64; p += 64) {
+                a = AESENC(a, LOAD128(p));
+                b = AESENC(b, LOAD128(p + 16));
+                c = AESENC(c, LOAD128(p + 32));
+                d = AESENC(d, LOAD128(p + 48));
+            }
+            if (end - p < 64) {
+                memset(tail, 0, sizeof(tail));
+                memcpy(tail, p, end - p);
+                p = tail;
+            }
+            a = AESENC(a, LOAD128(p));
+            b = AESENC(b, LOAD128(p + 16));
+            c = AESENC(c, LOAD128(p + 32));
+            d = AESENC(d, LOAD128(p + 48));
+        } else {
+            a = AESENC(a, LOAD128(p));
+            b = AESENC(b, LOAD128(end - 16));
+            if (n > 32) {
+                c = AESENC(c, LOAD128(p + 16));
+                d = AESENC(d, LOAD128(end - 32));
+            }
+        }
+        a = AESENC(AESENC(a, s1), s0);
+        b = AESENC(AESENC(b, s0), s1);
+        c = AESENC(AESENC(c, s1), s0);
+        d = AESENC(AESENC(d, s0), s1);
+        x = _mm_xor_si128(_mm_xor_si128(a, b), _mm_xor_si128(c, d));
+    }
+
+    x = AESENC(x, s1);
+    x = AESENC(x, s0);
+    x = AESENC(x, s1);
+    return (uint64_t)_mm_cvtsi128_si64(x) ^
+           (uint64_t)_mm_cvtsi128_si64(_mm_unpackhi_epi64(x, x));
+}
+
+static int cpu_has_aes(void)
+{
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] >> 25) & 1;
+#else
+    unsigned a, b, c, d;
+    if (!__get_cpuid(1, &a, &b, &c, &d)) {
+        return 0;
+    }
+    return (c >> 25) & 1;
+#endif
+}
+#endif /* HASH_AES */
+
+typedef uint64_t (*hash_fn)(const void *, size_t, uint64_t);
+
+/*
+ * The implementation used by tl_hash_fast64(). It starts as resolve_fast64,
+ * which picks the best one on the first call; calls from several threads
+ * may race to do so, hence the atomic accesses.
+ */
+static uint64_t resolve_fast64(const void *k, size_t n, uint64_t seed);
+static hash_fn fast64 = resolve_fast64;
+
+static hash_fn fast64_load(void)
+{
+#ifdef _WIN32
+    return (hash_fn)*(PVOID volatile *)&fast64;
+#else
+    return __atomic_load_n(&fast64, __ATOMIC_RELAXED);
+#endif
+}
+
+static void fast64_store(hash_fn fn)
+{
+#ifdef _WIN32
+    InterlockedExchangePointer((PVOID volatile *)&fast64, (PVOID)fn);
+#else
+    __atomic_store_n(&fast64, fn, __ATOMIC_RELAXED);
+#endif
+}
+
+static uint64_t resolve_fast64(const void *k, size_t n, uint64_t seed)
+{
+    tl_hash_select(-1);
+    return fast64_load()(k, n, seed);
+}
+
+uint64_t tl_hash_fast64(const void *k, size_t n, uint64_t seed)
+{
+    return fast64_load()(k, n, seed);
+}
+
+int tl_hash_select(int impl)
+{
+    if (impl == -1) {
+#ifdef HASH_AES
+        if (cpu_has_aes()) {
+            impl = TL_HASH_IMPL_AES;
+        } else
+#endif
+        {
+            impl = TL_HASH_IMPL_PORTABLE;
+        }
+    }
+
+    switch (impl) {
+    case TL_HASH_IMPL_PORTABLE:
+        fast64_store(tl_hash64);
+        return impl;
+#ifdef HASH_AES
+    case TL_HASH_IMPL_AES:
+        if (!cpu_has_aes()) {
+            return -1;
+        }
+        fast64_store(aes_hash64);
+        return impl;
+#endif
+    default:
+        return -1;
+    }
+}
+
+uint64_t tl_hash_randseed(void)
+{
+    static uint64_t counter;
+    struct {
+        uint64_t counter;
+        uint64_t now;
+        uint64_t ticks;
+        const void *stack;
+        const void *data;
+    } src;
+
+    memset(&src, 0, sizeof(src));
+#ifdef _WIN32
+    src.counter = (uint64_t)InterlockedIncrement64((LONG64 volatile *)&counter);
+#else
+    src.counter = __atomic_add_fetch(&counter, 1, __ATOMIC_RELAXED);
+#endif
+    src.now = (uint64_t)time(NULL);
+    src.ticks = (uint64_t)clock();
+    /* Varies between runs where the address space is randomised */
+    src.stack = &src;
+    src.data = &counter;
+    return tl_hash64(&src, sizeof(src), src.counter * P5 ^ src.now);
+}
@@ -6,17 +6,97 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <string.h>
+#include <limits.h>
+#include <stdint.h>
 #include "tl_hashtable.h"
+#include "tl_hash.h"
 
-/* Table of 32 primes by their distance from the nearest power of two */
-static size_t prime_size_table[] = {
-    3, 7, 13, 23, 47, 97, 193, 383, 769, 1531, 3067, 6143, 12289, 24571, 49157,
-    98299, 196613, 393209, 786433, 1572869, 3145721, 6291449, 12582917,
-    25165813, 50331653, 100663291, 201326611, 402653189, 805306357,
-    1610612741
-};
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define GENHASH_SSE2 1
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#if defined(__GNUC__)
+#define PREFETCH(p) __builtin_prefetch(p)
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#define PREFETCH(p) _mm_prefetch((const char *)(p), _MM_HINT_T0)
+#else
+#define PREFETCH(p) (void)(p)
+#endif
+
+/* Worker threads for tl_ht_new_bulk() */
+#ifdef _WIN32
+#include <windows.h>
+typedef HANDLE bulk_thread_t;
+#else
+#include <pthread.h>
+typedef pthread_t bulk_thread_t;
+#endif
+
+/* log2 of the smallest and largest bucket counts we will use */
+#define MIN_TABLE_BITS 2
+#define MAX_TABLE_BITS (SIZE_BITS - 2)
+
+/* Default load factors, in entries per 100 buckets (or slots) */
+#define DEFAULT_MAX_LOAD 100
+#define DEFAULT_OPEN_MAX_LOAD 87
+#define DEFAULT_COMPACT_MAX_LOAD 66
+#define DEFAULT_MIN_LOAD 10
+
+/* False positive rate of the filter kept with TL_HT_F_FILTER, by default */
+#define DEFAULT_FILTER_FPR 0.01
+
+/*
+ * While a resize is in progress, each operation migrates up to REHASH_STEP
+ * non-empty buckets from the old table, visiting no more than
+ * REHASH_EMPTY_VISITS empty ones. Open addressed tables migrate a single
+ * group of slots per operation.
+ */
+#define REHASH_STEP 4
+#define REHASH_EMPTY_VISITS (REHASH_STEP * 10)
+
+/* tl_ht_scan() examines no more than this many buckets (or groups) per item
+ * it is asked to return */
+#define SCAN_EMPTY_VISITS 10
+
+/* Batch operations have up to this many keys' memory accesses in flight */
+#define BATCH_SIZE 16
+
+#define SIZE_BITS (sizeof(size_t) * CHAR_BIT)
+
+/* Chained entries are carved from slabs holding between SLAB_MIN_ENTRIES and
+ * SLAB_MAX_ENTRIES entries, each slab twice the size of the previous one */
+#define SLAB_MIN_ENTRIES 16
+#define SLAB_MAX_ENTRIES 4096
+
+/* Inline key and value areas are padded to this alignment */
+#define INLINE_ALIGN 8
+#define ALIGN_UP(n) (((n) + INLINE_ALIGN - 1) & ~(size_t)(INLINE_ALIGN - 1))
+
+/*
+ * Open addressing: slots are arranged in groups of GROUP_SIZE, each slot
+ * having a control byte which is either EMPTY, DELETED, or the low 7 bits of
+ * the entry's hash. A whole group's control bytes are matched at once.
+ */
+#define GROUP_BITS 4
+#define GROUP_SIZE (1 << GROUP_BITS)
+#define CTRL_EMPTY 0x80
+#define CTRL_DELETED 0xfe
 
-#define TABLE_SIZE ((int)(sizeof(prime_size_table) / sizeof(int)))
+/*
+ * Compact engine: entries are appended to a dense array, and an index of
+ * 2^nbits slots holds entry numbers (plus INDEX_FIRST), using as few bytes
+ * per slot as the table's size allows. Deleted entries stay in the array,
+ * marked COMPACT_DELETED, until the table is rebuilt.
+ */
+#define INDEX_EMPTY 0
+#define INDEX_DELETED 1
+#define INDEX_FIRST 2
+#define COMPACT_DELETED ((size_t)-1)
 
 struct genhash_entry_t {
     /** The key for this entry */
@@ -27,17 +107,128 @@ struct genhash_entry_t {
     void *value;
     /** Size of the value */
     size_t nvalue;
-    /** Pointer to the next entry */
-    struct genhash_entry_t *next;
+    /** Hash of the key, as returned by genhash_hv() */
+    size_t hv;
+    union {
+        /** Pointer to the next entry (chained engine) */
+        struct genhash_entry_t *next;
+        /** Insertion order, used to find the newest of duplicate keys
+         * (open addressing engine) */
+        size_t seq;
+        /** Index slot referring to the entry, or COMPACT_DELETED (compact
+         * engine) */
+        size_t slot;
+    } u;
 };
 
-struct _genhash {
+struct genhash_table {
+    /** Bucket heads (chained engine) */
+    struct genhash_entry_t **buckets;
+    /** Control bytes, one per slot (open addressing engine) */
+    unsigned char *ctrl;
+    /** Entries (open addressing engine) */
+    struct genhash_entry_t *slots;
+    /** log2 of the number of buckets or slots */
+    size_t nbits;
+    /** Number of buckets or slots, 0 if the table is not allocated */
     size_t size;
+    /** Number of EMPTY slots which may still be filled (open addressing),
+     * or of entries which may still be appended (compact) */
+    size_t growth_left;
+    /** Index of entry numbers, each `iwidth` bytes (compact engine) */
+    void *index;
+    unsigned iwidth;
+    /** Number of entries appended, including deleted ones (compact) */
+    size_t nused;
+};
+
+struct genhash_slab {
+    struct genhash_slab *next;
+    /** Number of entries in this slab */
+    size_t nentries;
+    /** Entries, each genhash::entry_size bytes long */
+    struct genhash_entry_t entries[];
+};
+
+/**
+ * Values of a key in a multimap table (TL_HT_F_MULTI), oldest first. The
+ * key's entry points to this through its `value` field
+ */
+struct genhash_values {
+    size_t n;
+    size_t cap;
+    struct {
+        void *value;
+        size_t nvalue;
+    } items[];
+};
+
+/** Location of an entry, as needed to remove it */
+struct genhash_pos {
+    struct genhash_table *t;
+    /** Link pointing to the entry (chained engine) */
+    struct genhash_entry_t **pp;
+};
+
+struct _genhash {
     struct tl_HASHOPS ops;
-    struct genhash_entry_t *buckets[];
+    /** Table which receives new entries */
+    struct genhash_table cur;
+    /** Table being drained into `cur` while a resize is in progress */
+    struct genhash_table old;
+    /** Next bucket (or slot) of `old` to be migrated */
+    size_t rehashidx;
+    /** Number of entries in both tables */
+    size_t nitems;
+    /** Number of values held by multimap entries */
+    size_t nvalues;
+    /** Next insertion sequence number */
+    size_t seq;
+    /** The table never shrinks below this (derived from `est`) */
+    size_t min_bits;
+    /** Slabs for chained entries, newest first */
+    struct genhash_slab *slabs;
+    /** Number of never-used entries at the end of the newest slab */
+    size_t slab_avail;
+    /** Released entries, linked through u.next */
+    struct genhash_entry_t *freelist;
+    size_t nfree;
+    /**
+     * Size of an entry record. Records are followed by `inline_value` and
+     * then `inline_key` bytes, into which small values and keys are copied
+     */
+    size_t entry_size;
+    size_t inline_key;
+    size_t inline_value;
+    /** Seed for ops.hashfunc64 */
+    uint64_t seed;
+    int engine;
+    unsigned flags;
+    unsigned max_load;
+    unsigned min_load;
+    /**
+     * Negative lookup filter (TL_HT_F_FILTER) holding the keys of `cur`, and
+     * the one holding those of `old` while a resize is in progress
+     */
+    tl_BLOOM *filter;
+    tl_BLOOM *old_filter;
+    struct tl_BLOOMPARAMS filter_params;
+    double filter_fpr;
+    /** Number of keys `filter` is sized for */
+    size_t filter_cap;
+    /** Number of keys deleted since `filter` was built */
+    size_t filter_stale;
+    /** Lookups, and the probes they made (TL_HT_F_STATS) */
+    size_t nhits;
+    size_t nmisses;
+    size_t hit_probes;
+    size_t miss_probes;
 };
 
 static size_t estimate_table_size(size_t est);
+static struct genhash_entry_t *find_entry_hv(tl_HASHTABLE *h, size_t hv,
+                                             const void *k, size_t klen,
+                                             struct genhash_pos *pos);
 
 
 static void *dup_key(tl_HASHTABLE *h, const void *key, size_t klen)
@@ -72,344 +263,2704 @@ static void free_value(tl_HASHTABLE *h, void *value)
     }
 }
 
+/**
+ * Returns log2 of the bucket count for `est` items
+ */
 static size_t estimate_table_size(size_t est)
 {
-    size_t rv = 0;
-    while (prime_size_table[rv] < est && rv + 1 < TABLE_SIZE) {
+    size_t rv = MIN_TABLE_BITS;
+    while (((size_t)1 << rv) < est && rv < MAX_TABLE_BITS) {
         rv++;
     }
-    return prime_size_table[rv];
+    return rv;
 }
 
-void tl_ht_free(tl_HASHTABLE *h)
+/**
+ * Bucket indexes are taken from the high bits of the hash, so the value
+ * returned by the user's hash function is mixed first; this keeps weak
+ * functions (e.g. ones which only vary in their low bits) usable with
+ * power-of-two tables.
+ */
+static size_t genhash_mix(size_t v)
 {
-    if (h != NULL) {
-        tl_ht_clear(h);
-        free(h);
-    }
+#if SIZE_MAX > 0xffffffffUL
+    v ^= v >> 33;
+    v *= (size_t)0xff51afd7ed558ccdULL;
+    v ^= v >> 33;
+    v *= (size_t)0xc4ceb9fe1a85ec53ULL;
+    v ^= v >> 33;
+#else
+    v ^= v >> 16;
+    v *= 0x85ebca6bUL;
+    v ^= v >> 13;
+    v *= 0xc2b2ae35UL;
+    v ^= v >> 16;
+#endif
+    return v;
 }
 
-int tl_ht_store(tl_HASHTABLE *h, const void *k, size_t klen,
-                  const void *v, size_t vlen)
+uint64_t tl_ht_hash(tl_HASHTABLE *h, const void *k, size_t klen)
 {
-    size_t n = 0;
-    struct genhash_entry_t *p;
-
-    assert(h != NULL);
-
-    n = h->ops.hashfunc(k, klen) % h->size;
-    assert(n < h->size);
-
-    p = calloc(1, sizeof(struct genhash_entry_t));
-    if (!p) {
-        return -1;
+    if (h->ops.hashfunc64 != NULL) {
+        return h->ops.hashfunc64(k, klen, h->seed);
     }
+    return (unsigned)h->ops.hashfunc(k, klen);
+}
 
-    p->key = dup_key(h, k, klen);
-    p->nkey = klen;
-    p->value = dup_value(h, v, vlen);
-    p->nvalue = vlen;
-
-    p->next = h->buckets[n];
-    h->buckets[n] = p;
-    return 0;
+/** Convert a value returned by tl_ht_hash() into the hash stored in entries */
+static size_t genhash_hv(uint64_t hash)
+{
+    return genhash_mix((size_t)(hash ^ (hash >> 32)));
 }
 
-static struct genhash_entry_t *genhash_find_entry(tl_HASHTABLE *h,
-                                                  const void *k,
-                                                  size_t klen)
+static size_t genhash_hash(tl_HASHTABLE *h, const void *k, size_t klen)
 {
-    size_t n = 0;
-    struct genhash_entry_t *p;
+    return genhash_hv(tl_ht_hash(h, k, klen));
+}
 
-    assert(h != NULL);
-    n = h->ops.hashfunc(k, klen) % h->size;
-    assert(n < h->size);
+static char *inline_value_of(struct genhash_entry_t *e)
+{
+    return (char *)(e + 1);
+}
 
-    p = h->buckets[n];
-    for (p = h->buckets[n]; p && !h->ops.hasheq(k, klen, p->key, p->nkey); p = p->next);
-    return p;
+static char *inline_key_of(tl_HASHTABLE *h, struct genhash_entry_t *e)
+{
+    return (char *)(e + 1) + h->inline_value;
 }
 
-void *tl_ht_find(tl_HASHTABLE *h, const void *k, size_t klen)
+static int key_is_inline(tl_HASHTABLE *h, struct genhash_entry_t *e)
 {
-    struct genhash_entry_t *p;
-    void *rv = NULL;
+    return h->inline_key && e->key == inline_key_of(h, e);
+}
 
-    p = genhash_find_entry(h, k, klen);
+static int value_is_inline(tl_HASHTABLE *h, struct genhash_entry_t *e)
+{
+    return h->inline_value && e->value == inline_value_of(e);
+}
 
-    if (p) {
-        rv = p->value;
+static void set_key(tl_HASHTABLE *h, struct genhash_entry_t *e,
+                    const void *key, size_t klen)
+{
+    if (klen && klen <= h->inline_key) {
+        e->key = inline_key_of(h, e);
+        memcpy(e->key, key, klen);
+    } else {
+        e->key = dup_key(h, key, klen);
     }
-    return rv;
+    e->nkey = klen;
 }
 
-enum tl_UPDATETYPE tl_ht_update(tl_HASHTABLE *h, const void *k, size_t klen,
-                                const void *v, size_t vlen)
+static void set_value(tl_HASHTABLE *h, struct genhash_entry_t *e,
+                      const void *value, size_t vlen)
 {
-    struct genhash_entry_t *p;
-    enum tl_UPDATETYPE rv = 0;
-
-    p = genhash_find_entry(h, k, klen);
-
-    if (p) {
-        free_value(h, p->value);
-        p->value = dup_value(h, v, vlen);
-        rv = MODIFICATION;
+    if (vlen && vlen <= h->inline_value) {
+        e->value = inline_value_of(e);
+        memcpy(e->value, value, vlen);
     } else {
-        if (-1 == tl_ht_store(h, k, klen, v, vlen)) {
-            rv = ALLOC_FAILURE;
-        }
-        rv = NEW;
+        e->value = dup_value(h, value, vlen);
     }
-
-    return rv;
+    e->nvalue = vlen;
 }
 
-enum tl_UPDATETYPE tl_ht_funupdate(tl_HASHTABLE *h,
-                                    const void *k,
-                                    size_t klen,
-                                    void * (*upd)(const void *,
-                                                  const void *,
-                                                  size_t *,
-                                                  void *),
-                                    void (*fr)(void *),
-                                    void *arg,
-                                    const void *def,
-                                    size_t deflen)
+static void release_value(tl_HASHTABLE *h, struct genhash_entry_t *e)
 {
-    struct genhash_entry_t *p;
-    enum tl_UPDATETYPE rv = 0;
-    size_t newSize = 0;
-
-    p = genhash_find_entry(h, k, klen);
-
-    if (p) {
-        void *newValue = upd(k, p->value, &newSize, arg);
-        free_value(h, p->value);
-        p->value = dup_value(h, newValue, newSize);
-        fr(newValue);
-        rv = MODIFICATION;
-    } else {
-        void *newValue = upd(k, def, &newSize, arg);
-        tl_ht_store(h, k, klen, newValue, newSize);
-        fr(newValue);
-        rv = NEW;
+    if (!value_is_inline(h, e)) {
+        free_value(h, e->value);
     }
+}
 
-    (void)deflen;
-    return rv;
+static void free_values(tl_HASHTABLE *h, struct genhash_values *vals)
+{
+    size_t i;
+    for (i = 0; i < vals->n; i++) {
+        free_value(h, vals->items[i].value);
+    }
+    free(vals);
 }
 
 static void free_item(tl_HASHTABLE *h, struct genhash_entry_t *i)
 {
     assert(i);
-    free_key(h, i->key);
-    free_value(h, i->value);
-    free(i);
+    if (!key_is_inline(h, i)) {
+        free_key(h, i->key);
+    }
+    if (h->flags & TL_HT_F_MULTI) {
+        free_values(h, i->value);
+    } else {
+        release_value(h, i);
+    }
 }
 
-int tl_ht_del(tl_HASHTABLE *h, const void *k, size_t klen)
+/** Allocate an empty value vector with room for `cap` values */
+static struct genhash_values *values_alloc(size_t cap)
 {
-    struct genhash_entry_t *deleteme = NULL;
-    size_t n = 0;
-    int rv = 0;
+    struct genhash_values *vals;
+    vals = malloc(sizeof(*vals) + cap * sizeof(vals->items[0]));
+    if (vals != NULL) {
+        vals->n = 0;
+        vals->cap = cap;
+    }
+    return vals;
+}
 
-    assert(h != NULL);
-    n = h->ops.hashfunc(k, klen) % h->size;
-    assert(n < h->size);
-
-    if (h->buckets[n] != NULL) {
-        /* Special case the first one */
-        if (h->ops.hasheq(h->buckets[n]->key, h->buckets[n]->nkey, k, klen)) {
-            deleteme = h->buckets[n];
-            h->buckets[n] = deleteme->next;
-        } else {
-            struct genhash_entry_t *p = NULL;
-            for (p = h->buckets[n]; deleteme == NULL && p->next != NULL; p = p->next) {
-                if (h->ops.hasheq(p->next->key, p->next->nkey, k, klen)) {
-                    deleteme = p->next;
-                    p->next = deleteme->next;
-                }
-            }
+/**
+ * Append a value to a multimap entry, growing its vector if needed.
+ * Returns -1 if it cannot grow
+ */
+static int values_push(tl_HASHTABLE *h, struct genhash_entry_t *e,
+                       const void *v, size_t vlen)
+{
+    struct genhash_values *vals = e->value;
+
+    if (vals->n == vals->cap) {
+        vals = realloc(vals, sizeof(*vals) + vals->cap * 2 * sizeof(vals->items[0]));
+        if (vals == NULL) {
+            return -1;
         }
+        vals->cap *= 2;
+        e->value = vals;
     }
-    if (deleteme != NULL) {
-        free_item(h, deleteme);
-        rv++;
+    vals->items[vals->n].value = dup_value(h, v, vlen);
+    vals->items[vals->n].nvalue = vlen;
+    vals->n++;
+    h->nvalues++;
+    return 0;
+}
+
+/**
+ * Location of the newest value of an entry, and of its length: the entry's
+ * own fields, or the last item of a multimap entry's vector
+ */
+static void **newest_value(tl_HASHTABLE *h, struct genhash_entry_t *e,
+                           size_t **nvalue)
+{
+    if (h->flags & TL_HT_F_MULTI) {
+        struct genhash_values *vals = e->value;
+        *nvalue = &vals->items[vals->n - 1].nvalue;
+        return &vals->items[vals->n - 1].value;
     }
+    *nvalue = &e->nvalue;
+    return &e->value;
+}
 
-    return rv;
+/** Replace the newest value of an entry */
+static void replace_value(tl_HASHTABLE *h, struct genhash_entry_t *e,
+                          const void *v, size_t vlen)
+{
+    if (h->flags & TL_HT_F_MULTI) {
+        size_t *nvalue;
+        void **value = newest_value(h, e, &nvalue);
+        free_value(h, *value);
+        *value = dup_value(h, v, vlen);
+        *nvalue = vlen;
+    } else {
+        release_value(h, e);
+        set_value(h, e, v, vlen);
+    }
 }
 
-int tl_ht_delall(tl_HASHTABLE *h, const void *k, size_t klen)
+/**
+ * Pass each value of an entry to `iterfunc`, newest first.
+ * Returns the number of values
+ */
+static size_t visit_entry(tl_HASHTABLE *h, struct genhash_entry_t *e,
+                          tl_HASHITER_cb iterfunc, void *arg)
 {
-    int rv = 0;
-    while (tl_ht_del(h, k, klen) == 1) {
-        rv++;
+    struct genhash_values *vals;
+    size_t i;
+
+    if (!(h->flags & TL_HT_F_MULTI)) {
+        iterfunc(e->key, e->nkey, e->value, e->nvalue, arg);
+        return 1;
     }
-    return rv;
+    vals = e->value;
+    for (i = vals->n; i > 0; i--) {
+        iterfunc(e->key, e->nkey, vals->items[i - 1].value,
+                 vals->items[i - 1].nvalue, arg);
+    }
+    return vals->n;
 }
 
-void tl_ht_iter(tl_HASHTABLE *h,
-                  void (*iterfunc)(const void *key, size_t nkey,
-                                   const void *val, size_t nval,
-                                   void *arg), void *arg)
+/**
+ * Copy an entry record to a new location, repointing inline keys and values
+ */
+static void move_entry(tl_HASHTABLE *h, struct genhash_entry_t *dst,
+                       struct genhash_entry_t *src)
 {
-    size_t i = 0;
-    struct genhash_entry_t *p = NULL;
-    assert(h != NULL);
+    int kinline = key_is_inline(h, src), vinline = value_is_inline(h, src);
 
-    for (i = 0; i < h->size; i++) {
-        for (p = h->buckets[i]; p != NULL; p = p->next) {
-            iterfunc(p->key, p->nkey, p->value, p->nvalue, arg);
-        }
+    memcpy(dst, src, h->entry_size);
+    if (kinline) {
+        dst->key = inline_key_of(h, dst);
+    }
+    if (vinline) {
+        dst->value = inline_value_of(dst);
     }
 }
 
-int tl_ht_clear(tl_HASHTABLE *h)
+/******************************************************************************
+ * Chained engine
+ ******************************************************************************/
+
+static struct genhash_entry_t *entry_alloc(tl_HASHTABLE *h)
 {
-    size_t i = 0;
-    int rv = 0;
-    assert(h != NULL);
+    struct genhash_entry_t *e;
+
+    if (h->freelist != NULL) {
+        e = h->freelist;
+        h->freelist = e->u.next;
+        h->nfree--;
+        return e;
+    }
 
-    for (i = 0; i < h->size; i++) {
-        while (h->buckets[i]) {
-            struct genhash_entry_t *p = NULL;
-            p = h->buckets[i];
-            h->buckets[i] = p->next;
-            free_item(h, p);
+    if (h->slab_avail == 0) {
+        size_t n = SLAB_MIN_ENTRIES;
+        struct genhash_slab *slab;
+
+        if (h->slabs != NULL) {
+            n = h->slabs->nentries * 2;
+            if (n > SLAB_MAX_ENTRIES) {
+                n = SLAB_MAX_ENTRIES;
+            }
         }
+        slab = malloc(sizeof(*slab) + n * h->entry_size);
+        if (slab == NULL) {
+            return NULL;
+        }
+        slab->nentries = n;
+        slab->next = h->slabs;
+        h->slabs = slab;
+        h->slab_avail = n;
     }
 
-    return rv;
+    e = (struct genhash_entry_t *)((char *)h->slabs->entries +
+            (h->slabs->nentries - h->slab_avail--) * h->entry_size);
+    return e;
 }
 
-static void count_entries(const void *key,
-                          size_t klen,
-                          const void *val,
-                          size_t vlen,
-                          void *arg)
+static void entry_release(tl_HASHTABLE *h, struct genhash_entry_t *e)
 {
-    int *count = (int *)arg;
-    (*count)++;
-    (void)key;
-    (void)klen;
-    (void)val;
-    (void)vlen;
+    e->u.next = h->freelist;
+    h->freelist = e;
+    h->nfree++;
 }
 
-int tl_ht_size(tl_HASHTABLE *h)
+/** Free every slab, and with it every chained entry */
+static void slabs_release(tl_HASHTABLE *h)
 {
-    int rv = 0;
-    assert(h != NULL);
-    tl_ht_iter(h, count_entries, &rv);
-    return rv;
+    while (h->slabs != NULL) {
+        struct genhash_slab *slab = h->slabs;
+        h->slabs = slab->next;
+        free(slab);
+    }
+    h->slab_avail = 0;
+    h->freelist = NULL;
+    h->nfree = 0;
 }
 
-int tl_ht_sizekey(tl_HASHTABLE *h, const void *k, size_t klen)
+static size_t bucket_of(const struct genhash_table *t, size_t hv)
 {
-    int rv = 0;
-    assert(h != NULL);
-    tl_ht_iterkey(h, k, klen, count_entries, &rv);
-    return rv;
+    return hv >> (SIZE_BITS - t->nbits);
 }
 
-void tl_ht_iterkey(tl_HASHTABLE *h, const void *key, size_t klen,
-                      void (*iterfunc)(const void *key, size_t klen,
-                                       const void *val, size_t vlen,
-                                       void *arg), void *arg)
+/**
+ * Find the link pointing to the most recent entry for the key in a table.
+ * Each entry visited counts as a probe
+ */
+static struct genhash_entry_t **chain_findp(tl_HASHTABLE *h,
+                                            struct genhash_table *t,
+                                            size_t hv,
+                                            const void *k,
+                                            size_t klen,
+                                            size_t *probes)
 {
-    size_t n = 0;
-    struct genhash_entry_t *p = NULL;
-
-    assert(h != NULL);
-    n = h->ops.hashfunc(key, klen) % h->size;
-    assert(n < h->size);
+    struct genhash_entry_t **pp;
 
-    for (p = h->buckets[n]; p != NULL; p = p->next) {
-        if (h->ops.hasheq(key, klen, p->key, p->nkey)) {
-            iterfunc(p->key, p->nkey, p->value, p->nvalue, arg);
+    pp = &t->buckets[bucket_of(t, hv)];
+    for (; *pp; pp = &(*pp)->u.next) {
+        ++*probes;
+        if ((*pp)->hv == hv && h->ops.hasheq(k, klen, (*pp)->key, (*pp)->nkey)) {
+            return pp;
         }
     }
+    return NULL;
 }
 
-int tl_ht_strhash(const void *p, size_t nkey)
+static struct genhash_entry_t *chain_insert(tl_HASHTABLE *h,
+                                            struct genhash_table *t,
+                                            size_t hv)
 {
-    int rv = 5381;
-    int i = 0;
-    char *str = (char *)p;
-
-    for (i = 0; i < (int)nkey; i++) {
-        assert(str[i]);
-        rv = ((rv << 5) + rv) ^ str[i];
-    }
-
-    return rv;
-}
+    size_t n = bucket_of(t, hv);
+    struct genhash_entry_t *p;
 
-tl_HASHTABLE* tl_ht_new(size_t est, struct tl_HASHOPS ops) {
-    tl_HASHTABLE *rv = NULL;
-    size_t size = 0;
-    if (est < 1) {
-        return NULL ;
-    }
-    assert(ops.hashfunc != NULL);
-    assert(ops.hasheq != NULL);
-    assert((ops.dup_key != NULL && ops.free_key != NULL) || ops.free_key == NULL);
-    assert((ops.dup_value != NULL && ops.free_value != NULL) || ops.free_value == NULL);
-    size = estimate_table_size(est);
-    rv = calloc(1,
-                sizeof(tl_HASHTABLE)
-                        + (size * sizeof(struct genhash_entry_t*)));
-    if (rv == NULL ) {
-        return NULL ;
+    p = entry_alloc(h);
+    if (!p) {
+        return NULL;
     }
-    rv->size = size;
-    rv->ops = ops;
-    return rv;
+    p->hv = hv;
+    p->u.next = t->buckets[n];
+    t->buckets[n] = p;
+    return p;
 }
 
-
 /**
- * Convenience functions for creating string-based hashes
+ * Move a chain from the old table into the current one.
+ *
+ * Entries in the current table are always newer than those still in the
+ * old table, so migrated entries are placed at the tail of their new
+ * bucket. Entries of the same key keep their relative order, which keeps
+ * "most recent value" semantics intact across a resize. The stored hash is
+ * used, so the hash function is never called again.
  */
-static int
-hasheq_strp(const void *a, size_t na, const void *b, size_t nb)
+static void migrate_chain(tl_HASHTABLE *h, struct genhash_entry_t *chain)
 {
-    if (na != nb) {
-        return 0;
+    while (chain != NULL) {
+        size_t n = bucket_of(&h->cur, chain->hv);
+        struct genhash_entry_t *moved = NULL, **mtail = &moved;
+        struct genhash_entry_t **pp = &chain, **tail;
+
+        /* Pull out every entry destined for bucket `n`, preserving order */
+        while (*pp != NULL) {
+            struct genhash_entry_t *p = *pp;
+            if (bucket_of(&h->cur, p->hv) == n) {
+                *pp = p->u.next;
+                p->u.next = NULL;
+                *mtail = p;
+                mtail = &p->u.next;
+                if (h->filter != NULL) {
+                    tl_bloom_add(h->filter, p->hv);
+                }
+            } else {
+                pp = &p->u.next;
+            }
+        }
+
+        for (tail = &h->cur.buckets[n]; *tail != NULL; tail = &(*tail)->u.next);
+        *tail = moved;
     }
-    return memcmp(a, b, na) == 0;
 }
 
-static struct tl_HASHOPS hashops_nocopy = {
-    tl_ht_strhash,
-    hasheq_strp,
-    NULL,
-    NULL,
-    NULL,
-    NULL
-};
+static void chain_rehash_step(tl_HASHTABLE *h)
+{
+    size_t moved = 0, visits = 0;
 
-static int u32_hash(const void *p, size_t n)
+    while (moved < REHASH_STEP && h->rehashidx < h->old.size) {
+        struct genhash_entry_t *p = h->old.buckets[h->rehashidx];
+        h->old.buckets[h->rehashidx++] = NULL;
+        if (p == NULL) {
+            if (++visits == REHASH_EMPTY_VISITS) {
+                break;
+            }
+            continue;
+        }
+        migrate_chain(h, p);
+        moved++;
+    }
+}
+
+static void chain_iter(tl_HASHTABLE *h, struct genhash_table *t,
+                       tl_HASHITER_cb iterfunc, void *arg)
 {
-    (void)p;
-    return n;
+    size_t i = 0;
+    struct genhash_entry_t *p = NULL;
+
+    for (i = 0; i < t->size; i++) {
+        for (p = t->buckets[i]; p != NULL; p = p->u.next) {
+            visit_entry(h, p, iterfunc, arg);
+        }
+    }
 }
 
-static int u32_eq(const void *a, size_t na, const void *b, size_t nb)
+/**
+ * Whether `hv` lies in the hash range [lo, hi). A `hi` of 0 stands for the
+ * end of the hash space
+ */
+static int hash_in_range(size_t hv, size_t lo, size_t hi)
 {
-    (void)a; (void)b;
-    return na == nb;
+    return hv >= lo && (hi == 0 || hv < hi);
 }
 
-static struct tl_HASHOPS hashops_u32 = {
-        u32_hash,
+/**
+ * Visit the entries whose hash lies in [lo, hi). The range never spans more
+ * than one bucket (see tl_ht_scan())
+ */
+static size_t chain_scan(tl_HASHTABLE *h, struct genhash_table *t,
+                         size_t lo, size_t hi,
+                         tl_HASHITER_cb iterfunc, void *arg)
+{
+    struct genhash_entry_t *p;
+    size_t rv = 0;
+
+    for (p = t->buckets[bucket_of(t, lo)]; p != NULL; p = p->u.next) {
+        if (hash_in_range(p->hv, lo, hi)) {
+            rv += visit_entry(h, p, iterfunc, arg);
+        }
+    }
+    return rv;
+}
+
+/**
+ * Empty the buckets. The entries themselves are reclaimed all at once by
+ * slabs_release(), so they only need visiting if keys or values must be
+ * freed
+ */
+static void chain_clear(tl_HASHTABLE *h, struct genhash_table *t)
+{
+    size_t i = 0;
+    struct genhash_entry_t *p = NULL;
+
+    if (h->ops.free_key != NULL || h->ops.free_value != NULL ||
+            (h->flags & TL_HT_F_MULTI)) {
+        for (i = 0; i < t->size; i++) {
+            for (p = t->buckets[i]; p != NULL; p = p->u.next) {
+                free_item(h, p);
+            }
+        }
+    }
+    memset(t->buckets, 0, t->size * sizeof(*t->buckets));
+}
+
+static void chain_iterkey(tl_HASHTABLE *h, struct genhash_table *t,
+                          size_t hv, const void *key, size_t klen,
+                          tl_HASHITER_cb iterfunc, void *arg)
+{
+    struct genhash_entry_t *p = NULL;
+
+    for (p = t->buckets[bucket_of(t, hv)]; p != NULL; p = p->u.next) {
+        if (p->hv == hv && h->ops.hasheq(key, klen, p->key, p->nkey)) {
+            visit_entry(h, p, iterfunc, arg);
+        }
+    }
+}
+
+/******************************************************************************
+ * Open addressing engine
+ ******************************************************************************/
+
+static struct genhash_entry_t *slot_at(tl_HASHTABLE *h,
+                                       const struct genhash_table *t,
+                                       size_t n)
+{
+    return (struct genhash_entry_t *)((char *)t->slots + n * h->entry_size);
+}
+
+/** Returns a bitmask of the slots in the group whose control byte is `c` */
+static unsigned group_match(const unsigned char *g, unsigned char c)
+{
+#ifdef GENHASH_SSE2
+    __m128i ctrl = _mm_loadu_si128((const __m128i *)g);
+    return (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char)c)));
+#else
+    unsigned i, rv = 0;
+    for (i = 0; i < GROUP_SIZE; i++) {
+        rv |= (unsigned)(g[i] == c) << i;
+    }
+    return rv;
+#endif
+}
+
+/** Returns a bitmask of the EMPTY or DELETED slots in the group */
+static unsigned group_match_free(const unsigned char *g)
+{
+#ifdef GENHASH_SSE2
+    return (unsigned)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)g));
+#else
+    unsigned i, rv = 0;
+    for (i = 0; i < GROUP_SIZE; i++) {
+        rv |= (unsigned)(g[i] >> 7) << i;
+    }
+    return rv;
+#endif
+}
+
+static unsigned lowest_bit(unsigned mask)
+{
+#if defined(__GNUC__)
+    return (unsigned)__builtin_ctz(mask);
+#elif defined(_MSC_VER)
+    unsigned long rv;
+    _BitScanForward(&rv, mask);
+    return (unsigned)rv;
+#else
+    unsigned rv = 0;
+    while (!(mask & 1)) {
+        mask >>= 1;
+        rv++;
+    }
+    return rv;
+#endif
+}
+
+static unsigned char ctrl_of(size_t hv)
+{
+    return (unsigned char)(hv & 0x7f);
+}
+
+/** Number of groups in the table */
+static size_t ngroups(const struct genhash_table *t)
+{
+    return t->size >> GROUP_BITS;
+}
+
+/** Number of slots which may be filled before the table must be rebuilt */
+static size_t max_growth(const tl_HASHTABLE *h, size_t size)
+{
+    return size / 100 * h->max_load + size % 100 * h->max_load / 100;
+}
+
+/** Number of entries a table of the open or compact engine can hold */
+static size_t table_capacity(const tl_HASHTABLE *h, const struct genhash_table *t)
+{
+    size_t rv = max_growth(h, t->size);
+    return rv ? rv : 1;
+}
+
+/** Group at which probing for `hv` starts */
+static size_t group_of(const struct genhash_table *t, size_t hv)
+{
+    size_t gbits = t->nbits - GROUP_BITS;
+    return gbits ? hv >> (SIZE_BITS - gbits) : 0;
+}
+
+/**
+ * Find the most recent entry for the key. Probing moves linearly through the
+ * groups, stopping at the first group which has an EMPTY slot. Each group
+ * visited counts as a probe.
+ */
+static struct genhash_entry_t *open_find(tl_HASHTABLE *h,
+                                         struct genhash_table *t,
+                                         size_t hv,
+                                         const void *k,
+                                         size_t klen,
+                                         size_t *probes)
+{
+    size_t g = group_of(t, hv), i;
+    unsigned char c = ctrl_of(hv);
+    struct genhash_entry_t *rv = NULL;
+
+    for (i = 0; i < ngroups(t); i++, g = (g + 1) & (ngroups(t) - 1)) {
+        const unsigned char *ctrl = t->ctrl + (g << GROUP_BITS);
+        unsigned mask = group_match(ctrl, c);
+
+        ++*probes;
+        while (mask) {
+            struct genhash_entry_t *e;
+            e = slot_at(h, t, (g << GROUP_BITS) + lowest_bit(mask));
+            if (e->hv == hv && (rv == NULL || e->u.seq > rv->u.seq) &&
+                    h->ops.hasheq(k, klen, e->key, e->nkey)) {
+                rv = e;
+            }
+            mask &= mask - 1;
+        }
+        if (group_match(ctrl, CTRL_EMPTY)) {
+            break;
+        }
+    }
+    return rv;
+}
+
+/**
+ * Claim a slot for a new entry. Returns NULL if the table has reached its
+ * maximum load and no DELETED slot could be reused, unless `force` is set.
+ */
+static struct genhash_entry_t *open_insert(tl_HASHTABLE *h,
+                                           struct genhash_table *t,
+                                           size_t hv,
+                                           int force)
+{
+    size_t g = group_of(t, hv), i;
+
+    for (i = 0; i < ngroups(t); i++, g = (g + 1) & (ngroups(t) - 1)) {
+        unsigned char *ctrl = t->ctrl + (g << GROUP_BITS);
+        unsigned mask = group_match_free(ctrl);
+        size_t n;
+
+        if (!mask) {
+            continue;
+        }
+        n = (g << GROUP_BITS) + lowest_bit(mask);
+        if (t->ctrl[n] == CTRL_EMPTY) {
+            if (t->growth_left == 0 && !force) {
+                return NULL;
+            }
+            if (t->growth_left) {
+                t->growth_left--;
+            }
+        }
+        t->ctrl[n] = ctrl_of(hv);
+        slot_at(h, t, n)->hv = hv;
+        return slot_at(h, t, n);
+    }
+    return NULL;
+}
+
+static void open_remove(tl_HASHTABLE *h, struct genhash_table *t,
+                        struct genhash_entry_t *e)
+{
+    size_t n = (size_t)((char *)e - (char *)t->slots) / h->entry_size;
+    unsigned char *ctrl = t->ctrl + (n & ~(size_t)(GROUP_SIZE - 1));
+
+    /* A group with an EMPTY slot has never been full, so no probe sequence
+     * runs past it and the slot can be emptied rather than tombstoned */
+    if (group_match(ctrl, CTRL_EMPTY)) {
+        t->ctrl[n] = CTRL_EMPTY;
+        t->growth_left++;
+    } else {
+        t->ctrl[n] = CTRL_DELETED;
+    }
+}
+
+static void open_rehash_step(tl_HASHTABLE *h)
+{
+    size_t n, end = h->rehashidx + GROUP_SIZE;
+
+    for (n = h->rehashidx; n < end; n++) {
+        struct genhash_entry_t *src = slot_at(h, &h->old, n), *dst;
+        if (h->old.ctrl[n] & 0x80) {
+            continue;
+        }
+        dst = open_insert(h, &h->cur, src->hv, 1);
+        assert(dst != NULL);
+        move_entry(h, dst, src);
+        if (h->filter != NULL) {
+            tl_bloom_add(h->filter, dst->hv);
+        }
+        /* Keep probe sequences through this slot intact */
+        h->old.ctrl[n] = CTRL_DELETED;
+    }
+    h->rehashidx = end;
+}
+
+static void open_iter(tl_HASHTABLE *h, struct genhash_table *t,
+                      tl_HASHITER_cb iterfunc, void *arg)
+{
+    size_t i;
+    for (i = 0; i < t->size; i++) {
+        if (!(t->ctrl[i] & 0x80)) {
+            visit_entry(h, slot_at(h, t, i), iterfunc, arg);
+        }
+    }
+}
+
+/**
+ * Visit the entries whose hash lies in [lo, hi). Their home groups are those
+ * from group_of(lo) to group_of(hi - 1), but an entry may have been placed
+ * further along: probing carries on past groups which have no EMPTY slot, so
+ * the scan does too.
+ */
+static size_t open_scan(tl_HASHTABLE *h, struct genhash_table *t,
+                        size_t lo, size_t hi,
+                        tl_HASHITER_cb iterfunc, void *arg)
+{
+    size_t g = group_of(t, lo), last = group_of(t, hi - 1), i, j;
+    size_t rv = 0;
+    int reached = 0;
+
+    for (i = 0; i < ngroups(t); i++, g = (g + 1) & (ngroups(t) - 1)) {
+        const unsigned char *ctrl = t->ctrl + (g << GROUP_BITS);
+
+        for (j = 0; j < GROUP_SIZE; j++) {
+            struct genhash_entry_t *e;
+            if (ctrl[j] & 0x80) {
+                continue;
+            }
+            e = slot_at(h, t, (g << GROUP_BITS) + j);
+            if (hash_in_range(e->hv, lo, hi)) {
+                rv += visit_entry(h, e, iterfunc, arg);
+            }
+        }
+        if (g == last) {
+            reached = 1;
+        }
+        if (reached && group_match(ctrl, CTRL_EMPTY)) {
+            break;
+        }
+    }
+    return rv;
+}
+
+static void open_clear(tl_HASHTABLE *h, struct genhash_table *t)
+{
+    size_t i;
+
+    if (h->ops.free_key != NULL || h->ops.free_value != NULL ||
+            (h->flags & TL_HT_F_MULTI)) {
+        for (i = 0; i < t->size; i++) {
+            if (!(t->ctrl[i] & 0x80)) {
+                free_item(h, slot_at(h, t, i));
+            }
+        }
+    }
+    memset(t->ctrl, CTRL_EMPTY, t->size);
+    t->growth_left = max_growth(h, t->size);
+}
+
+static void open_iterkey(tl_HASHTABLE *h, struct genhash_table *t,
+                         size_t hv, const void *key, size_t klen,
+                         tl_HASHITER_cb iterfunc, void *arg)
+{
+    size_t g = group_of(t, hv), i;
+    unsigned char c = ctrl_of(hv);
+
+    for (i = 0; i < ngroups(t); i++, g = (g + 1) & (ngroups(t) - 1)) {
+        const unsigned char *ctrl = t->ctrl + (g << GROUP_BITS);
+        unsigned mask = group_match(ctrl, c);
+
+        while (mask) {
+            struct genhash_entry_t *e;
+            e = slot_at(h, t, (g << GROUP_BITS) + lowest_bit(mask));
+            if (e->hv == hv && h->ops.hasheq(key, klen, e->key, e->nkey)) {
+                visit_entry(h, e, iterfunc, arg);
+            }
+            mask &= mask - 1;
+        }
+        if (group_match(ctrl, CTRL_EMPTY)) {
+            break;
+        }
+    }
+}
+
+/******************************************************************************
+ * Compact engine
+ ******************************************************************************/
+
+static size_t index_get(const struct genhash_table *t, size_t n)
+{
+    switch (t->iwidth) {
+    case 1:
+        return ((const uint8_t *)t->index)[n];
+    case 2:
+        return ((const uint16_t *)t->index)[n];
+    case 4:
+        return ((const uint32_t *)t->index)[n];
+    default:
+        return ((const size_t *)t->index)[n];
+    }
+}
+
+static void index_set(struct genhash_table *t, size_t n, size_t v)
+{
+    switch (t->iwidth) {
+    case 1:
+        ((uint8_t *)t->index)[n] = (uint8_t)v;
+        break;
+    case 2:
+        ((uint16_t *)t->index)[n] = (uint16_t)v;
+        break;
+    case 4:
+        ((uint32_t *)t->index)[n] = (uint32_t)v;
+        break;
+    default:
+        ((size_t *)t->index)[n] = v;
+        break;
+    }
+}
+
+/**
+ * Bytes per index slot for a table of 2^nbits slots. There are fewer
+ * entries than slots, so every entry number fits
+ */
+static unsigned index_width(size_t nbits)
+{
+    if (nbits <= 8) {
+        return 1;
+    } else if (nbits <= 16) {
+        return 2;
+    } else if (nbits <= 32) {
+        return 4;
+    }
+    return sizeof(size_t);
+}
+
+static size_t index_next(const struct genhash_table *t, size_t n)
+{
+    return (n + 1) & (t->size - 1);
+}
+
+/**
+ * Find the most recent entry for the key. Probing is linear from the slot
+ * picked by the hash, up to the first EMPTY slot; later entries have higher
+ * numbers, so the highest numbered match is the newest. Each non-EMPTY slot
+ * visited counts as a probe.
+ */
+static struct genhash_entry_t *compact_find(tl_HASHTABLE *h,
+                                            struct genhash_table *t,
+                                            size_t hv,
+                                            const void *k,
+                                            size_t klen,
+                                            size_t *probes)
+{
+    size_t n = bucket_of(t, hv), ix;
+    struct genhash_entry_t *rv = NULL;
+
+    for (; (ix = index_get(t, n)) != INDEX_EMPTY; n = index_next(t, n)) {
+        struct genhash_entry_t *e;
+        ++*probes;
+        if (ix == INDEX_DELETED) {
+            continue;
+        }
+        e = slot_at(h, t, ix - INDEX_FIRST);
+        if (e->hv == hv && (rv == NULL || e > rv) &&
+                h->ops.hasheq(k, klen, e->key, e->nkey)) {
+            rv = e;
+        }
+    }
+    return rv;
+}
+
+/** Point the first free index slot for `hv` at entry `i` */
+static void compact_link(struct genhash_table *t, struct genhash_entry_t *e,
+                         size_t i)
+{
+    size_t n = bucket_of(t, e->hv);
+
+    while (index_get(t, n) > INDEX_DELETED) {
+        n = index_next(t, n);
+    }
+    index_set(t, n, i + INDEX_FIRST);
+    e->u.slot = n;
+}
+
+/**
+ * Append an entry. Returns NULL if the entry array is full; maybe_resize()
+ * rebuilds the table before that happens
+ */
+static struct genhash_entry_t *compact_insert(tl_HASHTABLE *h,
+                                              struct genhash_table *t,
+                                              size_t hv)
+{
+    struct genhash_entry_t *e;
+
+    if (t->growth_left == 0) {
+        return NULL;
+    }
+    t->growth_left--;
+    e = slot_at(h, t, t->nused);
+    e->hv = hv;
+    compact_link(t, e, t->nused++);
+    return e;
+}
+
+static void compact_remove(struct genhash_table *t, struct genhash_entry_t *e)
+{
+    index_set(t, e->u.slot, INDEX_DELETED);
+    e->u.slot = COMPACT_DELETED;
+}
+
+/**
+ * Move the live entries of `from` to the empty table `to`, in order,
+ * dropping the deleted ones
+ */
+static void compact_migrate(tl_HASHTABLE *h, struct genhash_table *from,
+                            struct genhash_table *to)
+{
+    size_t i;
+
+    for (i = 0; i < from->nused; i++) {
+        struct genhash_entry_t *src = slot_at(h, from, i), *dst;
+        if (src->u.slot == COMPACT_DELETED) {
+            continue;
+        }
+        dst = slot_at(h, to, to->nused);
+        move_entry(h, dst, src);
+        compact_link(to, dst, to->nused++);
+        to->growth_left--;
+        if (h->filter != NULL) {
+            tl_bloom_add(h->filter, dst->hv);
+        }
+    }
+}
+
+/** Visit the entries in insertion order */
+static void compact_iter(tl_HASHTABLE *h, struct genhash_table *t,
+                         tl_HASHITER_cb iterfunc, void *arg)
+{
+    size_t i;
+    for (i = 0; i < t->nused; i++) {
+        struct genhash_entry_t *e = slot_at(h, t, i);
+        if (e->u.slot != COMPACT_DELETED) {
+            visit_entry(h, e, iterfunc, arg);
+        }
+    }
+}
+
+/**
+ * Visit the entries whose hash lies in [lo, hi), a range covering a single
+ * index slot. As with open_scan(), entries placed further along are found
+ * by carrying on to the first EMPTY slot.
+ */
+static size_t compact_scan(tl_HASHTABLE *h, struct genhash_table *t,
+                           size_t lo, size_t hi,
+                           tl_HASHITER_cb iterfunc, void *arg)
+{
+    size_t n = bucket_of(t, lo), last = bucket_of(t, hi - 1), ix, i;
+    size_t rv = 0;
+    int reached = 0;
+
+    for (i = 0; i < t->size; i++, n = index_next(t, n)) {
+        ix = index_get(t, n);
+        if (ix >= INDEX_FIRST) {
+            struct genhash_entry_t *e = slot_at(h, t, ix - INDEX_FIRST);
+            if (hash_in_range(e->hv, lo, hi)) {
+                rv += visit_entry(h, e, iterfunc, arg);
+            }
+        }
+        if (n == last) {
+            reached = 1;
+        }
+        if (reached && ix == INDEX_EMPTY) {
+            break;
+        }
+    }
+    return rv;
+}
+
+static void compact_clear(tl_HASHTABLE *h, struct genhash_table *t)
+{
+    size_t i;
+
+    if (h->ops.free_key != NULL || h->ops.free_value != NULL ||
+            (h->flags & TL_HT_F_MULTI)) {
+        for (i = 0; i < t->nused; i++) {
+            struct genhash_entry_t *e = slot_at(h, t, i);
+            if (e->u.slot != COMPACT_DELETED) {
+                free_item(h, e);
+            }
+        }
+    }
+    memset(t->index, 0, t->size * t->iwidth);
+    t->growth_left += t->nused;
+    t->nused = 0;
+}
+
+static void compact_iterkey(tl_HASHTABLE *h, struct genhash_table *t,
+                            size_t hv, const void *key, size_t klen,
+                            tl_HASHITER_cb iterfunc, void *arg)
+{
+    size_t n = bucket_of(t, hv), ix;
+
+    for (; (ix = index_get(t, n)) != INDEX_EMPTY; n = index_next(t, n)) {
+        struct genhash_entry_t *e;
+        if (ix == INDEX_DELETED) {
+            continue;
+        }
+        e = slot_at(h, t, ix - INDEX_FIRST);
+        if (e->hv == hv && h->ops.hasheq(key, klen, e->key, e->nkey)) {
+            visit_entry(h, e, iterfunc, arg);
+        }
+    }
+}
+
+/******************************************************************************
+ * Engine dispatch
+ ******************************************************************************/
+
+static int table_init(tl_HASHTABLE *h, struct genhash_table *t, size_t nbits)
+{
+    size_t size = (size_t)1 << nbits;
+
+    memset(t, 0, sizeof(*t));
+    if (h->engine == TL_HT_ENGINE_OPEN) {
+        t->ctrl = malloc(size);
+        t->slots = malloc(size * h->entry_size);
+        if (t->ctrl == NULL || t->slots == NULL) {
+            free(t->ctrl);
+            free(t->slots);
+            return -1;
+        }
+        memset(t->ctrl, CTRL_EMPTY, size);
+        t->growth_left = max_growth(h, size);
+    } else if (h->engine == TL_HT_ENGINE_COMPACT) {
+        t->growth_left = max_growth(h, size);
+        if (t->growth_left == 0) {
+            t->growth_left = 1;
+        }
+        t->iwidth = index_width(nbits);
+        t->index = calloc(size, t->iwidth);
+        t->slots = malloc(t->growth_left * h->entry_size);
+        if (t->index == NULL || t->slots == NULL) {
+            free(t->index);
+            free(t->slots);
+            return -1;
+        }
+    } else {
+        t->buckets = calloc(size, sizeof(*t->buckets));
+        if (t->buckets == NULL) {
+            return -1;
+        }
+    }
+    t->nbits = nbits;
+    t->size = size;
+    return 0;
+}
+
+static void table_free(struct genhash_table *t)
+{
+    free(t->buckets);
+    free(t->ctrl);
+    free(t->slots);
+    free(t->index);
+    memset(t, 0, sizeof(*t));
+}
+
+static struct genhash_entry_t *table_find(tl_HASHTABLE *h,
+                                          struct genhash_table *t,
+                                          size_t hv,
+                                          const void *k,
+                                          size_t klen,
+                                          struct genhash_pos *pos,
+                                          size_t *probes)
+{
+    pos->t = t;
+    pos->pp = NULL;
+    if (t->size == 0) {
+        return NULL;
+    } else if (h->engine == TL_HT_ENGINE_OPEN) {
+        return open_find(h, t, hv, k, klen, probes);
+    } else if (h->engine == TL_HT_ENGINE_COMPACT) {
+        return compact_find(h, t, hv, k, klen, probes);
+    } else {
+        pos->pp = chain_findp(h, t, hv, k, klen, probes);
+        return pos->pp ? *pos->pp : NULL;
+    }
+}
+
+static void table_remove(tl_HASHTABLE *h, struct genhash_pos *pos,
+                         struct genhash_entry_t *e)
+{
+    free_item(h, e);
+    h->filter_stale++;
+    if (h->engine == TL_HT_ENGINE_OPEN) {
+        open_remove(h, pos->t, e);
+    } else if (h->engine == TL_HT_ENGINE_COMPACT) {
+        compact_remove(pos->t, e);
+    } else {
+        *pos->pp = e->u.next;
+        entry_release(h, e);
+    }
+}
+
+static void table_iter(tl_HASHTABLE *h, struct genhash_table *t,
+                       tl_HASHITER_cb iterfunc, void *arg)
+{
+    if (t->size == 0) {
+        return;
+    } else if (h->engine == TL_HT_ENGINE_OPEN) {
+        open_iter(h, t, iterfunc, arg);
+    } else if (h->engine == TL_HT_ENGINE_COMPACT) {
+        compact_iter(h, t, iterfunc, arg);
+    } else {
+        chain_iter(h, t, iterfunc, arg);
+    }
+}
+
+static size_t table_scan(tl_HASHTABLE *h, struct genhash_table *t,
+                         size_t lo, size_t hi,
+                         tl_HASHITER_cb iterfunc, void *arg)
+{
+    if (t->size == 0) {
+        return 0;
+    } else if (h->engine == TL_HT_ENGINE_OPEN) {
+        return open_scan(h, t, lo, hi, iterfunc, arg);
+    } else if (h->engine == TL_HT_ENGINE_COMPACT) {
+        return compact_scan(h, t, lo, hi, iterfunc, arg);
+    } else {
+        return chain_scan(h, t, lo, hi, iterfunc, arg);
+    }
+}
+
+static void table_clear(tl_HASHTABLE *h, struct genhash_table *t)
+{
+    if (t->size == 0) {
+        return;
+    } else if (h->engine == TL_HT_ENGINE_OPEN) {
+        open_clear(h, t);
+    } else if (h->engine == TL_HT_ENGINE_COMPACT) {
+        compact_clear(h, t);
+    } else {
+        chain_clear(h, t);
+    }
+}
+
+static void table_iterkey(tl_HASHTABLE *h, struct genhash_table *t,
+                          size_t hv, const void *key, size_t klen,
+                          tl_HASHITER_cb iterfunc, void *arg)
+{
+    if (t->size == 0) {
+        return;
+    } else if (h->engine == TL_HT_ENGINE_OPEN) {
+        open_iterkey(h, t, hv, key, klen, iterfunc, arg);
+    } else if (h->engine == TL_HT_ENGINE_COMPACT) {
+        compact_iterkey(h, t, hv, key, klen, iterfunc, arg);
+    } else {
+        chain_iterkey(h, t, hv, key, klen, iterfunc, arg);
+    }
+}
+
+/******************************************************************************
+ * Resizing
+ ******************************************************************************/
+
+static void rehash_step(tl_HASHTABLE *h)
+{
+    if (h->old.size == 0) {
+        return;
+    }
+
+    if (h->engine == TL_HT_ENGINE_OPEN) {
+        open_rehash_step(h);
+    } else {
+        chain_rehash_step(h);
+    }
+
+    if (h->rehashidx == h->old.size) {
+        table_free(&h->old);
+        h->rehashidx = 0;
+        tl_bloom_free(h->old_filter);
+        h->old_filter = NULL;
+    }
+}
+
+/**
+ * Number of keys the filter of a table of 2^nbits buckets (or slots) is
+ * sized for: as many as the table holds before it grows, or more if a table
+ * which cannot grow already holds more
+ */
+static size_t filter_capacity(tl_HASHTABLE *h, size_t nbits)
+{
+    size_t size = (size_t)1 << nbits;
+    size_t rv = size / 100 * h->max_load + size % 100 * h->max_load / 100;
+    return rv > h->nitems ? rv : h->nitems;
+}
+
+/**
+ * Whether the filter should be rebuilt, by rehashing at the same size: keys
+ * are never removed from it, so it degrades once many have been deleted, or
+ * once a table which cannot grow holds many more keys than it was sized for
+ */
+static int filter_needs_rebuild(tl_HASHTABLE *h)
+{
+    size_t count;
+
+    if (h->filter == NULL) {
+        return 0;
+    }
+    count = tl_bloom_count(h->filter);
+    return (h->filter_stale > h->filter_cap / 4 &&
+            count > h->filter_cap + h->filter_cap / 4) ||
+            count > h->filter_cap * 2;
+}
+
+/**
+ * Whether a key may be present. Keys move from the old filter to the
+ * current one as they are migrated, so both are checked during a resize
+ */
+static int filter_maybe(tl_HASHTABLE *h, size_t hv)
+{
+    return h->filter == NULL || tl_bloom_maybe(h->filter, hv) ||
+            (h->old_filter != NULL && tl_bloom_maybe(h->old_filter, hv));
+}
+
+/**
+ * Advance a resize on behalf of a lookup, unless lookups must not modify the
+ * table (TL_HT_F_CONST_FIND)
+ */
+static void lookup_step(tl_HASHTABLE *h)
+{
+    if (!(h->flags & TL_HT_F_CONST_FIND)) {
+        rehash_step(h);
+    }
+}
+
+/**
+ * Start a resize if the load factor is out of bounds. The entries themselves
+ * are moved incrementally by rehash_step()
+ */
+static void maybe_resize(tl_HASHTABLE *h)
+{
+    size_t nbits = h->cur.nbits;
+    struct genhash_table t;
+
+    if (h->engine != TL_HT_ENGINE_CHAINED) {
+        if (h->old.size != 0) {
+            if (h->cur.growth_left != 0) {
+                return;
+            }
+            /* Inserts have outpaced the migration; finish it now */
+            while (h->old.size != 0) {
+                rehash_step(h);
+            }
+        }
+
+        if (h->cur.growth_left == 0) {
+            /* Grow if more than half of the maximum load is live entries,
+             * otherwise rebuild at the same size to purge DELETED slots
+             * (or entries) */
+            if (!(h->flags & TL_HT_F_FIXED) && nbits < MAX_TABLE_BITS &&
+                    h->nitems * 200 > h->cur.size * h->max_load) {
+                nbits++;
+            } else if (h->nitems >= table_capacity(h, &h->cur) &&
+                    !filter_needs_rebuild(h)) {
+                /* Every slot in use holds a live entry, so a rebuild at the
+                 * same size would free nothing (a full fixed table) */
+                return;
+            }
+        } else if ((h->flags & TL_HT_F_SHRINK) && nbits > h->min_bits &&
+                h->nitems * 100 < h->cur.size * h->min_load) {
+            nbits--;
+        } else if (!filter_needs_rebuild(h)) {
+            return;
+        }
+
+    } else {
+        if (h->old.size != 0) {
+            return;
+        }
+
+        if (h->flags & TL_HT_F_FIXED) {
+            if (!filter_needs_rebuild(h)) {
+                return;
+            }
+        } else if (h->nitems * 100 > h->cur.size * h->max_load) {
+            if (nbits == MAX_TABLE_BITS) {
+                return;
+            }
+            nbits++;
+        } else if ((h->flags & TL_HT_F_SHRINK) && nbits > h->min_bits &&
+                h->nitems * 100 < h->cur.size * h->min_load) {
+            nbits--;
+        } else if (!filter_needs_rebuild(h)) {
+            return;
+        }
+    }
+
+    if (table_init(h, &t, nbits) != 0) {
+        /* Keep going with the current table */
+        return;
+    }
+    if (h->filter != NULL) {
+        /* The new filter is filled as entries are migrated, which leaves
+         * out the keys deleted since the current one was built */
+        size_t cap = filter_capacity(h, nbits);
+        tl_BLOOM *filter = tl_bloom_new_params(cap, &h->filter_params);
+        if (filter == NULL) {
+            table_free(&t);
+            return;
+        }
+        h->old_filter = h->filter;
+        h->filter = filter;
+        h->filter_cap = cap;
+        h->filter_stale = 0;
+    }
+    if (h->engine == TL_HT_ENGINE_COMPACT) {
+        /* Moving entries one at a time would let new ones be appended
+         * ahead of older ones, so they all move at once */
+        compact_migrate(h, &h->cur, &t);
+        table_free(&h->cur);
+        h->cur = t;
+        tl_bloom_free(h->old_filter);
+        h->old_filter = NULL;
+        return;
+    }
+    h->old = h->cur;
+    h->cur = t;
+    h->rehashidx = 0;
+}
+
+/******************************************************************************
+ * Public API
+ ******************************************************************************/
+
+void tl_ht_free(tl_HASHTABLE *h)
+{
+    if (h != NULL) {
+        tl_ht_clear(h);
+        table_free(&h->cur);
+        tl_bloom_free(h->filter);
+        free(h);
+    }
+}
+
+/**
+ * Claim an entry for a new key and set its key. The caller must set the
+ * value and then call maybe_resize(). Returns NULL if no entry is available
+ */
+static struct genhash_entry_t *new_entry(tl_HASHTABLE *h, size_t hv,
+                                         const void *k, size_t klen)
+{
+    struct genhash_entry_t *p;
+
+    if (h->engine == TL_HT_ENGINE_OPEN) {
+        p = open_insert(h, &h->cur, hv, 0);
+        if (p != NULL) {
+            p->u.seq = h->seq++;
+        }
+    } else if (h->engine == TL_HT_ENGINE_COMPACT) {
+        if (h->cur.growth_left == 0) {
+            /* Left full by tl_ht_upsert() */
+            maybe_resize(h);
+        }
+        p = compact_insert(h, &h->cur, hv);
+    } else {
+        p = chain_insert(h, &h->cur, hv);
+    }
+    if (!p) {
+        return NULL;
+    }
+
+    set_key(h, p, k, klen);
+    h->nitems++;
+    if (h->filter != NULL) {
+        tl_bloom_add(h->filter, hv);
+    }
+    return p;
+}
+
+/**
+ * Add an entry holding `v`. In a multimap table the key must not be present
+ */
+static int insert_hv(tl_HASHTABLE *h, size_t hv, const void *k, size_t klen,
+                     const void *v, size_t vlen)
+{
+    struct genhash_values *vals = NULL;
+    struct genhash_entry_t *p;
+
+    if ((h->flags & TL_HT_F_MULTI) && (vals = values_alloc(1)) == NULL) {
+        return -1;
+    }
+    p = new_entry(h, hv, k, klen);
+    if (!p) {
+        free(vals);
+        return -1;
+    }
+    if (vals != NULL) {
+        p->value = vals;
+        p->nvalue = 0;
+        values_push(h, p, v, vlen);
+    } else {
+        set_value(h, p, v, vlen);
+    }
+    maybe_resize(h);
+    return 0;
+}
+
+static int store_hv(tl_HASHTABLE *h, size_t hv, const void *k, size_t klen,
+                    const void *v, size_t vlen)
+{
+    if (h->flags & TL_HT_F_MULTI) {
+        struct genhash_pos pos;
+        struct genhash_entry_t *p = find_entry_hv(h, hv, k, klen, &pos);
+        if (p != NULL) {
+            return values_push(h, p, v, vlen);
+        }
+    }
+    return insert_hv(h, hv, k, klen, v, vlen);
+}
+
+int tl_ht_store_hashed(tl_HASHTABLE *h, uint64_t hash,
+                       const void *k, size_t klen, const void *v, size_t vlen)
+{
+    assert(h != NULL);
+    rehash_step(h);
+    return store_hv(h, genhash_hv(hash), k, klen, v, vlen);
+}
+
+int tl_ht_store(tl_HASHTABLE *h, const void *k, size_t klen,
+                  const void *v, size_t vlen)
+{
+    return tl_ht_store_hashed(h, tl_ht_hash(h, k, klen), k, klen, v, vlen);
+}
+
+static struct genhash_entry_t *find_entry_hv(tl_HASHTABLE *h,
+                                             size_t hv,
+                                             const void *k,
+                                             size_t klen,
+                                             struct genhash_pos *pos)
+{
+    struct genhash_entry_t *e = NULL, *olde;
+    struct genhash_pos oldpos;
+    size_t probes = 0;
+
+    if (!filter_maybe(h, hv)) {
+        pos->t = &h->cur;
+        pos->pp = NULL;
+        goto done;
+    }
+    e = table_find(h, &h->cur, hv, k, klen, pos, &probes);
+    if (h->old.size == 0 || (e != NULL && h->engine != TL_HT_ENGINE_OPEN)) {
+        goto done;
+    }
+
+    /* Chained tables keep newer entries in `cur`. Open addressed tables
+     * migrate slot by slot, so compare insertion order */
+    olde = table_find(h, &h->old, hv, k, klen, &oldpos, &probes);
+    if (olde != NULL && (e == NULL || olde->u.seq > e->u.seq)) {
+        *pos = oldpos;
+        e = olde;
+    }
+
+    done:
+    if (h->flags & TL_HT_F_STATS) {
+        if (e != NULL) {
+            h->nhits++;
+            h->hit_probes += probes;
+        } else {
+            h->nmisses++;
+            h->miss_probes += probes;
+        }
+    }
+    return e;
+}
+
+static struct genhash_entry_t *genhash_find_entry(tl_HASHTABLE *h,
+                                                  uint64_t hash,
+                                                  const void *k,
+                                                  size_t klen,
+                                                  struct genhash_pos *pos)
+{
+    assert(h != NULL);
+    rehash_step(h);
+    return find_entry_hv(h, genhash_hv(hash), k, klen, pos);
+}
+
+void *tl_ht_findn_hashed(tl_HASHTABLE *h, uint64_t hash,
+                         const void *k, size_t klen, size_t *nvalue)
+{
+    struct genhash_entry_t *p;
+    struct genhash_pos pos;
+    void *rv = NULL;
+
+    assert(h != NULL);
+    lookup_step(h);
+    p = find_entry_hv(h, genhash_hv(hash), k, klen, &pos);
+
+    if (p) {
+        size_t *np;
+        rv = *newest_value(h, p, &np);
+        *nvalue = *np;
+    }
+    return rv;
+}
+
+void *tl_ht_find_hashed(tl_HASHTABLE *h, uint64_t hash,
+                        const void *k, size_t klen)
+{
+    size_t nvalue;
+    return tl_ht_findn_hashed(h, hash, k, klen, &nvalue);
+}
+
+void *tl_ht_findn(tl_HASHTABLE *h, const void *k, size_t klen, size_t *nvalue)
+{
+    return tl_ht_findn_hashed(h, tl_ht_hash(h, k, klen), k, klen, nvalue);
+}
+
+void *tl_ht_find(tl_HASHTABLE *h, const void *k, size_t klen)
+{
+    size_t nvalue;
+    return tl_ht_findn(h, k, klen, &nvalue);
+}
+
+enum tl_UPDATETYPE tl_ht_update_hashed(tl_HASHTABLE *h, uint64_t hash,
+                                       const void *k, size_t klen,
+                                       const void *v, size_t vlen)
+{
+    struct genhash_entry_t *p;
+    struct genhash_pos pos;
+    enum tl_UPDATETYPE rv = 0;
+
+    p = genhash_find_entry(h, hash, k, klen, &pos);
+
+    if (p) {
+        replace_value(h, p, v, vlen);
+        rv = MODIFICATION;
+    } else if (-1 == insert_hv(h, genhash_hv(hash), k, klen, v, vlen)) {
+        rv = ALLOC_FAILURE;
+    } else {
+        rv = NEW;
+    }
+
+    return rv;
+}
+
+enum tl_UPDATETYPE tl_ht_update(tl_HASHTABLE *h, const void *k, size_t klen,
+                                const void *v, size_t vlen)
+{
+    return tl_ht_update_hashed(h, tl_ht_hash(h, k, klen), k, klen, v, vlen);
+}
+
+enum tl_UPDATETYPE tl_ht_funupdate_hashed(tl_HASHTABLE *h,
+                                          uint64_t hash,
+                                          const void *k,
+                                          size_t klen,
+                                          void * (*upd)(const void *,
+                                                        const void *,
+                                                        size_t *,
+                                                        void *),
+                                          void (*fr)(void *),
+                                          void *arg,
+                                          const void *def,
+                                          size_t deflen)
+{
+    struct genhash_entry_t *p;
+    struct genhash_pos pos;
+    enum tl_UPDATETYPE rv = 0;
+    size_t newSize = 0;
+
+    p = genhash_find_entry(h, hash, k, klen, &pos);
+
+    if (p) {
+        size_t *np;
+        void *newValue = upd(k, *newest_value(h, p, &np), &newSize, arg);
+        replace_value(h, p, newValue, newSize);
+        fr(newValue);
+        rv = MODIFICATION;
+    } else {
+        void *newValue = upd(k, def, &newSize, arg);
+        insert_hv(h, genhash_hv(hash), k, klen, newValue, newSize);
+        fr(newValue);
+        rv = NEW;
+    }
+
+    (void)deflen;
+    return rv;
+}
+
+void **tl_ht_upsert_key_hashed(tl_HASHTABLE *h, uint64_t hash,
+                               const void *k, size_t klen,
+                               const void **stored, int *created)
+{
+    struct genhash_entry_t *p;
+    struct genhash_pos pos;
+    struct genhash_values *vals = NULL;
+    size_t hv = genhash_hv(hash), *np;
+    void **rv;
+    int dummy;
+
+    if (created == NULL) {
+        created = &dummy;
+    }
+    *created = 0;
+
+    p = genhash_find_entry(h, hash, k, klen, &pos);
+    if (p) {
+        *stored = p->key;
+        return newest_value(h, p, &np);
+    }
+
+    if ((h->flags & TL_HT_F_MULTI) && (vals = values_alloc(1)) == NULL) {
+        return NULL;
+    }
+    p = new_entry(h, hv, k, klen);
+    if (!p) {
+        free(vals);
+        return NULL;
+    }
+    if (vals != NULL) {
+        vals->items[0].value = NULL;
+        vals->items[0].nvalue = 0;
+        vals->n = 1;
+        h->nvalues++;
+        p->value = vals;
+        p->nvalue = 0;
+    } else if (h->inline_value) {
+        p->value = inline_value_of(p);
+        memset(p->value, 0, h->inline_value);
+        p->nvalue = h->inline_value;
+    } else {
+        p->value = NULL;
+        p->nvalue = 0;
+    }
+    /* A resize started here leaves `p` in the old table until a later call
+     * migrates it, so the pointer stays valid until then. Compact tables
+     * move every entry when they resize, so that waits for the next insert */
+    rv = newest_value(h, p, &np);
+    *stored = p->key;
+    if (h->engine != TL_HT_ENGINE_COMPACT) {
+        maybe_resize(h);
+    }
+    *created = 1;
+    return rv;
+}
+
+void **tl_ht_upsert_hashed(tl_HASHTABLE *h, uint64_t hash,
+                           const void *k, size_t klen, int *created)
+{
+    const void *stored;
+    return tl_ht_upsert_key_hashed(h, hash, k, klen, &stored, created);
+}
+
+void **tl_ht_upsert(tl_HASHTABLE *h, const void *k, size_t klen, int *created)
+{
+    return tl_ht_upsert_hashed(h, tl_ht_hash(h, k, klen), k, klen, created);
+}
+
+enum tl_UPDATETYPE tl_ht_funupdate(tl_HASHTABLE *h,
+                                    const void *k,
+                                    size_t klen,
+                                    void * (*upd)(const void *,
+                                                  const void *,
+                                                  size_t *,
+                                                  void *),
+                                    void (*fr)(void *),
+                                    void *arg,
+                                    const void *def,
+                                    size_t deflen)
+{
+    return tl_ht_funupdate_hashed(h, tl_ht_hash(h, k, klen), k, klen,
+                                  upd, fr, arg, def, deflen);
+}
+
+static int del_hv(tl_HASHTABLE *h, size_t hv, const void *k, size_t klen)
+{
+    struct genhash_entry_t *deleteme;
+    struct genhash_pos pos;
+
+    deleteme = find_entry_hv(h, hv, k, klen, &pos);
+    if (deleteme == NULL) {
+        return 0;
+    }
+
+    if (h->flags & TL_HT_F_MULTI) {
+        struct genhash_values *vals = deleteme->value;
+        free_value(h, vals->items[--vals->n].value);
+        h->nvalues--;
+        if (vals->n != 0) {
+            return 1;
+        }
+    }
+    table_remove(h, &pos, deleteme);
+    h->nitems--;
+    maybe_resize(h);
+    return 1;
+}
+
+int tl_ht_del_hashed(tl_HASHTABLE *h, uint64_t hash,
+                     const void *k, size_t klen)
+{
+    assert(h != NULL);
+    rehash_step(h);
+    return del_hv(h, genhash_hv(hash), k, klen);
+}
+
+int tl_ht_del(tl_HASHTABLE *h, const void *k, size_t klen)
+{
+    return tl_ht_del_hashed(h, tl_ht_hash(h, k, klen), k, klen);
+}
+
+int tl_ht_delall_hashed(tl_HASHTABLE *h, uint64_t hash,
+                        const void *k, size_t klen)
+{
+    struct genhash_entry_t *e;
+    struct genhash_pos pos;
+    size_t n;
+    int rv = 0;
+
+    if (!(h->flags & TL_HT_F_MULTI)) {
+        while (tl_ht_del_hashed(h, hash, k, klen) == 1) {
+            rv++;
+        }
+        return rv;
+    }
+
+    e = genhash_find_entry(h, hash, k, klen, &pos);
+    if (e == NULL) {
+        return 0;
+    }
+    n = ((struct genhash_values *)e->value)->n;
+    table_remove(h, &pos, e);
+    h->nitems--;
+    h->nvalues -= n;
+    maybe_resize(h);
+    return (int)n;
+}
+
+int tl_ht_delall(tl_HASHTABLE *h, const void *k, size_t klen)
+{
+    return tl_ht_delall_hashed(h, tl_ht_hash(h, k, klen), k, klen);
+}
+
+/*
+ * Batch operations work on BATCH_SIZE keys at a time, in stages. Each stage
+ * issues a prefetch for every key and the next stage uses the memory the
+ * previous one prefetched, so by the time a key's lookup is done its
+ * bucket (or control group), first entry and stored key are in cache.
+ *
+ * The rehash steps each single operation would do are all done before the
+ * first stage, so entries do not move between the stages.
+ */
+
+/** Stage 1: the bucket head (or control group) for `hv` */
+static void batch_prefetch_bucket(tl_HASHTABLE *h, struct genhash_table *t,
+                                  size_t hv)
+{
+    if (t->size == 0) {
+        return;
+    } else if (h->engine == TL_HT_ENGINE_OPEN) {
+        PREFETCH(t->ctrl + (group_of(t, hv) << GROUP_BITS));
+    } else if (h->engine == TL_HT_ENGINE_COMPACT) {
+        PREFETCH((char *)t->index + bucket_of(t, hv) * t->iwidth);
+    } else {
+        PREFETCH(&t->buckets[bucket_of(t, hv)]);
+    }
+}
+
+/** Stage 2: the first entry which may hold the key */
+static struct genhash_entry_t *batch_prefetch_entry(tl_HASHTABLE *h,
+                                                    struct genhash_table *t,
+                                                    size_t hv)
+{
+    struct genhash_entry_t *e = NULL;
+
+    if (t->size == 0) {
+        return NULL;
+    } else if (h->engine == TL_HT_ENGINE_OPEN) {
+        size_t g = group_of(t, hv);
+        unsigned mask = group_match(t->ctrl + (g << GROUP_BITS), ctrl_of(hv));
+        if (mask) {
+            e = slot_at(h, t, (g << GROUP_BITS) + lowest_bit(mask));
+        }
+    } else if (h->engine == TL_HT_ENGINE_COMPACT) {
+        size_t ix = index_get(t, bucket_of(t, hv));
+        if (ix >= INDEX_FIRST) {
+            e = slot_at(h, t, ix - INDEX_FIRST);
+        }
+    } else {
+        e = t->buckets[bucket_of(t, hv)];
+    }
+    if (e != NULL) {
+        PREFETCH(e);
+    }
+    return e;
+}
+
+/** Stage 3: the stored key, if the entry looks like a match */
+static void batch_prefetch_key(tl_HASHTABLE *h, struct genhash_entry_t *e,
+                               size_t hv)
+{
+    if (e != NULL && e->hv == hv && !key_is_inline(h, e)) {
+        PREFETCH(e->key);
+    }
+}
+
+static void batch_prefetch(tl_HASHTABLE *h, const size_t *hv, size_t n)
+{
+    struct genhash_entry_t *e[BATCH_SIZE];
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        batch_prefetch_bucket(h, &h->cur, hv[i]);
+    }
+    for (i = 0; i < n; i++) {
+        e[i] = batch_prefetch_entry(h, &h->cur, hv[i]);
+    }
+    for (i = 0; i < n; i++) {
+        batch_prefetch_key(h, e[i], hv[i]);
+    }
+}
+
+/** Hash up to BATCH_SIZE keys, returning how many were hashed */
+static size_t batch_hash(tl_HASHTABLE *h, const void * const *keys,
+                         const size_t *klens, size_t n, size_t *hv,
+                         int lookup)
+{
+    size_t i;
+
+    if (n > BATCH_SIZE) {
+        n = BATCH_SIZE;
+    }
+    for (i = 0; i < n; i++) {
+        if (lookup) {
+            lookup_step(h);
+        } else {
+            rehash_step(h);
+        }
+    }
+    for (i = 0; i < n; i++) {
+        hv[i] = genhash_hash(h, keys[i], klens[i]);
+    }
+    return n;
+}
+
+int tl_ht_find_batch(tl_HASHTABLE *h, const void * const *keys,
+                     const size_t *klens, size_t n, void **values)
+{
+    size_t hv[BATCH_SIZE];
+    size_t off, nb, i;
+    int rv = 0;
+
+    assert(h != NULL);
+    for (off = 0; off < n; off += nb) {
+        nb = batch_hash(h, keys + off, klens + off, n - off, hv, 1);
+        batch_prefetch(h, hv, nb);
+        for (i = 0; i < nb; i++) {
+            struct genhash_pos pos;
+            struct genhash_entry_t *e;
+            e = find_entry_hv(h, hv[i], keys[off + i], klens[off + i], &pos);
+            if (e != NULL) {
+                size_t *np;
+                values[off + i] = *newest_value(h, e, &np);
+            } else {
+                values[off + i] = NULL;
+            }
+            rv += e != NULL;
+        }
+    }
+    return rv;
+}
+
+size_t tl_ht_store_batch(tl_HASHTABLE *h, const void * const *keys,
+                         const size_t *klens, const void * const *values,
+                         const size_t *vlens, size_t n)
+{
+    size_t hv[BATCH_SIZE];
+    size_t off, nb, i;
+
+    assert(h != NULL);
+    for (off = 0; off < n; off += nb) {
+        nb = batch_hash(h, keys + off, klens + off, n - off, hv, 0);
+        /* Only the buckets are needed to insert */
+        for (i = 0; i < nb; i++) {
+            batch_prefetch_bucket(h, &h->cur, hv[i]);
+        }
+        for (i = 0; i < nb; i++) {
+            if (store_hv(h, hv[i], keys[off + i], klens[off + i],
+                         values[off + i], vlens[off + i]) != 0) {
+                return off + i;
+            }
+        }
+    }
+    return n;
+}
+
+int tl_ht_del_batch(tl_HASHTABLE *h, const void * const *keys,
+                    const size_t *klens, size_t n)
+{
+    size_t hv[BATCH_SIZE];
+    size_t off, nb, i;
+    int rv = 0;
+
+    assert(h != NULL);
+    for (off = 0; off < n; off += nb) {
+        nb = batch_hash(h, keys + off, klens + off, n - off, hv, 0);
+        batch_prefetch(h, hv, nb);
+        for (i = 0; i < nb; i++) {
+            rv += del_hv(h, hv[i], keys[off + i], klens[off + i]);
+        }
+    }
+    return rv;
+}
+
+void tl_ht_iter(tl_HASHTABLE *h, tl_HASHITER_cb iterfunc, void *arg)
+{
+    assert(h != NULL);
+    table_iter(h, &h->cur, iterfunc, arg);
+    table_iter(h, &h->old, iterfunc, arg);
+}
+
+/*
+ * Buckets (and open addressing groups) cover consecutive ranges of hash
+ * values, as their index is taken from the high bits of the hash. The cursor
+ * is the lowest hash value not yet visited; each step visits the entries
+ * hashing to the range from the cursor to the end of its bucket in the
+ * table with the most buckets, looking in both tables during a resize.
+ * Ranges are the same in every table of a given size and nest across
+ * sizes, so a resize between calls never causes an entry to be skipped;
+ * after shrinking, part of a bucket may be visited again.
+ */
+size_t tl_ht_scan(tl_HASHTABLE *h, size_t cursor, size_t max_items,
+                  tl_HASHITER_cb iterfunc, void *arg)
+{
+    size_t nitems = 0, nsteps = 0;
+
+    assert(h != NULL);
+    do {
+        size_t bits = h->cur.nbits > h->old.nbits ? h->cur.nbits : h->old.nbits;
+        size_t hi = 0;
+
+        if (h->engine == TL_HT_ENGINE_OPEN) {
+            bits -= GROUP_BITS;
+        }
+        if (bits != 0) {
+            hi = (cursor | (((size_t)1 << (SIZE_BITS - bits)) - 1)) + 1;
+        }
+        nitems += table_scan(h, &h->cur, cursor, hi, iterfunc, arg);
+        nitems += table_scan(h, &h->old, cursor, hi, iterfunc, arg);
+        cursor = hi;
+    } while (cursor != 0 && nitems < max_items &&
+             ++nsteps < max_items * SCAN_EMPTY_VISITS);
+    return cursor;
+}
+
+int tl_ht_clear(tl_HASHTABLE *h)
+{
+    int rv = 0;
+    assert(h != NULL);
+
+    rv = (int)((h->flags & TL_HT_F_MULTI) ? h->nvalues : h->nitems);
+    table_clear(h, &h->cur);
+    table_clear(h, &h->old);
+
+    table_free(&h->old);
+    slabs_release(h);
+    h->rehashidx = 0;
+    h->nitems = 0;
+    h->nvalues = 0;
+    if (h->filter != NULL) {
+        tl_bloom_clear(h->filter);
+        tl_bloom_free(h->old_filter);
+        h->old_filter = NULL;
+        h->filter_stale = 0;
+    }
+    return rv;
+}
+
+void tl_ht_allocstats(tl_HASHTABLE *h, struct tl_HTALLOCSTATS *stats)
+{
+    struct genhash_slab *slab;
+
+    assert(h != NULL);
+    memset(stats, 0, sizeof(*stats));
+
+    if (h->engine == TL_HT_ENGINE_COMPACT) {
+        stats->nblocks = 1;
+        stats->capacity = h->cur.nused + h->cur.growth_left;
+        stats->bytes = stats->capacity * h->entry_size +
+                h->cur.size * h->cur.iwidth;
+        stats->nfree = h->cur.nused - h->nitems;
+        stats->nunused = h->cur.growth_left;
+    } else if (h->engine == TL_HT_ENGINE_OPEN) {
+        struct genhash_table *tables[2];
+        size_t i;
+
+        tables[0] = &h->cur;
+        tables[1] = &h->old;
+        for (i = 0; i < 2; i++) {
+            if (tables[i]->size == 0) {
+                continue;
+            }
+            stats->nblocks++;
+            stats->capacity += tables[i]->size;
+            stats->bytes += tables[i]->size * (h->entry_size + 1);
+        }
+    } else {
+        for (slab = h->slabs; slab != NULL; slab = slab->next) {
+            stats->nblocks++;
+            stats->capacity += slab->nentries;
+            stats->bytes += sizeof(*slab) + slab->nentries * h->entry_size;
+        }
+        stats->nfree = h->nfree;
+        stats->nunused = h->slab_avail;
+    }
+    stats->nused = h->nitems;
+}
+
+int tl_ht_filterstats(tl_HASHTABLE *h, struct tl_HTFILTERSTATS *stats)
+{
+    assert(h != NULL);
+    memset(stats, 0, sizeof(*stats));
+    if (h->filter == NULL) {
+        return -1;
+    }
+    stats->bytes = tl_bloom_bytes(h->filter);
+    if (h->old_filter != NULL) {
+        stats->bytes += tl_bloom_bytes(h->old_filter);
+    }
+    stats->capacity = h->filter_cap;
+    stats->nkeys = tl_bloom_count(h->filter);
+    stats->nstale = h->filter_stale;
+    stats->bits_per_key = h->filter_params.bits_per_key;
+    stats->k = h->filter_params.k;
+    stats->target_fpr = h->filter_fpr;
+    stats->fpr = tl_bloom_fpr(h->filter);
+    return 0;
+}
+
+static void count_entries(const void *key,
+                          size_t klen,
+                          const void *val,
+                          size_t vlen,
+                          void *arg)
+{
+    int *count = (int *)arg;
+    (*count)++;
+    (void)key;
+    (void)klen;
+    (void)val;
+    (void)vlen;
+}
+
+int tl_ht_size(tl_HASHTABLE *h)
+{
+    assert(h != NULL);
+    return (int)((h->flags & TL_HT_F_MULTI) ? h->nvalues : h->nitems);
+}
+
+/**
+ * Probe length of the entries in bucket (or slot) `n`, added to `hist`.
+ * Returns the number of entries found there
+ */
+static size_t sample_bucket(tl_HASHTABLE *h, struct genhash_table *t,
+                            size_t n, size_t *hist)
+{
+    size_t len, home;
+
+    if (h->engine == TL_HT_ENGINE_CHAINED) {
+        struct genhash_entry_t *e;
+        for (len = 0, e = t->buckets[n]; e != NULL; e = e->u.next) {
+            len++;
+        }
+        if (len == 0) {
+            return 0;
+        }
+    } else if (h->engine == TL_HT_ENGINE_OPEN) {
+        if (t->ctrl[n] >= CTRL_EMPTY) {
+            return 0;
+        }
+        /* Groups from the one probing starts at */
+        home = group_of(t, slot_at(h, t, n)->hv);
+        len = (((n >> GROUP_BITS) - home) & (ngroups(t) - 1)) + 1;
+    } else {
+        size_t ix = index_get(t, n);
+        if (ix < INDEX_FIRST) {
+            return 0;
+        }
+        home = bucket_of(t, slot_at(h, t, ix - INDEX_FIRST)->hv);
+        len = ((n - home) & (t->size - 1)) + 1;
+    }
+    hist[len < TL_HT_STATS_NHIST ? len : TL_HT_STATS_NHIST - 1]++;
+    return 1;
+}
+
+void tl_ht_stats(tl_HASHTABLE *h, struct tl_HTSTATS *stats, size_t nsample)
+{
+    struct genhash_table *tables[2];
+    struct tl_HTALLOCSTATS astats;
+    struct tl_HTFILTERSTATS fstats;
+    size_t i, n, total, nfull = 0, seen;
+
+    assert(h != NULL);
+    memset(stats, 0, sizeof(*stats));
+    tables[0] = &h->cur;
+    tables[1] = &h->old;
+    stats->nitems = h->nitems;
+    stats->nbuckets = h->cur.size + h->old.size;
+    stats->resizing = h->old.size != 0;
+    if (stats->nbuckets) {
+        stats->load = (double)h->nitems / stats->nbuckets;
+    }
+
+    /* Sample each table in proportion to its size, at an even stride */
+    for (i = 0; i < 2; i++) {
+        struct genhash_table *t = tables[i];
+        size_t step = 1;
+        if (t->size == 0) {
+            continue;
+        }
+        if (nsample != 0 && nsample < stats->nbuckets) {
+            step = stats->nbuckets / nsample;
+        }
+        for (n = step / 2; n < t->size; n += step) {
+            nfull += sample_bucket(h, t, n, stats->hist);
+            stats->nsampled++;
+        }
+    }
+    if (stats->nsampled) {
+        stats->occupancy = (double)nfull / stats->nsampled;
+    }
+    for (i = 1, total = 0; i < TL_HT_STATS_NHIST; i++) {
+        total += stats->hist[i];
+        if (stats->hist[i]) {
+            stats->max_probe = i;
+        }
+    }
+    for (i = 1, seen = 0; i < TL_HT_STATS_NHIST; i++) {
+        seen += stats->hist[i];
+        if (seen * 100 >= total * 99) {
+            stats->p99_probe = i;
+            break;
+        }
+    }
+
+    tl_ht_allocstats(h, &astats);
+    stats->bytes = astats.bytes;
+    if (h->engine == TL_HT_ENGINE_CHAINED) {
+        stats->bytes += stats->nbuckets * sizeof(*h->cur.buckets);
+    }
+    if (tl_ht_filterstats(h, &fstats) == 0) {
+        stats->bytes += fstats.bytes;
+    }
+
+    stats->nhits = h->nhits;
+    stats->nmisses = h->nmisses;
+    stats->hit_probes = h->hit_probes;
+    stats->miss_probes = h->miss_probes;
+    if (h->nhits) {
+        stats->probes_per_hit = (double)h->hit_probes / h->nhits;
+    }
+    if (h->nmisses) {
+        stats->probes_per_miss = (double)h->miss_probes / h->nmisses;
+    }
+}
+
+int tl_ht_sizekey(tl_HASHTABLE *h, const void *k, size_t klen)
+{
+    int rv = 0;
+    assert(h != NULL);
+    if (h->flags & TL_HT_F_MULTI) {
+        struct genhash_pos pos;
+        struct genhash_entry_t *e;
+        e = find_entry_hv(h, genhash_hash(h, k, klen), k, klen, &pos);
+        return e ? (int)((struct genhash_values *)e->value)->n : 0;
+    }
+    tl_ht_iterkey(h, k, klen, count_entries, &rv);
+    return rv;
+}
+
+void tl_ht_iterkey_hashed(tl_HASHTABLE *h, uint64_t hash,
+                          const void *key, size_t klen,
+                          tl_HASHITER_cb iterfunc, void *arg)
+{
+    size_t hv = 0;
+
+    assert(h != NULL);
+    hv = genhash_hv(hash);
+    if (h->flags & TL_HT_F_MULTI) {
+        struct genhash_pos pos;
+        struct genhash_entry_t *e = find_entry_hv(h, hv, key, klen, &pos);
+        if (e != NULL) {
+            visit_entry(h, e, iterfunc, arg);
+        }
+        return;
+    }
+    table_iterkey(h, &h->cur, hv, key, klen, iterfunc, arg);
+    table_iterkey(h, &h->old, hv, key, klen, iterfunc, arg);
+}
+
+void tl_ht_iterkey(tl_HASHTABLE *h, const void *key, size_t klen,
+                   tl_HASHITER_cb iterfunc, void *arg)
+{
+    assert(h != NULL);
+    tl_ht_iterkey_hashed(h, tl_ht_hash(h, key, klen), key, klen,
+                         iterfunc, arg);
+}
+
+int tl_ht_strhash(const void *p, size_t nkey)
+{
+    uint64_t hv = tl_hash64(p, nkey, 0);
+    return (int)(hv ^ (hv >> 32));
+}
+
+tl_HASHTABLE* tl_ht_new_ex(size_t est, struct tl_HASHOPS ops,
+                           const struct tl_HASHCONF *conf)
+{
+    tl_HASHTABLE *rv = NULL;
+    if (est < 1) {
+        return NULL ;
+    }
+    assert(ops.hashfunc != NULL || ops.hashfunc64 != NULL);
+    assert(ops.hasheq != NULL);
+    assert((ops.dup_key != NULL && ops.free_key != NULL) || ops.free_key == NULL);
+    assert((ops.dup_value != NULL && ops.free_value != NULL) || ops.free_value == NULL);
+    rv = calloc(1, sizeof(tl_HASHTABLE));
+    if (rv == NULL ) {
+        return NULL ;
+    }
+    rv->ops = ops;
+    rv->engine = TL_HT_ENGINE_CHAINED;
+    rv->min_load = DEFAULT_MIN_LOAD;
+    if (conf != NULL) {
+        rv->flags = conf->flags;
+        rv->engine = conf->engine;
+        rv->max_load = conf->max_load;
+        if (conf->min_load) {
+            rv->min_load = conf->min_load;
+        }
+        rv->inline_key = conf->inline_key;
+        rv->inline_value = ALIGN_UP(conf->inline_value);
+    }
+    /* Multimap entries point to their value vector */
+    if ((rv->flags & TL_HT_F_MULTI) && rv->inline_value) {
+        free(rv);
+        return NULL;
+    }
+    /* Lookup counters would be written by concurrent lookups */
+    if ((rv->flags & TL_HT_F_STATS) && (rv->flags & TL_HT_F_CONST_FIND)) {
+        free(rv);
+        return NULL;
+    }
+    if (conf != NULL && (conf->flags & TL_HT_F_SEED)) {
+        rv->seed = conf->seed;
+    } else if (ops.hashfunc64 != NULL) {
+        rv->seed = tl_hash_randseed();
+    }
+    rv->entry_size = ALIGN_UP(sizeof(struct genhash_entry_t) +
+                              rv->inline_value + rv->inline_key);
+
+    if (rv->engine == TL_HT_ENGINE_OPEN) {
+        if (rv->max_load == 0) {
+            rv->max_load = DEFAULT_OPEN_MAX_LOAD;
+        }
+        /* Probing relies on some group always having an EMPTY slot */
+        if (rv->max_load >= 100) {
+            free(rv);
+            return NULL;
+        }
+        /* Size by slots rather than buckets */
+        est = est / rv->max_load * 100 + est % rv->max_load * 100 / rv->max_load;
+    } else if (rv->engine == TL_HT_ENGINE_COMPACT) {
+        if (rv->max_load == 0) {
+            rv->max_load = DEFAULT_COMPACT_MAX_LOAD;
+        }
+        /* Probing relies on the index always having an EMPTY slot */
+        if (rv->max_load >= 100) {
+            free(rv);
+            return NULL;
+        }
+        /* Size the index for `est` entries, rounding up */
+        est = est / rv->max_load * 100 + est % rv->max_load * 100 / rv->max_load + 1;
+    } else if (rv->engine == TL_HT_ENGINE_CHAINED) {
+        if (rv->max_load == 0) {
+            rv->max_load = DEFAULT_MAX_LOAD;
+        }
+    } else {
+        free(rv);
+        return NULL;
+    }
+
+    /* Halving the table doubles its load; make sure that can't trigger a
+     * grow straight away */
+    if (rv->min_load * 2 >= rv->max_load) {
+        free(rv);
+        return NULL;
+    }
+
+    rv->min_bits = estimate_table_size(est);
+    if (rv->engine == TL_HT_ENGINE_OPEN && rv->min_bits < GROUP_BITS) {
+        rv->min_bits = GROUP_BITS;
+    }
+    if (rv->flags & TL_HT_F_FILTER) {
+        rv->filter_fpr = DEFAULT_FILTER_FPR;
+        if (conf->filter_fpr > 0) {
+            rv->filter_fpr = conf->filter_fpr;
+        }
+        tl_bloom_params(rv->filter_fpr, &rv->filter_params);
+        rv->filter_cap = filter_capacity(rv, rv->min_bits);
+        rv->filter = tl_bloom_new_params(rv->filter_cap, &rv->filter_params);
+        if (rv->filter == NULL) {
+            free(rv);
+            return NULL;
+        }
+    }
+    if (table_init(rv, &rv->cur, rv->min_bits) != 0) {
+        tl_bloom_free(rv->filter);
+        free(rv);
+        return NULL;
+    }
+    return rv;
+}
+
+tl_HASHTABLE* tl_ht_new(size_t est, struct tl_HASHOPS ops) {
+    return tl_ht_new_ex(est, ops, NULL);
+}
+
+/******************************************************************************
+ * Bulk construction
+ ******************************************************************************/
+
+/*
+ * Items are partitioned by the high bits of their hash, which is what picks
+ * their bucket (or home group): each partition owns a contiguous range of
+ * buckets, so partitions are filled in parallel without any locking. There
+ * are a few partitions per thread, so that threads finish at about the same
+ * time however the hashes fall.
+ *
+ * The build runs in three parallel phases, each thread taking its share of
+ * the input (phases 1 and 2) or of the partitions (phase 3):
+ *  1. hash the keys and count the items of each partition
+ *  2. scatter the item indexes into partition order, keeping input order
+ *     within each partition
+ *  3. fill each partition's buckets, in input order so that later items of
+ *     a key shadow earlier ones as with tl_ht_store()
+ *
+ * Chained entries come from a single slab, laid out in partition (and so in
+ * bucket) order. Open addressed partitions only probe their own groups; an
+ * item which runs off the end of its partition is inserted afterwards, by
+ * the calling thread. Compact tables keep their entries in input order, and
+ * their index is filled the same way.
+ */
+#define BULK_PARTS_PER_THREAD 4
+
+struct bulk_build {
+    tl_HASHTABLE *h;
+    const void * const *keys;
+    const size_t *klens;
+    const void * const *values;
+    const size_t *vlens;
+    size_t n;
+    unsigned nthreads;
+    /** log2 of the number of partitions */
+    size_t pbits;
+    size_t *hv;
+    /** Item indexes, in partition order */
+    size_t *order;
+    /** Per thread counts (then offsets) of each partition's items */
+    size_t *counts;
+    /** Start of each partition in `order`, and one past the last */
+    size_t *starts;
+    /** Number of items in each partition which were not placed (open) */
+    size_t *noverflow;
+    /** Number of EMPTY slots filled in each partition (open) */
+    size_t *nfilled;
+    /** Entries of the chained engine, in partition order */
+    char *entries;
+};
+
+struct bulk_worker {
+    struct bulk_build *b;
+    unsigned id;
+    void (*phase)(struct bulk_build *, unsigned);
+    bulk_thread_t thr;
+};
+
+static size_t nparts_of(const struct bulk_build *b)
+{
+    return (size_t)1 << b->pbits;
+}
+
+static size_t part_of(const struct bulk_build *b, size_t hv)
+{
+    return b->pbits ? hv >> (SIZE_BITS - b->pbits) : 0;
+}
+
+static void bulk_hash(struct bulk_build *b, unsigned id)
+{
+    size_t i, end = b->n / b->nthreads * (id + 1);
+    size_t *counts = b->counts + id * nparts_of(b);
+
+    if (id == b->nthreads - 1) {
+        end = b->n;
+    }
+    for (i = b->n / b->nthreads * id; i < end; i++) {
+        b->hv[i] = genhash_hash(b->h, b->keys[i], b->klens[i]);
+        counts[part_of(b, b->hv[i])]++;
+    }
+}
+
+static void bulk_scatter(struct bulk_build *b, unsigned id)
+{
+    size_t i, end = b->n / b->nthreads * (id + 1);
+    size_t *offsets = b->counts + id * nparts_of(b);
+
+    if (id == b->nthreads - 1) {
+        end = b->n;
+    }
+    for (i = b->n / b->nthreads * id; i < end; i++) {
+        b->order[offsets[part_of(b, b->hv[i])]++] = i;
+    }
+}
+
+static void bulk_fill_entry(struct bulk_build *b, struct genhash_entry_t *e,
+                            size_t i)
+{
+    e->hv = b->hv[i];
+    set_key(b->h, e, b->keys[i], b->klens[i]);
+    set_value(b->h, e, b->values[i], b->vlens[i]);
+}
+
+/** Insert into a slot of groups [g, gend), or return NULL if all are full */
+static struct genhash_entry_t *bulk_open_insert(tl_HASHTABLE *h, size_t hv,
+                                                size_t g, size_t gend)
+{
+    for (; g < gend; g++) {
+        unsigned char *ctrl = h->cur.ctrl + (g << GROUP_BITS);
+        unsigned mask = group_match_free(ctrl);
+        if (mask) {
+            size_t n = (g << GROUP_BITS) + lowest_bit(mask);
+            h->cur.ctrl[n] = ctrl_of(hv);
+            return slot_at(h, &h->cur, n);
+        }
+    }
+    return NULL;
+}
+
+static void bulk_fill(struct bulk_build *b, unsigned id)
+{
+    tl_HASHTABLE *h = b->h;
+    size_t p, j;
+
+    for (p = id; p < nparts_of(b); p += b->nthreads) {
+        if (h->engine == TL_HT_ENGINE_OPEN) {
+            size_t gbits = h->cur.nbits - GROUP_BITS - b->pbits;
+            size_t gend = (p + 1) << gbits;
+            for (j = b->starts[p]; j < b->starts[p + 1]; j++) {
+                size_t i = b->order[j];
+                struct genhash_entry_t *e;
+                e = bulk_open_insert(h, b->hv[i], group_of(&h->cur, b->hv[i]), gend);
+                if (e == NULL) {
+                    /* `order` has been read up to `j`; reuse it */
+                    b->order[b->starts[p] + b->noverflow[p]++] = i;
+                    continue;
+                }
+                bulk_fill_entry(b, e, i);
+                e->u.seq = i;
+                b->nfilled[p]++;
+            }
+        } else if (h->engine == TL_HT_ENGINE_COMPACT) {
+            size_t end = (p + 1) << (h->cur.nbits - b->pbits);
+            for (j = b->starts[p]; j < b->starts[p + 1]; j++) {
+                size_t i = b->order[j], n;
+                struct genhash_entry_t *e = slot_at(h, &h->cur, i);
+                bulk_fill_entry(b, e, i);
+                n = bucket_of(&h->cur, e->hv);
+                while (n < end && index_get(&h->cur, n) != INDEX_EMPTY) {
+                    n++;
+                }
+                if (n == end) {
+                    b->order[b->starts[p] + b->noverflow[p]++] = i;
+                    continue;
+                }
+                index_set(&h->cur, n, i + INDEX_FIRST);
+                e->u.slot = n;
+            }
+        } else {
+            for (j = b->starts[p]; j < b->starts[p + 1]; j++) {
+                size_t i = b->order[j];
+                struct genhash_entry_t *e, **head;
+                e = (struct genhash_entry_t *)(b->entries + j * h->entry_size);
+                bulk_fill_entry(b, e, i);
+                head = &h->cur.buckets[bucket_of(&h->cur, e->hv)];
+                e->u.next = *head;
+                *head = e;
+            }
+        }
+    }
+}
+
+#ifdef _WIN32
+static DWORD WINAPI bulk_thread_main(LPVOID arg)
+#else
+static void *bulk_thread_main(void *arg)
+#endif
+{
+    struct bulk_worker *w = arg;
+    w->phase(w->b, w->id);
+    return 0;
+}
+
+/**
+ * Run a phase on every thread, the calling thread taking the first share.
+ * A share whose thread cannot be started is run by the calling thread
+ */
+static void bulk_run(struct bulk_build *b, struct bulk_worker *workers,
+                     void (*phase)(struct bulk_build *, unsigned))
+{
+    unsigned i;
+    int *started = (int *)(workers + b->nthreads);
+
+    for (i = 1; i < b->nthreads; i++) {
+        workers[i].b = b;
+        workers[i].id = i;
+        workers[i].phase = phase;
+#ifdef _WIN32
+        workers[i].thr = CreateThread(NULL, 0, bulk_thread_main, &workers[i], 0, NULL);
+        started[i] = workers[i].thr != NULL;
+#else
+        started[i] = pthread_create(&workers[i].thr, NULL, bulk_thread_main,
+                                    &workers[i]) == 0;
+#endif
+    }
+    phase(b, 0);
+    for (i = 1; i < b->nthreads; i++) {
+        if (!started[i]) {
+            phase(b, i);
+            continue;
+        }
+#ifdef _WIN32
+        WaitForSingleObject(workers[i].thr, INFINITE);
+        CloseHandle(workers[i].thr);
+#else
+        pthread_join(workers[i].thr, NULL);
+#endif
+    }
+}
+
+/** Work out the partitions, and where each thread scatters its items */
+static void bulk_offsets(struct bulk_build *b)
+{
+    size_t p, pos = 0;
+    unsigned t;
+
+    for (p = 0; p < nparts_of(b); p++) {
+        b->starts[p] = pos;
+        for (t = 0; t < b->nthreads; t++) {
+            size_t *c = &b->counts[t * nparts_of(b) + p];
+            size_t count = *c;
+            *c = pos;
+            pos += count;
+        }
+    }
+    b->starts[p] = pos;
+}
+
+static int bulk_build(struct bulk_build *b)
+{
+    tl_HASHTABLE *h = b->h;
+    size_t nparts, p, nunits, j, nfilled = 0;
+    struct bulk_worker *workers;
+    void *mem;
+
+    /* Partitions are whole groups (or buckets, or index slots) */
+    nunits = h->cur.nbits - (h->engine == TL_HT_ENGINE_OPEN ? GROUP_BITS : 0);
+    for (b->pbits = 0; ((size_t)1 << b->pbits) < b->nthreads * BULK_PARTS_PER_THREAD &&
+                       b->pbits < nunits; b->pbits++);
+    nparts = nparts_of(b);
+
+    mem = calloc(1, b->n * 2 * sizeof(size_t) +
+                    (b->nthreads * nparts + nparts * 3 + 1) * sizeof(size_t) +
+                    b->nthreads * (sizeof(*workers) + sizeof(int)));
+    if (mem == NULL) {
+        return -1;
+    }
+    b->hv = mem;
+    b->order = b->hv + b->n;
+    b->counts = b->order + b->n;
+    b->starts = b->counts + b->nthreads * nparts;
+    b->noverflow = b->starts + nparts + 1;
+    b->nfilled = b->noverflow + nparts;
+    workers = (struct bulk_worker *)(b->nfilled + nparts);
+
+    if (h->engine == TL_HT_ENGINE_CHAINED) {
+        struct genhash_slab *slab = malloc(sizeof(*slab) + b->n * h->entry_size);
+        if (slab == NULL) {
+            free(mem);
+            return -1;
+        }
+        slab->nentries = b->n;
+        slab->next = h->slabs;
+        h->slabs = slab;
+        b->entries = (char *)slab->entries;
+    }
+
+    bulk_run(b, workers, bulk_hash);
+    bulk_offsets(b);
+    bulk_run(b, workers, bulk_scatter);
+    bulk_run(b, workers, bulk_fill);
+
+    if (h->engine == TL_HT_ENGINE_COMPACT) {
+        for (p = 0; p < nparts; p++) {
+            for (j = 0; j < b->noverflow[p]; j++) {
+                size_t i = b->order[b->starts[p] + j];
+                compact_link(&h->cur, slot_at(h, &h->cur, i), i);
+            }
+        }
+        h->cur.nused = b->n;
+        h->cur.growth_left -= b->n;
+    } else if (h->engine == TL_HT_ENGINE_OPEN) {
+        for (p = 0; p < nparts; p++) {
+            nfilled += b->nfilled[p];
+        }
+        h->cur.growth_left -= nfilled;
+        for (p = 0; p < nparts; p++) {
+            for (j = 0; j < b->noverflow[p]; j++) {
+                size_t i = b->order[b->starts[p] + j];
+                struct genhash_entry_t *e = open_insert(h, &h->cur, b->hv[i], 1);
+                assert(e != NULL);
+                bulk_fill_entry(b, e, i);
+                e->u.seq = i;
+            }
+        }
+        h->seq = b->n;
+    }
+    if (h->filter != NULL) {
+        for (j = 0; j < b->n; j++) {
+            tl_bloom_add(h->filter, b->hv[j]);
+        }
+    }
+    h->nitems = b->n;
+    free(mem);
+    return 0;
+}
+
+tl_HASHTABLE *tl_ht_new_bulk(struct tl_HASHOPS ops,
+                             const struct tl_HASHCONF *conf,
+                             const void * const *keys, const size_t *klens,
+                             const void * const *values, const size_t *vlens,
+                             size_t n, unsigned nthreads)
+{
+    struct bulk_build b;
+    tl_HASHTABLE *h = tl_ht_new_ex(n ? n : 1, ops, conf);
+
+    if (h == NULL || n == 0) {
+        return h;
+    }
+    if ((h->flags & TL_HT_F_MULTI) ||
+            (h->engine != TL_HT_ENGINE_CHAINED && h->cur.growth_left < n)) {
+        /* Values of a key are gathered onto one entry, and a table which
+         * cannot grow may be too small; store the items in turn */
+        if (tl_ht_store_batch(h, keys, klens, values, vlens, n) != n) {
+            tl_ht_free(h);
+            return NULL;
+        }
+        return h;
+    }
+
+    memset(&b, 0, sizeof(b));
+    b.h = h;
+    b.keys = keys;
+    b.klens = klens;
+    b.values = values;
+    b.vlens = vlens;
+    b.n = n;
+    b.nthreads = nthreads ? nthreads : 1;
+    if (bulk_build(&b) != 0) {
+        tl_ht_free(h);
+        return NULL;
+    }
+    return h;
+}
+
+
+/**
+ * Convenience functions for creating string-based hashes
+ */
+static int
+hasheq_strp(const void *a, size_t na, const void *b, size_t nb)
+{
+    if (na != nb) {
+        return 0;
+    }
+    return memcmp(a, b, na) == 0;
+}
+
+static struct tl_HASHOPS hashops_nocopy = {
+    tl_ht_strhash,
+    hasheq_strp,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    tl_hash_fast64
+};
+
+static int u32_hash(const void *p, size_t n)
+{
+    (void)p;
+    return n;
+}
+
+static int u32_eq(const void *a, size_t na, const void *b, size_t nb)
+{
+    (void)a; (void)b;
+    return na == nb;
+}
+
+static struct tl_HASHOPS hashops_u32 = {
+        u32_hash,
         u32_eq,
         NULL,
         NULL,
         NULL,
+        NULL,
         NULL
 };
 
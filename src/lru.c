@@ -0,0 +1,506 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2014 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <assert.h>
+#include <limits.h>
+#include <string.h>
+#include "tl_lru.h"
+#include "tl_dlist.h"
+#include "tl_hash.h"
+
+#ifdef _WIN32
+#include <windows.h>
+typedef SRWLOCK lru_lock_t;
+#define LOCK_INIT(l) (InitializeSRWLock(l), 0)
+#define LOCK_DESTROY(l) (void)(l)
+#define LOCK(l) AcquireSRWLockExclusive(l)
+#define UNLOCK(l) ReleaseSRWLockExclusive(l)
+#else
+#include <pthread.h>
+typedef pthread_mutex_t lru_lock_t;
+#define LOCK_INIT(l) pthread_mutex_init(l, NULL)
+#define LOCK_DESTROY(l) pthread_mutex_destroy(l)
+#define LOCK(l) pthread_mutex_lock(l)
+#define UNLOCK(l) pthread_mutex_unlock(l)
+#endif
+
+#define CACHELINE 64
+#define MAX_SHARDS 256
+
+#define SIZE_BITS (sizeof(size_t) * CHAR_BIT)
+
+/** Counters per sketch row, at least */
+#define SKETCH_MIN_WIDTH 64
+#define SKETCH_ROWS 4
+/**
+ * Counters per row for each item the cache holds. With fewer, a row is
+ * mostly taken by the counts of the cached keys, and keys requested once
+ * share all their counters with some of them often enough to be admitted
+ * (and then hold on to the back of the list, as their estimates do not
+ * decay)
+ */
+#define SKETCH_WIDTH_PER_ITEM 2
+/** Counters are halved after this many increments per counter of a row,
+ * i.e. about ten per cached item */
+#define SKETCH_SAMPLE 5
+/**
+ * Doorkeeper bits per counter of a row. Up to SKETCH_SAMPLE keys per counter
+ * are seen between resets, and the doorkeeper needs several bits for each
+ * to keep keys seen once from passing as seen before
+ */
+#define DOOR_BITS 32
+
+/**
+ * An item: the inline value of its hash table entry. Chained tables never
+ * move their entries, so the list may link these directly
+ */
+struct lru_node {
+    tl_DLISTNODE ll;
+    void *value;
+    size_t charge;
+    uint64_t hash;
+    /** The table's copy of the key */
+    const void *key;
+    size_t nkey;
+};
+
+/**
+ * TinyLFU frequency sketch: SKETCH_ROWS rows of `width` 4 bit counters,
+ * sixteen to a word, and a doorkeeper of DOOR_BITS bits per counter of a row
+ */
+struct lru_sketch {
+    size_t width;
+    size_t additions;
+    uint64_t *counters;
+    uint64_t *door;
+};
+
+struct lru_shard {
+    lru_lock_t lock;
+    tl_HASHTABLE *ht;
+    /** Most recently used first */
+    tl_DLIST list;
+    size_t charge;
+    size_t max_items;
+    size_t max_charge;
+    struct lru_sketch sketch;
+};
+
+struct tl_LRU_st {
+    struct tl_LRUCONF conf;
+    unsigned nbits;
+    unsigned nshards;
+    int locked;
+    size_t stride;
+    void *mem;
+    char *shards;
+};
+
+static struct lru_shard *shard_at(tl_LRU *c, unsigned n)
+{
+    return (struct lru_shard *)(c->shards + n * c->stride);
+}
+
+/* Same as tl_CHASHTABLE: keep the table's own bucket bits for the table */
+static struct lru_shard *shard_for(tl_LRU *c, uint64_t hash)
+{
+    size_t hv = (size_t)(hash ^ (hash >> 32));
+
+    if (c->nbits == 0) {
+        return shard_at(c, 0);
+    }
+#if SIZE_MAX > 0xffffffffUL
+    hv *= (size_t)0x9E3779B97F4A7C15ULL;
+#else
+    hv *= 0x9E3779B9UL;
+#endif
+    return shard_at(c, (unsigned)(hv >> (SIZE_BITS - c->nbits)));
+}
+
+static void shard_lock(tl_LRU *c, struct lru_shard *s)
+{
+    if (c->locked) {
+        LOCK(&s->lock);
+    }
+}
+
+static void shard_unlock(tl_LRU *c, struct lru_shard *s)
+{
+    if (c->locked) {
+        UNLOCK(&s->lock);
+    }
+}
+
+static int sketch_init(struct lru_sketch *sk, size_t nitems)
+{
+    size_t w = SKETCH_MIN_WIDTH;
+    uint64_t *counters, *door;
+
+    while (w < nitems * SKETCH_WIDTH_PER_ITEM) {
+        w <<= 1;
+    }
+    counters = calloc(SKETCH_ROWS * w / 16, sizeof(uint64_t));
+    door = calloc(DOOR_BITS * w / 64, sizeof(uint64_t));
+    if (counters == NULL || door == NULL) {
+        free(counters);
+        free(door);
+        return -1;
+    }
+    free(sk->counters);
+    free(sk->door);
+    sk->counters = counters;
+    sk->door = door;
+    sk->width = w;
+    sk->additions = 0;
+    return 0;
+}
+
+/** Counter `i` of row `row` for a hash */
+static size_t sketch_index(const struct lru_sketch *sk, uint64_t hash, int row)
+{
+    uint32_t h1 = (uint32_t)hash, h2 = (uint32_t)(hash >> 32) | 1;
+    return row * sk->width + ((h1 + (uint32_t)row * h2) & (sk->width - 1));
+}
+
+static unsigned counter_get(const struct lru_sketch *sk, size_t i)
+{
+    return (unsigned)(sk->counters[i / 16] >> (i % 16 * 4)) & 0xf;
+}
+
+static int door_test_set(struct lru_sketch *sk, uint64_t hash, int set)
+{
+    size_t nbits = DOOR_BITS * sk->width;
+    size_t a = (size_t)(hash >> 24) & (nbits - 1);
+    size_t b = (size_t)((hash * 0x9E3779B97F4A7C15ULL) >> 24) & (nbits - 1);
+    uint64_t ma = (uint64_t)1 << (a % 64), mb = (uint64_t)1 << (b % 64);
+    int rv = (sk->door[a / 64] & ma) && (sk->door[b / 64] & mb);
+
+    if (set) {
+        sk->door[a / 64] |= ma;
+        sk->door[b / 64] |= mb;
+    }
+    return rv;
+}
+
+/** Count a request for a key */
+static void sketch_record(struct lru_sketch *sk, uint64_t hash)
+{
+    int row;
+
+    if (door_test_set(sk, hash, 1)) {
+        for (row = 0; row < SKETCH_ROWS; row++) {
+            size_t i = sketch_index(sk, hash, row);
+            if (counter_get(sk, i) != 0xf) {
+                sk->counters[i / 16] += (uint64_t)1 << (i % 16 * 4);
+            }
+        }
+    }
+    if (++sk->additions >= SKETCH_SAMPLE * sk->width) {
+        size_t i, nwords = SKETCH_ROWS * sk->width / 16;
+        for (i = 0; i < nwords; i++) {
+            sk->counters[i] = (sk->counters[i] >> 1) & 0x7777777777777777ULL;
+        }
+        memset(sk->door, 0, DOOR_BITS * sk->width / 8);
+        sk->additions /= 2;
+    }
+}
+
+/** Estimated number of requests for a key */
+static unsigned sketch_estimate(struct lru_sketch *sk, uint64_t hash)
+{
+    unsigned rv = 0xf, n;
+    int row;
+
+    for (row = 0; row < SKETCH_ROWS; row++) {
+        n = counter_get(sk, sketch_index(sk, hash, row));
+        rv = n < rv ? n : rv;
+    }
+    return rv + door_test_set(sk, hash, 0);
+}
+
+static int keys_equal(const void *a, size_t na, const void *b, size_t nb)
+{
+    return na == nb && memcmp(a, b, na) == 0;
+}
+
+static void *copy_key(const void *k, size_t nk)
+{
+    void *rv = malloc(nk ? nk : 1);
+    if (rv != NULL) {
+        memcpy(rv, k, nk);
+    }
+    return rv;
+}
+
+tl_LRU *tl_lru_new(const struct tl_LRUCONF *conf)
+{
+    struct tl_HASHOPS ops = { NULL, keys_equal, copy_key, NULL, free, NULL,
+                              tl_hash64 };
+    struct tl_HASHCONF hconf;
+    tl_LRU *rv;
+    unsigned i, nshards = conf->nshards ? conf->nshards : 1;
+
+    if ((conf->max_items == 0 && conf->max_charge == 0) ||
+            nshards > MAX_SHARDS || (nshards & (nshards - 1))) {
+        return NULL;
+    }
+
+    rv = calloc(1, sizeof(*rv));
+    if (rv == NULL) {
+        return NULL;
+    }
+    rv->conf = *conf;
+    rv->locked = conf->nshards != 0;
+    rv->nshards = nshards;
+    while ((1U << rv->nbits) < nshards) {
+        rv->nbits++;
+    }
+    rv->stride = (sizeof(struct lru_shard) + CACHELINE - 1) & ~(size_t)(CACHELINE - 1);
+    rv->mem = calloc(1, nshards * rv->stride + CACHELINE);
+    if (rv->mem == NULL) {
+        free(rv);
+        return NULL;
+    }
+    rv->shards = (char *)rv->mem + (CACHELINE - (size_t)rv->mem % CACHELINE);
+
+    memset(&hconf, 0, sizeof(hconf));
+    hconf.flags = TL_HT_F_SEED;
+    hconf.seed = tl_hash_randseed();
+    hconf.engine = TL_HT_ENGINE_CHAINED;
+    hconf.inline_key = conf->inline_key;
+    hconf.inline_value = sizeof(struct lru_node);
+
+    for (i = 0; i < nshards; i++) {
+        struct lru_shard *s = shard_at(rv, i);
+        s->max_items = (conf->max_items + nshards - 1) / nshards;
+        s->max_charge = (conf->max_charge + nshards - 1) / nshards;
+        tl_dlist_init(&s->list);
+        s->ht = tl_ht_new_ex(s->max_items ? s->max_items : 1, ops, &hconf);
+        if (s->ht == NULL) {
+            break;
+        }
+        if ((conf->flags & TL_LRU_F_TINYLFU) &&
+                sketch_init(&s->sketch, s->max_items) != 0) {
+            tl_ht_free(s->ht);
+            s->ht = NULL;
+            break;
+        }
+        if (LOCK_INIT(&s->lock) != 0) {
+            tl_ht_free(s->ht);
+            s->ht = NULL;
+            free(s->sketch.counters);
+            free(s->sketch.door);
+            break;
+        }
+    }
+    if (i != nshards) {
+        rv->nshards = i;
+        tl_lru_free(rv);
+        return NULL;
+    }
+    return rv;
+}
+
+/** Unlink an item and delete it from its table, releasing its value */
+static void remove_node(tl_LRU *c, struct lru_shard *s, struct lru_node *n,
+                        enum tl_LRUREASON reason)
+{
+    int rc;
+
+    tl_dlist_delete(&s->list, &n->ll);
+    s->charge -= n->charge;
+    if (c->conf.release != NULL) {
+        c->conf.release(n->key, n->nkey, n->value, n->charge, reason,
+                        c->conf.arg);
+    }
+    rc = tl_ht_del_hashed(s->ht, n->hash, n->key, n->nkey);
+    assert(rc == 1);
+    (void)rc;
+}
+
+static struct lru_node *lru_tail(struct lru_shard *s)
+{
+    return TL_DLIST_ITEM(s->list.base.prev, struct lru_node, ll);
+}
+
+static int over_limits(const struct lru_shard *s, size_t extra_items,
+                       size_t extra_charge)
+{
+    return (s->max_items && s->list.size + extra_items > s->max_items) ||
+           (s->max_charge && s->charge + extra_charge > s->max_charge);
+}
+
+void tl_lru_free(tl_LRU *c)
+{
+    unsigned i;
+
+    if (c == NULL) {
+        return;
+    }
+    for (i = 0; i < c->nshards; i++) {
+        struct lru_shard *s = shard_at(c, i);
+        while (!TL_DLIST_EMPTY(&s->list)) {
+            remove_node(c, s, lru_tail(s), TL_LRU_DELETED);
+        }
+        tl_ht_free(s->ht);
+        free(s->sketch.counters);
+        free(s->sketch.door);
+        LOCK_DESTROY(&s->lock);
+    }
+    free(c->mem);
+    free(c);
+}
+
+static uint64_t lru_hash(tl_LRU *c, const void *k, size_t klen)
+{
+    return tl_ht_hash(shard_at(c, 0)->ht, k, klen);
+}
+
+static void shard_record(tl_LRU *c, struct lru_shard *s, uint64_t hash)
+{
+    if (c->conf.flags & TL_LRU_F_TINYLFU) {
+        /* Caches limited by charge alone size the sketch by their items */
+        if (s->list.size * SKETCH_WIDTH_PER_ITEM > s->sketch.width) {
+            sketch_init(&s->sketch, s->list.size);
+        }
+        sketch_record(&s->sketch, hash);
+    }
+}
+
+int tl_lru_put(tl_LRU *c, const void *k, size_t klen, void *value,
+               size_t charge)
+{
+    uint64_t hash = lru_hash(c, k, klen);
+    struct lru_shard *s = shard_for(c, hash);
+    struct lru_node *n;
+    const void *stored;
+    void **slot;
+    int created, rv = 1;
+
+    shard_lock(c, s);
+    if (s->max_charge && charge > s->max_charge) {
+        rv = 0;
+        goto done;
+    }
+
+    slot = tl_ht_upsert_key_hashed(s->ht, hash, k, klen, &stored, &created);
+    if (slot == NULL) {
+        rv = -1;
+        goto done;
+    }
+    n = *slot;
+
+    if (!created) {
+        tl_dlist_delete(&s->list, &n->ll);
+        s->charge -= n->charge;
+        if (c->conf.release != NULL) {
+            c->conf.release(n->key, n->nkey, n->value, n->charge,
+                            TL_LRU_REPLACED, c->conf.arg);
+        }
+    } else if ((c->conf.flags & TL_LRU_F_TINYLFU) &&
+               over_limits(s, 1, charge) && !TL_DLIST_EMPTY(&s->list) &&
+               sketch_estimate(&s->sketch, hash) <=
+               sketch_estimate(&s->sketch, lru_tail(s)->hash)) {
+        tl_ht_del_hashed(s->ht, hash, stored, klen);
+        rv = 0;
+        goto done;
+    } else {
+        n->hash = hash;
+        n->key = stored;
+        n->nkey = klen;
+    }
+
+    n->value = value;
+    n->charge = charge;
+    while (over_limits(s, 1, charge) && !TL_DLIST_EMPTY(&s->list)) {
+        remove_node(c, s, lru_tail(s), TL_LRU_EVICTED);
+    }
+    tl_dlist_prepend(&s->list, &n->ll);
+    s->charge += charge;
+
+    done:
+    shard_unlock(c, s);
+    return rv;
+}
+
+void *tl_lru_get(tl_LRU *c, const void *k, size_t klen)
+{
+    uint64_t hash = lru_hash(c, k, klen);
+    struct lru_shard *s = shard_for(c, hash);
+    struct lru_node *n;
+    void *rv = NULL;
+
+    shard_lock(c, s);
+    shard_record(c, s, hash);
+    n = tl_ht_find_hashed(s->ht, hash, k, klen);
+    if (n != NULL) {
+        if (s->list.base.next != &n->ll) {
+            tl_dlist_delete(&s->list, &n->ll);
+            tl_dlist_prepend(&s->list, &n->ll);
+        }
+        rv = n->value;
+        if (c->conf.retain != NULL) {
+            c->conf.retain(rv, c->conf.arg);
+        }
+    }
+    shard_unlock(c, s);
+    return rv;
+}
+
+int tl_lru_del(tl_LRU *c, const void *k, size_t klen)
+{
+    uint64_t hash = lru_hash(c, k, klen);
+    struct lru_shard *s = shard_for(c, hash);
+    struct lru_node *n;
+
+    shard_lock(c, s);
+    n = tl_ht_find_hashed(s->ht, hash, k, klen);
+    if (n != NULL) {
+        remove_node(c, s, n, TL_LRU_DELETED);
+    }
+    shard_unlock(c, s);
+    return n != NULL;
+}
+
+size_t tl_lru_size(tl_LRU *c)
+{
+    size_t rv = 0;
+    unsigned i;
+
+    for (i = 0; i < c->nshards; i++) {
+        struct lru_shard *s = shard_at(c, i);
+        shard_lock(c, s);
+        rv += s->list.size;
+        shard_unlock(c, s);
+    }
+    return rv;
+}
+
+size_t tl_lru_charge(tl_LRU *c)
+{
+    size_t rv = 0;
+    unsigned i;
+
+    for (i = 0; i < c->nshards; i++) {
+        struct lru_shard *s = shard_at(c, i);
+        shard_lock(c, s);
+        rv += s->charge;
+        shard_unlock(c, s);
+    }
+    return rv;
+}
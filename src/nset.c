@@ -17,31 +17,303 @@
 
 #include <stdlib.h>
 #include <assert.h>
+#include <limits.h>
+#include <stdint.h>
 #include "tl_nset.h"
 
-static const unsigned int prime_1 = 73;
-static const unsigned int prime_2 = 5009;
+/* Worker threads for tl_nset_new_bulk() */
+#ifdef _WIN32
+#include <windows.h>
+typedef HANDLE bulk_thread_t;
+#else
+#include <pthread.h>
+typedef pthread_t bulk_thread_t;
+#endif
 
-tl_pNSET
-tl_nset_new()
+/*
+ * Items are probed a group of slots at a time: the hash picks a group, and
+ * probing moves linearly through the following groups up to the first one
+ * with an empty slot. A group of 64 bit items is one cache line, and the
+ * slots are aligned on one, so most lookups (hits and misses alike) read a
+ * single line. The slots of a group are compared at once with SSE2 (or
+ * AVX2) on 64 bit platforms.
+ */
+#define SIZE_BITS (sizeof(size_t) * CHAR_BIT)
+#define GROUP_BITS 3
+#define GROUP_SIZE (1 << GROUP_BITS)
+#define LINE_SIZE 64
+
+#if SIZE_MAX > 0xffffffffUL
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define NSET_AVX2 1
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define NSET_SSE2 1
+#endif
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#if defined(__GNUC__)
+#define PREFETCH(p) __builtin_prefetch(p)
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#define PREFETCH(p) _mm_prefetch((const char *)(p), _MM_HINT_T0)
+#else
+#define PREFETCH(p) (void)(p)
+#endif
+
+/** Empty and deleted slots */
+#define SLOT_EMPTY 0
+#define SLOT_DELETED 1
+
+/** The table is rebuilt once items and tombstones fill this percentage of
+ * its slots... */
+#define MAX_LOAD 85
+/** ...or once tombstones alone fill this percentage... */
+#define MAX_DELETED 25
+/** ...or once items fill less than this percentage */
+#define MIN_LOAD 20
+
+/**
+ * Groups of the old table moved by each add or delete while a rebuild is in
+ * progress. This finishes the move well before the new table may need to
+ * be rebuilt in turn
+ */
+#define REHASH_GROUPS 2
+
+/**
+ * Group at which probing for `value` starts in a table of 2^nbits slots.
+ * Multiplying by 2^64 / phi (Fibonacci hashing) and keeping the top bits
+ * mixes every bit of the value into the index, so pointers, whose low bits
+ * are always clear, and sequential integers spread evenly.
+ */
+static size_t
+home_group(size_t nbits, size_t value)
+{
+    size_t gbits = nbits - GROUP_BITS;
+#if SIZE_MAX > 0xffffffffUL
+    value *= (size_t)0x9E3779B97F4A7C15ULL;
+#else
+    value *= 0x9E3779B9UL;
+#endif
+    return gbits ? value >> (SIZE_BITS - gbits) : 0;
+}
+
+static size_t
+ngroups(size_t nbits)
+{
+    return (size_t)1 << (nbits - GROUP_BITS);
+}
+
+/** Returns a bitmask of the slots in the group holding `value` */
+static unsigned
+group_match(const size_t *g, size_t value)
+{
+#if defined(NSET_AVX2)
+    __m256i v = _mm256_set1_epi64x((long long)value);
+    __m256i lo = _mm256_cmpeq_epi64(_mm256_load_si256((const __m256i *)g), v);
+    __m256i hi = _mm256_cmpeq_epi64(_mm256_load_si256((const __m256i *)g + 1), v);
+    return (unsigned)_mm256_movemask_pd(_mm256_castsi256_pd(lo)) |
+            (unsigned)_mm256_movemask_pd(_mm256_castsi256_pd(hi)) << 4;
+#elif defined(NSET_SSE2)
+    /* SSE2 compares 32 bit lanes; an item matches if both its halves do */
+    __m128i v = _mm_set1_epi64x((long long)value);
+    unsigned i, rv = 0;
+    for (i = 0; i < GROUP_SIZE / 2; i++) {
+        __m128i eq = _mm_cmpeq_epi32(_mm_load_si128((const __m128i *)g + i), v);
+        eq = _mm_and_si128(eq, _mm_shuffle_epi32(eq, _MM_SHUFFLE(2, 3, 0, 1)));
+        rv |= (unsigned)_mm_movemask_pd(_mm_castsi128_pd(eq)) << (2 * i);
+    }
+    return rv;
+#else
+    unsigned i, rv = 0;
+    for (i = 0; i < GROUP_SIZE; i++) {
+        rv |= (unsigned)(g[i] == value) << i;
+    }
+    return rv;
+#endif
+}
+
+static unsigned
+lowest_bit(unsigned mask)
+{
+#if defined(__GNUC__)
+    return (unsigned)__builtin_ctz(mask);
+#elif defined(_MSC_VER)
+    unsigned long rv;
+    _BitScanForward(&rv, mask);
+    return (unsigned)rv;
+#else
+    unsigned rv = 0;
+    while (!(mask & 1)) {
+        mask >>= 1;
+        rv++;
+    }
+    return rv;
+#endif
+}
+
+/** `pct` percent of `capacity` */
+static size_t
+pct_of(size_t capacity, unsigned pct)
+{
+    return capacity / 100 * pct + capacity % 100 * pct / 100;
+}
+
+static int
+over_load(size_t nitems, size_t capacity)
+{
+    return nitems >= pct_of(capacity, MAX_LOAD);
+}
+
+/**
+ * Size of the table to rebuild into for `nitems` items: the smallest which
+ * they fill to at most half of the maximum load, leaving room to grow and to
+ * shrink before the next rebuild
+ */
+static size_t
+target_bits(size_t nitems)
+{
+    size_t nbits = GROUP_BITS;
+    while (nitems > pct_of((size_t)1 << nbits, MAX_LOAD) / 2) {
+        nbits++;
+    }
+    return nbits;
+}
+
+/**
+ * Allocate zeroed slots for a table of 2^nbits items, aligned on a cache
+ * line within `*mem`. Returns NULL if memory cannot be allocated
+ */
+static size_t *
+alloc_slots(size_t nbits, void **mem)
+{
+    *mem = calloc(((size_t)1 << nbits) * sizeof(size_t) + LINE_SIZE, 1);
+    if (*mem == NULL) {
+        return NULL;
+    }
+    return (size_t *)((char *)*mem + (LINE_SIZE - (size_t)*mem % LINE_SIZE));
+}
+
+/** Find the slot holding `value` in a table, or NULL */
+static size_t *
+find_slot(size_t *items, size_t nbits, size_t value)
+{
+    size_t g = home_group(nbits, value), i;
+
+    for (i = 0; i < ngroups(nbits); i++, g = (g + 1) & (ngroups(nbits) - 1)) {
+        size_t *grp = items + (g << GROUP_BITS);
+        unsigned mask = group_match(grp, value);
+        if (mask) {
+            return grp + lowest_bit(mask);
+        }
+        if (group_match(grp, SLOT_EMPTY)) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Find the slot holding `value` in the current table, or failing that the
+ * first empty or deleted slot along its probe, where it would go. Returns
+ * NULL if there is neither
+ */
+static size_t *
+probe_slot(size_t *items, size_t nbits, size_t value)
+{
+    size_t g = home_group(nbits, value), i, *dest = NULL;
+
+    for (i = 0; i < ngroups(nbits); i++, g = (g + 1) & (ngroups(nbits) - 1)) {
+        size_t *grp = items + (g << GROUP_BITS);
+        unsigned mask = group_match(grp, value), empty;
+        if (mask) {
+            return grp + lowest_bit(mask);
+        }
+        empty = group_match(grp, SLOT_EMPTY);
+        if (dest == NULL) {
+            mask = empty | group_match(grp, SLOT_DELETED);
+            if (mask) {
+                dest = grp + lowest_bit(mask);
+            }
+        }
+        if (empty) {
+            break;
+        }
+    }
+    return dest;
+}
+
+/**
+ * Find the first empty or deleted slot along the probe of a value which is
+ * known not to be in the table, without looking for it
+ */
+static size_t *
+free_slot(size_t *items, size_t nbits, size_t value)
+{
+    size_t g = home_group(nbits, value), i;
+
+    for (i = 0; i < ngroups(nbits); i++, g = (g + 1) & (ngroups(nbits) - 1)) {
+        size_t *grp = items + (g << GROUP_BITS);
+        unsigned mask = group_match(grp, SLOT_EMPTY) | group_match(grp, SLOT_DELETED);
+        if (mask) {
+            return grp + lowest_bit(mask);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Clear a slot. Probes stop at the first group with an empty slot, so none
+ * goes past a group which already has one, and the slot can be made empty
+ * again; otherwise it becomes a tombstone. Returns 1 for a tombstone
+ */
+static int
+clear_slot(size_t *items, size_t *slot)
+{
+    size_t *grp = items + ((size_t)(slot - items) & ~(size_t)(GROUP_SIZE - 1));
+
+    if (group_match(grp, SLOT_EMPTY)) {
+        *slot = SLOT_EMPTY;
+        return 0;
+    }
+    *slot = SLOT_DELETED;
+    return 1;
+}
+
+/** Create a set with room for `n` items before it needs rebuilding */
+static tl_pNSET
+nset_sized(size_t n)
 {
     tl_pNSET set = calloc(1, sizeof(struct tl_SET));
+    size_t nbits = GROUP_BITS;
 
     if (set == NULL) {
         return NULL;
     }
-    set->nbits = 3;
-    set->capacity = (size_t)(1 << set->nbits);
+    while (over_load(n, (size_t)1 << nbits)) {
+        nbits++;
+    }
+    set->nbits = nbits;
+    set->capacity = (size_t)1 << nbits;
     set->mask = set->capacity - 1;
-    set->items = calloc(set->capacity, sizeof(size_t));
+    set->items = alloc_slots(nbits, &set->mem);
     if (set->items == NULL) {
         tl_nset_free(set);
         return NULL;
     }
-    set->nitems = 0;
     return set;
 }
 
+tl_pNSET
+tl_nset_new()
+{
+    return nset_sized(0);
+}
+
 size_t
 tl_nset_count(tl_pNSET set)
 {
@@ -52,64 +324,155 @@ void
 tl_nset_free(tl_pNSET set)
 {
     if (set) {
-        free(set->items);
+        free(set->mem);
+        free(set->old_mem);
     }
     free(set);
 }
 
-static int
-add_member(tl_pNSET set, void *item)
+/**
+ * Move up to `ngroups` groups of the old table into the current one, and
+ * release the old table once it is empty. Moved items leave tombstones, so
+ * that the items after them in the old table can still be found.
+ */
+static void
+rehash_step(tl_pNSET set, size_t ngroups_max)
 {
-    size_t value = (size_t)item;
-    size_t ii;
+    size_t end = ngroups(set->old_nbits), i;
 
-    if (value == 0 || value == 1) {
-        return -1;
+    for (; ngroups_max && set->rehashidx < end; ngroups_max--, set->rehashidx++) {
+        size_t *grp = set->old_items + (set->rehashidx << GROUP_BITS);
+        for (i = 0; i < GROUP_SIZE; i++) {
+            if (grp[i] > SLOT_DELETED) {
+                size_t *dest = free_slot(set->items, set->nbits, grp[i]);
+                set->ndeleted -= *dest == SLOT_DELETED;
+                *dest = grp[i];
+                grp[i] = SLOT_DELETED;
+            }
+        }
     }
+    if (set->rehashidx == end) {
+        free(set->old_mem);
+        set->old_mem = NULL;
+        set->old_items = NULL;
+        set->old_nbits = 0;
+        set->rehashidx = 0;
+    }
+}
 
-    ii = set->mask & (prime_1 * value);
+/**
+ * Start rebuilding the table if it is too full (of items or tombstones) or
+ * too empty. The rebuild moves the items into a table sized for them, a few
+ * groups at a time (see rehash_step()), which also drops the tombstones.
+ */
+static void
+maybe_rehash(tl_pNSET set)
+{
+    size_t nbits;
+    size_t *items;
+    void *mem;
 
-    while (set->items[ii] != 0 && set->items[ii] != 1) {
-        if (set->items[ii] == value) {
-            return 0;
-        } else {
-            /* search free slot */
-            ii = set->mask & (ii + prime_2);
+    if (set->old_items != NULL) {
+        rehash_step(set, REHASH_GROUPS);
+        /* Only finish early if the new table has filled up meanwhile */
+        if (!over_load(set->nitems + set->ndeleted, set->capacity)) {
+            return;
         }
+        rehash_step(set, (size_t)-1);
+    }
+    if (!over_load(set->nitems + set->ndeleted, set->capacity) &&
+            set->ndeleted <= pct_of(set->capacity, MAX_DELETED) &&
+            (set->nitems >= pct_of(set->capacity, MIN_LOAD) ||
+             set->nbits == GROUP_BITS)) {
+        return;
+    }
+
+    nbits = target_bits(set->nitems);
+    /* The table stays usable (if slower) when it cannot be rebuilt */
+    if ((items = alloc_slots(nbits, &mem)) == NULL) {
+        return;
     }
+    set->old_items = set->items;
+    set->old_mem = set->mem;
+    set->old_nbits = set->nbits;
+    set->rehashidx = 0;
+    set->items = items;
+    set->mem = mem;
+    set->nbits = nbits;
+    set->capacity = (size_t)1 << nbits;
+    set->mask = set->capacity - 1;
+    set->ndeleted = 0;
+    rehash_step(set, REHASH_GROUPS);
+}
+
+/** Add an item to the current table, if it isn't there already */
+static int
+insert_item(tl_pNSET set, size_t value)
+{
+    size_t *dest = probe_slot(set->items, set->nbits, value);
+
+    assert(dest != NULL);
+    if (*dest == value) {
+        return 0;
+    }
+    set->ndeleted -= *dest == SLOT_DELETED;
     set->nitems++;
-    set->items[ii] = value;
+    *dest = value;
     return 1;
 }
 
+/** Add an item known not to be in the set to the current table */
 static void
-maybe_rehash(tl_pNSET set)
+place_item(tl_pNSET set, size_t value)
 {
-    size_t *old_items;
-    size_t old_capacity, ii;
+    size_t *dest = free_slot(set->items, set->nbits, value);
 
+    assert(dest != NULL);
+    set->ndeleted -= *dest == SLOT_DELETED;
+    set->nitems++;
+    *dest = value;
+}
 
-    if ((float)set->nitems >= (size_t)((double)set->capacity * 0.85)) {
-        old_items = set->items;
-        old_capacity = set->capacity;
-        set->nbits++;
-        set->capacity = (size_t)(1 << set->nbits);
-        set->mask = set->capacity - 1;
-        set->items = calloc(set->capacity, sizeof(size_t));
-        set->nitems = 0;
-        assert(set->items);
-        for (ii = 0; ii < old_capacity; ii++) {
-            add_member(set, (void *)old_items[ii]);
-        }
-        free(old_items);
+static int
+add_member(tl_pNSET set, void *item)
+{
+    size_t value = (size_t)item;
+
+    if (value == SLOT_EMPTY || value == SLOT_DELETED) {
+        return -1;
     }
+    if (set->old_items != NULL &&
+            find_slot(set->old_items, set->old_nbits, value) != NULL) {
+        return 0;
+    }
+    return insert_item(set, value);
+}
+
+/** Remove an item, without advancing or starting a rebuild */
+static int
+remove_item(tl_pNSET set, size_t value)
+{
+    size_t *slot;
+
+    if ((slot = find_slot(set->items, set->nbits, value)) != NULL) {
+        set->ndeleted += clear_slot(set->items, slot);
+    } else if (set->old_items != NULL &&
+            (slot = find_slot(set->old_items, set->old_nbits, value)) != NULL) {
+        clear_slot(set->old_items, slot);
+    } else {
+        return 0;
+    }
+    set->nitems--;
+    return 1;
 }
 
 int
 tl_nset_add(tl_pNSET set, void *item)
 {
     int rv = add_member(set, item);
-    maybe_rehash(set);
+    if (rv != -1) {
+        maybe_rehash(set);
+    }
     return rv;
 }
 
@@ -117,34 +480,26 @@ int
 tl_nset_del(tl_pNSET set, void *item)
 {
     size_t value = (size_t)item;
-    size_t ii = set->mask & (prime_1 * value);
 
-    while (set->items[ii] != 0) {
-        if (set->items[ii] == value) {
-            set->items[ii] = 1;
-            set->nitems--;
-            return 1;
-        } else {
-            ii = set->mask & (ii + prime_2);
-        }
+    if (value == SLOT_EMPTY || value == SLOT_DELETED ||
+            !remove_item(set, value)) {
+        return 0;
     }
-    return 0;
+    maybe_rehash(set);
+    return 1;
 }
 
 int
 tl_nset_contains(tl_pNSET set, void *item)
 {
     size_t value = (size_t)item;
-    size_t ii = set->mask & (prime_1 * value);
 
-    while (set->items[ii] != 0) {
-        if (set->items[ii] == value) {
-            return 1;
-        } else {
-            ii = set->mask & (ii + prime_2);
-        }
+    if (value == SLOT_EMPTY || value == SLOT_DELETED) {
+        return 0;
     }
-    return 0;
+    return find_slot(set->items, set->nbits, value) != NULL ||
+            (set->old_items != NULL &&
+             find_slot(set->old_items, set->old_nbits, value) != NULL);
 }
 
 void **
@@ -170,6 +525,464 @@ tl_nset_items(tl_pNSET set, void **itemlist)
             oix++;
         }
     }
+    for (ii = 0; set->old_items != NULL && ii < ((size_t)1 << set->old_nbits); ii++) {
+        if (set->old_items[ii] > 1) {
+            itemlist[oix] = (void *)set->old_items[ii];
+            oix++;
+        }
+    }
 
     return itemlist;
 }
+
+/*
+ * Set algebra. The items of one set are read a batch at a time, finding the
+ * occupied slots of each group with the same compares as lookups, and the
+ * groups they hash to in the other set are prefetched before any of them is
+ * probed, so that the cache misses of a batch overlap.
+ */
+#define BATCH_SIZE 16
+
+/** Position within the slots of a set's tables */
+struct nset_cursor {
+    tl_pNSET set;
+    /** 0 for `items`, 1 for `old_items` */
+    int table;
+    /** Next group */
+    size_t group;
+};
+
+/**
+ * Read the next items of a set into `out`, which has room for BATCH_SIZE.
+ * Returns the number read, 0 once all have been
+ */
+static size_t
+next_items(struct nset_cursor *c, size_t *out)
+{
+    size_t n = 0;
+
+    while (c->table < 2 && n + GROUP_SIZE <= BATCH_SIZE) {
+        const size_t *items = c->table ? c->set->old_items : c->set->items;
+        size_t nbits = c->table ? c->set->old_nbits : c->set->nbits;
+        const size_t *grp;
+        unsigned live;
+
+        if (items == NULL || c->group == ngroups(nbits)) {
+            c->table++;
+            c->group = 0;
+            continue;
+        }
+        grp = items + (c->group++ << GROUP_BITS);
+        live = ~(group_match(grp, SLOT_EMPTY) | group_match(grp, SLOT_DELETED)) &
+                ((1U << GROUP_SIZE) - 1);
+        for (; live; live &= live - 1) {
+            out[n++] = grp[lowest_bit(live)];
+        }
+    }
+    return n;
+}
+
+/** Test each of `n` items for membership of `set`, setting `found[i]` */
+static void
+contains_batch(tl_pNSET set, const size_t *values, size_t n, unsigned char *found)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        PREFETCH(set->items + (home_group(set->nbits, values[i]) << GROUP_BITS));
+    }
+    for (i = 0; i < n; i++) {
+        found[i] = find_slot(set->items, set->nbits, values[i]) != NULL ||
+                (set->old_items != NULL &&
+                 find_slot(set->old_items, set->old_nbits, values[i]) != NULL);
+    }
+}
+
+/** Items kept by filter_items(), in the order they were found */
+struct nset_kept {
+    size_t *items;
+    size_t n;
+    size_t cap;
+};
+
+/**
+ * Go through the items of `src`, keeping those which are (`want` = 1) or
+ * are not (`want` = 0) in `other`: they are appended to `keep` if it is not
+ * NULL, and removed from `rm` if it is not NULL. Returns 0, 1 as soon as an
+ * item is kept if `stop` is set, or -1 if `keep` cannot grow
+ */
+static int
+filter_items(tl_pNSET src, tl_pNSET other, int want, struct nset_kept *keep,
+             tl_pNSET rm, int stop)
+{
+    struct nset_cursor c = { NULL, 0, 0 };
+    size_t values[BATCH_SIZE], n, i;
+    unsigned char found[BATCH_SIZE];
+
+    c.set = src;
+    while ((n = next_items(&c, values)) != 0) {
+        contains_batch(other, values, n, found);
+        if (keep != NULL && keep->cap - keep->n < n) {
+            size_t cap = keep->cap ? keep->cap * 2 : 64;
+            size_t *items = realloc(keep->items, cap * sizeof(*items));
+            if (items == NULL) {
+                return -1;
+            }
+            keep->items = items;
+            keep->cap = cap;
+        }
+        for (i = 0; i < n; i++) {
+            if (found[i] != want) {
+                continue;
+            } else if (stop) {
+                return 1;
+            }
+            if (keep != NULL) {
+                keep->items[keep->n++] = values[i];
+            }
+            if (rm != NULL) {
+                remove_item(rm, values[i]);
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * Create a set from the items of `src` which are (`want` = 1) or are not
+ * (`want` = 0) in `other`. They are gathered first so that the new set is
+ * sized for them rather than for all of `src`
+ */
+static tl_pNSET
+filter_new(tl_pNSET src, tl_pNSET other, int want)
+{
+    struct nset_kept keep = { NULL, 0, 0 };
+    tl_pNSET rv = NULL;
+    size_t i;
+
+    if (filter_items(src, other, want, &keep, NULL, 0) == 0 &&
+            (rv = nset_sized(keep.n)) != NULL) {
+        for (i = 0; i < keep.n; i++) {
+            place_item(rv, keep.items[i]);
+        }
+    }
+    free(keep.items);
+    return rv;
+}
+
+/** Remove the items of `src` from `set`, which is a different set */
+static void
+remove_items(tl_pNSET set, tl_pNSET src)
+{
+    struct nset_cursor c = { NULL, 0, 0 };
+    size_t values[BATCH_SIZE], n, i;
+
+    c.set = src;
+    while ((n = next_items(&c, values)) != 0) {
+        for (i = 0; i < n; i++) {
+            PREFETCH(set->items + (home_group(set->nbits, values[i]) << GROUP_BITS));
+        }
+        for (i = 0; i < n; i++) {
+            remove_item(set, values[i]);
+        }
+    }
+}
+
+/** Replace the contents of `set` with those of `from`, which is freed */
+static void
+nset_replace(tl_pNSET set, tl_pNSET from)
+{
+    struct tl_SET tmp = *set;
+    *set = *from;
+    *from = tmp;
+    tl_nset_free(from);
+}
+
+tl_pNSET
+tl_nset_union_new(tl_pNSET a, tl_pNSET b)
+{
+    tl_pNSET rv = nset_sized(a->nitems + b->nitems);
+    struct nset_cursor c = { NULL, 0, 0 };
+    size_t values[BATCH_SIZE], n, i;
+    int pass;
+
+    if (rv == NULL) {
+        return NULL;
+    }
+    for (pass = 0; pass < 2; pass++) {
+        c.set = pass ? b : a;
+        c.table = 0;
+        c.group = 0;
+        while ((n = next_items(&c, values)) != 0) {
+            for (i = 0; i < n; i++) {
+                PREFETCH(rv->items + (home_group(rv->nbits, values[i]) << GROUP_BITS));
+            }
+            for (i = 0; i < n; i++) {
+                if (pass) {
+                    insert_item(rv, values[i]);
+                } else {
+                    place_item(rv, values[i]);
+                }
+            }
+        }
+    }
+    return rv;
+}
+
+tl_pNSET
+tl_nset_intersect_new(tl_pNSET a, tl_pNSET b)
+{
+    if (a->nitems <= b->nitems) {
+        return filter_new(a, b, 1);
+    }
+    return filter_new(b, a, 1);
+}
+
+tl_pNSET
+tl_nset_difference_new(tl_pNSET a, tl_pNSET b)
+{
+    return filter_new(a, b, 0);
+}
+
+int
+tl_nset_union(tl_pNSET a, tl_pNSET b)
+{
+    struct nset_cursor c = { NULL, 0, 0 };
+    size_t values[BATCH_SIZE], n, i;
+
+    if (a == b) {
+        return 0;
+    }
+    /* Items come in the order of their slots in `b`, and so of their hash.
+     * Fed to a table which has to grow along the way, they would pile up in
+     * its first groups, so rebuild `a` once at the size it may reach */
+    if (over_load(a->nitems + a->ndeleted + b->nitems, a->capacity)) {
+        tl_pNSET rv = tl_nset_union_new(a, b);
+        if (rv == NULL) {
+            return -1;
+        }
+        nset_replace(a, rv);
+        return 0;
+    }
+    c.set = b;
+    while ((n = next_items(&c, values)) != 0) {
+        for (i = 0; i < n; i++) {
+            PREFETCH(a->items + (home_group(a->nbits, values[i]) << GROUP_BITS));
+        }
+        for (i = 0; i < n; i++) {
+            tl_nset_add(a, (void *)values[i]);
+        }
+    }
+    return 0;
+}
+
+int
+tl_nset_intersect(tl_pNSET a, tl_pNSET b)
+{
+    tl_pNSET rv;
+
+    if (a == b) {
+        return 0;
+    } else if (a->nitems <= b->nitems) {
+        /* Removing items moves none of the others, so the cursor over `a`
+         * is unaffected; any rebuild waits until the end */
+        filter_items(a, b, 0, NULL, a, 0);
+        maybe_rehash(a);
+        return 0;
+    }
+    if ((rv = filter_new(b, a, 1)) == NULL) {
+        return -1;
+    }
+    nset_replace(a, rv);
+    return 0;
+}
+
+int
+tl_nset_difference(tl_pNSET a, tl_pNSET b)
+{
+    if (a == b) {
+        b = tl_nset_new();
+        if (b == NULL) {
+            return -1;
+        }
+        nset_replace(a, b);
+    } else if (b->nitems <= a->nitems) {
+        remove_items(a, b);
+    } else {
+        filter_items(a, b, 1, NULL, a, 0);
+    }
+    maybe_rehash(a);
+    return 0;
+}
+
+int
+tl_nset_is_subset(tl_pNSET a, tl_pNSET b)
+{
+    if (a->nitems > b->nitems) {
+        return 0;
+    }
+    return !filter_items(a, b, 0, NULL, NULL, 1);
+}
+
+/*
+ * Bulk construction: the table is sized for every item up front, and each
+ * thread adds its share of the items, claiming empty slots with an atomic
+ * compare-and-swap. Nothing is ever removed while building, so a thread
+ * which finds its item in a slot (whether it lost the race for that slot or
+ * came later) knows the item is present.
+ */
+struct nset_bulk {
+    tl_pNSET set;
+    void * const *items;
+    size_t n;
+    unsigned nthreads;
+};
+
+struct nset_worker {
+    struct nset_bulk *b;
+    unsigned id;
+    /** Number of items added, or (size_t)-1 if an item was invalid */
+    size_t nadded;
+    bulk_thread_t thr;
+};
+
+static size_t
+slot_load(size_t *slot)
+{
+#ifdef _WIN32
+    return *(volatile size_t *)slot;
+#else
+    return __atomic_load_n(slot, __ATOMIC_RELAXED);
+#endif
+}
+
+/* Store `value` in the slot if it is empty. Returns nonzero on success */
+static int
+slot_claim(size_t *slot, size_t value)
+{
+#ifdef _WIN32
+    return InterlockedCompareExchangePointer((PVOID volatile *)slot,
+                                             (PVOID)value, NULL) == NULL;
+#else
+    size_t expected = 0;
+    return __atomic_compare_exchange_n(slot, &expected, value, 0,
+                                       __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+#endif
+}
+
+static void
+bulk_add(struct nset_worker *w)
+{
+    struct nset_bulk *b = w->b;
+    tl_pNSET set = b->set;
+    size_t i, end = b->n / b->nthreads * (w->id + 1);
+
+    if (w->id == b->nthreads - 1) {
+        end = b->n;
+    }
+    for (i = b->n / b->nthreads * w->id; i < end; i++) {
+        size_t value = (size_t)b->items[i];
+        size_t ii;
+
+        if (value == SLOT_EMPTY || value == SLOT_DELETED) {
+            w->nadded = (size_t)-1;
+            return;
+        }
+        /* Slots only ever fill up, so taking the first empty slot from the
+         * start of the home group keeps every group before it full, as
+         * find_slot() expects */
+        ii = home_group(set->nbits, value) << GROUP_BITS;
+        for (;;) {
+            size_t cur = slot_load(&set->items[ii]);
+            if (cur == 0 && slot_claim(&set->items[ii], value)) {
+                w->nadded++;
+                break;
+            }
+            if (cur == value || slot_load(&set->items[ii]) == value) {
+                break;
+            }
+            ii = (ii + 1) & set->mask;
+        }
+    }
+}
+
+#ifdef _WIN32
+static DWORD WINAPI
+bulk_thread_main(LPVOID arg)
+#else
+static void *
+bulk_thread_main(void *arg)
+#endif
+{
+    bulk_add(arg);
+    return 0;
+}
+
+tl_pNSET
+tl_nset_new_bulk(void * const *items, size_t n, unsigned nthreads)
+{
+    struct nset_bulk b;
+    struct nset_worker *workers;
+    int *started;
+    tl_pNSET set;
+    unsigned i;
+    int failed = 0;
+
+    /* Room for every item without reaching the load which triggers a
+     * rehash (see maybe_rehash()) */
+    set = nset_sized(n);
+    if (set == NULL) {
+        return NULL;
+    }
+
+    b.set = set;
+    b.items = items;
+    b.n = n;
+    b.nthreads = nthreads ? nthreads : 1;
+    workers = calloc(b.nthreads, sizeof(*workers) + sizeof(int));
+    if (workers == NULL) {
+        tl_nset_free(set);
+        return NULL;
+    }
+    started = (int *)(workers + b.nthreads);
+
+    for (i = 0; i < b.nthreads; i++) {
+        workers[i].b = &b;
+        workers[i].id = i;
+    }
+    for (i = 1; i < b.nthreads; i++) {
+#ifdef _WIN32
+        workers[i].thr = CreateThread(NULL, 0, bulk_thread_main, &workers[i], 0, NULL);
+        started[i] = workers[i].thr != NULL;
+#else
+        started[i] = pthread_create(&workers[i].thr, NULL, bulk_thread_main,
+                                    &workers[i]) == 0;
+#endif
+    }
+    bulk_add(&workers[0]);
+    for (i = 1; i < b.nthreads; i++) {
+        if (!started[i]) {
+            bulk_add(&workers[i]);
+        } else {
+#ifdef _WIN32
+            WaitForSingleObject(workers[i].thr, INFINITE);
+            CloseHandle(workers[i].thr);
+#else
+            pthread_join(workers[i].thr, NULL);
+#endif
+        }
+    }
+    for (i = 0; i < b.nthreads; i++) {
+        if (workers[i].nadded == (size_t)-1) {
+            failed = 1;
+        } else {
+            set->nitems += workers[i].nadded;
+        }
+    }
+    free(workers);
+    if (failed) {
+        tl_nset_free(set);
+        return NULL;
+    }
+    return set;
+}
@@ -0,0 +1,1459 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2014 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "tl_roaring.h"
+
+/** Most values of an array chunk; fuller chunks are bitmaps */
+#define ARRAY_MAX 4096
+#define BITMAP_WORDS 1024
+#define BITMAP_BYTES (BITMAP_WORDS * 8)
+#define CHUNK_VALUES 65536
+
+/** Format cookies, for sets with and without run chunks */
+#define COOKIE_RUNS 12347
+#define COOKIE_NORUNS 12346
+/** Sets with run chunks only have an offset header from this many chunks */
+#define NO_OFFSET_THRESHOLD 4
+
+enum { CHUNK_ARRAY, CHUNK_BITMAP, CHUNK_RUN };
+enum { OP_OR, OP_AND, OP_ANDNOT };
+
+/** The values `start` to `start + len` */
+struct rr_run {
+    uint16_t start;
+    uint16_t len;
+};
+
+/** The values sharing their upper 16 bits */
+struct rr_chunk {
+    /**
+     * Sorted uint16_t values, BITMAP_WORDS words, or sorted struct rr_run
+     * which neither overlap nor touch
+     */
+    void *data;
+    /** Number of values, 1 to 65536 */
+    uint32_t card;
+    /** Values or runs in `data`, and room for */
+    uint32_t n;
+    uint32_t cap;
+    uint16_t key;
+    uint8_t type;
+};
+
+struct tl_ROARING_st {
+    /** Sorted by key */
+    struct rr_chunk *c;
+    size_t n;
+    size_t cap;
+    uint64_t card;
+};
+
+/* Without the instruction, the builtin is a call into libgcc, slower than
+ * the inline version */
+static unsigned popcount64(uint64_t x)
+{
+#if defined(__GNUC__) && (defined(__POPCNT__) || defined(__aarch64__))
+    return (unsigned)__builtin_popcountll(x);
+#else
+    x = x - ((x >> 1) & 0x5555555555555555ULL);
+    x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+    x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    return (unsigned)((x * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+static unsigned lowest_bit64(uint64_t x)
+{
+#if defined(__GNUC__)
+    return (unsigned)__builtin_ctzll(x);
+#else
+    unsigned rv = 0;
+    while (!(x & 1)) {
+        x >>= 1;
+        rv++;
+    }
+    return rv;
+#endif
+}
+
+/** Set the bits from `lo` to `hi`, inclusive */
+static void words_set(uint64_t *w, uint32_t lo, uint32_t hi)
+{
+    uint32_t i, first = lo / 64, last = hi / 64;
+    uint64_t head = ~(uint64_t)0 << (lo % 64);
+    uint64_t tail = ~(uint64_t)0 >> (63 - hi % 64);
+
+    if (first == last) {
+        w[first] |= head & tail;
+        return;
+    }
+    w[first] |= head;
+    for (i = first + 1; i < last; i++) {
+        w[i] = ~(uint64_t)0;
+    }
+    w[last] |= tail;
+}
+
+static uint32_t words_count(const uint64_t *w)
+{
+    uint32_t rv = 0, i;
+    for (i = 0; i < BITMAP_WORDS; i++) {
+        rv += popcount64(w[i]);
+    }
+    return rv;
+}
+
+/** Number of runs of set bits: the set bits whose predecessor is clear */
+static uint32_t words_runs(const uint64_t *w)
+{
+    uint32_t rv = 0, i;
+    uint64_t prev = 0;
+
+    for (i = 0; i < BITMAP_WORDS; i++) {
+        rv += popcount64(w[i] & ~((w[i] << 1) | (prev >> 63)));
+        prev = w[i];
+    }
+    return rv;
+}
+
+/** First bit at or after `pos` which is set (or clear, if `flip` is all
+ * ones), or CHUNK_VALUES if none */
+static uint32_t words_next(const uint64_t *w, uint32_t pos, uint64_t flip)
+{
+    uint32_t i = pos / 64;
+    uint64_t x;
+
+    if (pos >= CHUNK_VALUES) {
+        return CHUNK_VALUES;
+    }
+    x = (w[i] ^ flip) & (~(uint64_t)0 << (pos % 64));
+    while (!x) {
+        if (++i == BITMAP_WORDS) {
+            return CHUNK_VALUES;
+        }
+        x = w[i] ^ flip;
+    }
+    return i * 64 + lowest_bit64(x);
+}
+
+/** First index of a value not less than `v` */
+static uint32_t array_lower(const uint16_t *a, uint32_t n, uint16_t v)
+{
+    uint32_t lo = 0, hi = n;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        if (a[mid] < v) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/** Number of runs starting at or before `v` */
+static uint32_t run_upper(const struct rr_run *r, uint32_t n, uint16_t v)
+{
+    uint32_t lo = 0, hi = n;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        if (r[mid].start <= v) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/** Serialized size of a chunk's values, which is also their smallest size
+ * in memory */
+static size_t form_bytes(int type, uint32_t card, uint32_t nruns)
+{
+    if (type == CHUNK_RUN) {
+        return 2 + (size_t)nruns * sizeof(struct rr_run);
+    } else if (type == CHUNK_ARRAY) {
+        return (size_t)card * sizeof(uint16_t);
+    }
+    return BITMAP_BYTES;
+}
+
+/** The form holding `card` values, without runs */
+static int plain_form(uint32_t card)
+{
+    return card <= ARRAY_MAX ? CHUNK_ARRAY : CHUNK_BITMAP;
+}
+
+static int best_form(uint32_t card, uint32_t nruns)
+{
+    int rv = plain_form(card);
+    if (form_bytes(CHUNK_RUN, card, nruns) < form_bytes(rv, card, nruns)) {
+        rv = CHUNK_RUN;
+    }
+    return rv;
+}
+
+static int chunk_contains(const struct rr_chunk *c, uint16_t v)
+{
+    if (c->type == CHUNK_ARRAY) {
+        const uint16_t *a = c->data;
+        uint32_t i = array_lower(a, c->n, v);
+        return i < c->n && a[i] == v;
+    } else if (c->type == CHUNK_BITMAP) {
+        const uint64_t *w = c->data;
+        return (w[v / 64] >> (v % 64)) & 1;
+    } else {
+        const struct rr_run *r = c->data;
+        uint32_t i = run_upper(r, c->n, v);
+        return i > 0 && v <= (uint32_t)r[i - 1].start + r[i - 1].len;
+    }
+}
+
+/** Write the chunk's values, in order, to `out` */
+static void chunk_values(const struct rr_chunk *c, uint16_t *out)
+{
+    uint32_t i, n = 0;
+
+    if (c->type == CHUNK_ARRAY) {
+        memcpy(out, c->data, c->n * sizeof(uint16_t));
+    } else if (c->type == CHUNK_BITMAP) {
+        const uint64_t *w = c->data;
+        for (i = 0; i < BITMAP_WORDS; i++) {
+            uint64_t x;
+            for (x = w[i]; x; x &= x - 1) {
+                out[n++] = (uint16_t)(i * 64 + lowest_bit64(x));
+            }
+        }
+    } else {
+        const struct rr_run *r = c->data;
+        for (i = 0; i < c->n; i++) {
+            uint32_t v, end = (uint32_t)r[i].start + r[i].len;
+            for (v = r[i].start; v <= end; v++) {
+                out[n++] = (uint16_t)v;
+            }
+        }
+    }
+}
+
+/** Set the bits of the chunk's values in `w` */
+static void chunk_words(const struct rr_chunk *c, uint64_t *w)
+{
+    uint32_t i;
+
+    if (c->type == CHUNK_BITMAP) {
+        memcpy(w, c->data, BITMAP_BYTES);
+        return;
+    }
+    memset(w, 0, BITMAP_BYTES);
+    if (c->type == CHUNK_ARRAY) {
+        const uint16_t *a = c->data;
+        for (i = 0; i < c->n; i++) {
+            w[a[i] / 64] |= (uint64_t)1 << (a[i] % 64);
+        }
+    } else {
+        const struct rr_run *r = c->data;
+        for (i = 0; i < c->n; i++) {
+            words_set(w, r[i].start, (uint32_t)r[i].start + r[i].len);
+        }
+    }
+}
+
+static uint32_t chunk_nruns(const struct rr_chunk *c)
+{
+    uint32_t rv, i;
+
+    if (c->type == CHUNK_RUN) {
+        return c->n;
+    } else if (c->type == CHUNK_BITMAP) {
+        return words_runs(c->data);
+    } else {
+        const uint16_t *a = c->data;
+        for (i = 1, rv = 1; i < c->n; i++) {
+            rv += a[i] != a[i - 1] + 1;
+        }
+        return rv;
+    }
+}
+
+/** Make room for `n` values or runs */
+static int chunk_reserve(struct rr_chunk *c, uint32_t n)
+{
+    size_t size = c->type == CHUNK_ARRAY ? sizeof(uint16_t) : sizeof(struct rr_run);
+    uint32_t cap = c->cap ? c->cap : 4;
+    void *data;
+
+    if (n <= c->cap) {
+        return 0;
+    }
+    while (cap < n) {
+        cap *= 2;
+    }
+    if ((data = realloc(c->data, cap * size)) == NULL) {
+        return -1;
+    }
+    c->data = data;
+    c->cap = cap;
+    return 0;
+}
+
+/** Replace the chunk's data with `data`, holding its values in `type` */
+static void chunk_set_data(struct rr_chunk *c, void *data, int type, uint32_t n)
+{
+    free(c->data);
+    c->data = data;
+    c->type = (uint8_t)type;
+    c->n = c->cap = n;
+}
+
+/**
+ * Store the chunk as an array or a bitmap, as its number of values calls
+ * for. The chunk is left as it was if memory cannot be allocated
+ */
+static int chunk_unrun(struct rr_chunk *c)
+{
+    void *data;
+
+    if (plain_form(c->card) == CHUNK_ARRAY) {
+        if ((data = malloc(c->card * sizeof(uint16_t))) == NULL) {
+            return -1;
+        }
+        chunk_values(c, data);
+        chunk_set_data(c, data, CHUNK_ARRAY, c->card);
+    } else {
+        if ((data = malloc(BITMAP_BYTES)) == NULL) {
+            return -1;
+        }
+        chunk_words(c, data);
+        chunk_set_data(c, data, CHUNK_BITMAP, 0);
+    }
+    return 0;
+}
+
+/** Store the `card` values set in `w` (which may be the chunk's own
+ * bitmap) in the chunk, in their smallest form */
+static int chunk_from_words(struct rr_chunk *c, const uint64_t *w, uint32_t card)
+{
+    uint32_t nruns = words_runs(w), i, pos;
+    int type = best_form(card, nruns);
+    void *data;
+
+    if (type == CHUNK_RUN) {
+        struct rr_run *r = malloc(nruns * sizeof(*r));
+        if (r == NULL) {
+            return -1;
+        }
+        for (i = 0, pos = words_next(w, 0, 0); i < nruns; i++) {
+            uint32_t end = words_next(w, pos, ~(uint64_t)0);
+            r[i].start = (uint16_t)pos;
+            r[i].len = (uint16_t)(end - 1 - pos);
+            pos = words_next(w, end, 0);
+        }
+        chunk_set_data(c, r, CHUNK_RUN, nruns);
+    } else if (type == CHUNK_ARRAY) {
+        uint16_t *a = malloc(card * sizeof(*a));
+        uint32_t n = 0;
+        if (a == NULL) {
+            return -1;
+        }
+        for (i = 0; i < BITMAP_WORDS; i++) {
+            uint64_t x;
+            for (x = w[i]; x; x &= x - 1) {
+                a[n++] = (uint16_t)(i * 64 + lowest_bit64(x));
+            }
+        }
+        chunk_set_data(c, a, CHUNK_ARRAY, card);
+    } else {
+        if ((data = malloc(BITMAP_BYTES)) == NULL) {
+            return -1;
+        }
+        memcpy(data, w, BITMAP_BYTES);
+        chunk_set_data(c, data, CHUNK_BITMAP, 0);
+    }
+    c->card = card;
+    return 0;
+}
+
+/** Runs are only kept while they are smaller than the alternative; the
+ * chunk stays valid (if larger) if it cannot be converted */
+static void run_check(struct rr_chunk *c)
+{
+    if (form_bytes(CHUNK_RUN, c->card, c->n) >
+            form_bytes(plain_form(c->card), c->card, c->n)) {
+        chunk_unrun(c);
+    }
+}
+
+static int run_add(struct rr_chunk *c, uint16_t v)
+{
+    struct rr_run *r = c->data;
+    uint32_t i = run_upper(r, c->n, v);
+    int joins_prev = 0, joins_next;
+
+    if (i > 0) {
+        uint32_t end = (uint32_t)r[i - 1].start + r[i - 1].len;
+        if (v <= end) {
+            return 0;
+        }
+        joins_prev = v == end + 1;
+    }
+    joins_next = i < c->n && (uint32_t)v + 1 == r[i].start;
+
+    if (joins_prev && joins_next) {
+        r[i - 1].len = (uint16_t)(r[i].start + r[i].len - r[i - 1].start);
+        memmove(r + i, r + i + 1, (c->n - i - 1) * sizeof(*r));
+        c->n--;
+    } else if (joins_prev) {
+        r[i - 1].len++;
+    } else if (joins_next) {
+        r[i].start--;
+        r[i].len++;
+    } else {
+        if (chunk_reserve(c, c->n + 1)) {
+            return -1;
+        }
+        r = c->data;
+        memmove(r + i + 1, r + i, (c->n - i) * sizeof(*r));
+        r[i].start = v;
+        r[i].len = 0;
+        c->n++;
+    }
+    c->card++;
+    run_check(c);
+    return 1;
+}
+
+static int run_del(struct rr_chunk *c, uint16_t v)
+{
+    struct rr_run *r = c->data;
+    uint32_t i = run_upper(r, c->n, v), end;
+
+    if (i == 0 || v > (end = (uint32_t)r[i - 1].start + r[i - 1].len)) {
+        return 0;
+    }
+    i--;
+    if (r[i].len == 0) {
+        memmove(r + i, r + i + 1, (c->n - i - 1) * sizeof(*r));
+        c->n--;
+    } else if (v == r[i].start) {
+        r[i].start++;
+        r[i].len--;
+    } else if (v == end) {
+        r[i].len--;
+    } else {
+        /* Split the run around `v` */
+        if (chunk_reserve(c, c->n + 1)) {
+            return -1;
+        }
+        r = c->data;
+        memmove(r + i + 2, r + i + 1, (c->n - i - 1) * sizeof(*r));
+        r[i + 1].start = (uint16_t)(v + 1);
+        r[i + 1].len = (uint16_t)(end - v - 1);
+        r[i].len = (uint16_t)(v - r[i].start - 1);
+        c->n++;
+    }
+    if (--c->card) {
+        run_check(c);
+    }
+    return 1;
+}
+
+/** @return 1 if added, 0 if present, -1 if memory cannot be allocated */
+static int chunk_add(struct rr_chunk *c, uint16_t v)
+{
+    if (c->type == CHUNK_ARRAY) {
+        uint16_t *a = c->data;
+        uint32_t i = array_lower(a, c->n, v);
+
+        if (i < c->n && a[i] == v) {
+            return 0;
+        }
+        if (c->n == ARRAY_MAX) {
+            uint64_t *w = malloc(BITMAP_BYTES);
+            if (w == NULL) {
+                return -1;
+            }
+            chunk_words(c, w);
+            w[v / 64] |= (uint64_t)1 << (v % 64);
+            chunk_set_data(c, w, CHUNK_BITMAP, 0);
+        } else {
+            if (chunk_reserve(c, c->n + 1)) {
+                return -1;
+            }
+            a = c->data;
+            memmove(a + i + 1, a + i, (c->n - i) * sizeof(*a));
+            a[i] = v;
+            c->n++;
+        }
+        c->card++;
+        return 1;
+    } else if (c->type == CHUNK_BITMAP) {
+        uint64_t *w = c->data, bit = (uint64_t)1 << (v % 64);
+        if (w[v / 64] & bit) {
+            return 0;
+        }
+        w[v / 64] |= bit;
+        c->card++;
+        return 1;
+    }
+    return run_add(c, v);
+}
+
+/** @return 1 if removed, 0 if absent, -1 if memory cannot be allocated */
+static int chunk_del(struct rr_chunk *c, uint16_t v)
+{
+    if (c->type == CHUNK_ARRAY) {
+        uint16_t *a = c->data;
+        uint32_t i = array_lower(a, c->n, v);
+
+        if (i == c->n || a[i] != v) {
+            return 0;
+        }
+        memmove(a + i, a + i + 1, (c->n - i - 1) * sizeof(*a));
+        c->n--;
+        c->card--;
+        return 1;
+    } else if (c->type == CHUNK_BITMAP) {
+        uint64_t *w = c->data, bit = (uint64_t)1 << (v % 64);
+        if (!(w[v / 64] & bit)) {
+            return 0;
+        }
+        w[v / 64] &= ~bit;
+        if (--c->card && plain_form(c->card) == CHUNK_ARRAY) {
+            /* As for runs, the bitmap stays if it cannot be converted */
+            chunk_unrun(c);
+        }
+        return 1;
+    }
+    return run_del(c, v);
+}
+
+/** Number of values not greater than `v` */
+static uint32_t chunk_rank(const struct rr_chunk *c, uint16_t v)
+{
+    uint32_t rv = 0, i;
+
+    if (c->type == CHUNK_ARRAY) {
+        const uint16_t *a = c->data;
+        i = array_lower(a, c->n, v);
+        return i + (i < c->n && a[i] == v);
+    } else if (c->type == CHUNK_BITMAP) {
+        /* Count from whichever end of the bitmap is nearer */
+        const uint64_t *w = c->data;
+        if (v < 32768) {
+            for (i = 0; i < v / 64u; i++) {
+                rv += popcount64(w[i]);
+            }
+            return rv + popcount64(w[i] & (~(uint64_t)0 >> (63 - v % 64)));
+        }
+        for (i = BITMAP_WORDS - 1; i > v / 64u; i--) {
+            rv += popcount64(w[i]);
+        }
+        return c->card - rv - popcount64(w[i] & ~(~(uint64_t)0 >> (63 - v % 64)));
+    } else {
+        const struct rr_run *r = c->data;
+        uint32_t n = run_upper(r, c->n, v);
+        for (i = 0; i < n; i++) {
+            uint32_t len = v - r[i].start;
+            rv += (len < r[i].len ? len : r[i].len) + 1;
+        }
+        return rv;
+    }
+}
+
+/** The value with `n` smaller ones, which must be less than the count */
+static uint16_t chunk_select(const struct rr_chunk *c, uint32_t n)
+{
+    uint32_t i;
+
+    if (c->type == CHUNK_ARRAY) {
+        return ((const uint16_t *)c->data)[n];
+    } else if (c->type == CHUNK_BITMAP) {
+        const uint64_t *w = c->data;
+        uint64_t x;
+        if (n < c->card / 2) {
+            for (i = 0; n >= popcount64(w[i]); i++) {
+                n -= popcount64(w[i]);
+            }
+        } else {
+            /* Find the word from the end; `n` becomes the rank within it */
+            uint32_t after = c->card - n;
+            for (i = BITMAP_WORDS - 1; after > popcount64(w[i]); i--) {
+                after -= popcount64(w[i]);
+            }
+            n = popcount64(w[i]) - after;
+        }
+        for (x = w[i]; n; n--) {
+            x &= x - 1;
+        }
+        return (uint16_t)(i * 64 + lowest_bit64(x));
+    } else {
+        const struct rr_run *r = c->data;
+        for (i = 0; n > r[i].len; i++) {
+            n -= r[i].len + 1u;
+        }
+        return (uint16_t)(r[i].start + n);
+    }
+}
+
+static size_t chunk_data_bytes(const struct rr_chunk *c)
+{
+    if (c->type == CHUNK_BITMAP) {
+        return BITMAP_BYTES;
+    }
+    return c->cap * (c->type == CHUNK_ARRAY ? sizeof(uint16_t) : sizeof(struct rr_run));
+}
+
+static int chunk_copy(struct rr_chunk *dst, const struct rr_chunk *src)
+{
+    size_t size;
+
+    *dst = *src;
+    dst->cap = src->n;
+    size = chunk_data_bytes(dst);
+    if ((dst->data = malloc(size)) == NULL) {
+        return -1;
+    }
+    memcpy(dst->data, src->data, size);
+    return 0;
+}
+
+/**
+ * Keep the values of array `a` which are (`want` = 1) or are not (`want` =
+ * 0) in `b`. Both arrays are walked together; other chunks are looked up
+ */
+static int array_filter(const struct rr_chunk *a, const struct rr_chunk *b,
+                        int want, struct rr_chunk *out)
+{
+    const uint16_t *va = a->data;
+    uint16_t *o = malloc(a->n * sizeof(*o));
+    uint32_t i, j = 0, n = 0;
+
+    if (o == NULL) {
+        return -1;
+    }
+    for (i = 0; i < a->n; i++) {
+        int found;
+        if (b->type == CHUNK_ARRAY) {
+            const uint16_t *vb = b->data;
+            while (j < b->n && vb[j] < va[i]) {
+                j++;
+            }
+            found = j < b->n && vb[j] == va[i];
+        } else {
+            found = chunk_contains(b, va[i]);
+        }
+        if (found == want) {
+            o[n++] = va[i];
+        }
+    }
+    out->type = CHUNK_ARRAY;
+    out->data = o;
+    out->n = out->cap = out->card = n;
+    return 0;
+}
+
+/** Merge two arrays holding at most ARRAY_MAX values between them */
+static int array_union(const struct rr_chunk *a, const struct rr_chunk *b,
+                       struct rr_chunk *out)
+{
+    const uint16_t *va = a->data, *vb = b->data;
+    uint16_t *o = malloc((a->n + b->n) * sizeof(*o));
+    uint32_t i = 0, j = 0, n = 0;
+
+    if (o == NULL) {
+        return -1;
+    }
+    while (i < a->n && j < b->n) {
+        uint16_t v = va[i] < vb[j] ? va[i] : vb[j];
+        i += va[i] == v;
+        j += vb[j] == v;
+        o[n++] = v;
+    }
+    while (i < a->n) {
+        o[n++] = va[i++];
+    }
+    while (j < b->n) {
+        o[n++] = vb[j++];
+    }
+    out->type = CHUNK_ARRAY;
+    out->data = o;
+    out->n = out->cap = out->card = n;
+    return 0;
+}
+
+/**
+ * Combine two chunks with the same key into `out`, whose count is left at
+ * 0 if no values result. Arrays are merged or filtered; other pairs are
+ * combined a word at a time in the scratch bitmaps `w1` and `w2`, and the
+ * result stored in its smallest form
+ */
+static int chunk_op(const struct rr_chunk *a, const struct rr_chunk *b, int op,
+                    struct rr_chunk *out, uint64_t *w1, uint64_t *w2)
+{
+    uint32_t i;
+
+    out->key = a->key;
+    if (op != OP_OR && a->type == CHUNK_ARRAY) {
+        return array_filter(a, b, op == OP_AND, out);
+    } else if (op == OP_AND && b->type == CHUNK_ARRAY) {
+        return array_filter(b, a, 1, out);
+    } else if (op == OP_OR && a->type == CHUNK_ARRAY &&
+            b->type == CHUNK_ARRAY && a->n + b->n <= ARRAY_MAX) {
+        return array_union(a, b, out);
+    }
+
+    chunk_words(a, w1);
+    chunk_words(b, w2);
+    if (op == OP_OR) {
+        for (i = 0; i < BITMAP_WORDS; i++) {
+            w1[i] |= w2[i];
+        }
+    } else if (op == OP_AND) {
+        for (i = 0; i < BITMAP_WORDS; i++) {
+            w1[i] &= w2[i];
+        }
+    } else {
+        for (i = 0; i < BITMAP_WORDS; i++) {
+            w1[i] &= ~w2[i];
+        }
+    }
+    out->card = words_count(w1);
+    return out->card ? chunk_from_words(out, w1, out->card) : 0;
+}
+
+/** Check whether the values of `a` are all in `b`, which has the same key */
+static int chunk_subset(const struct rr_chunk *a, const struct rr_chunk *b)
+{
+    uint32_t i, j = 0;
+
+    if (a->card > b->card) {
+        return 0;
+    } else if (a->type == CHUNK_BITMAP && b->type == CHUNK_BITMAP) {
+        const uint64_t *wa = a->data, *wb = b->data;
+        for (i = 0; i < BITMAP_WORDS; i++) {
+            if (wa[i] & ~wb[i]) {
+                return 0;
+            }
+        }
+    } else if (a->type == CHUNK_RUN && b->type == CHUNK_RUN) {
+        /* Runs are maximal, so each run of `a` must be within one of `b` */
+        const struct rr_run *ra = a->data, *rb = b->data;
+        for (i = 0; i < a->n; i++) {
+            j = run_upper(rb, b->n, ra[i].start);
+            if (j == 0 || (uint32_t)ra[i].start + ra[i].len >
+                    (uint32_t)rb[j - 1].start + rb[j - 1].len) {
+                return 0;
+            }
+        }
+    } else if (a->type == CHUNK_ARRAY) {
+        const uint16_t *va = a->data;
+        for (i = 0; i < a->n; i++) {
+            if (!chunk_contains(b, va[i])) {
+                return 0;
+            }
+        }
+    } else if (a->type == CHUNK_RUN) {
+        const struct rr_run *ra = a->data;
+        for (i = 0; i < a->n; i++) {
+            uint32_t v, end = (uint32_t)ra[i].start + ra[i].len;
+            for (v = ra[i].start; v <= end; v++) {
+                if (!chunk_contains(b, (uint16_t)v)) {
+                    return 0;
+                }
+            }
+        }
+    } else {
+        uint32_t v = 0;
+        while ((v = words_next(a->data, v, 0)) < CHUNK_VALUES) {
+            if (!chunk_contains(b, (uint16_t)v++)) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+tl_ROARING *tl_roaring_new(void)
+{
+    return calloc(1, sizeof(tl_ROARING));
+}
+
+static void roaring_clear(tl_ROARING *r)
+{
+    size_t i;
+    for (i = 0; i < r->n; i++) {
+        free(r->c[i].data);
+    }
+    free(r->c);
+    r->c = NULL;
+    r->n = r->cap = 0;
+    r->card = 0;
+}
+
+void tl_roaring_free(tl_ROARING *r)
+{
+    if (r != NULL) {
+        roaring_clear(r);
+        free(r);
+    }
+}
+
+/** Index of the first chunk with a key not less than `key` */
+static size_t find_chunk(const tl_ROARING *r, uint16_t key)
+{
+    size_t lo = 0, hi = r->n;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (r->c[mid].key < key) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static const struct rr_chunk *get_chunk(const tl_ROARING *r, uint16_t key)
+{
+    size_t i = find_chunk(r, key);
+    return i < r->n && r->c[i].key == key ? &r->c[i] : NULL;
+}
+
+static int reserve_chunks(tl_ROARING *r, size_t n)
+{
+    size_t cap = r->cap ? r->cap : 4;
+    struct rr_chunk *c;
+
+    if (n <= r->cap) {
+        return 0;
+    }
+    while (cap < n) {
+        cap *= 2;
+    }
+    if ((c = realloc(r->c, cap * sizeof(*c))) == NULL) {
+        return -1;
+    }
+    r->c = c;
+    r->cap = cap;
+    return 0;
+}
+
+/** Insert an empty array chunk at index `i` */
+static struct rr_chunk *insert_chunk(tl_ROARING *r, size_t i, uint16_t key)
+{
+    if (reserve_chunks(r, r->n + 1)) {
+        return NULL;
+    }
+    memmove(r->c + i + 1, r->c + i, (r->n - i) * sizeof(*r->c));
+    r->n++;
+    memset(&r->c[i], 0, sizeof(r->c[i]));
+    r->c[i].key = key;
+    r->c[i].type = CHUNK_ARRAY;
+    return &r->c[i];
+}
+
+static void remove_chunk(tl_ROARING *r, size_t i)
+{
+    free(r->c[i].data);
+    memmove(r->c + i, r->c + i + 1, (r->n - i - 1) * sizeof(*r->c));
+    r->n--;
+}
+
+int tl_roaring_add(tl_ROARING *r, uint32_t value)
+{
+    uint16_t key = (uint16_t)(value >> 16);
+    size_t i = find_chunk(r, key);
+    struct rr_chunk *c;
+    int rv;
+
+    if (i < r->n && r->c[i].key == key) {
+        c = &r->c[i];
+    } else if ((c = insert_chunk(r, i, key)) == NULL) {
+        return -1;
+    }
+    rv = chunk_add(c, (uint16_t)value);
+    if (rv == 1) {
+        r->card++;
+    } else if (c->card == 0) {
+        remove_chunk(r, i);
+    }
+    return rv;
+}
+
+int tl_roaring_add_range(tl_ROARING *r, uint32_t first, uint32_t last)
+{
+    uint64_t *w;
+    uint32_t key;
+
+    if (first > last) {
+        return 0;
+    }
+    if ((w = malloc(BITMAP_BYTES)) == NULL) {
+        return -1;
+    }
+    for (key = first >> 16; key <= last >> 16; key++) {
+        uint32_t lo = key == first >> 16 ? first & 0xffff : 0;
+        uint32_t hi = key == last >> 16 ? last & 0xffff : 0xffff;
+        size_t i = find_chunk(r, (uint16_t)key);
+        struct rr_chunk *c = i < r->n && r->c[i].key == key ? &r->c[i] : NULL;
+        uint32_t card;
+
+        if (c != NULL) {
+            chunk_words(c, w);
+        } else {
+            memset(w, 0, BITMAP_BYTES);
+        }
+        words_set(w, lo, hi);
+        card = words_count(w);
+        if (c == NULL && (c = insert_chunk(r, i, (uint16_t)key)) == NULL) {
+            free(w);
+            return -1;
+        }
+        r->card -= c->card;
+        if (chunk_from_words(c, w, card)) {
+            r->card += c->card;
+            if (c->card == 0) {
+                remove_chunk(r, i);
+            }
+            free(w);
+            return -1;
+        }
+        r->card += c->card;
+    }
+    free(w);
+    return 0;
+}
+
+int tl_roaring_del(tl_ROARING *r, uint32_t value)
+{
+    uint16_t key = (uint16_t)(value >> 16);
+    size_t i = find_chunk(r, key);
+    int rv;
+
+    if (i == r->n || r->c[i].key != key) {
+        return 0;
+    }
+    rv = chunk_del(&r->c[i], (uint16_t)value);
+    if (rv == 1) {
+        r->card--;
+        if (r->c[i].card == 0) {
+            remove_chunk(r, i);
+        }
+    }
+    return rv;
+}
+
+int tl_roaring_contains(const tl_ROARING *r, uint32_t value)
+{
+    const struct rr_chunk *c = get_chunk(r, (uint16_t)(value >> 16));
+    return c != NULL && chunk_contains(c, (uint16_t)value);
+}
+
+uint64_t tl_roaring_count(const tl_ROARING *r)
+{
+    return r->card;
+}
+
+uint32_t *tl_roaring_items(const tl_ROARING *r, uint32_t *out)
+{
+    uint16_t *low;
+    uint64_t n = 0;
+    size_t i;
+    uint32_t j;
+
+    if (r->card == 0 || r->card > (size_t)-1 / sizeof(uint32_t)) {
+        return NULL;
+    }
+    if ((low = malloc(CHUNK_VALUES * sizeof(*low))) == NULL) {
+        return NULL;
+    }
+    if (out == NULL && (out = malloc((size_t)r->card * sizeof(*out))) == NULL) {
+        free(low);
+        return NULL;
+    }
+    for (i = 0; i < r->n; i++) {
+        uint32_t high = (uint32_t)r->c[i].key << 16;
+        chunk_values(&r->c[i], low);
+        for (j = 0; j < r->c[i].card; j++) {
+            out[n++] = high | low[j];
+        }
+    }
+    free(low);
+    return out;
+}
+
+uint64_t tl_roaring_rank(const tl_ROARING *r, uint32_t value)
+{
+    uint16_t key = (uint16_t)(value >> 16);
+    size_t i = find_chunk(r, key), j;
+    uint64_t rv = 0;
+
+    /* Sum the counts of the chunks on the nearer side of this one */
+    if (i < r->n / 2) {
+        for (j = 0; j < i; j++) {
+            rv += r->c[j].card;
+        }
+    } else {
+        for (rv = r->card, j = r->n; j > i; j--) {
+            rv -= r->c[j - 1].card;
+        }
+    }
+    if (i < r->n && r->c[i].key == key) {
+        rv += chunk_rank(&r->c[i], (uint16_t)value);
+    }
+    return rv;
+}
+
+int tl_roaring_select(const tl_ROARING *r, uint64_t n, uint32_t *value)
+{
+    size_t i;
+
+    if (n >= r->card) {
+        return -1;
+    }
+    if (n < r->card / 2) {
+        for (i = 0; n >= r->c[i].card; i++) {
+            n -= r->c[i].card;
+        }
+    } else {
+        uint64_t after = r->card - n;
+        for (i = r->n - 1; after > r->c[i].card; i--) {
+            after -= r->c[i].card;
+        }
+        n = r->c[i].card - after;
+    }
+    *value = (uint32_t)r->c[i].key << 16 | chunk_select(&r->c[i], (uint32_t)n);
+    return 0;
+}
+
+/** Combine two sets chunk by chunk into a new set */
+static tl_ROARING *roaring_op(const tl_ROARING *a, const tl_ROARING *b, int op)
+{
+    tl_ROARING *rv = tl_roaring_new();
+    uint64_t *w = NULL;
+    size_t i = 0, j = 0;
+
+    if (rv == NULL) {
+        return NULL;
+    }
+    while (i < a->n || j < b->n) {
+        const struct rr_chunk *ca = i < a->n ? &a->c[i] : NULL;
+        const struct rr_chunk *cb = j < b->n ? &b->c[j] : NULL;
+        struct rr_chunk out;
+
+        memset(&out, 0, sizeof(out));
+        if (op == OP_AND && (ca == NULL || cb == NULL)) {
+            break;
+        } else if (cb == NULL || (ca != NULL && ca->key < cb->key)) {
+            i++;
+            if (op == OP_AND) {
+                continue;
+            } else if (chunk_copy(&out, ca)) {
+                goto fail;
+            }
+        } else if (ca == NULL || cb->key < ca->key) {
+            j++;
+            if (op != OP_OR) {
+                continue;
+            } else if (chunk_copy(&out, cb)) {
+                goto fail;
+            }
+        } else {
+            i++;
+            j++;
+            if (w == NULL && (w = malloc(2 * BITMAP_BYTES)) == NULL) {
+                goto fail;
+            }
+            if (chunk_op(ca, cb, op, &out, w, w + BITMAP_WORDS)) {
+                goto fail;
+            }
+            if (out.card == 0) {
+                free(out.data);
+                continue;
+            }
+        }
+        if (reserve_chunks(rv, rv->n + 1)) {
+            free(out.data);
+            goto fail;
+        }
+        rv->c[rv->n++] = out;
+        rv->card += out.card;
+    }
+    free(w);
+    return rv;
+
+    fail:
+    free(w);
+    tl_roaring_free(rv);
+    return NULL;
+}
+
+/** Replace the contents of `r` with those of `from`, which is freed */
+static void roaring_replace(tl_ROARING *r, tl_ROARING *from)
+{
+    tl_ROARING tmp = *r;
+    *r = *from;
+    *from = tmp;
+    tl_roaring_free(from);
+}
+
+tl_ROARING *tl_roaring_union_new(const tl_ROARING *a, const tl_ROARING *b)
+{
+    return roaring_op(a, b, OP_OR);
+}
+
+tl_ROARING *tl_roaring_intersect_new(const tl_ROARING *a, const tl_ROARING *b)
+{
+    return roaring_op(a, b, OP_AND);
+}
+
+tl_ROARING *tl_roaring_difference_new(const tl_ROARING *a, const tl_ROARING *b)
+{
+    return roaring_op(a, b, OP_ANDNOT);
+}
+
+int tl_roaring_union(tl_ROARING *a, const tl_ROARING *b)
+{
+    tl_ROARING *rv;
+
+    if (a == b) {
+        return 0;
+    } else if ((rv = roaring_op(a, b, OP_OR)) == NULL) {
+        return -1;
+    }
+    roaring_replace(a, rv);
+    return 0;
+}
+
+int tl_roaring_intersect(tl_ROARING *a, const tl_ROARING *b)
+{
+    tl_ROARING *rv;
+
+    if (a == b) {
+        return 0;
+    } else if ((rv = roaring_op(a, b, OP_AND)) == NULL) {
+        return -1;
+    }
+    roaring_replace(a, rv);
+    return 0;
+}
+
+int tl_roaring_difference(tl_ROARING *a, const tl_ROARING *b)
+{
+    tl_ROARING *rv;
+
+    if (a == b) {
+        roaring_clear(a);
+        return 0;
+    } else if ((rv = roaring_op(a, b, OP_ANDNOT)) == NULL) {
+        return -1;
+    }
+    roaring_replace(a, rv);
+    return 0;
+}
+
+int tl_roaring_is_subset(const tl_ROARING *a, const tl_ROARING *b)
+{
+    size_t i;
+
+    if (a->card > b->card) {
+        return 0;
+    }
+    for (i = 0; i < a->n; i++) {
+        const struct rr_chunk *cb = get_chunk(b, a->c[i].key);
+        if (cb == NULL || !chunk_subset(&a->c[i], cb)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int tl_roaring_optimize(tl_ROARING *r)
+{
+    uint64_t *w = NULL;
+    size_t i;
+    int rv = 0;
+
+    for (i = 0; i < r->n && rv == 0; i++) {
+        struct rr_chunk *c = &r->c[i];
+
+        if (best_form(c->card, chunk_nruns(c)) != c->type) {
+            if (w == NULL && (w = malloc(BITMAP_BYTES)) == NULL) {
+                return -1;
+            }
+            chunk_words(c, w);
+            rv = chunk_from_words(c, w, c->card);
+        } else if (c->type != CHUNK_BITMAP && c->cap > c->n) {
+            /* Give back the room left by removals; failing to is harmless */
+            void *data = realloc(c->data, c->n * (c->type == CHUNK_ARRAY ?
+                                 sizeof(uint16_t) : sizeof(struct rr_run)));
+            if (data != NULL) {
+                c->data = data;
+                c->cap = c->n;
+            }
+        }
+    }
+    free(w);
+    return rv;
+}
+
+size_t tl_roaring_bytes(const tl_ROARING *r)
+{
+    size_t rv = sizeof(*r) + r->cap * sizeof(*r->c), i;
+    for (i = 0; i < r->n; i++) {
+        rv += chunk_data_bytes(&r->c[i]);
+    }
+    return rv;
+}
+
+/* The portable format is little endian throughout */
+static unsigned char *put16(unsigned char *p, uint32_t v)
+{
+    p[0] = (unsigned char)v;
+    p[1] = (unsigned char)(v >> 8);
+    return p + 2;
+}
+
+static unsigned char *put32(unsigned char *p, uint32_t v)
+{
+    return put16(put16(p, v & 0xffff), v >> 16);
+}
+
+static uint32_t get16(const unsigned char *p)
+{
+    return p[0] | (uint32_t)p[1] << 8;
+}
+
+static uint32_t get32(const unsigned char *p)
+{
+    return get16(p) | get16(p + 2) << 16;
+}
+
+/** Serialized size of a chunk. Array and bitmap chunks are told apart by
+ * their count, so that decides how they are written */
+static size_t chunk_serial_bytes(const struct rr_chunk *c)
+{
+    return form_bytes(c->type == CHUNK_RUN ? CHUNK_RUN : plain_form(c->card),
+                      c->card, c->n);
+}
+
+int tl_roaring_serialize(const tl_ROARING *r, tl_STRING *str)
+{
+    size_t i, size, header;
+    int runs = 0;
+    unsigned char *p;
+
+    for (i = 0; i < r->n; i++) {
+        runs |= r->c[i].type == CHUNK_RUN;
+    }
+    header = (runs ? 4 + (r->n + 7) / 8 : 8) + 4 * r->n;
+    if (!runs || r->n >= NO_OFFSET_THRESHOLD) {
+        header += 4 * r->n;
+    }
+    for (i = 0, size = header; i < r->n; i++) {
+        size += chunk_serial_bytes(&r->c[i]);
+    }
+    if (tl_str_reserve(str, size)) {
+        return -1;
+    }
+
+    p = (unsigned char *)tl_str_tail(str);
+    if (runs) {
+        p = put32(p, COOKIE_RUNS | (uint32_t)(r->n - 1) << 16);
+        memset(p, 0, (r->n + 7) / 8);
+        for (i = 0; i < r->n; i++) {
+            if (r->c[i].type == CHUNK_RUN) {
+                p[i / 8] |= 1 << (i % 8);
+            }
+        }
+        p += (r->n + 7) / 8;
+    } else {
+        p = put32(put32(p, COOKIE_NORUNS), (uint32_t)r->n);
+    }
+    for (i = 0; i < r->n; i++) {
+        p = put32(p, r->c[i].key | (r->c[i].card - 1) << 16);
+    }
+    if (!runs || r->n >= NO_OFFSET_THRESHOLD) {
+        size_t offset = header;
+        for (i = 0; i < r->n; i++) {
+            p = put32(p, (uint32_t)offset);
+            offset += chunk_serial_bytes(&r->c[i]);
+        }
+    }
+
+    for (i = 0; i < r->n; i++) {
+        const struct rr_chunk *c = &r->c[i];
+        uint32_t j;
+
+        if (c->type == CHUNK_RUN) {
+            const struct rr_run *rr = c->data;
+            p = put16(p, c->n);
+            for (j = 0; j < c->n; j++) {
+                p = put16(put16(p, rr[j].start), rr[j].len);
+            }
+        } else if (plain_form(c->card) == CHUNK_BITMAP) {
+            const uint64_t *w = c->data;
+            for (j = 0; j < BITMAP_WORDS; j++) {
+                p = put32(put32(p, (uint32_t)w[j]), (uint32_t)(w[j] >> 32));
+            }
+        } else if (c->type == CHUNK_ARRAY) {
+            const uint16_t *a = c->data;
+            for (j = 0; j < c->n; j++) {
+                p = put16(p, a[j]);
+            }
+        } else {
+            /* A bitmap which could not be turned back into an array */
+            uint32_t v = 0;
+            while ((v = words_next(c->data, v, 0)) < CHUNK_VALUES) {
+                p = put16(p, v++);
+            }
+        }
+    }
+    assert(p == (unsigned char *)tl_str_tail(str) + size);
+    tl_str_added(str, size);
+    return 0;
+}
+
+/**
+ * Read a chunk's values from `p`, which has `avail` bytes, given its count
+ * from the header. Touching runs are merged. Returns the number of bytes
+ * read, or 0 if they are not valid
+ */
+static size_t read_chunk(struct rr_chunk *c, const unsigned char *p,
+                         size_t avail, int run)
+{
+    uint32_t i, n = 0;
+
+    if (run) {
+        struct rr_run *r;
+        uint32_t nruns, card = 0;
+        int32_t end = -2;
+
+        if (avail < 2 || (nruns = get16(p)) == 0 || avail - 2 < nruns * 4) {
+            return 0;
+        }
+        if ((r = malloc(nruns * sizeof(*r))) == NULL) {
+            return 0;
+        }
+        chunk_set_data(c, r, CHUNK_RUN, 0);
+        for (i = 0; i < nruns; i++) {
+            uint32_t start = get16(p + 2 + i * 4), len = get16(p + 4 + i * 4);
+            if ((int32_t)start <= end || start + len >= CHUNK_VALUES) {
+                return 0;
+            } else if ((int32_t)start == end + 1) {
+                r[n - 1].len = (uint16_t)(r[n - 1].len + len + 1);
+            } else {
+                r[n].start = (uint16_t)start;
+                r[n++].len = (uint16_t)len;
+            }
+            end = (int32_t)(start + len);
+            card += len + 1;
+        }
+        c->n = n;
+        c->cap = nruns;
+        return card == c->card ? 2 + nruns * 4 : 0;
+    } else if (plain_form(c->card) == CHUNK_ARRAY) {
+        uint16_t *a;
+        if (avail < c->card * 2 || (a = malloc(c->card * sizeof(*a))) == NULL) {
+            return 0;
+        }
+        chunk_set_data(c, a, CHUNK_ARRAY, c->card);
+        for (i = 0; i < c->card; i++) {
+            a[i] = (uint16_t)get16(p + i * 2);
+            if (i > 0 && a[i] <= a[i - 1]) {
+                return 0;
+            }
+        }
+        return c->card * 2;
+    } else {
+        uint64_t *w;
+        if (avail < BITMAP_BYTES || (w = malloc(BITMAP_BYTES)) == NULL) {
+            return 0;
+        }
+        chunk_set_data(c, w, CHUNK_BITMAP, 0);
+        for (i = 0; i < BITMAP_WORDS; i++) {
+            w[i] = get32(p + i * 8) | (uint64_t)get32(p + i * 8 + 4) << 32;
+        }
+        return words_count(w) == c->card ? BITMAP_BYTES : 0;
+    }
+}
+
+tl_ROARING *tl_roaring_deserialize(const void *data, size_t n, size_t *nread)
+{
+    const unsigned char *p = data, *runs = NULL, *keys;
+    size_t size, pos, i;
+    uint32_t cookie;
+    tl_ROARING *r;
+
+    if (n < 8) {
+        return NULL;
+    }
+    cookie = get32(p);
+    if ((cookie & 0xffff) == COOKIE_RUNS) {
+        size = (cookie >> 16) + 1;
+        runs = p + 4;
+        pos = 4 + (size + 7) / 8;
+    } else if (cookie == COOKIE_NORUNS && get32(p + 4) <= CHUNK_VALUES) {
+        size = get32(p + 4);
+        pos = 8;
+    } else {
+        return NULL;
+    }
+    keys = p + pos;
+    pos += 4 * size;
+    if (runs == NULL || size >= NO_OFFSET_THRESHOLD) {
+        pos += 4 * size;
+    }
+    if (pos > n || (r = tl_roaring_new()) == NULL) {
+        return NULL;
+    }
+    if (reserve_chunks(r, size)) {
+        tl_roaring_free(r);
+        return NULL;
+    }
+
+    for (i = 0; i < size; i++) {
+        struct rr_chunk *c = &r->c[i];
+        size_t used;
+
+        memset(c, 0, sizeof(*c));
+        r->n++;
+        c->key = (uint16_t)get16(keys + i * 4);
+        c->card = get16(keys + i * 4 + 2) + 1;
+        if (i > 0 && c->key <= c[-1].key) {
+            break;
+        }
+        used = read_chunk(c, p + pos, n - pos,
+                          runs != NULL && (runs[i / 8] >> (i % 8)) & 1);
+        if (used == 0) {
+            break;
+        }
+        pos += used;
+        r->card += c->card;
+    }
+    if (i < size) {
+        tl_roaring_free(r);
+        return NULL;
+    }
+    if (nread != NULL) {
+        *nread = pos;
+    }
+    return r;
+}
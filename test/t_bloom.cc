@@ -0,0 +1,99 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2014 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <typelib/typelib.h>
+
+class Bloom : public ::testing::Test
+{
+};
+
+TEST_F(Bloom, testBasic)
+{
+    tl_BLOOM *b = tl_bloom_new(1000, 0.01);
+    ASSERT_TRUE(b != NULL);
+    ASSERT_EQ(0U, tl_bloom_count(b));
+
+    /* Hashes of small integers are mixed before use */
+    for (uint64_t ii = 0; ii < 1000; ii++) {
+        tl_bloom_add(b, ii);
+    }
+    ASSERT_EQ(1000U, tl_bloom_count(b));
+    for (uint64_t ii = 0; ii < 1000; ii++) {
+        ASSERT_NE(0, tl_bloom_maybe(b, ii));
+    }
+    size_t nfalse = 0;
+    for (uint64_t ii = 1000; ii < 101000; ii++) {
+        nfalse += tl_bloom_maybe(b, ii) != 0;
+    }
+    ASSERT_LT(nfalse, 2000U);
+
+    tl_bloom_clear(b);
+    ASSERT_EQ(0U, tl_bloom_count(b));
+    for (uint64_t ii = 0; ii < 1000; ii++) {
+        ASSERT_EQ(0, tl_bloom_maybe(b, ii));
+    }
+    tl_bloom_free(b);
+    tl_bloom_free(NULL);
+}
+
+TEST_F(Bloom, testRates)
+{
+    double rates[] = { 0.1, 0.01, 0.001, 0.0001 };
+    double prev_bits = 0;
+
+    for (size_t rr = 0; rr < sizeof(rates) / sizeof(rates[0]); rr++) {
+        struct tl_BLOOMPARAMS params;
+        tl_bloom_params(rates[rr], &params);
+        ASSERT_GT(params.bits_per_key, prev_bits);
+        prev_bits = params.bits_per_key;
+
+        const size_t nkeys = 20000;
+        tl_BLOOM *b = tl_bloom_new_params(nkeys, &params);
+        ASSERT_TRUE(b != NULL);
+        ASSERT_GE(tl_bloom_bytes(b) * 8, (size_t)(nkeys * params.bits_per_key));
+        ASSERT_LE(tl_bloom_bytes(b) * 8, (size_t)(nkeys * params.bits_per_key) + 512);
+
+        uint64_t h = 0x123456789ULL;
+        for (size_t ii = 0; ii < nkeys; ii++) {
+            tl_bloom_add(b, tl_hash64(&ii, sizeof(ii), h));
+        }
+        for (size_t ii = 0; ii < nkeys; ii++) {
+            ASSERT_NE(0, tl_bloom_maybe(b, tl_hash64(&ii, sizeof(ii), h)));
+        }
+        size_t nprobes = (size_t)(200 / rates[rr]), nfalse = 0;
+        for (size_t ii = nkeys; ii < nkeys + nprobes; ii++) {
+            nfalse += tl_bloom_maybe(b, tl_hash64(&ii, sizeof(ii), h)) != 0;
+        }
+        /* 200 false positives are expected */
+        ASSERT_GT(nfalse, 120U) << rates[rr];
+        ASSERT_LT(nfalse, 300U) << rates[rr];
+        ASSERT_LE(tl_bloom_fpr(b), rates[rr] * 1.01);
+        tl_bloom_free(b);
+    }
+
+    /* Rates are clamped rather than rejected */
+    struct tl_BLOOMPARAMS lo, hi;
+    tl_bloom_params(0, &lo);
+    ASSERT_LE(lo.bits_per_key, 64);
+    tl_bloom_params(1, &hi);
+    ASSERT_GE(hi.k, 1U);
+    ASSERT_LT(hi.bits_per_key, lo.bits_per_key);
+
+    struct tl_BLOOMPARAMS bad = { 10, 0 };
+    ASSERT_TRUE(tl_bloom_new_params(10, &bad) == NULL);
+}
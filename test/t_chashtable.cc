@@ -0,0 +1,217 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2014 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <typelib/typelib.h>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+static int strEq(const void *a, size_t na, const void *b, size_t nb)
+{
+    return na == nb && memcmp(a, b, na) == 0;
+}
+
+static void copyValue(const void *, size_t, const void *v, size_t nv, void *arg)
+{
+    ASSERT_EQ(sizeof(size_t), nv);
+    memcpy(arg, v, nv);
+}
+
+/* Values are counters stored inline in the entries */
+class CHashtable : public ::testing::TestWithParam<int>
+{
+protected:
+    tl_CHASHTABLE *newTable(unsigned nshards) {
+        struct tl_HASHOPS ops = { NULL, strEq, NULL, NULL, NULL, NULL, tl_hash64 };
+        struct tl_HASHCONF conf = { 0, 0, 0, GetParam(), 32, sizeof(size_t) };
+        return tl_cht_new(1, ops, &conf, nshards);
+    }
+
+    static void genKeys(std::vector<std::string> &keys, size_t n) {
+        char buf[64];
+        for (size_t ii = 0; ii < n; ii++) {
+            sprintf(buf, "Key_%lu", (unsigned long)ii);
+            keys.push_back(buf);
+        }
+    }
+
+    static size_t get(tl_CHASHTABLE *h, const std::string &k) {
+        size_t v = (size_t)-1;
+        tl_cht_find(h, k.c_str(), k.size(), copyValue, &v);
+        return v;
+    }
+};
+
+INSTANTIATE_TEST_CASE_P(Engines, CHashtable,
+                        ::testing::Values((int)TL_HT_ENGINE_CHAINED,
+                                          (int)TL_HT_ENGINE_OPEN));
+
+TEST_P(CHashtable, testBasic)
+{
+    std::vector<std::string> keys;
+    genKeys(keys, 10000);
+
+    tl_CHASHTABLE *h = newTable(0);
+    ASSERT_TRUE(h != NULL);
+    for (size_t ii = 0; ii < keys.size(); ii++) {
+        ASSERT_EQ(0, tl_cht_store(h, keys[ii].c_str(), keys[ii].size(),
+                                  &ii, sizeof(ii)));
+    }
+    ASSERT_EQ((int)keys.size(), tl_cht_size(h));
+    for (size_t ii = 0; ii < keys.size(); ii++) {
+        ASSERT_EQ(ii, get(h, keys[ii]));
+    }
+    ASSERT_EQ(0, tl_cht_find(h, "nonexist", 8, NULL, NULL));
+
+    size_t v = 42;
+    ASSERT_EQ(MODIFICATION, tl_cht_update(h, "Key_1", 5, &v, sizeof(v)));
+    ASSERT_EQ(NEW, tl_cht_update(h, "New", 3, &v, sizeof(v)));
+    ASSERT_EQ(42, get(h, "Key_1"));
+    ASSERT_EQ(42, get(h, "New"));
+
+    ASSERT_EQ(1, tl_cht_del(h, "Key_1", 5));
+    ASSERT_EQ(0, tl_cht_find(h, "Key_1", 5, NULL, NULL));
+    ASSERT_EQ((int)keys.size(), tl_cht_clear(h));
+    ASSERT_EQ(0, tl_cht_size(h));
+    tl_cht_free(h);
+}
+
+TEST_P(CHashtable, testInvalid)
+{
+    struct tl_HASHOPS ops = { NULL, strEq, NULL, NULL, NULL, NULL, tl_hash64 };
+    ASSERT_TRUE(tl_cht_new(1, ops, NULL, 3) == NULL);
+    ASSERT_TRUE(tl_cht_new(1, ops, NULL, TL_CHT_MAX_SHARDS * 2) == NULL);
+    ASSERT_TRUE(tl_cht_new(0, ops, NULL, 4) == NULL);
+    tl_CHASHTABLE *h = tl_cht_new(1, ops, NULL, 1);
+    ASSERT_TRUE(h != NULL);
+    tl_cht_free(h);
+}
+
+static int nHashCalls;
+static uint64_t countingHash64(const void *k, size_t nk, uint64_t seed)
+{
+    nHashCalls++;
+    return tl_hash64(k, nk, seed);
+}
+
+TEST_P(CHashtable, testHashOnce)
+{
+    struct tl_HASHOPS ops = { NULL, strEq, NULL, NULL, NULL, NULL, countingHash64 };
+    struct tl_HASHCONF conf = { 0, 0, 0, GetParam() };
+    tl_CHASHTABLE *h = tl_cht_new(1, ops, &conf, 8);
+    size_t v = 1;
+
+    nHashCalls = 0;
+    ASSERT_EQ(0, tl_cht_store(h, "foo", 3, &v, sizeof(v)));
+    ASSERT_EQ(1, tl_cht_find(h, "foo", 3, NULL, NULL));
+    ASSERT_EQ(MODIFICATION, tl_cht_update(h, "foo", 3, &v, sizeof(v)));
+    ASSERT_EQ(1, tl_cht_delall(h, "foo", 3));
+    ASSERT_EQ(4, nHashCalls);
+    tl_cht_free(h);
+}
+
+static void *increment(const void *, const void *oldv, size_t *ns, void *)
+{
+    size_t *rv = (size_t *)malloc(sizeof(size_t));
+    memcpy(rv, oldv, sizeof(size_t));
+    (*rv)++;
+    *ns = sizeof(size_t);
+    return rv;
+}
+
+TEST_P(CHashtable, testConcurrentUpdates)
+{
+    const size_t nthreads = 8, nkeys = 200, nrounds = 50;
+    std::vector<std::string> keys;
+    genKeys(keys, nkeys);
+
+    tl_CHASHTABLE *h = newTable(4);
+    std::vector<std::thread> threads;
+
+    /* Every thread increments every key; none of the increments may be
+     * lost, while readers see the counters only ever going up */
+    for (size_t tt = 0; tt < nthreads; tt++) {
+        threads.push_back(std::thread([&, tt]() {
+            size_t zero = 0;
+            for (size_t rr = 0; rr < nrounds; rr++) {
+                for (size_t ii = 0; ii < nkeys; ii++) {
+                    const std::string &k = keys[(ii + tt * 7) % nkeys];
+                    tl_cht_funupdate(h, k.c_str(), k.size(), increment, free,
+                                     NULL, &zero, sizeof(zero));
+                }
+            }
+        }));
+    }
+    threads.push_back(std::thread([&]() {
+        std::vector<size_t> last(nkeys);
+        for (size_t rr = 0; rr < nrounds; rr++) {
+            for (size_t ii = 0; ii < nkeys; ii++) {
+                size_t v = 0;
+                if (tl_cht_find(h, keys[ii].c_str(), keys[ii].size(),
+                                copyValue, &v)) {
+                    EXPECT_GE(v, last[ii]);
+                    last[ii] = v;
+                }
+            }
+        }
+    }));
+    for (size_t tt = 0; tt < threads.size(); tt++) {
+        threads[tt].join();
+    }
+
+    ASSERT_EQ((int)nkeys, tl_cht_size(h));
+    for (size_t ii = 0; ii < nkeys; ii++) {
+        ASSERT_EQ(nthreads * nrounds, get(h, keys[ii]));
+    }
+    tl_cht_free(h);
+}
+
+TEST_P(CHashtable, testConcurrentStoreDelete)
+{
+    const size_t nthreads = 4, nkeys = 5000;
+    tl_CHASHTABLE *h = newTable(8);
+    std::vector<std::thread> threads;
+
+    /* Each thread owns its own keys, so the table grows and shrinks in
+     * every shard while other threads use it */
+    for (size_t tt = 0; tt < nthreads; tt++) {
+        threads.push_back(std::thread([&, tt]() {
+            std::vector<std::string> keys;
+            char buf[64];
+            for (size_t ii = 0; ii < nkeys; ii++) {
+                sprintf(buf, "T%lu_%lu", (unsigned long)tt, (unsigned long)ii);
+                keys.push_back(buf);
+                EXPECT_EQ(0, tl_cht_store(h, buf, strlen(buf), &ii, sizeof(ii)));
+            }
+            for (size_t ii = 0; ii < nkeys; ii++) {
+                EXPECT_EQ(ii, get(h, keys[ii]));
+                if (ii % 2) {
+                    EXPECT_EQ(1, tl_cht_del(h, keys[ii].c_str(), keys[ii].size()));
+                }
+            }
+        }));
+    }
+    for (size_t tt = 0; tt < threads.size(); tt++) {
+        threads[tt].join();
+    }
+    ASSERT_EQ((int)(nthreads * nkeys / 2), tl_cht_size(h));
+    tl_cht_free(h);
+}
@@ -0,0 +1,262 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2014 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <typelib/typelib.h>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+static int strEq(const void *a, size_t na, const void *b, size_t nb)
+{
+    return na == nb && memcmp(a, b, na) == 0;
+}
+
+static void *dupString(const void *p, size_t n)
+{
+    char *rv = (char *)malloc(n + 1);
+    memcpy(rv, p, n);
+    rv[n] = '\0';
+    return rv;
+}
+
+static void collect(const void *k, size_t nk, const void *v, size_t nv, void *arg)
+{
+    std::map<std::string, std::string> *m = (std::map<std::string, std::string> *)arg;
+    (*m)[std::string((const char *)k, nk)] = std::string((const char *)v, nv);
+}
+
+/* Frozen copies of tables built with each engine */
+class FHashtable : public ::testing::TestWithParam<int>
+{
+protected:
+    tl_pHASHTABLE newTable(unsigned flags = 0) {
+        struct tl_HASHOPS ops = { tl_ht_strhash, strEq, dupString, dupString, free, free };
+        struct tl_HASHCONF conf = { flags, 0, 0, GetParam() };
+        return tl_ht_new_ex(1, ops, &conf);
+    }
+};
+
+INSTANTIATE_TEST_CASE_P(Engines, FHashtable,
+                        ::testing::Values((int)TL_HT_ENGINE_CHAINED,
+                                          (int)TL_HT_ENGINE_OPEN));
+
+TEST_P(FHashtable, testBasic)
+{
+    tl_pHASHTABLE ht = newTable();
+    std::map<std::string, std::string> ref;
+    char kbuf[64], vbuf[64];
+
+    for (int ii = 0; ii < 50000; ii++) {
+        sprintf(kbuf, "Key_%d", ii);
+        sprintf(vbuf, "Value %d", ii * 7);
+        tl_ht_store(ht, kbuf, strlen(kbuf), vbuf, strlen(vbuf));
+        ref[kbuf] = vbuf;
+    }
+    /* Empty keys and values */
+    tl_ht_store(ht, "", 0, "empty key", 9);
+    ref[""] = "empty key";
+
+    tl_FHASHTABLE *f = tl_ht_freeze(ht);
+    ASSERT_TRUE(f != NULL);
+    tl_ht_free(ht);
+
+    ASSERT_EQ(ref.size(), tl_fht_size(f));
+    ASSERT_GT(tl_fht_bytes(f), ref.size() * 16);
+    for (std::map<std::string, std::string>::iterator it = ref.begin(); it != ref.end(); ++it) {
+        size_t nv = 0;
+        const char *v = (const char *)tl_fht_findn(f, it->first.c_str(), it->first.size(), &nv);
+        ASSERT_TRUE(v != NULL) << it->first;
+        ASSERT_EQ(it->second, std::string(v, nv));
+    }
+    for (int ii = 0; ii < 50000; ii++) {
+        sprintf(kbuf, "Missing_%d", ii);
+        ASSERT_TRUE(tl_fht_find(f, kbuf, strlen(kbuf)) == NULL);
+    }
+    ASSERT_TRUE(tl_fht_find(f, "Key_1", 4) == NULL);
+    ASSERT_TRUE(tl_fht_find(f, "Key_1x", 6) == NULL);
+
+    std::map<std::string, std::string> seen;
+    tl_fht_iter(f, collect, &seen);
+    ASSERT_EQ(ref, seen);
+    tl_fht_free(f);
+}
+
+TEST_P(FHashtable, testNewestValue)
+{
+    /* Duplicate keys, and keys with several values in a multimap, keep the
+     * value tl_ht_find() returns */
+    for (unsigned flags = 0; flags <= TL_HT_F_MULTI; flags += TL_HT_F_MULTI) {
+        tl_pHASHTABLE ht = newTable(flags);
+        tl_ht_store(ht, "a", 1, "1", 1);
+        tl_ht_store(ht, "b", 1, "2", 1);
+        tl_ht_store(ht, "a", 1, "3", 1);
+        tl_ht_store(ht, "a", 1, "4", 1);
+
+        tl_FHASHTABLE *f = tl_ht_freeze(ht);
+        ASSERT_TRUE(f != NULL);
+        ASSERT_EQ(2U, tl_fht_size(f));
+        ASSERT_EQ(0, memcmp("4", tl_fht_find(f, "a", 1), 1));
+        ASSERT_EQ(0, memcmp("2", tl_fht_find(f, "b", 1), 1));
+        tl_fht_free(f);
+        tl_ht_free(ht);
+    }
+}
+
+TEST_P(FHashtable, testPointerValues)
+{
+    /* Zero length values are pointers, kept as they are */
+    struct tl_HASHOPS ops = { tl_ht_strhash, strEq, NULL, NULL, NULL, NULL };
+    struct tl_HASHCONF conf = { 0, 0, 0, GetParam() };
+    tl_pHASHTABLE ht = tl_ht_new_ex(1, ops, &conf);
+    int objects[3];
+    tl_ht_store(ht, "zero", 4, &objects[0], 0);
+    tl_ht_store(ht, "one", 3, &objects[1], 0);
+    tl_ht_store(ht, "null", 4, NULL, 0);
+
+    tl_FHASHTABLE *f = tl_ht_freeze(ht);
+    tl_ht_free(ht);
+    ASSERT_TRUE(f != NULL);
+    size_t nv = 1;
+    ASSERT_EQ((const void *)&objects[0], tl_fht_findn(f, "zero", 4, &nv));
+    ASSERT_EQ(0U, nv);
+    ASSERT_EQ((const void *)&objects[1], tl_fht_find(f, "one", 3));
+    ASSERT_TRUE(tl_fht_find(f, "null", 4) == NULL);
+    tl_fht_free(f);
+}
+
+TEST_P(FHashtable, testEmpty)
+{
+    tl_pHASHTABLE ht = newTable();
+    tl_FHASHTABLE *f = tl_ht_freeze(ht);
+    ASSERT_TRUE(f != NULL);
+    ASSERT_EQ(0U, tl_fht_size(f));
+    ASSERT_TRUE(tl_fht_find(f, "foo", 3) == NULL);
+    tl_fht_free(f);
+
+    /* A single key */
+    tl_ht_store(ht, "foo", 3, "bar", 3);
+    f = tl_ht_freeze(ht);
+    ASSERT_EQ(0, memcmp("bar", tl_fht_find(f, "foo", 3), 3));
+    ASSERT_TRUE(tl_fht_find(f, "fop", 3) == NULL);
+    tl_fht_free(f);
+    tl_ht_free(ht);
+}
+
+TEST_P(FHashtable, testThreads)
+{
+    tl_pHASHTABLE ht = newTable();
+    char buf[64];
+    for (size_t ii = 0; ii < 10000; ii++) {
+        sprintf(buf, "Key_%lu", (unsigned long)ii);
+        tl_ht_store(ht, buf, strlen(buf), &ii, sizeof(ii));
+    }
+    tl_FHASHTABLE *f = tl_ht_freeze(ht);
+    tl_ht_free(ht);
+
+    /* Readers share the table without any locking */
+    std::vector<std::thread> threads;
+    std::vector<size_t> errors(4);
+    for (size_t tt = 0; tt < errors.size(); tt++) {
+        threads.push_back(std::thread([f, tt, &errors]() {
+            char kbuf[64];
+            for (size_t ii = tt; ii < 10000; ii++) {
+                size_t v;
+                sprintf(kbuf, "Key_%lu", (unsigned long)ii);
+                const void *p = tl_fht_find(f, kbuf, strlen(kbuf));
+                memcpy(&v, p, sizeof(v));
+                errors[tt] += v != ii;
+            }
+        }));
+    }
+    for (size_t tt = 0; tt < threads.size(); tt++) {
+        threads[tt].join();
+        ASSERT_EQ(0U, errors[tt]);
+    }
+    tl_fht_free(f);
+}
+
+TEST_P(FHashtable, testSnapshot)
+{
+    const char *path = "t_fhashtable.snapshot";
+    tl_pHASHTABLE ht = newTable();
+    std::map<std::string, std::string> ref;
+    char kbuf[64], vbuf[64];
+
+    for (int ii = 0; ii < 20000; ii++) {
+        sprintf(kbuf, "Key_%d", ii);
+        sprintf(vbuf, "Value %d", ii * 3);
+        tl_ht_store(ht, kbuf, strlen(kbuf), vbuf, strlen(vbuf));
+        ref[kbuf] = vbuf;
+    }
+    tl_FHASHTABLE *f = tl_ht_freeze(ht);
+    tl_ht_free(ht);
+    ASSERT_EQ(0, tl_fht_save(f, path));
+
+    /* The snapshot is the table's memory as it is */
+    std::vector<uint64_t> image((tl_fht_bytes(f) + 7) / 8);
+    FILE *fp = fopen(path, "rb");
+    ASSERT_TRUE(fp != NULL);
+    ASSERT_EQ(tl_fht_bytes(f), fread(&image[0], 1, tl_fht_bytes(f), fp));
+    fclose(fp);
+    tl_fht_free(f);
+
+    tl_FHASHTABLE *mapped = tl_fht_open(path);
+    tl_FHASHTABLE *viewed = tl_fht_view(&image[0], image.size() * 8);
+    ASSERT_TRUE(mapped != NULL);
+    ASSERT_TRUE(viewed != NULL);
+    ASSERT_EQ(ref.size(), tl_fht_size(mapped));
+    for (std::map<std::string, std::string>::iterator it = ref.begin(); it != ref.end(); ++it) {
+        size_t nv = 0;
+        const char *v = (const char *)tl_fht_findn(mapped, it->first.c_str(), it->first.size(), &nv);
+        ASSERT_TRUE(v != NULL);
+        ASSERT_EQ(it->second, std::string(v, nv));
+        v = (const char *)tl_fht_findn(viewed, it->first.c_str(), it->first.size(), &nv);
+        ASSERT_EQ(it->second, std::string(v, nv));
+    }
+    ASSERT_TRUE(tl_fht_find(mapped, "Key_20000", 9) == NULL);
+    std::map<std::string, std::string> seen;
+    tl_fht_iter(mapped, collect, &seen);
+    ASSERT_EQ(ref, seen);
+    tl_fht_free(mapped);
+    tl_fht_free(viewed);
+
+    /* So are headers whose offsets wrap around: a displacement table just
+     * below the end of the address space, and slots at offset 0 */
+    std::vector<uint64_t> wrapped(image);
+    uint64_t slot_size = (image[7] - image[6]) / image[3];
+    wrapped[3] = 1;
+    wrapped[4] = 1;
+    wrapped[5] = (uint64_t)0 - 8;
+    wrapped[6] = 0;
+    wrapped[7] = slot_size;
+    ASSERT_TRUE(tl_fht_view(&wrapped[0], wrapped.size() * 8) == NULL);
+
+    /* Truncated, misaligned and foreign buffers are refused */
+    ASSERT_TRUE(tl_fht_view(&image[0], image.size() * 8 - 16) == NULL);
+    ASSERT_TRUE(tl_fht_view((char *)&image[0] + 4, image.size() * 8 - 8) == NULL);
+    ((uint32_t *)&image[0])[2] = TL_FHT_FORMAT_VERSION + 1;
+    ASSERT_TRUE(tl_fht_view(&image[0], image.size() * 8) == NULL);
+    ASSERT_TRUE(tl_fht_view("not a table", 11) == NULL);
+
+    remove(path);
+    ASSERT_TRUE(tl_fht_open(path) == NULL);
+}
@@ -0,0 +1,107 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2014 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <typelib/typelib.h>
+#include <set>
+#include <string>
+#include <vector>
+#include <cstring>
+
+class Hash : public ::testing::Test
+{
+protected:
+    virtual void TearDown() {
+        tl_hash_select(-1);
+    }
+
+    static std::vector<int> impls() {
+        std::vector<int> ret;
+        ret.push_back(TL_HASH_IMPL_PORTABLE);
+        if (tl_hash_select(TL_HASH_IMPL_AES) != -1) {
+            ret.push_back(TL_HASH_IMPL_AES);
+        }
+        return ret;
+    }
+};
+
+TEST_F(Hash, testPortableVectors)
+{
+    /* Published XXH64 test vectors */
+    const char *s = "Nobody inspects the spammish repetition";
+    ASSERT_EQ(0xEF46DB3751D8E999ULL, tl_hash64("", 0, 0));
+    ASSERT_EQ(0xD24EC4F1A98C6E5BULL, tl_hash64("a", 1, 0));
+    ASSERT_EQ(0x44BC2CF5AD770999ULL, tl_hash64("abc", 3, 0));
+    ASSERT_EQ(0xFBCEA83C8A378BF1ULL, tl_hash64(s, strlen(s), 0));
+}
+
+TEST_F(Hash, testSelect)
+{
+    ASSERT_EQ(TL_HASH_IMPL_PORTABLE, tl_hash_select(TL_HASH_IMPL_PORTABLE));
+    ASSERT_EQ(tl_hash64("abc", 3, 5), tl_hash_fast64("abc", 3, 5));
+    ASSERT_EQ(-1, tl_hash_select(1000));
+    ASSERT_NE(-1, tl_hash_select(-1));
+}
+
+TEST_F(Hash, testDistinct)
+{
+    std::vector<int> ii = impls();
+    for (size_t impl = 0; impl < ii.size(); impl++) {
+        ASSERT_EQ(ii[impl], tl_hash_select(ii[impl]));
+
+        /* Every length and every single-bit difference gives a new hash */
+        std::set<uint64_t> seen;
+        unsigned char buf[300];
+        memset(buf, 0xa5, sizeof(buf));
+        for (size_t len = 0; len <= sizeof(buf); len++) {
+            ASSERT_TRUE(seen.insert(tl_hash_fast64(buf, len, 0)).second);
+            for (size_t bit = 0; bit < len * 8; bit += 7) {
+                buf[bit / 8] ^= 1 << (bit % 8);
+                ASSERT_TRUE(seen.insert(tl_hash_fast64(buf, len, 0)).second)
+                    << "impl " << ii[impl] << " len " << len << " bit " << bit;
+                buf[bit / 8] ^= 1 << (bit % 8);
+            }
+        }
+    }
+}
+
+TEST_F(Hash, testSeedAndAlignment)
+{
+    std::vector<int> ii = impls();
+    char buf[600];
+    for (size_t jj = 0; jj < sizeof(buf); jj++) {
+        buf[jj] = (char)(jj * 31);
+    }
+
+    for (size_t impl = 0; impl < ii.size(); impl++) {
+        ASSERT_EQ(ii[impl], tl_hash_select(ii[impl]));
+        for (size_t len = 0; len < 280; len += 13) {
+            uint64_t hv = tl_hash_fast64(buf, len, 1);
+            ASSERT_NE(hv, tl_hash_fast64(buf, len, 2));
+            for (size_t off = 1; off < 16; off++) {
+                memmove(buf + off, buf, len);
+                ASSERT_EQ(hv, tl_hash_fast64(buf + off, len, 1));
+                memmove(buf, buf + off, len);
+            }
+        }
+    }
+}
+
+TEST_F(Hash, testRandSeed)
+{
+    ASSERT_NE(tl_hash_randseed(), tl_hash_randseed());
+}
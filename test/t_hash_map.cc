@@ -0,0 +1,342 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2014 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <typelib/tl_hash_map.hpp>
+#include <map>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <cstdio>
+
+class HashMap : public ::testing::Test
+{
+};
+
+TEST_F(HashMap, testBasic)
+{
+    tl::hash_map<std::string, int> m;
+    ASSERT_TRUE(m.empty());
+    ASSERT_TRUE(m.find("nothing") == m.end());
+    ASSERT_TRUE(m.begin() == m.end());
+
+    ASSERT_TRUE(m.insert(std::make_pair(std::string("one"), 1)).second);
+    ASSERT_FALSE(m.insert(std::make_pair(std::string("one"), 100)).second);
+    ASSERT_EQ(1, m["one"]);
+    ASSERT_TRUE(m.emplace("two", 2).second);
+    m["three"] = 3;
+    ASSERT_EQ(3U, m.size());
+    ASSERT_EQ(2, m.at("two"));
+    ASSERT_THROW(m.at("four"), std::out_of_range);
+
+    ASSERT_EQ(1U, m.erase(std::string("one")));
+    ASSERT_EQ(0U, m.erase(std::string("one")));
+    ASSERT_EQ(0U, m.count("one"));
+    ASSERT_EQ(2U, m.size());
+
+    ASSERT_FALSE(m.insert_or_assign("two", 22).second);
+    ASSERT_EQ(22, m["two"]);
+
+    m.clear();
+    ASSERT_TRUE(m.empty());
+    ASSERT_TRUE(m.begin() == m.end());
+    m["again"] = 1;
+    ASSERT_EQ(1U, m.size());
+}
+
+TEST_F(HashMap, testTryEmplace)
+{
+    typedef tl::hash_map<std::string, std::unique_ptr<int> > map_type;
+    map_type m;
+    std::unique_ptr<int> p(new int(42));
+
+    ASSERT_TRUE(m.try_emplace("key", std::move(p)).second);
+    ASSERT_TRUE(p.get() == NULL);
+    ASSERT_EQ(42, *m.at("key"));
+
+    /* The key exists, so the argument must not be moved from */
+    std::unique_ptr<int> q(new int(43));
+    std::string key("key");
+    std::pair<map_type::iterator, bool> rv = m.try_emplace(std::move(key), std::move(q));
+    ASSERT_FALSE(rv.second);
+    ASSERT_TRUE(q.get() != NULL);
+    ASSERT_EQ("key", key);
+    ASSERT_EQ(42, *rv.first->second);
+
+    /* Move-only values survive the table being rebuilt */
+    for (int ii = 0; ii < 1000; ii++) {
+        m.try_emplace(std::to_string(ii), new int(ii));
+    }
+    for (int ii = 0; ii < 1000; ii++) {
+        ASSERT_EQ(ii, *m.at(std::to_string(ii)));
+    }
+}
+
+TEST_F(HashMap, testHeterogeneous)
+{
+    tl::hash_map<std::string, int> m;
+    m["hello"] = 1;
+    m["world"] = 2;
+
+    const char *cs = "hello";
+    ASSERT_TRUE(m.find(cs) != m.end());
+    ASSERT_EQ(1, m.find(cs)->second);
+    ASSERT_TRUE(m.contains("world"));
+    ASSERT_FALSE(m.contains("nope"));
+#ifdef TL_HASH_MAP_STRING_VIEW
+    std::string_view sv("world, again");
+    ASSERT_EQ(2, m.at(sv.substr(0, 5)));
+    ASSERT_EQ(1U, m.count(sv.substr(0, 5)));
+    ASSERT_EQ(0U, m.count(sv));
+    ASSERT_EQ(1U, m.erase(sv.substr(0, 5)));
+    ASSERT_FALSE(m.contains("world"));
+#endif
+}
+
+TEST_F(HashMap, testIteration)
+{
+    tl::hash_map<int, int> m;
+    for (int ii = 0; ii < 500; ii++) {
+        m[ii] = ii * 2;
+    }
+
+    std::map<int, int> seen;
+    for (tl::hash_map<int, int>::const_iterator it = m.cbegin(); it != m.cend(); ++it) {
+        seen[it->first] = it->second;
+    }
+    ASSERT_EQ(500U, seen.size());
+    for (int ii = 0; ii < 500; ii++) {
+        ASSERT_EQ(ii * 2, seen[ii]);
+    }
+
+    /* Erase every odd key while iterating */
+    for (tl::hash_map<int, int>::iterator it = m.begin(); it != m.end();) {
+        if (it->first % 2) {
+            it = m.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    ASSERT_EQ(250U, m.size());
+    for (int ii = 0; ii < 500; ii++) {
+        ASSERT_EQ(ii % 2 ? 0U : 1U, m.count(ii));
+    }
+}
+
+TEST_F(HashMap, testCopyMove)
+{
+    tl::hash_map<std::string, std::string> m;
+    char buf[64];
+    for (int ii = 0; ii < 100; ii++) {
+        sprintf(buf, "Key_%d", ii);
+        m[buf] = std::string(buf) + " value";
+    }
+
+    tl::hash_map<std::string, std::string> copy(m);
+    ASSERT_EQ(100U, copy.size());
+    ASSERT_EQ("Key_7 value", copy["Key_7"]);
+    copy.erase(std::string("Key_7"));
+    ASSERT_EQ(1U, m.count("Key_7"));
+
+    tl::hash_map<std::string, std::string> moved(std::move(m));
+    ASSERT_EQ(100U, moved.size());
+    ASSERT_EQ(0U, m.size());
+    ASSERT_TRUE(m.find("Key_1") == m.end());
+    m["reused"] = "yes";
+    ASSERT_EQ(1U, m.size());
+
+    m = copy;
+    ASSERT_EQ(99U, m.size());
+    m = std::move(moved);
+    ASSERT_EQ(100U, m.size());
+    ASSERT_EQ("Key_7 value", m["Key_7"]);
+
+    tl::hash_map<std::string, int> il = { { "a", 1 }, { "b", 2 } };
+    ASSERT_EQ(2U, il.size());
+    ASSERT_EQ(2, il["b"]);
+}
+
+/* All keys collide; every lookup must still find its own key */
+struct ConstantHash {
+    size_t operator()(int) const { return 42; }
+};
+
+TEST_F(HashMap, testCollisions)
+{
+    tl::hash_map<int, int, ConstantHash> m;
+    for (int ii = 0; ii < 100; ii++) {
+        m[ii] = ii;
+    }
+    for (int ii = 0; ii < 100; ii += 2) {
+        ASSERT_EQ(1U, m.erase(ii));
+    }
+    for (int ii = 0; ii < 100; ii++) {
+        ASSERT_EQ(ii % 2 ? 1U : 0U, m.count(ii));
+    }
+}
+
+/* A value which can only be copied, and whose copies throw on request */
+struct Fragile {
+    static int live;
+    static int copies_left;
+    int v;
+
+    explicit Fragile(int v) : v(v) { live++; }
+    Fragile(const Fragile &other) : v(other.v) {
+        if (copies_left-- == 0) {
+            throw std::runtime_error("copy");
+        }
+        live++;
+    }
+    ~Fragile() { live--; }
+};
+int Fragile::live = 0;
+int Fragile::copies_left = 0;
+
+TEST_F(HashMap, testRebuildThrows)
+{
+    {
+        tl::hash_map<int, Fragile> m;
+        Fragile::copies_left = 1000000;
+        for (int ii = 0; ii < 100; ii++) {
+            m.try_emplace(ii, ii);
+        }
+        size_t nbuckets = m.bucket_count();
+        ASSERT_EQ(100, Fragile::live);
+
+        /* A copy failing half way leaves the map as it was */
+        Fragile::copies_left = 50;
+        ASSERT_THROW(m.reserve(1000), std::runtime_error);
+        ASSERT_EQ(100, Fragile::live);
+        ASSERT_EQ(100U, m.size());
+        ASSERT_EQ(nbuckets, m.bucket_count());
+        for (int ii = 0; ii < 100; ii++) {
+            ASSERT_EQ(ii, m.at(ii).v);
+        }
+
+        Fragile::copies_left = 1000000;
+        m.reserve(1000);
+        ASSERT_LT(nbuckets, m.bucket_count());
+        ASSERT_EQ(100, Fragile::live);
+        for (int ii = 0; ii < 100; ii++) {
+            ASSERT_EQ(ii, m.at(ii).v);
+        }
+    }
+    ASSERT_EQ(0, Fragile::live);
+}
+
+/* A hash which throws on request */
+struct FragileHash {
+    static int calls_left;
+    size_t operator()(const std::string &s) const {
+        if (calls_left-- == 0) {
+            throw std::runtime_error("hash");
+        }
+        return std::hash<std::string>()(s);
+    }
+};
+int FragileHash::calls_left = 0;
+
+/* A value which can only be moved, and whose moves throw on request */
+struct Slippery {
+    static int moves_left;
+    int v;
+
+    explicit Slippery(int v) : v(v) {}
+    Slippery(const Slippery &) = delete;
+    Slippery(Slippery &&other) : v(other.v) {
+        if (moves_left-- == 0) {
+            throw std::runtime_error("move");
+        }
+        other.v = -1;
+    }
+};
+int Slippery::moves_left = 0;
+
+TEST_F(HashMap, testRebuildThrowsMoving)
+{
+    char buf[64];
+
+    /* Strings move without throwing, but the hash may throw after some of
+     * them have moved */
+    tl::hash_map<std::string, std::string, FragileHash> m;
+    FragileHash::calls_left = 1000000;
+    for (int ii = 0; ii < 100; ii++) {
+        sprintf(buf, "Key_%d", ii);
+        m[buf] = std::string(buf) + " value";
+    }
+    size_t nbuckets = m.bucket_count();
+    FragileHash::calls_left = 50;
+    ASSERT_THROW(m.reserve(1000), std::runtime_error);
+    FragileHash::calls_left = 1000000;
+    ASSERT_EQ(100U, m.size());
+    ASSERT_EQ(nbuckets, m.bucket_count());
+    for (int ii = 0; ii < 100; ii++) {
+        sprintf(buf, "Key_%d", ii);
+        ASSERT_EQ(std::string(buf) + " value", m.at(buf));
+    }
+
+    /* Values which cannot be copied are moved even if that may throw */
+    tl::hash_map<int, Slippery> ms;
+    Slippery::moves_left = 1000000;
+    for (int ii = 0; ii < 100; ii++) {
+        ms.try_emplace(ii, ii);
+    }
+    nbuckets = ms.bucket_count();
+    Slippery::moves_left = 50;
+    ASSERT_THROW(ms.reserve(1000), std::runtime_error);
+    ASSERT_EQ(100U, ms.size());
+    ASSERT_EQ(nbuckets, ms.bucket_count());
+    for (int ii = 0; ii < 100; ii++) {
+        ASSERT_EQ(ii, ms.at(ii).v);
+    }
+    Slippery::moves_left = 1000000;
+    ms.reserve(1000);
+    ASSERT_LT(nbuckets, ms.bucket_count());
+    for (int ii = 0; ii < 100; ii++) {
+        ASSERT_EQ(ii, ms.at(ii).v);
+    }
+}
+
+/* Random operations, compared against std::map. Erasing leaves DELETED
+ * slots, so this also covers rebuilding at the same size */
+TEST_F(HashMap, testRandom)
+{
+    tl::hash_map<unsigned, unsigned> m;
+    std::map<unsigned, unsigned> ref;
+    std::mt19937 rng(1);
+
+    m.reserve(100);
+    size_t nbuckets = m.bucket_count();
+    ASSERT_GE(nbuckets, 100U);
+
+    for (int ii = 0; ii < 100000; ii++) {
+        unsigned k = rng() % 2000;
+        if (rng() % 3) {
+            m[k] = ii;
+            ref[k] = ii;
+        } else {
+            ASSERT_EQ(ref.erase(k), m.erase(k));
+        }
+    }
+    ASSERT_EQ(ref.size(), m.size());
+    for (std::map<unsigned, unsigned>::iterator it = ref.begin(); it != ref.end(); ++it) {
+        ASSERT_EQ(it->second, m.at(it->first));
+    }
+    ASSERT_LE(m.load_factor(), 0.87f);
+}
@@ -17,6 +17,9 @@
 
 #include <gtest/gtest.h>
 #include <typelib/compat.h>
+#include <algorithm>
+#include <iterator>
+#include <set>
 #include <vector>
 
 #ifdef _MSC_VER
@@ -258,3 +261,201 @@ TEST_F(Hashset, testGetAll)
     ASSERT_EQ(0, hashset_num_items(set));
     ASSERT_TRUE(NULL == hashset_get_items(set, NULL));
 }
+
+TEST_F(Hashset, testBulk)
+{
+    std::vector<void *> items;
+    for (size_t ii = 2; ii < 100000; ii++) {
+        items.push_back((void *)(ii * 3));
+    }
+    /* Duplicates, spread over the threads' shares */
+    for (size_t ii = 2; ii < 100000; ii += 5) {
+        items.push_back((void *)(ii * 3));
+    }
+
+    unsigned nthreads[] = { 1, 4 };
+    for (size_t tt = 0; tt < 2; tt++) {
+        hashset_t hs = tl_nset_new_bulk(&items[0], items.size(), nthreads[tt]);
+        ASSERT_TRUE(hs != NULL);
+        ASSERT_EQ(99998U, hashset_num_items(hs));
+        for (size_t ii = 0; ii < 300010; ii++) {
+            ASSERT_EQ(ii >= 6 && ii % 3 == 0 && ii < 300000,
+                      (bool)hashset_is_member(hs, (void *)ii)) << ii;
+        }
+        /* It carries on like any other */
+        ASSERT_EQ(1, hashset_add(hs, (void *)1000001));
+        ASSERT_EQ(1, hashset_remove(hs, (void *)6));
+        ASSERT_EQ(99998U, hashset_num_items(hs));
+        hashset_destroy(hs);
+    }
+
+    hashset_t hs = tl_nset_new_bulk(NULL, 0, 4);
+    ASSERT_TRUE(hs != NULL);
+    ASSERT_EQ(0U, hashset_num_items(hs));
+    hashset_destroy(hs);
+
+    items.push_back((void *)1);
+    ASSERT_TRUE(tl_nset_new_bulk(&items[0], items.size(), 4) == NULL);
+}
+
+TEST_F(Hashset, testChurn)
+{
+    std::set<size_t> ref;
+    size_t seed = 42;
+
+    /* Pointer-like items (low bits clear) mostly differing in few bits,
+     * added and removed at random */
+    for (size_t ii = 0; ii < 200000; ii++) {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        size_t item = 0x10000 + ((seed >> 33) % 20000) * 16;
+        switch ((seed >> 20) % 3) {
+        case 0:
+            ASSERT_EQ((int)ref.insert(item).second, hashset_add(set, (void *)item));
+            break;
+        case 1:
+            ASSERT_EQ((int)ref.erase(item), hashset_remove(set, (void *)item));
+            break;
+        default:
+            ASSERT_EQ((int)ref.count(item), hashset_is_member(set, (void *)item));
+            break;
+        }
+    }
+    ASSERT_EQ(ref.size(), hashset_num_items(set));
+    void **items = hashset_get_items(set, NULL);
+    ASSERT_TRUE(items != NULL);
+    hsXref(set, items, ref);
+    free(items);
+}
+
+TEST_F(Hashset, testTombstonesAndShrink)
+{
+    /* A sliding window of in-flight IDs: each new one replaces the oldest */
+    for (size_t id = 2; id < 1000000; id++) {
+        ASSERT_EQ(1, hashset_add(set, (void *)(id * 8)));
+        if (id >= 1002) {
+            ASSERT_EQ(1, hashset_remove(set, (void *)((id - 1000) * 8)));
+        }
+        /* Tombstones are purged rather than piling up */
+        ASSERT_LE(set->ndeleted, set->capacity / 4 + 1);
+    }
+    ASSERT_EQ(1000U, hashset_num_items(set));
+    ASSERT_LE(set->capacity, 4096U);
+    ASSERT_TRUE(hashset_is_member(set, (void *)(999999 * 8)));
+    ASSERT_FALSE(hashset_is_member(set, (void *)(998999 * 8)));
+
+    /* A burst grows the set, which shrinks back once it is over. Rebuilds
+     * move a few groups per call rather than the whole table at once */
+    size_t maxcap = 0;
+    for (size_t ii = 2; ii < 200000; ii++) {
+        size_t idx = set->old_items ? set->rehashidx : 0;
+        ASSERT_EQ(1, hashset_add(set, (void *)(ii * 8 + 1)));
+        if (set->old_items) {
+            ASSERT_LE(set->rehashidx, idx + 2);
+        }
+        maxcap = std::max(maxcap, (size_t)set->capacity);
+    }
+    ASSERT_GE(maxcap, 200000U);
+    for (size_t ii = 2; ii < 200000; ii++) {
+        size_t idx = set->old_items ? set->rehashidx : 0;
+        ASSERT_EQ(1, hashset_remove(set, (void *)(ii * 8 + 1)));
+        if (set->old_items) {
+            ASSERT_LE(set->rehashidx, idx + 2);
+        }
+    }
+    ASSERT_EQ(1000U, hashset_num_items(set));
+    ASSERT_LE(set->capacity, 4096U);
+    for (size_t id = 999000; id < 1000000; id++) {
+        ASSERT_TRUE(hashset_is_member(set, (void *)(id * 8)));
+    }
+}
+
+/* Fill a set and its reference from `n` random items below `range` (times
+ * 16). Removing some as it goes leaves tombstones, and may leave the set in
+ * the middle of a rebuild */
+static hashset_t hsRandom(size_t &seed, std::set<size_t> &ref, size_t n,
+                          size_t range)
+{
+    hashset_t rv = hashset_create();
+    for (size_t ii = 0; ii < n; ii++) {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        size_t item = 16 + ((seed >> 33) % range) * 16;
+        if ((seed >> 20) % 4 == 0) {
+            hashset_remove(rv, (void *)item);
+            ref.erase(item);
+        } else {
+            hashset_add(rv, (void *)item);
+            ref.insert(item);
+        }
+    }
+    return rv;
+}
+
+static void hsCheck(hashset_t hs, const std::set<size_t> &ref)
+{
+    void **items = hashset_get_items(hs, NULL);
+    hsXref(hs, items, ref);
+    free(items);
+}
+
+TEST_F(Hashset, testAlgebra)
+{
+    size_t sizes[] = { 0, 1, 50, 3000, 40000 }, seed = 42;
+    typedef std::set<size_t> Ref;
+
+    for (size_t aa = 0; aa < sizeof(sizes) / sizeof(sizes[0]); aa++) {
+        for (size_t bb = 0; bb < sizeof(sizes) / sizeof(sizes[0]); bb++) {
+            size_t range = (sizes[aa] + sizes[bb]) * 2 + 1;
+            Ref ra, rb, ru, ri, rd;
+            hashset_t a = hsRandom(seed, ra, sizes[aa], range);
+            hashset_t b = hsRandom(seed, rb, sizes[bb], range);
+            std::set_union(ra.begin(), ra.end(), rb.begin(), rb.end(),
+                           std::inserter(ru, ru.end()));
+            std::set_intersection(ra.begin(), ra.end(), rb.begin(), rb.end(),
+                                  std::inserter(ri, ri.end()));
+            std::set_difference(ra.begin(), ra.end(), rb.begin(), rb.end(),
+                                std::inserter(rd, rd.end()));
+
+            hashset_t r = tl_nset_union_new(a, b);
+            hsCheck(r, ru);
+            hashset_destroy(r);
+            r = tl_nset_intersect_new(a, b);
+            hsCheck(r, ri);
+            hashset_destroy(r);
+            r = tl_nset_difference_new(a, b);
+            hsCheck(r, rd);
+            hashset_destroy(r);
+            ASSERT_EQ(std::includes(rb.begin(), rb.end(), ra.begin(), ra.end()),
+                      (bool)tl_nset_is_subset(a, b));
+
+            /* In place; the inputs are left as they were */
+            r = tl_nset_union_new(a, a);
+            ASSERT_EQ(0, tl_nset_union(r, b));
+            hsCheck(r, ru);
+            ASSERT_TRUE(tl_nset_is_subset(b, r));
+            hashset_destroy(r);
+            r = tl_nset_union_new(a, a);
+            ASSERT_EQ(0, tl_nset_intersect(r, b));
+            hsCheck(r, ri);
+            hashset_destroy(r);
+            r = tl_nset_union_new(a, a);
+            ASSERT_EQ(0, tl_nset_difference(r, b));
+            hsCheck(r, rd);
+            /* The result keeps working as a set */
+            ASSERT_EQ(1, hashset_add(r, (void *)8));
+            ASSERT_TRUE(hashset_is_member(r, (void *)8));
+            hashset_destroy(r);
+            hsCheck(a, ra);
+            hsCheck(b, rb);
+
+            /* With itself */
+            ASSERT_EQ(0, tl_nset_union(a, a));
+            ASSERT_EQ(0, tl_nset_intersect(a, a));
+            hsCheck(a, ra);
+            ASSERT_TRUE(tl_nset_is_subset(a, a));
+            ASSERT_EQ(0, tl_nset_difference(a, a));
+            ASSERT_EQ(0U, hashset_num_items(a));
+            hashset_destroy(a);
+            hashset_destroy(b);
+        }
+    }
+}
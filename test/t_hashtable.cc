@@ -0,0 +1,1183 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2014 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <typelib/typelib.h>
+#include <map>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+
+static int strEq(const void *a, size_t na, const void *b, size_t nb)
+{
+    return na == nb && memcmp(a, b, na) == 0;
+}
+
+/* Each test is run against every storage engine */
+class Hashtable : public ::testing::TestWithParam<int>
+{
+protected:
+    tl_pHASHTABLE newTable(size_t est, unsigned flags = 0) {
+        struct tl_HASHOPS ops = { tl_ht_strhash, strEq, NULL, NULL, NULL, NULL };
+        struct tl_HASHCONF conf = { flags, 0, 0, GetParam() };
+        return tl_ht_new_ex(est, ops, &conf);
+    }
+
+    static void genKeys(std::vector<std::string> &keys, size_t n) {
+        char buf[64];
+        for (size_t ii = 0; ii < n; ii++) {
+            sprintf(buf, "Key_%lu", (unsigned long)ii);
+            keys.push_back(buf);
+        }
+    }
+};
+
+INSTANTIATE_TEST_CASE_P(Engines, Hashtable,
+                        ::testing::Values((int)TL_HT_ENGINE_CHAINED,
+                                          (int)TL_HT_ENGINE_OPEN,
+                                          (int)TL_HT_ENGINE_COMPACT));
+
+TEST_P(Hashtable, testBasic)
+{
+    tl_pHASHTABLE ht = newTable(10);
+    ASSERT_TRUE(ht != NULL);
+
+    ASSERT_EQ(0, tl_ht_store(ht, "foo", 3, "bar", 3));
+    ASSERT_EQ(0, tl_ht_store(ht, "baz", 3, "qux", 3));
+    ASSERT_STREQ("bar", (const char *)tl_ht_find(ht, "foo", 3));
+    ASSERT_STREQ("qux", (const char *)tl_ht_find(ht, "baz", 3));
+    ASSERT_TRUE(tl_ht_find(ht, "nonexist", 8) == NULL);
+    ASSERT_EQ(2, tl_ht_size(ht));
+
+    ASSERT_EQ(1, tl_ht_del(ht, "foo", 3));
+    ASSERT_EQ(0, tl_ht_del(ht, "foo", 3));
+    ASSERT_TRUE(tl_ht_find(ht, "foo", 3) == NULL);
+    ASSERT_EQ(1, tl_ht_size(ht));
+
+    ASSERT_EQ(1, tl_ht_clear(ht));
+    ASSERT_EQ(0, tl_ht_size(ht));
+    tl_ht_free(ht);
+}
+
+TEST_P(Hashtable, testGrow)
+{
+    std::vector<std::string> keys;
+    genKeys(keys, 10000);
+
+    tl_pHASHTABLE ht = newTable(1);
+    ASSERT_TRUE(ht != NULL);
+
+    for (size_t ii = 0; ii < keys.size(); ii++) {
+        const std::string &k = keys[ii];
+        ASSERT_EQ(0, tl_ht_store(ht, k.c_str(), k.size(), k.c_str(), k.size()));
+        /* Earlier keys must remain visible while buckets are migrating */
+        const std::string &prev = keys[ii / 2];
+        ASSERT_EQ(prev.c_str(), tl_ht_find(ht, prev.c_str(), prev.size()));
+    }
+
+    ASSERT_EQ((int)keys.size(), tl_ht_size(ht));
+    for (size_t ii = 0; ii < keys.size(); ii++) {
+        const std::string &k = keys[ii];
+        ASSERT_EQ(k.c_str(), tl_ht_find(ht, k.c_str(), k.size()));
+    }
+    for (size_t ii = 0; ii < keys.size(); ii++) {
+        const std::string &k = keys[ii];
+        ASSERT_EQ(1, tl_ht_del(ht, k.c_str(), k.size()));
+    }
+    ASSERT_EQ(0, tl_ht_size(ht));
+    tl_ht_free(ht);
+}
+
+TEST_P(Hashtable, testDuplicatesAcrossResize)
+{
+    std::vector<std::string> keys;
+    genKeys(keys, 2000);
+    const char *values[] = { "v1", "v2", "v3" };
+
+    tl_pHASHTABLE ht = newTable(1);
+    ASSERT_TRUE(ht != NULL);
+
+    /* Interleave duplicates of a single key with table growth */
+    for (size_t ii = 0; ii < keys.size(); ii++) {
+        const std::string &k = keys[ii];
+        if (ii % 700 == 0) {
+            tl_ht_store(ht, "dup", 3, values[ii / 700], 2);
+        }
+        tl_ht_store(ht, k.c_str(), k.size(), NULL, 0);
+    }
+
+    ASSERT_EQ(3, tl_ht_sizekey(ht, "dup", 3));
+    ASSERT_STREQ("v3", (const char *)tl_ht_find(ht, "dup", 3));
+    ASSERT_EQ(1, tl_ht_del(ht, "dup", 3));
+    ASSERT_STREQ("v2", (const char *)tl_ht_find(ht, "dup", 3));
+    ASSERT_EQ(2, tl_ht_delall(ht, "dup", 3));
+    ASSERT_TRUE(tl_ht_find(ht, "dup", 3) == NULL);
+    tl_ht_free(ht);
+}
+
+TEST_P(Hashtable, testChurn)
+{
+    std::vector<std::string> keys;
+    genKeys(keys, 1000);
+
+    /* A fixed-size table must keep working as deletions leave gaps */
+    tl_pHASHTABLE ht = newTable(256, TL_HT_F_FIXED);
+    ASSERT_TRUE(ht != NULL);
+
+    for (size_t round = 0; round < 20; round++) {
+        for (size_t ii = 0; ii < 100; ii++) {
+            const std::string &k = keys[(round * 100 + ii) % keys.size()];
+            ASSERT_EQ(0, tl_ht_store(ht, k.c_str(), k.size(), k.c_str(), k.size()));
+        }
+        for (size_t ii = 0; ii < 100; ii++) {
+            const std::string &k = keys[(round * 100 + ii) % keys.size()];
+            ASSERT_EQ(k.c_str(), tl_ht_find(ht, k.c_str(), k.size()));
+            ASSERT_EQ(1, tl_ht_del(ht, k.c_str(), k.size()));
+        }
+        ASSERT_EQ(0, tl_ht_size(ht));
+    }
+    tl_ht_free(ht);
+}
+
+TEST_P(Hashtable, testFixedFull)
+{
+    std::vector<std::string> keys;
+    genKeys(keys, 200);
+    /* Room for 64 keys is 128 slots at the default max_load of the open
+     * and compact engines */
+    size_t limits[] = { keys.size(), 128 * 87 / 100, 128 * 66 / 100 };
+    size_t buckets[] = { 64, 128, 128 };
+    size_t limit = limits[GetParam()], nstored = 0;
+    struct tl_HTSTATS stats;
+
+    tl_pHASHTABLE ht = newTable(64, TL_HT_F_FIXED);
+    ASSERT_TRUE(ht != NULL);
+    for (size_t ii = 0; ii < keys.size(); ii++) {
+        const std::string &k = keys[ii];
+        if (tl_ht_store(ht, k.c_str(), k.size(), k.c_str(), k.size()) == 0) {
+            nstored++;
+        }
+    }
+    ASSERT_EQ(limit, nstored);
+    ASSERT_EQ((int)limit, tl_ht_size(ht));
+    tl_ht_stats(ht, &stats, 0);
+    ASSERT_EQ(buckets[GetParam()], stats.nbuckets);
+    ASSERT_EQ(0, stats.resizing);
+
+    /* Deleting a key makes room for another */
+    ASSERT_EQ(1, tl_ht_del(ht, keys[0].c_str(), keys[0].size()));
+    ASSERT_EQ(0, tl_ht_store(ht, "new", 3, "new", 3));
+    ASSERT_STREQ("new", (const char *)tl_ht_find(ht, "new", 3));
+    ASSERT_EQ((int)limit, tl_ht_size(ht));
+    tl_ht_free(ht);
+}
+
+TEST_P(Hashtable, testShrink)
+{
+    std::vector<std::string> keys;
+    genKeys(keys, 5000);
+
+    tl_pHASHTABLE ht = newTable(4, TL_HT_F_SHRINK);
+    ASSERT_TRUE(ht != NULL);
+
+    for (size_t ii = 0; ii < keys.size(); ii++) {
+        const std::string &k = keys[ii];
+        tl_ht_store(ht, k.c_str(), k.size(), k.c_str(), k.size());
+    }
+
+    /* Delete most of the keys, checking the rest survive the shrinking */
+    for (size_t ii = 0; ii < keys.size(); ii++) {
+        const std::string &k = keys[ii];
+        if (ii % 50) {
+            ASSERT_EQ(1, tl_ht_del(ht, k.c_str(), k.size()));
+        }
+    }
+    for (size_t ii = 0; ii < keys.size(); ii++) {
+        const std::string &k = keys[ii];
+        void *expected = ii % 50 ? NULL : (void *)k.c_str();
+        ASSERT_EQ(expected, tl_ht_find(ht, k.c_str(), k.size()));
+    }
+    ASSERT_EQ(100, tl_ht_size(ht));
+    tl_ht_free(ht);
+}
+
+static int nHashCalls, nEqCalls;
+
+static int countingHash(const void *k, size_t nk)
+{
+    nHashCalls++;
+    return tl_ht_strhash(k, nk);
+}
+
+static int countingEq(const void *a, size_t na, const void *b, size_t nb)
+{
+    nEqCalls++;
+    return strEq(a, na, b, nb);
+}
+
+static uint64_t countingHash64(const void *k, size_t nk, uint64_t seed)
+{
+    nHashCalls++;
+    return tl_hash64(k, nk, seed);
+}
+
+TEST_P(Hashtable, testHashOnce)
+{
+    std::vector<std::string> keys;
+    genKeys(keys, 5000);
+
+    struct tl_HASHOPS ops = { countingHash, countingEq, NULL, NULL, NULL, NULL };
+    struct tl_HASHCONF conf = { 0, 0, 0, GetParam() };
+    tl_pHASHTABLE ht = tl_ht_new_ex(1, ops, &conf);
+    ASSERT_TRUE(ht != NULL);
+
+    /* Resizing must reuse the stored hashes */
+    nHashCalls = nEqCalls = 0;
+    for (size_t ii = 0; ii < keys.size(); ii++) {
+        const std::string &k = keys[ii];
+        tl_ht_store(ht, k.c_str(), k.size(), k.c_str(), k.size());
+    }
+    ASSERT_EQ((int)keys.size(), nHashCalls);
+    ASSERT_EQ(0, nEqCalls);
+
+    /* Each hit compares only the matching entry */
+    nHashCalls = nEqCalls = 0;
+    for (size_t ii = 0; ii < keys.size(); ii++) {
+        const std::string &k = keys[ii];
+        ASSERT_EQ(k.c_str(), tl_ht_find(ht, k.c_str(), k.size()));
+    }
+    ASSERT_EQ((int)keys.size(), nHashCalls);
+    ASSERT_EQ((int)keys.size(), nEqCalls);
+    tl_ht_free(ht);
+}
+
+TEST_P(Hashtable, testAllocStats)
+{
+    std::vector<std::string> keys;
+    genKeys(keys, 1000);
+    struct tl_HTALLOCSTATS stats;
+
+    tl_pHASHTABLE ht = newTable(1);
+    ASSERT_TRUE(ht != NULL);
+    for (size_t ii = 0; ii < keys.size(); ii++) {
+        const std::string &k = keys[ii];
+        tl_ht_store(ht, k.c_str(), k.size(), NULL, 0);
+    }
+
+    tl_ht_allocstats(ht, &stats);
+    ASSERT_EQ(1000, stats.nused);
+    ASSERT_GE(stats.capacity, stats.nused + stats.nfree + stats.nunused);
+    ASSERT_GT(stats.nblocks, 0);
+    ASSERT_GT(stats.bytes, 0);
+
+    for (size_t ii = 0; ii < 100; ii++) {
+        const std::string &k = keys[ii];
+        tl_ht_del(ht, k.c_str(), k.size());
+    }
+    tl_ht_allocstats(ht, &stats);
+    ASSERT_EQ(900, stats.nused);
+    if (GetParam() == TL_HT_ENGINE_CHAINED) {
+        /* Deleted entries are kept for reuse */
+        ASSERT_EQ(100, stats.nfree);
+        tl_ht_store(ht, "foo", 3, NULL, 0);
+        tl_ht_allocstats(ht, &stats);
+        ASSERT_EQ(99, stats.nfree);
+    }
+
+    int nitems = tl_ht_size(ht);
+    ASSERT_EQ(nitems, tl_ht_clear(ht));
+    tl_ht_allocstats(ht, &stats);
+    ASSERT_EQ(0, stats.nused);
+    ASSERT_EQ(0, stats.nfree);
+    if (GetParam() == TL_HT_ENGINE_CHAINED) {
+        ASSERT_EQ(0, stats.nblocks);
+    }
+
+    /* The table remains usable */
+    tl_ht_store(ht, "foo", 3, "bar", 3);
+    ASSERT_STREQ("bar", (const char *)tl_ht_find(ht, "foo", 3));
+    tl_ht_free(ht);
+}
+
+static void *dupString(const void *p, size_t n)
+{
+    char *rv = (char *)malloc(n + 1);
+    memcpy(rv, p, n);
+    rv[n] = '\0';
+    return rv;
+}
+
+TEST_P(Hashtable, testClearOwned)
+{
+    std::vector<std::string> keys;
+    genKeys(keys, 1000);
+
+    /* Keys and values owned by the table must be freed by a clear */
+    struct tl_HASHOPS ops = { tl_ht_strhash, strEq, dupString, dupString, free, free };
+    struct tl_HASHCONF conf = { 0, 0, 0, GetParam() };
+    tl_pHASHTABLE ht = tl_ht_new_ex(1, ops, &conf);
+    ASSERT_TRUE(ht != NULL);
+
+    for (size_t ii = 0; ii < keys.size(); ii++) {
+        const std::string &k = keys[ii];
+        tl_ht_store(ht, k.c_str(), k.size(), k.c_str(), k.size());
+    }
+    ASSERT_STREQ("Key_10", (const char *)tl_ht_find(ht, "Key_10", 6));
+    ASSERT_EQ(1000, tl_ht_clear(ht));
+    ASSERT_TRUE(tl_ht_find(ht, "Key_10", 6) == NULL);
+    tl_ht_store(ht, "foo", 3, "bar", 3);
+    tl_ht_free(ht);
+}
+
+TEST_P(Hashtable, testInlineStorage)
+{
+    std::vector<std::string> keys;
+    genKeys(keys, 2000);
+    keys.push_back("A key which is too long to be stored inline");
+
+    /* Keys which don't fit inline still go through dup_key/free_key */
+    struct tl_HASHOPS ops = { tl_ht_strhash, strEq, dupString, NULL, free, NULL };
+    struct tl_HASHCONF conf = { 0, 0, 0, GetParam(), 16, sizeof(size_t) };
+    tl_pHASHTABLE ht = tl_ht_new_ex(1, ops, &conf);
+    ASSERT_TRUE(ht != NULL);
+
+    for (size_t ii = 0; ii < keys.size(); ii++) {
+        /* Neither the key nor the value buffer outlive the store */
+        std::string k = keys[ii];
+        size_t v = ii;
+        ASSERT_EQ(0, tl_ht_store(ht, k.c_str(), k.size(), &v, sizeof(v)));
+        k.assign(k.size(), 'x');
+        v = 0;
+    }
+
+    for (size_t ii = 0; ii < keys.size(); ii++) {
+        const std::string &k = keys[ii];
+        size_t *v = (size_t *)tl_ht_find(ht, k.c_str(), k.size());
+        ASSERT_TRUE(v != NULL);
+        ASSERT_EQ(ii, *v);
+    }
+
+    size_t v = 42;
+    ASSERT_EQ(MODIFICATION, tl_ht_update(ht, "Key_1", 5, &v, sizeof(v)));
+    ASSERT_EQ(42, *(size_t *)tl_ht_find(ht, "Key_1", 5));
+
+    /* Values which are too large are stored by reference */
+    const char *big = "a value larger than a size_t";
+    ASSERT_EQ(MODIFICATION, tl_ht_update(ht, "Key_1", 5, big, strlen(big)));
+    ASSERT_EQ(big, tl_ht_find(ht, "Key_1", 5));
+
+    const std::string &longKey = keys.back();
+    ASSERT_EQ(1, tl_ht_del(ht, longKey.c_str(), longKey.size()));
+    ASSERT_EQ(1, tl_ht_del(ht, "Key_2", 5));
+    ASSERT_EQ((int)keys.size() - 2, tl_ht_size(ht));
+    tl_ht_free(ht);
+}
+
+TEST_P(Hashtable, testUpsert)
+{
+    std::vector<std::string> keys;
+    genKeys(keys, 3000);
+
+    /* Counters kept in the inline value area, through several resizes */
+    struct tl_HASHOPS ops = { countingHash, strEq, NULL, NULL, NULL, NULL };
+    struct tl_HASHCONF conf = { 0, 0, 0, GetParam(), 0, sizeof(uint64_t) };
+    tl_pHASHTABLE ht = tl_ht_new_ex(1, ops, &conf);
+    ASSERT_TRUE(ht != NULL);
+
+    nHashCalls = 0;
+    for (int round = 0; round < 3; round++) {
+        for (size_t ii = 0; ii < keys.size(); ii++) {
+            const std::string &k = keys[ii];
+            int created = -1;
+            void **slot = tl_ht_upsert(ht, k.c_str(), k.size(), &created);
+            ASSERT_TRUE(slot != NULL);
+            ASSERT_EQ(round == 0, created);
+            ++*(uint64_t *)*slot;
+        }
+    }
+    ASSERT_EQ((int)keys.size() * 3, nHashCalls);
+    ASSERT_EQ((int)keys.size(), tl_ht_size(ht));
+    for (size_t ii = 0; ii < keys.size(); ii++) {
+        const std::string &k = keys[ii];
+        size_t nvalue = 0;
+        uint64_t *v = (uint64_t *)tl_ht_findn(ht, k.c_str(), k.size(), &nvalue);
+        ASSERT_TRUE(v != NULL);
+        ASSERT_EQ(3U, *v);
+        ASSERT_EQ(sizeof(uint64_t), nvalue);
+    }
+    tl_ht_free(ht);
+
+    /* Without inline values the slot holds a pointer owned by the table */
+    struct tl_HASHOPS ops2 = { tl_ht_strhash, strEq, dupString, dupString, free, free };
+    struct tl_HASHCONF conf2 = { 0, 0, 0, GetParam() };
+    ht = tl_ht_new_ex(1, ops2, &conf2);
+    ASSERT_TRUE(ht != NULL);
+    for (size_t ii = 0; ii < keys.size(); ii++) {
+        const std::string &k = keys[ii];
+        void **slot = tl_ht_upsert(ht, k.c_str(), k.size(), NULL);
+        ASSERT_TRUE(slot != NULL);
+        ASSERT_TRUE(*slot == NULL);
+        *slot = dupString(k.c_str(), k.size());
+    }
+    int created = -1;
+    void **slot = tl_ht_upsert(ht, "Key_7", 5, &created);
+    ASSERT_EQ(0, created);
+    ASSERT_STREQ("Key_7", (const char *)*slot);
+    ASSERT_EQ(1, tl_ht_del(ht, "Key_7", 5));
+
+    /* The table's own copy of the key, which can be used to find it */
+    const void *stored = NULL;
+    uint64_t hash = tl_ht_hash(ht, "Key_8", 5);
+    slot = tl_ht_upsert_key_hashed(ht, hash, "Key_8", 5, &stored, &created);
+    ASSERT_EQ(0, created);
+    ASSERT_STREQ("Key_8", (const char *)stored);
+    ASSERT_NE((const void *)"Key_8", stored);
+    ASSERT_EQ(*slot, tl_ht_find_hashed(ht, hash, stored, 5));
+    slot = tl_ht_upsert_key_hashed(ht, tl_ht_hash(ht, "Key_new", 7), "Key_new",
+                                   7, &stored, &created);
+    ASSERT_EQ(1, created);
+    ASSERT_STREQ("Key_new", (const char *)stored);
+    ASSERT_EQ(1, tl_ht_del_hashed(ht, tl_ht_hash(ht, "Key_new", 7), stored, 7));
+
+    /* A new key whose value is left NULL */
+    ASSERT_TRUE(tl_ht_upsert(ht, "empty", 5, &created) != NULL);
+    ASSERT_EQ(1, created);
+    tl_ht_free(ht);
+}
+
+static void collectValues(const void *, size_t, const void *v, size_t nv, void *arg)
+{
+    std::vector<std::string> *values = (std::vector<std::string> *)arg;
+    values->push_back(std::string((const char *)v, nv));
+}
+
+TEST_P(Hashtable, testMulti)
+{
+    std::vector<std::string> keys;
+    genKeys(keys, 2000);
+
+    struct tl_HASHOPS ops = { tl_ht_strhash, countingEq, dupString, dupString, free, free };
+    struct tl_HASHCONF conf = { TL_HT_F_MULTI, 0, 0, GetParam() };
+    tl_pHASHTABLE ht = tl_ht_new_ex(1, ops, &conf);
+    ASSERT_TRUE(ht != NULL);
+
+    /* Key i gets i % 5 values, stored in rounds so that the table resizes
+     * between values of the same key */
+    for (int round = 0; round < 4; round++) {
+        for (size_t ii = 0; ii < keys.size(); ii++) {
+            const std::string &k = keys[ii];
+            if ((int)(ii % 5) > round) {
+                std::string v = k + "_" + std::to_string(round);
+                ASSERT_EQ(0, tl_ht_store(ht, k.c_str(), k.size(), v.c_str(), v.size()));
+            }
+        }
+    }
+    ASSERT_EQ(2000 / 5 * (1 + 2 + 3 + 4), tl_ht_size(ht));
+
+    struct tl_HTALLOCSTATS stats;
+    tl_ht_allocstats(ht, &stats);
+    ASSERT_EQ(2000U / 5 * 4, stats.nused);
+
+    /* A key's values are counted and visited with a single comparison */
+    nEqCalls = 0;
+    ASSERT_EQ(4, tl_ht_sizekey(ht, "Key_9", 5));
+    ASSERT_EQ(1, nEqCalls);
+    ASSERT_EQ(0, tl_ht_sizekey(ht, "Key_10", 6));
+
+    std::vector<std::string> values;
+    tl_ht_iterkey(ht, "Key_9", 5, collectValues, &values);
+    ASSERT_EQ(4U, values.size());
+    ASSERT_EQ("Key_9_3", values[0]);
+    ASSERT_EQ("Key_9_0", values[3]);
+
+    /* Lookups and updates act on the newest value */
+    ASSERT_STREQ("Key_9_3", (const char *)tl_ht_find(ht, "Key_9", 5));
+    ASSERT_EQ(MODIFICATION, tl_ht_update(ht, "Key_9", 5, "new", 3));
+    ASSERT_STREQ("new", (const char *)tl_ht_find(ht, "Key_9", 5));
+    ASSERT_EQ(4, tl_ht_sizekey(ht, "Key_9", 5));
+
+    int created = -1;
+    void **slot = tl_ht_upsert(ht, "Key_9", 5, &created);
+    ASSERT_EQ(0, created);
+    ASSERT_STREQ("new", (const char *)*slot);
+    slot = tl_ht_upsert(ht, "fresh", 5, &created);
+    ASSERT_EQ(1, created);
+    ASSERT_TRUE(*slot == NULL);
+    *slot = dupString("x", 1);
+    ASSERT_EQ(1, tl_ht_sizekey(ht, "fresh", 5));
+
+    /* Deleting pops values; the key goes with its last one */
+    ASSERT_EQ(1, tl_ht_del(ht, "Key_8", 5));
+    ASSERT_STREQ("Key_8_1", (const char *)tl_ht_find(ht, "Key_8", 5));
+    ASSERT_EQ(1, tl_ht_del(ht, "Key_6", 5));
+    ASSERT_TRUE(tl_ht_find(ht, "Key_6", 5) == NULL);
+    ASSERT_EQ(0, tl_ht_del(ht, "Key_6", 5));
+
+    nEqCalls = 0;
+    ASSERT_EQ(4, tl_ht_delall(ht, "Key_9", 5));
+    ASSERT_EQ(1, nEqCalls);
+    ASSERT_EQ(0, tl_ht_delall(ht, "Key_9", 5));
+
+    for (size_t ii = 0; ii < keys.size(); ii++) {
+        const std::string &k = keys[ii];
+        int n = (int)(ii % 5);
+        if (ii == 6 || ii == 9) {
+            n = 0;
+        } else if (ii == 8) {
+            n = 2;
+        }
+        ASSERT_EQ(n, tl_ht_delall(ht, k.c_str(), k.size()));
+    }
+    ASSERT_EQ(1, tl_ht_size(ht));
+
+    /* Stores of a present key append, also in batches */
+    const void *bkeys[] = { "a", "b", "a", "a" };
+    size_t bklens[] = { 1, 1, 1, 1 };
+    const void *bvalues[] = { "1", "2", "3", "4" };
+    size_t bvlens[] = { 1, 1, 1, 1 };
+    ASSERT_EQ(4U, tl_ht_store_batch(ht, bkeys, bklens, bvalues, bvlens, 4));
+    ASSERT_EQ(3, tl_ht_sizekey(ht, "a", 1));
+    ASSERT_EQ(2, tl_ht_del_batch(ht, bkeys, bklens, 2));
+    ASSERT_STREQ("3", (const char *)tl_ht_find(ht, "a", 1));
+    ASSERT_EQ(3, tl_ht_clear(ht));
+    tl_ht_free(ht);
+
+    /* Values are kept out of line */
+    conf.inline_value = 8;
+    ASSERT_TRUE(tl_ht_new_ex(1, ops, &conf) == NULL);
+}
+
+TEST_P(Hashtable, testBatch)
+{
+    std::vector<std::string> keys;
+    genKeys(keys, 5003);
+
+    std::vector<const void *> kptrs, vptrs;
+    std::vector<size_t> klens;
+    for (size_t ii = 0; ii < keys.size(); ii++) {
+        kptrs.push_back(keys[ii].c_str());
+        klens.push_back(keys[ii].size());
+        vptrs.push_back(&keys[ii]);
+    }
+
+    tl_pHASHTABLE ht = newTable(1);
+    ASSERT_EQ(keys.size(), tl_ht_store_batch(ht, &kptrs[0], &klens[0],
+                                             &vptrs[0], &klens[0], keys.size()));
+    ASSERT_EQ((int)keys.size(), tl_ht_size(ht));
+
+    /* Look up every key along with one which doesn't exist */
+    std::vector<const void *> lkeys(kptrs);
+    std::vector<size_t> llens(klens);
+    lkeys.insert(lkeys.begin() + 100, "nonexist");
+    llens.insert(llens.begin() + 100, 8);
+    std::vector<void *> values(lkeys.size());
+    ASSERT_EQ((int)keys.size(), tl_ht_find_batch(ht, &lkeys[0], &llens[0],
+                                                 lkeys.size(), &values[0]));
+    for (size_t ii = 0; ii < lkeys.size(); ii++) {
+        if (ii == 100) {
+            ASSERT_TRUE(values[ii] == NULL);
+        } else {
+            ASSERT_EQ(vptrs[ii < 100 ? ii : ii - 1], values[ii]);
+        }
+    }
+
+    /* Delete every other key; deleting a key twice removes it once */
+    std::vector<const void *> dkeys;
+    std::vector<size_t> dlens;
+    for (size_t ii = 0; ii < keys.size(); ii += 2) {
+        dkeys.push_back(kptrs[ii]);
+        dlens.push_back(klens[ii]);
+    }
+    dkeys.push_back(kptrs[0]);
+    dlens.push_back(klens[0]);
+    ASSERT_EQ((int)dkeys.size() - 1,
+              tl_ht_del_batch(ht, &dkeys[0], &dlens[0], dkeys.size()));
+    ASSERT_EQ((int)(keys.size() - dkeys.size() + 1), tl_ht_size(ht));
+
+    ASSERT_EQ((int)(keys.size() / 2), tl_ht_find_batch(ht, &kptrs[0], &klens[0],
+                                                       keys.size(), &values[0]));
+    for (size_t ii = 0; ii < keys.size(); ii++) {
+        ASSERT_EQ(ii % 2 ? vptrs[ii] : NULL, values[ii]);
+    }
+    tl_ht_free(ht);
+}
+
+static void countVisits(const void *k, size_t nk, const void *, size_t, void *arg)
+{
+    std::map<std::string, int> *visits = (std::map<std::string, int> *)arg;
+    (*visits)[std::string((const char *)k, nk)]++;
+}
+
+TEST_P(Hashtable, testScan)
+{
+    std::vector<std::string> keys;
+    genKeys(keys, 10000);
+
+    tl_pHASHTABLE ht = newTable(1);
+    for (size_t ii = 0; ii < keys.size(); ii++) {
+        tl_ht_store(ht, keys[ii].c_str(), keys[ii].size(), NULL, 0);
+    }
+
+    std::map<std::string, int> visits;
+    size_t cursor = 0, ncalls = 0;
+    do {
+        size_t before = visits.size();
+        cursor = tl_ht_scan(ht, cursor, 100, countVisits, &visits);
+        ASSERT_LT(visits.size() - before, 200U);
+        ncalls++;
+    } while (cursor != 0);
+
+    /* Without modifications, every item is visited exactly once */
+    ASSERT_EQ(keys.size(), visits.size());
+    for (size_t ii = 0; ii < keys.size(); ii++) {
+        ASSERT_EQ(1, visits[keys[ii]]);
+    }
+    ASSERT_GT(ncalls, 50U);
+    tl_ht_free(ht);
+}
+
+TEST_P(Hashtable, testScanResize)
+{
+    std::vector<std::string> keys, extra;
+    genKeys(keys, 20000);
+    extra.assign(keys.begin() + 2000, keys.end());
+    keys.resize(2000);
+
+    /* The table first grows well past its initial size while `extra` is
+     * stored, then shrinks back as `extra` is deleted again; the first 2000
+     * keys are present throughout */
+    tl_pHASHTABLE ht = newTable(1, TL_HT_F_SHRINK);
+    for (size_t ii = 0; ii < keys.size(); ii++) {
+        tl_ht_store(ht, keys[ii].c_str(), keys[ii].size(), NULL, 0);
+    }
+
+    std::map<std::string, int> visits;
+    size_t cursor = 0, nstored = 0, ndeleted = 0;
+    do {
+        cursor = tl_ht_scan(ht, cursor, 3, countVisits, &visits);
+        for (size_t ii = 0; ii < 40 && nstored < extra.size(); ii++, nstored++) {
+            const std::string &k = extra[nstored];
+            tl_ht_store(ht, k.c_str(), k.size(), NULL, 0);
+        }
+        if (nstored == extra.size()) {
+            for (size_t ii = 0; ii < 40 && ndeleted < extra.size(); ii++, ndeleted++) {
+                const std::string &k = extra[ndeleted];
+                tl_ht_del(ht, k.c_str(), k.size());
+            }
+        }
+    } while (cursor != 0);
+
+    ASSERT_EQ(extra.size(), ndeleted);
+    for (size_t ii = 0; ii < keys.size(); ii++) {
+        ASSERT_GE(visits[keys[ii]], 1) << keys[ii];
+    }
+    tl_ht_free(ht);
+}
+
+TEST_P(Hashtable, testHashed)
+{
+    struct tl_HASHOPS ops = { NULL, strEq, NULL, NULL, NULL, NULL, countingHash64 };
+    struct tl_HASHCONF conf = { TL_HT_F_SEED, 0, 0, GetParam() };
+    conf.seed = 99;
+    std::vector<std::string> keys;
+    genKeys(keys, 2000);
+
+    /* Tables sharing a hash function and seed share hashes */
+    tl_pHASHTABLE tables[3];
+    for (size_t tt = 0; tt < 3; tt++) {
+        tables[tt] = tl_ht_new_ex(1, ops, &conf);
+    }
+    nHashCalls = 0;
+    for (size_t ii = 0; ii < keys.size(); ii++) {
+        const std::string &k = keys[ii];
+        uint64_t hash = tl_ht_hash(tables[0], k.c_str(), k.size());
+        for (size_t tt = 0; tt < 3; tt++) {
+            ASSERT_EQ(0, tl_ht_store_hashed(tables[tt], hash, k.c_str(), k.size(),
+                                            &keys[ii], tt));
+        }
+    }
+    ASSERT_EQ((int)keys.size(), nHashCalls);
+
+    for (size_t ii = 0; ii < keys.size(); ii++) {
+        const std::string &k = keys[ii];
+        uint64_t hash = tl_ht_hash(tables[1], k.c_str(), k.size());
+        for (size_t tt = 0; tt < 3; tt++) {
+            size_t nvalue = 99;
+            ASSERT_EQ(&keys[ii], tl_ht_find(tables[tt], k.c_str(), k.size()));
+            ASSERT_EQ(&keys[ii], tl_ht_find_hashed(tables[tt], hash,
+                                                   k.c_str(), k.size()));
+            ASSERT_EQ(&keys[ii], tl_ht_findn_hashed(tables[tt], hash, k.c_str(),
+                                                    k.size(), &nvalue));
+            ASSERT_EQ(tt, nvalue);
+        }
+    }
+
+    nHashCalls = 0;
+    uint64_t hash = tl_ht_hash(tables[0], "Key_1", 5);
+    ASSERT_EQ(MODIFICATION, tl_ht_update_hashed(tables[0], hash, "Key_1", 5, "x", 1));
+    ASSERT_EQ(NEW, tl_ht_update_hashed(tables[0], tl_ht_hash(tables[0], "new", 3),
+                                       "new", 3, "y", 1));
+    ASSERT_EQ(0, tl_ht_store_hashed(tables[0], hash, "Key_1", 5, "z", 1));
+    std::map<std::string, int> visits;
+    tl_ht_iterkey_hashed(tables[0], hash, "Key_1", 5, countVisits, &visits);
+    ASSERT_EQ(2, visits["Key_1"]);
+    ASSERT_EQ(1, tl_ht_del_hashed(tables[0], hash, "Key_1", 5));
+    ASSERT_STREQ("x", (const char *)tl_ht_find_hashed(tables[0], hash, "Key_1", 5));
+    ASSERT_EQ(1, tl_ht_del_hashed(tables[0], hash, "Key_1", 5));
+    ASSERT_EQ(0, tl_ht_del_hashed(tables[0], hash, "Key_1", 5));
+    ASSERT_EQ(2, nHashCalls);
+
+    for (size_t tt = 0; tt < 3; tt++) {
+        tl_ht_free(tables[tt]);
+    }
+}
+
+static uint64_t lastSeed;
+static uint64_t seedHash(const void *k, size_t n, uint64_t seed)
+{
+    lastSeed = seed;
+    return tl_hash64(k, n, seed);
+}
+
+TEST_P(Hashtable, testHash64)
+{
+    struct tl_HASHOPS ops = { NULL, strEq, NULL, NULL, NULL, NULL, seedHash };
+    struct tl_HASHCONF conf = { TL_HT_F_SEED, 0, 0, GetParam() };
+    conf.seed = 0x1234;
+
+    tl_pHASHTABLE ht = tl_ht_new_ex(1, ops, &conf);
+    ASSERT_TRUE(ht != NULL);
+    std::vector<std::string> keys;
+    genKeys(keys, 1000);
+    for (size_t ii = 0; ii < keys.size(); ii++) {
+        const std::string &k = keys[ii];
+        ASSERT_EQ(0, tl_ht_store(ht, k.c_str(), k.size(), &keys[ii], 1));
+    }
+    ASSERT_EQ(0x1234, lastSeed);
+    for (size_t ii = 0; ii < keys.size(); ii++) {
+        const std::string &k = keys[ii];
+        ASSERT_EQ(&keys[ii], tl_ht_find(ht, k.c_str(), k.size()));
+    }
+    tl_ht_free(ht);
+
+    /* Without TL_HT_F_SEED each table gets its own seed */
+    conf.flags = 0;
+    uint64_t seeds[2];
+    for (size_t ii = 0; ii < 2; ii++) {
+        ht = tl_ht_new_ex(1, ops, &conf);
+        ASSERT_EQ(0, tl_ht_store(ht, "foo", 3, "bar", 3));
+        ASSERT_STREQ("bar", (const char *)tl_ht_find(ht, "foo", 3));
+        seeds[ii] = lastSeed;
+        tl_ht_free(ht);
+    }
+    ASSERT_NE(seeds[0], seeds[1]);
+    ASSERT_NE(0x1234, seeds[0]);
+}
+
+TEST_P(Hashtable, testInvalidConf)
+{
+    struct tl_HASHOPS ops = { tl_ht_strhash, strEq, NULL, NULL, NULL, NULL };
+    struct tl_HASHCONF conf = { TL_HT_F_SHRINK, 80, 40, GetParam() };
+    ASSERT_TRUE(tl_ht_new_ex(4, ops, &conf) == NULL);
+    ASSERT_TRUE(newTable(0) == NULL);
+
+    conf.min_load = 0;
+    conf.max_load = 100;
+    if (GetParam() != TL_HT_ENGINE_CHAINED) {
+        ASSERT_TRUE(tl_ht_new_ex(4, ops, &conf) == NULL);
+    } else {
+        tl_pHASHTABLE ht = tl_ht_new_ex(4, ops, &conf);
+        ASSERT_TRUE(ht != NULL);
+        tl_ht_free(ht);
+    }
+}
+
+TEST_P(Hashtable, testFilter)
+{
+    std::vector<std::string> keys;
+    genKeys(keys, 20000);
+    struct tl_HTFILTERSTATS stats;
+
+    tl_pHASHTABLE ht = newTable(1);
+    ASSERT_EQ(-1, tl_ht_filterstats(ht, &stats));
+    tl_ht_free(ht);
+
+    ht = newTable(1, TL_HT_F_FILTER | TL_HT_F_SHRINK);
+    ASSERT_TRUE(ht != NULL);
+    ASSERT_EQ(0, tl_ht_filterstats(ht, &stats));
+    ASSERT_EQ(0.01, stats.target_fpr);
+    ASSERT_EQ(0U, stats.nkeys);
+
+    /* Keys stay visible while entries (and filters) are migrating */
+    for (size_t ii = 0; ii < keys.size(); ii++) {
+        const std::string &k = keys[ii];
+        ASSERT_EQ(0, tl_ht_store(ht, k.c_str(), k.size(), k.c_str(), k.size()));
+        const std::string &prev = keys[ii / 2];
+        ASSERT_EQ(prev.c_str(), tl_ht_find(ht, prev.c_str(), prev.size()));
+        ASSERT_TRUE(tl_ht_find(ht, "absent", 6) == NULL);
+    }
+    ASSERT_EQ(0, tl_ht_filterstats(ht, &stats));
+    ASSERT_LE(keys.size(), stats.capacity);
+    ASSERT_LE(stats.nkeys, keys.size());
+    ASSERT_LE(stats.fpr, 0.01);
+    ASSERT_GE(stats.bytes * 8, stats.capacity * stats.bits_per_key);
+    ASSERT_GT(stats.bits_per_key, 8);
+    ASSERT_LT(stats.bits_per_key, 12);
+
+    /* Deletes make the filter stale, and it is rebuilt as the table
+     * shrinks; deleted keys never reappear */
+    for (size_t ii = 0; ii < keys.size(); ii++) {
+        const std::string &k = keys[ii];
+        if (ii % 10) {
+            ASSERT_EQ(1, tl_ht_del(ht, k.c_str(), k.size()));
+            ASSERT_TRUE(tl_ht_find(ht, k.c_str(), k.size()) == NULL);
+        }
+    }
+    for (size_t ii = 0; ii < keys.size(); ii++) {
+        const std::string &k = keys[ii];
+        void *expected = ii % 10 ? NULL : (void *)k.c_str();
+        ASSERT_EQ(expected, tl_ht_find(ht, k.c_str(), k.size()));
+    }
+    ASSERT_EQ(0, tl_ht_filterstats(ht, &stats));
+    ASSERT_LT(stats.nkeys, keys.size() / 4);
+
+    ASSERT_EQ(2000, tl_ht_clear(ht));
+    ASSERT_EQ(0, tl_ht_filterstats(ht, &stats));
+    ASSERT_EQ(0U, stats.nkeys);
+    ASSERT_EQ(0U, stats.nstale);
+    ASSERT_TRUE(tl_ht_find(ht, keys[0].c_str(), keys[0].size()) == NULL);
+    tl_ht_free(ht);
+}
+
+TEST_P(Hashtable, testFilterRebuild)
+{
+    std::vector<std::string> keys;
+    genKeys(keys, 10000);
+    struct tl_HASHOPS ops = { tl_ht_strhash, strEq, NULL, NULL, NULL, NULL };
+    struct tl_HASHCONF conf = { TL_HT_F_FILTER | TL_HT_F_FIXED, 0, 0,
+                                GetParam(), 0, 0, 0, 0.001 };
+    struct tl_HTFILTERSTATS stats;
+
+    /* A table which never grows still rebuilds its filter under churn */
+    tl_pHASHTABLE ht = tl_ht_new_ex(2000, ops, &conf);
+    ASSERT_TRUE(ht != NULL);
+    for (size_t round = 0; round < 100; round++) {
+        for (size_t ii = 0; ii < 100; ii++) {
+            const std::string &k = keys[round * 100 + ii];
+            ASSERT_EQ(0, tl_ht_store(ht, k.c_str(), k.size(), k.c_str(), k.size()));
+        }
+        for (size_t ii = 0; ii < 100; ii++) {
+            const std::string &k = keys[round * 100 + ii];
+            ASSERT_EQ(k.c_str(), tl_ht_find(ht, k.c_str(), k.size()));
+            if (ii % 10) {
+                ASSERT_EQ(1, tl_ht_del(ht, k.c_str(), k.size()));
+            }
+        }
+        ASSERT_EQ(0, tl_ht_filterstats(ht, &stats));
+        ASSERT_LE(stats.nkeys, stats.capacity * 5 / 4 + 100);
+    }
+    ASSERT_EQ(0.001, stats.target_fpr);
+    ASSERT_GT(stats.bits_per_key, 14);
+    for (size_t ii = 0; ii < keys.size(); ii++) {
+        const std::string &k = keys[ii];
+        void *expected = ii % 10 ? NULL : (void *)k.c_str();
+        ASSERT_EQ(expected, tl_ht_find(ht, k.c_str(), k.size()));
+    }
+    tl_ht_free(ht);
+
+    /* Lookups which may not modify the table, and a multimap */
+    conf.flags = TL_HT_F_FILTER | TL_HT_F_CONST_FIND | TL_HT_F_MULTI;
+    ht = tl_ht_new_ex(1, ops, &conf);
+    for (size_t ii = 0; ii < keys.size(); ii++) {
+        const std::string &k = keys[ii / 2];
+        ASSERT_EQ(0, tl_ht_store(ht, k.c_str(), k.size(), k.c_str(), k.size()));
+        ASSERT_EQ(k.c_str(), tl_ht_find(ht, k.c_str(), k.size()));
+        ASSERT_EQ(1 + (int)(ii % 2), tl_ht_sizekey(ht, k.c_str(), k.size()));
+    }
+    ASSERT_EQ(0, tl_ht_filterstats(ht, &stats));
+    ASSERT_LE(stats.nkeys, keys.size() / 2);
+    tl_ht_free(ht);
+}
+
+static int badHash(const void *, size_t)
+{
+    return 42;
+}
+
+TEST_P(Hashtable, testStats)
+{
+    std::vector<std::string> keys;
+    genKeys(keys, 20000);
+    struct tl_HTSTATS stats;
+
+    tl_pHASHTABLE ht = newTable(1, TL_HT_F_STATS);
+    ASSERT_TRUE(ht != NULL);
+    for (size_t ii = 0; ii < keys.size(); ii++) {
+        const std::string &k = keys[ii];
+        ASSERT_EQ(0, tl_ht_store(ht, k.c_str(), k.size(), NULL, 0));
+    }
+    for (size_t ii = 0; ii < keys.size(); ii += 2) {
+        const std::string &k = keys[ii];
+        ASSERT_EQ(1, tl_ht_del(ht, k.c_str(), k.size()));
+    }
+    ASSERT_EQ((int)keys.size() / 2, tl_ht_size(ht));
+
+    /* Sampling every bucket accounts for every entry, whether or not a
+     * resize is in progress */
+    tl_ht_stats(ht, &stats, 0);
+    ASSERT_EQ(keys.size() / 2, stats.nitems);
+    ASSERT_EQ(stats.nbuckets, stats.nsampled);
+    ASSERT_GT(stats.nbuckets, stats.nitems);
+    ASSERT_DOUBLE_EQ((double)stats.nitems / stats.nbuckets, stats.load);
+    size_t counted = 0, nonempty = 0;
+    for (size_t ii = 0; ii < TL_HT_STATS_NHIST; ii++) {
+        counted += stats.hist[ii] * (GetParam() == TL_HT_ENGINE_CHAINED ? ii : 1);
+        nonempty += stats.hist[ii];
+    }
+    ASSERT_EQ(0U, stats.hist[0]);
+    ASSERT_EQ(stats.nitems, counted);
+    ASSERT_DOUBLE_EQ((double)nonempty / stats.nsampled, stats.occupancy);
+    ASSERT_GE(stats.max_probe, stats.p99_probe);
+    ASSERT_GE(stats.p99_probe, 1U);
+    ASSERT_LT(stats.p99_probe, 20U);
+    struct tl_HTALLOCSTATS astats;
+    tl_ht_allocstats(ht, &astats);
+    ASSERT_GE(stats.bytes, astats.bytes);
+
+    /* Each delete made a lookup; stores don't look the key up */
+    ASSERT_EQ(keys.size() / 2, stats.nhits);
+    ASSERT_EQ(0U, stats.nmisses);
+    ASSERT_GE(stats.probes_per_hit, 1.0);
+    ASSERT_LT(stats.probes_per_hit, 8.0);
+    for (size_t ii = 0; ii < keys.size(); ii++) {
+        const std::string &k = keys[ii];
+        tl_ht_find(ht, k.c_str(), k.size());
+    }
+    tl_ht_stats(ht, &stats, 0);
+    ASSERT_EQ(keys.size(), stats.nhits);
+    ASSERT_EQ(keys.size() / 2, stats.nmisses);
+    ASSERT_DOUBLE_EQ((double)stats.hit_probes / stats.nhits, stats.probes_per_hit);
+    ASSERT_LT(stats.probes_per_miss, 8.0);
+
+    /* A sample gives about as many buckets as asked for */
+    tl_ht_stats(ht, &stats, 1000);
+    ASSERT_GE(stats.nsampled, 1000U);
+    ASSERT_LT(stats.nsampled, 1100U);
+    ASSERT_GT(stats.occupancy, 0.0);
+    ASSERT_LT(stats.p99_probe, 20U);
+    tl_ht_free(ht);
+
+    /* A hash function which puts every key in the same place shows */
+    struct tl_HASHOPS ops = { badHash, strEq, NULL, NULL, NULL, NULL };
+    struct tl_HASHCONF conf = { TL_HT_F_STATS, 0, 0, GetParam() };
+    ht = tl_ht_new_ex(1000, ops, &conf);
+    for (size_t ii = 0; ii < 500; ii++) {
+        const std::string &k = keys[ii];
+        ASSERT_EQ(0, tl_ht_store(ht, k.c_str(), k.size(), NULL, 0));
+    }
+    ASSERT_TRUE(tl_ht_find(ht, "missing", 7) == NULL);
+    tl_ht_stats(ht, &stats, 0);
+    ASSERT_EQ(TL_HT_STATS_NHIST - 1, stats.max_probe);
+    ASSERT_EQ(TL_HT_STATS_NHIST - 1, stats.p99_probe);
+    ASSERT_GT(stats.probes_per_miss, 10.0);
+    tl_ht_free(ht);
+
+    /* Lookups must not write to a table with TL_HT_F_CONST_FIND */
+    ASSERT_TRUE(newTable(1, TL_HT_F_STATS | TL_HT_F_CONST_FIND) == NULL);
+
+    /* Without TL_HT_F_STATS, lookups are not counted */
+    ht = newTable(1);
+    tl_ht_store(ht, "foo", 3, NULL, 0);
+    tl_ht_find(ht, "foo", 3);
+    tl_ht_stats(ht, &stats, 0);
+    ASSERT_EQ(0U, stats.nhits + stats.nmisses);
+    ASSERT_EQ(1U, stats.nitems);
+    tl_ht_free(ht);
+}
+
+TEST_P(Hashtable, testBulk)
+{
+    std::vector<std::string> keys;
+    genKeys(keys, 20000);
+    /* Every tenth key is stored again later with another value */
+    std::vector<const void *> kptrs, vptrs;
+    std::vector<size_t> klens, vlens;
+    for (size_t ii = 0; ii < keys.size(); ii++) {
+        kptrs.push_back(keys[ii].c_str());
+        klens.push_back(keys[ii].size());
+        vptrs.push_back(keys[ii].c_str());
+        vlens.push_back(keys[ii].size() + 1);
+    }
+    for (size_t ii = 0; ii < keys.size(); ii += 10) {
+        kptrs.push_back(keys[ii].c_str());
+        klens.push_back(keys[ii].size());
+        vptrs.push_back("dup");
+        vlens.push_back(4);
+    }
+
+    struct tl_HASHOPS ops = { tl_ht_strhash, strEq, dupString, dupString, free, free };
+    unsigned nthreads[] = { 1, 3, 8 };
+    for (size_t tt = 0; tt < sizeof(nthreads) / sizeof(nthreads[0]); tt++) {
+        struct tl_HASHCONF conf = { TL_HT_F_FILTER, 0, 0, GetParam(), 12, 8 };
+        tl_pHASHTABLE ht = tl_ht_new_bulk(ops, &conf, &kptrs[0], &klens[0],
+                                          &vptrs[0], &vlens[0], kptrs.size(),
+                                          nthreads[tt]);
+        ASSERT_TRUE(ht != NULL);
+        ASSERT_EQ((int)kptrs.size(), tl_ht_size(ht));
+        for (size_t ii = 0; ii < keys.size(); ii++) {
+            const std::string &k = keys[ii];
+            const char *v = (const char *)tl_ht_find(ht, k.c_str(), k.size());
+            ASSERT_TRUE(v != NULL) << k;
+            ASSERT_EQ(ii % 10 ? k : "dup", v);
+            ASSERT_EQ(ii % 10 ? 1 : 2, tl_ht_sizekey(ht, k.c_str(), k.size()));
+        }
+        ASSERT_TRUE(tl_ht_find(ht, "absent", 6) == NULL);
+
+        /* The table carries on like any other */
+        for (size_t ii = 0; ii < keys.size(); ii++) {
+            const std::string &k = keys[ii];
+            ASSERT_EQ(ii % 10 ? 1 : 2, tl_ht_delall(ht, k.c_str(), k.size()));
+        }
+        ASSERT_EQ(0, tl_ht_size(ht));
+        ASSERT_EQ(0, tl_ht_store(ht, "foo", 3, "bar", 4));
+        ASSERT_STREQ("bar", (const char *)tl_ht_find(ht, "foo", 3));
+        tl_ht_free(ht);
+    }
+
+    /* Small tables, where partitions of a single group often fill up */
+    for (size_t n = 1; n < 300; n += 7) {
+        tl_pHASHTABLE ht = tl_ht_new_bulk(ops, NULL, &kptrs[0], &klens[0],
+                                          &vptrs[0], &vlens[0], n, 8);
+        ASSERT_EQ((int)n, tl_ht_size(ht));
+        for (size_t ii = 0; ii < n; ii++) {
+            ASSERT_STREQ(keys[ii].c_str(), (const char *)tl_ht_find(ht, kptrs[ii], klens[ii]));
+        }
+        tl_ht_free(ht);
+    }
+
+    /* Multimaps gather each key's values */
+    struct tl_HASHCONF conf = { TL_HT_F_MULTI, 0, 0, GetParam() };
+    tl_pHASHTABLE ht = tl_ht_new_bulk(ops, &conf, &kptrs[0], &klens[0],
+                                      &vptrs[0], &vlens[0], kptrs.size(), 4);
+    ASSERT_TRUE(ht != NULL);
+    ASSERT_EQ((int)kptrs.size(), tl_ht_size(ht));
+    ASSERT_EQ(2, tl_ht_sizekey(ht, "Key_10", 6));
+    ASSERT_STREQ("dup", (const char *)tl_ht_find(ht, "Key_10", 6));
+    tl_ht_free(ht);
+
+    ht = tl_ht_new_bulk(ops, NULL, NULL, NULL, NULL, NULL, 0, 4);
+    ASSERT_TRUE(ht != NULL);
+    ASSERT_EQ(0, tl_ht_size(ht));
+    tl_ht_free(ht);
+}
+
+static void genKeysCompact(std::vector<std::string> &keys, size_t n)
+{
+    char buf[64];
+    for (size_t ii = 0; ii < n; ii++) {
+        sprintf(buf, "Key_%lu", (unsigned long)ii);
+        keys.push_back(buf);
+    }
+}
+
+static void collectKeys(const void *k, size_t nk, const void *, size_t, void *arg)
+{
+    ((std::vector<std::string> *)arg)->push_back(std::string((const char *)k, nk));
+}
+
+TEST(HashtableCompact, testOrder)
+{
+    std::vector<std::string> keys, expected, visited;
+    genKeysCompact(keys, 100000);
+    struct tl_HASHOPS ops = { tl_ht_strhash, strEq, NULL, NULL, NULL, NULL };
+    struct tl_HASHCONF conf = { TL_HT_F_SHRINK, 0, 0, TL_HT_ENGINE_COMPACT };
+    tl_pHASHTABLE ht = tl_ht_new_ex(1, ops, &conf);
+    ASSERT_TRUE(ht != NULL);
+
+    /* Iteration follows insertion order through growth (and the index
+     * widening from 1 to 4 bytes), deletes and compaction */
+    for (size_t ii = 0; ii < keys.size(); ii++) {
+        const std::string &k = keys[ii];
+        ASSERT_EQ(0, tl_ht_store(ht, k.c_str(), k.size(), NULL, 0));
+        if (ii % 3 == 0) {
+            const std::string &d = keys[ii / 2];
+            ASSERT_EQ(1, tl_ht_del(ht, d.c_str(), d.size()));
+        }
+    }
+    std::vector<bool> deleted(keys.size());
+    for (size_t ii = 0; ii < keys.size(); ii += 3) {
+        deleted[ii / 2] = true;
+    }
+    for (size_t ii = 0; ii < keys.size(); ii++) {
+        if (!deleted[ii]) {
+            expected.push_back(keys[ii]);
+        }
+    }
+    tl_ht_iter(ht, collectKeys, &visited);
+    ASSERT_EQ(expected, visited);
+    ASSERT_EQ((int)expected.size(), tl_ht_size(ht));
+
+    /* A key stored again after being deleted goes to the end */
+    ASSERT_EQ(1, tl_ht_del(ht, expected[0].c_str(), expected[0].size()));
+    ASSERT_EQ(0, tl_ht_store(ht, expected[0].c_str(), expected[0].size(), NULL, 0));
+    visited.clear();
+    tl_ht_iter(ht, collectKeys, &visited);
+    ASSERT_EQ(expected[0], visited.back());
+    ASSERT_EQ(expected[1], visited.front());
+
+    /* Shrinking keeps the order too */
+    for (size_t ii = 1; ii < expected.size(); ii++) {
+        if (ii % 100) {
+            ASSERT_EQ(1, tl_ht_del(ht, expected[ii].c_str(), expected[ii].size()));
+        }
+    }
+    visited.clear();
+    tl_ht_iter(ht, collectKeys, &visited);
+    ASSERT_EQ(expected.size() / 100, visited.size() - 1);
+    for (size_t ii = 0; ii + 1 < visited.size(); ii++) {
+        ASSERT_EQ(expected[(ii + 1) * 100], visited[ii]);
+    }
+    struct tl_HTALLOCSTATS stats;
+    tl_ht_allocstats(ht, &stats);
+    ASSERT_LT(stats.capacity, expected.size() / 10);
+    tl_ht_free(ht);
+}
+
+TEST(HashtableCompact, testSmallTables)
+{
+    struct tl_HASHOPS ops = { tl_ht_strhash, strEq, NULL, NULL, NULL, NULL };
+    size_t bytes[3];
+
+    /* Tables of a handful of items take less memory than with the other
+     * engines */
+    for (int engine = 0; engine < 3; engine++) {
+        struct tl_HASHCONF conf = { 0, 0, 0, engine };
+        struct tl_HTALLOCSTATS stats;
+        tl_pHASHTABLE ht = tl_ht_new_ex(1, ops, &conf);
+        for (size_t ii = 0; ii < 20; ii++) {
+            char k[16];
+            sprintf(k, "k%lu", (unsigned long)ii);
+            ASSERT_EQ(0, tl_ht_store(ht, k, strlen(k), NULL, 0));
+        }
+        tl_ht_allocstats(ht, &stats);
+        bytes[engine] = stats.bytes;
+        tl_ht_free(ht);
+    }
+    ASSERT_LT(bytes[TL_HT_ENGINE_COMPACT], bytes[TL_HT_ENGINE_CHAINED]);
+    ASSERT_LT(bytes[TL_HT_ENGINE_COMPACT], bytes[TL_HT_ENGINE_OPEN]);
+}
@@ -0,0 +1,232 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2014 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <typelib/typelib.h>
+#include <typelib/tl_int_map.hpp>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+
+/* A map whose keys all hash to the same slot, so every store, lookup and
+ * delete runs through long probe sequences which wrap around the table */
+static size_t constHash(uint32_t key, unsigned bits)
+{
+    (void)key;
+    return ((size_t)1 << bits) - 2;
+}
+
+TL_IMAP_INIT(collide, uint32_t, int, constHash)
+
+class IMap : public ::testing::Test
+{
+};
+
+TEST_F(IMap, testBasic)
+{
+    tl_IMAP_u64 m;
+    int created;
+    void **slot;
+
+    tl_imap_u64_init(&m);
+    ASSERT_EQ(0U, tl_imap_u64_size(&m));
+    ASSERT_TRUE(tl_imap_u64_find(&m, 1) == NULL);
+    ASSERT_EQ(0, tl_imap_u64_del(&m, 1));
+
+    slot = tl_imap_u64_put(&m, 42, &created);
+    ASSERT_TRUE(slot != NULL);
+    ASSERT_EQ(1, created);
+    ASSERT_TRUE(*slot == NULL);
+    *slot = &m;
+    ASSERT_EQ(slot, tl_imap_u64_put(&m, 42, &created));
+    ASSERT_EQ(0, created);
+
+    /* Key 0 is kept outside the table */
+    ASSERT_TRUE(tl_imap_u64_find(&m, 0) == NULL);
+    ASSERT_EQ(0, tl_imap_u64_store(&m, 0, &created));
+    ASSERT_EQ(0, tl_imap_u64_store(&m, 0xffffffff00000000ULL, &slot));
+    ASSERT_EQ(3U, tl_imap_u64_size(&m));
+    ASSERT_EQ((void *)&created, *tl_imap_u64_find(&m, 0));
+    ASSERT_EQ((void *)&slot, *tl_imap_u64_find(&m, 0xffffffff00000000ULL));
+    ASSERT_EQ((void *)&m, *tl_imap_u64_find(&m, 42));
+
+    std::map<uint64_t, void *> seen;
+    size_t pos = 0;
+    uint64_t key;
+    void **value;
+    while (tl_imap_u64_next(&m, &pos, &key, &value)) {
+        seen[key] = *value;
+    }
+    ASSERT_EQ(3U, seen.size());
+    ASSERT_EQ((void *)&created, seen[0]);
+
+    ASSERT_EQ(1, tl_imap_u64_del(&m, 0));
+    ASSERT_EQ(0, tl_imap_u64_del(&m, 0));
+    ASSERT_EQ(1, tl_imap_u64_del(&m, 42));
+    ASSERT_EQ(1U, tl_imap_u64_size(&m));
+
+    tl_imap_u64_clear(&m);
+    ASSERT_EQ(0U, tl_imap_u64_size(&m));
+    ASSERT_TRUE(tl_imap_u64_find(&m, 0xffffffff00000000ULL) == NULL);
+    tl_imap_u64_cleanup(&m);
+}
+
+TEST_F(IMap, testReserve)
+{
+    tl_IMAP_u32 m;
+    tl_imap_u32_init(&m);
+    ASSERT_EQ(0, tl_imap_u32_reserve(&m, 1000));
+    size_t size = m.size;
+    ASSERT_GE(size * TL_IMAP_MAX_LOAD / 100, 1000U);
+    for (uint32_t ii = 1; ii <= 1000; ii++) {
+        ASSERT_EQ(0, tl_imap_u32_store(&m, ii, NULL));
+    }
+    ASSERT_EQ(size, m.size);
+    ASSERT_EQ(1000U, tl_imap_u32_size(&m));
+    tl_imap_u32_cleanup(&m);
+
+    /* Reserving room for `n` keys takes as many slots as storing them one
+     * at a time would, with either interface */
+    uint32_t counts[] = { 1, 3, 9, 27, 81, 1000 };
+    for (size_t ii = 0; ii < sizeof(counts) / sizeof(counts[0]); ii++) {
+        tl_IMAP_u32 grown, reserved;
+        tl::int_map<uint32_t, int> reserved_cc;
+        tl_imap_u32_init(&grown);
+        tl_imap_u32_init(&reserved);
+        for (uint32_t k = 1; k <= counts[ii]; k++) {
+            ASSERT_EQ(0, tl_imap_u32_store(&grown, k, NULL));
+        }
+        ASSERT_EQ(0, tl_imap_u32_reserve(&reserved, counts[ii]));
+        reserved_cc.reserve(counts[ii]);
+        ASSERT_EQ(grown.size, reserved.size);
+        ASSERT_EQ(grown.size, reserved_cc.bucket_count());
+        tl_imap_u32_cleanup(&grown);
+        tl_imap_u32_cleanup(&reserved);
+    }
+}
+
+/* Random stores and deletes compared against std::map. Deleting shifts
+ * entries back, which is checked by looking up every remaining key */
+TEST_F(IMap, testRandom)
+{
+    tl_IMAP_u32 m;
+    std::map<uint32_t, uintptr_t> ref;
+    std::mt19937 rng(1);
+
+    tl_imap_u32_init(&m);
+    for (int ii = 0; ii < 100000; ii++) {
+        uint32_t k = rng() % 3000;
+        if (rng() % 3) {
+            ASSERT_EQ(0, tl_imap_u32_store(&m, k, (void *)(uintptr_t)ii));
+            ref[k] = ii;
+        } else {
+            ASSERT_EQ((int)ref.erase(k), tl_imap_u32_del(&m, k));
+        }
+    }
+    ASSERT_EQ(ref.size(), tl_imap_u32_size(&m));
+    for (std::map<uint32_t, uintptr_t>::iterator it = ref.begin(); it != ref.end(); ++it) {
+        void **v = tl_imap_u32_find(&m, it->first);
+        ASSERT_TRUE(v != NULL);
+        ASSERT_EQ(it->second, (uintptr_t)*v);
+    }
+    tl_imap_u32_cleanup(&m);
+}
+
+TEST_F(IMap, testCollisions)
+{
+    tl_IMAP_collide m;
+    tl_imap_collide_init(&m);
+    for (uint32_t ii = 1; ii <= 50; ii++) {
+        ASSERT_EQ(0, tl_imap_collide_store(&m, ii, (int)ii));
+    }
+    for (uint32_t ii = 1; ii <= 50; ii += 2) {
+        ASSERT_EQ(1, tl_imap_collide_del(&m, ii));
+    }
+    for (uint32_t ii = 1; ii <= 50; ii++) {
+        int *v = tl_imap_collide_find(&m, ii);
+        if (ii % 2) {
+            ASSERT_TRUE(v == NULL);
+        } else {
+            ASSERT_TRUE(v != NULL);
+            ASSERT_EQ((int)ii, *v);
+        }
+    }
+    tl_imap_collide_cleanup(&m);
+}
+
+TEST_F(IMap, testIntMap)
+{
+    tl::int_map<int64_t, std::string> m;
+    m[0] = "zero";
+    m[-1] = "minus one";
+    ASSERT_TRUE(m.try_emplace(7, "seven").second);
+    ASSERT_FALSE(m.try_emplace(7, "SEVEN").second);
+    ASSERT_EQ(3U, m.size());
+    ASSERT_EQ("seven", *m.find(7));
+    ASSERT_EQ("zero", *m.find(0));
+    ASSERT_TRUE(m.find(8) == NULL);
+
+    std::map<int64_t, std::string> ref;
+    std::mt19937 rng(2);
+    ref[0] = "zero";
+    ref[-1] = "minus one";
+    ref[7] = "seven";
+    for (int ii = 0; ii < 20000; ii++) {
+        int64_t k = (int64_t)(rng() % 1000) - 500;
+        if (rng() % 3) {
+            m[k] = std::to_string(ii);
+            ref[k] = std::to_string(ii);
+        } else {
+            ASSERT_EQ(ref.erase(k) == 1, m.erase(k));
+        }
+    }
+    ASSERT_EQ(ref.size(), m.size());
+
+    tl::int_map<int64_t, std::string> copy(m);
+    tl::int_map<int64_t, std::string> moved(std::move(m));
+    ASSERT_TRUE(m.empty());
+    size_t n = 0;
+    moved.for_each([&](int64_t k, const std::string &v) {
+        ASSERT_EQ(ref[k], v);
+        ASSERT_EQ(ref[k], *copy.find(k));
+        n++;
+    });
+    ASSERT_EQ(ref.size(), n);
+
+    m = copy;
+    ASSERT_EQ(ref.size(), m.size());
+    m.clear();
+    ASSERT_TRUE(m.empty());
+}
+
+TEST_F(IMap, testIntMapMoveOnly)
+{
+    tl::int_map<uint32_t, std::unique_ptr<int> > m;
+    for (uint32_t ii = 0; ii < 1000; ii++) {
+        m.try_emplace(ii, new int(ii));
+    }
+    for (uint32_t ii = 0; ii < 1000; ii += 2) {
+        ASSERT_TRUE(m.erase(ii));
+    }
+    for (uint32_t ii = 0; ii < 1000; ii++) {
+        ASSERT_EQ(ii % 2 == 1, m.contains(ii));
+        if (ii % 2) {
+            ASSERT_EQ((int)ii, **m.find(ii));
+        }
+    }
+}
@@ -0,0 +1,307 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2014 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <typelib/typelib.h>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+
+/* Records every release */
+struct LruReleases {
+    std::vector<std::string> keys;
+    std::vector<size_t> values;
+    std::vector<int> reasons;
+};
+
+static void recordRelease(const void *k, size_t nk, void *value, size_t,
+                          enum tl_LRUREASON reason, void *arg)
+{
+    LruReleases *r = (LruReleases *)arg;
+    r->keys.push_back(std::string((const char *)k, nk));
+    r->values.push_back((size_t)value);
+    r->reasons.push_back(reason);
+}
+
+static std::string lruKey(size_t n)
+{
+    char buf[64];
+    sprintf(buf, "Key_%lu", (unsigned long)n);
+    return buf;
+}
+
+/* Run with keys stored in the entries and with keys allocated separately */
+class Lru : public ::testing::TestWithParam<unsigned>
+{
+protected:
+    LruReleases released;
+
+    struct tl_LRUCONF conf(size_t max_items, size_t max_charge,
+                           unsigned flags = 0) {
+        struct tl_LRUCONF rv;
+        memset(&rv, 0, sizeof(rv));
+        rv.max_items = max_items;
+        rv.max_charge = max_charge;
+        rv.release = recordRelease;
+        rv.arg = &released;
+        rv.flags = flags;
+        rv.inline_key = GetParam();
+        return rv;
+    }
+
+    static int put(tl_LRU *c, size_t n, size_t charge = 1) {
+        std::string k = lruKey(n);
+        return tl_lru_put(c, k.c_str(), k.size(), (void *)(n + 1), charge);
+    }
+
+    static size_t get(tl_LRU *c, size_t n) {
+        std::string k = lruKey(n);
+        return (size_t)tl_lru_get(c, k.c_str(), k.size());
+    }
+};
+
+INSTANTIATE_TEST_CASE_P(InlineKeys, Lru, ::testing::Values(0U, 16U));
+
+TEST_P(Lru, testBasic)
+{
+    struct tl_LRUCONF cf = conf(100, 0);
+    tl_LRU *c = tl_lru_new(&cf);
+    ASSERT_TRUE(c != NULL);
+
+    for (size_t ii = 0; ii < 100; ii++) {
+        ASSERT_EQ(1, put(c, ii));
+    }
+    ASSERT_EQ(100U, tl_lru_size(c));
+    ASSERT_TRUE(released.keys.empty());
+
+    /* Touch the even keys; the odd ones are then the least recently used */
+    for (size_t ii = 0; ii < 100; ii += 2) {
+        ASSERT_EQ(ii + 1, get(c, ii));
+    }
+    for (size_t ii = 100; ii < 150; ii++) {
+        ASSERT_EQ(1, put(c, ii));
+    }
+    ASSERT_EQ(100U, tl_lru_size(c));
+    ASSERT_EQ(50U, released.keys.size());
+    for (size_t ii = 0; ii < 50; ii++) {
+        ASSERT_EQ(lruKey(ii * 2 + 1), released.keys[ii]);
+        ASSERT_EQ(ii * 2 + 2, released.values[ii]);
+        ASSERT_EQ(TL_LRU_EVICTED, released.reasons[ii]);
+    }
+    for (size_t ii = 0; ii < 150; ii++) {
+        ASSERT_EQ(ii % 2 == 0 || ii >= 100 ? ii + 1 : 0, get(c, ii)) << ii;
+    }
+
+    /* Replacing a value releases the old one and makes the key the newest */
+    released = LruReleases();
+    std::string k = lruKey(0);
+    ASSERT_EQ(1, tl_lru_put(c, k.c_str(), k.size(), (void *)1000, 1));
+    ASSERT_EQ(1U, released.keys.size());
+    ASSERT_EQ(1U, released.values[0]);
+    ASSERT_EQ(TL_LRU_REPLACED, released.reasons[0]);
+    ASSERT_EQ(100U, tl_lru_size(c));
+    ASSERT_EQ(1000U, get(c, 0));
+
+    ASSERT_EQ(1, tl_lru_del(c, k.c_str(), k.size()));
+    ASSERT_EQ(0, tl_lru_del(c, k.c_str(), k.size()));
+    ASSERT_EQ(TL_LRU_DELETED, released.reasons.back());
+    ASSERT_EQ(1000U, released.values.back());
+    ASSERT_EQ(0U, get(c, 0));
+    ASSERT_EQ(99U, tl_lru_size(c));
+
+    /* Whatever is left is released when the cache is freed */
+    released = LruReleases();
+    tl_lru_free(c);
+    ASSERT_EQ(99U, released.keys.size());
+    for (size_t ii = 0; ii < released.reasons.size(); ii++) {
+        ASSERT_EQ(TL_LRU_DELETED, released.reasons[ii]);
+    }
+}
+
+TEST_P(Lru, testCharge)
+{
+    struct tl_LRUCONF cf = conf(0, 1000);
+    tl_LRU *c = tl_lru_new(&cf);
+
+    for (size_t ii = 0; ii < 10; ii++) {
+        ASSERT_EQ(1, put(c, ii, 100));
+    }
+    ASSERT_EQ(1000U, tl_lru_charge(c));
+    ASSERT_TRUE(released.keys.empty());
+
+    /* A large item evicts as many of the oldest as needed */
+    ASSERT_EQ(1, put(c, 10, 350));
+    ASSERT_EQ(4U, released.keys.size());
+    ASSERT_EQ(lruKey(3), released.keys.back());
+    ASSERT_EQ(950U, tl_lru_charge(c));
+    ASSERT_EQ(7U, tl_lru_size(c));
+
+    /* Growing an item's charge evicts others, never the item itself */
+    ASSERT_EQ(1, put(c, 10, 1000));
+    ASSERT_EQ(1000U, tl_lru_charge(c));
+    ASSERT_EQ(1U, tl_lru_size(c));
+    ASSERT_EQ(11U, get(c, 10));
+
+    /* Items larger than the cache are refused, and the cache is unchanged */
+    released = LruReleases();
+    ASSERT_EQ(0, put(c, 11, 1001));
+    ASSERT_EQ(0, put(c, 10, 1001));
+    ASSERT_TRUE(released.keys.empty());
+    ASSERT_EQ(11U, get(c, 10));
+    ASSERT_EQ(0U, get(c, 11));
+
+    /* Both limits at once */
+    tl_lru_free(c);
+    cf = conf(5, 1000);
+    c = tl_lru_new(&cf);
+    for (size_t ii = 0; ii < 10; ii++) {
+        ASSERT_EQ(1, put(c, ii, 10));
+    }
+    ASSERT_EQ(5U, tl_lru_size(c));
+    ASSERT_EQ(50U, tl_lru_charge(c));
+    tl_lru_free(c);
+}
+
+TEST_P(Lru, testTinyLfu)
+{
+    struct tl_LRUCONF cf = conf(1000, 0, TL_LRU_F_TINYLFU);
+    tl_LRU *c = tl_lru_new(&cf);
+    ASSERT_TRUE(c != NULL);
+
+    /* A working set which keeps being requested... */
+    for (int round = 0; round < 3; round++) {
+        for (size_t ii = 0; ii < 1000; ii++) {
+            if (get(c, ii) == 0) {
+                put(c, ii);
+            }
+        }
+    }
+    ASSERT_EQ(1000U, tl_lru_size(c));
+
+    /* ...keeps its hits through a scan of keys requested once */
+    size_t hits = 0, admitted = 0;
+    for (size_t ii = 1000; ii < 20000; ii++) {
+        if (get(c, ii % 1000) != 0) {
+            hits++;
+        } else {
+            put(c, ii % 1000);
+        }
+        if (get(c, ii) == 0) {
+            admitted += put(c, ii) == 1;
+        }
+    }
+    ASSERT_GT(hits, 19000U * 8 / 10);
+    ASSERT_LT(admitted, 19000U / 10);
+    ASSERT_EQ(1000U, tl_lru_size(c));
+
+    /* A key requested more often than the others gets in */
+    for (int ii = 0; ii < 20; ii++) {
+        get(c, 50000);
+    }
+    ASSERT_EQ(1, put(c, 50000));
+    ASSERT_EQ(50001U, get(c, 50000));
+
+    /* Without the filter, the scan keeps flushing the working set */
+    tl_lru_free(c);
+    cf = conf(1000, 0);
+    c = tl_lru_new(&cf);
+    for (size_t ii = 0; ii < 1000; ii++) {
+        put(c, ii);
+    }
+    hits = 0;
+    for (size_t ii = 1000; ii < 20000; ii++) {
+        if (get(c, ii % 1000) != 0) {
+            hits++;
+        } else {
+            put(c, ii % 1000);
+        }
+        ASSERT_EQ(1, put(c, ii));
+    }
+    ASSERT_LT(hits, 19000U / 10);
+    tl_lru_free(c);
+}
+
+TEST_P(Lru, testInvalidConf)
+{
+    struct tl_LRUCONF cf = conf(0, 0);
+    ASSERT_TRUE(tl_lru_new(&cf) == NULL);
+    cf = conf(10, 0);
+    cf.nshards = 3;
+    ASSERT_TRUE(tl_lru_new(&cf) == NULL);
+    cf.nshards = 512;
+    ASSERT_TRUE(tl_lru_new(&cf) == NULL);
+}
+
+/* Values are reference counts; the cache holds one reference */
+static void lruRetain(void *value, void *)
+{
+    ((std::atomic<int> *)value)->fetch_add(1);
+}
+
+static void lruRelease(const void *, size_t, void *value, size_t,
+                       enum tl_LRUREASON, void *)
+{
+    ((std::atomic<int> *)value)->fetch_sub(1);
+}
+
+TEST_P(Lru, testThreads)
+{
+    struct tl_LRUCONF cf = conf(2000, 0, TL_LRU_F_TINYLFU);
+    cf.nshards = 8;
+    cf.release = lruRelease;
+    cf.retain = lruRetain;
+    tl_LRU *c = tl_lru_new(&cf);
+    ASSERT_TRUE(c != NULL);
+
+    std::vector<std::atomic<int> > refs(10000);
+    for (size_t ii = 0; ii < refs.size(); ii++) {
+        refs[ii] = 0;
+    }
+    std::vector<std::thread> threads;
+    for (size_t tt = 0; tt < 4; tt++) {
+        threads.push_back(std::thread([c, tt, &refs]() {
+            for (size_t ii = 0; ii < 50000; ii++) {
+                size_t n = (ii * 7919 + tt * 104729) % refs.size();
+                /* Two thirds of the requests go to a quarter of the keys */
+                size_t idx = n % 3 == 0 ? n : n % 2500;
+                std::string k = lruKey(idx);
+                std::atomic<int> *v = (std::atomic<int> *)tl_lru_get(c, k.c_str(), k.size());
+                if (v != NULL) {
+                    EXPECT_EQ(&refs[idx], v);
+                    EXPECT_GT(v->load(), 0);
+                    v->fetch_sub(1);
+                } else {
+                    refs[idx].fetch_add(1);
+                    if (tl_lru_put(c, k.c_str(), k.size(), &refs[idx], 1) != 1) {
+                        refs[idx].fetch_sub(1);
+                    }
+                }
+            }
+        }));
+    }
+    for (size_t tt = 0; tt < threads.size(); tt++) {
+        threads[tt].join();
+    }
+    ASSERT_LE(tl_lru_size(c), 2000U);
+    tl_lru_free(c);
+    for (size_t ii = 0; ii < refs.size(); ii++) {
+        ASSERT_EQ(0, refs[ii].load()) << ii;
+    }
+}
@@ -0,0 +1,318 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2014 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <typelib/typelib.h>
+#include <algorithm>
+#include <iterator>
+#include <set>
+#include <string>
+#include <vector>
+#include <cstdlib>
+
+class Roaring : public ::testing::Test
+{
+protected:
+    typedef std::set<uint32_t> Ref;
+
+    static void check(tl_ROARING *r, const Ref &ref) {
+        ASSERT_EQ(ref.size(), tl_roaring_count(r));
+        uint32_t *items = tl_roaring_items(r, NULL);
+        ASSERT_EQ(ref.empty(), items == NULL);
+        ASSERT_TRUE(std::equal(ref.begin(), ref.end(), items));
+        free(items);
+    }
+
+    static std::string serialize(tl_ROARING *r) {
+        tl_STRING str;
+        tl_str_init(&str);
+        EXPECT_EQ(0, tl_roaring_serialize(r, &str));
+        std::string rv(str.base, str.nused);
+        tl_str_cleanup(&str);
+        return rv;
+    }
+
+    /* Random additions, removals and ranges around a few chunks, dense in
+     * some and sparse in others */
+    static tl_ROARING *random(size_t &seed, Ref &ref, uint32_t span) {
+        tl_ROARING *r = tl_roaring_new();
+        for (size_t ii = 0; ii < 6000; ii++) {
+            seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+            uint32_t v = 100000 + (uint32_t)(seed >> 33) % span;
+            switch ((seed >> 20) % 8) {
+            case 0:
+            case 1:
+                EXPECT_EQ((int)ref.erase(v), tl_roaring_del(r, v));
+                break;
+            case 2: {
+                uint32_t last = v + (uint32_t)(seed >> 24) % 100;
+                EXPECT_EQ(0, tl_roaring_add_range(r, v, last));
+                for (uint32_t x = v; x <= last; x++) {
+                    ref.insert(x);
+                }
+                break;
+            }
+            default:
+                EXPECT_EQ((int)ref.insert(v).second, tl_roaring_add(r, v));
+                break;
+            }
+        }
+        return r;
+    }
+};
+
+TEST_F(Roaring, testBasic)
+{
+    tl_ROARING *r = tl_roaring_new();
+    uint32_t values[] = { 0, 1, 65535, 65536, 1000000, 0xFFFFFFFFU };
+    size_t nvalues = sizeof(values) / sizeof(values[0]);
+
+    ASSERT_TRUE(r != NULL);
+    ASSERT_EQ(0U, tl_roaring_count(r));
+    ASSERT_TRUE(tl_roaring_items(r, NULL) == NULL);
+    for (size_t ii = 0; ii < nvalues; ii++) {
+        ASSERT_EQ(1, tl_roaring_add(r, values[ii]));
+        ASSERT_EQ(0, tl_roaring_add(r, values[ii]));
+    }
+    check(r, Ref(values, values + nvalues));
+    ASSERT_FALSE(tl_roaring_contains(r, 2));
+    ASSERT_FALSE(tl_roaring_contains(r, 65537));
+    ASSERT_FALSE(tl_roaring_contains(r, 0xFFFFFFFEU));
+
+    for (size_t ii = 0; ii < nvalues; ii++) {
+        ASSERT_TRUE(tl_roaring_contains(r, values[ii]));
+        ASSERT_EQ(1, tl_roaring_del(r, values[ii]));
+        ASSERT_EQ(0, tl_roaring_del(r, values[ii]));
+        ASSERT_FALSE(tl_roaring_contains(r, values[ii]));
+    }
+    ASSERT_EQ(0U, tl_roaring_count(r));
+    tl_roaring_free(r);
+}
+
+TEST_F(Roaring, testForms)
+{
+    tl_ROARING *r = tl_roaring_new();
+    Ref ref;
+
+    /* Sparse values take two bytes each, up to 4096 of them... */
+    for (uint32_t ii = 0; ii < 4096; ii++) {
+        tl_roaring_add(r, ii * 16);
+        ref.insert(ii * 16);
+    }
+    size_t array = tl_roaring_bytes(r);
+    ASSERT_LE(array, 4096U * 2 + 256);
+    /* ...then a bit each, over the chunk, and back again */
+    tl_roaring_add(r, 1);
+    ASSERT_GE(tl_roaring_bytes(r), 8192U);
+    ASSERT_LT(tl_roaring_bytes(r), 8192U + 256);
+    tl_roaring_del(r, 1);
+    ASSERT_LE(tl_roaring_bytes(r), array);
+    check(r, ref);
+    tl_roaring_free(r);
+
+    /* Ranges take a few bytes per run, whatever their length */
+    r = tl_roaring_new();
+    ASSERT_EQ(0, tl_roaring_add_range(r, 10, 9999999));
+    ASSERT_EQ(9999990U, tl_roaring_count(r));
+    ASSERT_LT(tl_roaring_bytes(r), 153U * 64);
+    ASSERT_TRUE(tl_roaring_contains(r, 10));
+    ASSERT_TRUE(tl_roaring_contains(r, 9999999));
+    ASSERT_FALSE(tl_roaring_contains(r, 9));
+    ASSERT_FALSE(tl_roaring_contains(r, 10000000));
+
+    /* Removals split runs; values join them */
+    ASSERT_EQ(1, tl_roaring_del(r, 500));
+    ASSERT_EQ(1, tl_roaring_del(r, 502));
+    ASSERT_FALSE(tl_roaring_contains(r, 502));
+    ASSERT_TRUE(tl_roaring_contains(r, 501));
+    ASSERT_EQ(1, tl_roaring_add(r, 500));
+    ASSERT_EQ(1, tl_roaring_add(r, 502));
+    ASSERT_EQ(9999990U, tl_roaring_count(r));
+    ASSERT_LT(tl_roaring_bytes(r), 153U * 64);
+
+    /* Splitting a run into many turns it into a bitmap */
+    for (uint32_t ii = 10; ii < 65536; ii += 2) {
+        tl_roaring_del(r, ii);
+    }
+    ASSERT_EQ(9999990U - 32763, tl_roaring_count(r));
+    ASSERT_FALSE(tl_roaring_contains(r, 1000));
+    ASSERT_TRUE(tl_roaring_contains(r, 1001));
+    tl_roaring_free(r);
+
+    /* Consecutive values added one at a time are run-encoded on request */
+    r = tl_roaring_new();
+    for (uint32_t ii = 0; ii < 3000; ii++) {
+        tl_roaring_add(r, ii);
+    }
+    size_t before = tl_roaring_bytes(r);
+    ASSERT_EQ(0, tl_roaring_optimize(r));
+    ASSERT_LT(tl_roaring_bytes(r) * 10, before);
+    ASSERT_EQ(3000U, tl_roaring_count(r));
+    ASSERT_EQ(1, tl_roaring_add(r, 5000));
+    ASSERT_TRUE(tl_roaring_contains(r, 2999));
+    ASSERT_FALSE(tl_roaring_contains(r, 3000));
+    tl_roaring_free(r);
+}
+
+TEST_F(Roaring, testRankSelect)
+{
+    size_t seed = 42;
+    Ref ref;
+    tl_ROARING *r = random(seed, ref, 300000);
+    uint32_t v;
+    uint64_t ii = 0;
+
+    check(r, ref);
+    for (Ref::iterator it = ref.begin(); it != ref.end(); ++it, ++ii) {
+        ASSERT_EQ(0, tl_roaring_select(r, ii, &v));
+        ASSERT_EQ(*it, v);
+        ASSERT_EQ(ii + 1, tl_roaring_rank(r, *it));
+        ASSERT_EQ(ii, tl_roaring_rank(r, *it - 1));
+    }
+    ASSERT_EQ(-1, tl_roaring_select(r, ref.size(), &v));
+    ASSERT_EQ(0U, tl_roaring_rank(r, 0));
+    ASSERT_EQ(ref.size(), tl_roaring_rank(r, 0xFFFFFFFFU));
+    tl_roaring_free(r);
+
+    /* Every 32 bit value */
+    r = tl_roaring_new();
+    ASSERT_EQ(0, tl_roaring_add_range(r, 0, 0xFFFFFFFFU));
+    ASSERT_EQ(1ULL << 32, tl_roaring_count(r));
+    ASSERT_EQ(0, tl_roaring_select(r, 0xFFFFFFFFU, &v));
+    ASSERT_EQ(0xFFFFFFFFU, v);
+    ASSERT_EQ(0x80000000ULL, tl_roaring_rank(r, 0x7FFFFFFFU));
+    tl_roaring_free(r);
+}
+
+TEST_F(Roaring, testAlgebra)
+{
+    uint32_t spans[] = { 3000, 150000, 400000 };
+    size_t seed = 42;
+    const size_t nspans = sizeof(spans) / sizeof(spans[0]);
+
+    for (size_t aa = 0; aa < nspans; aa++) {
+        for (size_t bb = 0; bb < nspans; bb++) {
+            Ref ra, rb, ru, ri, rd;
+            tl_ROARING *a = random(seed, ra, spans[aa]);
+            tl_ROARING *b = random(seed, rb, spans[bb]);
+            if (bb == 2) {
+                ASSERT_EQ(0, tl_roaring_optimize(b));
+            }
+            std::set_union(ra.begin(), ra.end(), rb.begin(), rb.end(),
+                           std::inserter(ru, ru.end()));
+            std::set_intersection(ra.begin(), ra.end(), rb.begin(), rb.end(),
+                                  std::inserter(ri, ri.end()));
+            std::set_difference(ra.begin(), ra.end(), rb.begin(), rb.end(),
+                                std::inserter(rd, rd.end()));
+
+            tl_ROARING *r = tl_roaring_union_new(a, b);
+            check(r, ru);
+            ASSERT_TRUE(tl_roaring_is_subset(a, r));
+            ASSERT_TRUE(tl_roaring_is_subset(b, r));
+            tl_roaring_free(r);
+            r = tl_roaring_intersect_new(a, b);
+            check(r, ri);
+            ASSERT_TRUE(tl_roaring_is_subset(r, a));
+            tl_roaring_free(r);
+            r = tl_roaring_difference_new(a, b);
+            check(r, rd);
+            tl_roaring_free(r);
+            ASSERT_EQ(std::includes(rb.begin(), rb.end(), ra.begin(), ra.end()),
+                      (bool)tl_roaring_is_subset(a, b));
+
+            /* In place */
+            r = tl_roaring_union_new(a, a);
+            ASSERT_EQ(0, tl_roaring_union(r, b));
+            check(r, ru);
+            ASSERT_EQ(0, tl_roaring_intersect(r, a));
+            check(r, ra);
+            ASSERT_EQ(0, tl_roaring_difference(r, b));
+            check(r, rd);
+            ASSERT_EQ(0, tl_roaring_union(r, r));
+            ASSERT_EQ(0, tl_roaring_intersect(r, r));
+            check(r, rd);
+            ASSERT_EQ(0, tl_roaring_difference(r, r));
+            check(r, Ref());
+            ASSERT_EQ(1, tl_roaring_add(r, 7));
+            tl_roaring_free(r);
+            check(a, ra);
+            check(b, rb);
+            tl_roaring_free(a);
+            tl_roaring_free(b);
+        }
+    }
+}
+
+TEST_F(Roaring, testSerialize)
+{
+    tl_ROARING *r = tl_roaring_new();
+
+    /* The portable format: cookie and count, then the key and count - 1
+     * of each chunk, their offsets, and their values */
+    tl_roaring_add(r, 1);
+    tl_roaring_add(r, 2);
+    tl_roaring_add(r, 3);
+    static const char plain[] = "\x3a\x30\0\0" "\x01\0\0\0" "\0\0\x02\0"
+                                "\x10\0\0\0" "\x01\0\x02\0\x03\0";
+    ASSERT_EQ(std::string(plain, sizeof(plain) - 1), serialize(r));
+    tl_roaring_free(r);
+
+    /* With runs, the cookie holds the count and is followed by a bitset of
+     * the run chunks; there are no offsets for so few chunks */
+    r = tl_roaring_new();
+    tl_roaring_add_range(r, 0, 99);
+    static const char runs[] = "\x3b\x30\0\0" "\x01" "\0\0\x63\0"
+                               "\x01\0" "\0\0\x63\0";
+    ASSERT_EQ(std::string(runs, sizeof(runs) - 1), serialize(r));
+    tl_roaring_free(r);
+
+    /* All three forms, and their round trip */
+    size_t seed = 42;
+    Ref ref;
+    r = random(seed, ref, 400000);
+    tl_roaring_add_range(r, 1000000, 1200000);
+    for (uint32_t ii = 1000000; ii <= 1200000; ii++) {
+        ref.insert(ii);
+    }
+    for (uint32_t ii = 0; ii < 100; ii++) {
+        tl_roaring_add(r, 50000000 + ii * 7);
+        ref.insert(50000000 + ii * 7);
+    }
+    std::string s = serialize(r);
+    tl_roaring_free(r);
+    size_t nread = 0;
+    s += "trailing";
+    r = tl_roaring_deserialize(s.data(), s.size(), &nread);
+    ASSERT_TRUE(r != NULL);
+    ASSERT_EQ(s.size() - 8, nread);
+    check(r, ref);
+    ASSERT_EQ(1, tl_roaring_add(r, 1200001));
+    ASSERT_EQ(1, tl_roaring_del(r, 1100000));
+    ASSERT_EQ(ref.size(), tl_roaring_count(r));
+    tl_roaring_free(r);
+
+    /* Truncated or damaged buffers are refused */
+    for (size_t ii = 0; ii < nread; ii += 1 + ii / 16) {
+        ASSERT_TRUE(tl_roaring_deserialize(s.data(), ii, NULL) == NULL) << ii;
+    }
+    std::string bad(runs, sizeof(runs) - 1);
+    bad[7] = 0x64;
+    ASSERT_TRUE(tl_roaring_deserialize(bad.data(), bad.size(), NULL) == NULL);
+    bad = std::string(plain, sizeof(plain) - 1);
+    bad[18] = 0x01;
+    ASSERT_TRUE(tl_roaring_deserialize(bad.data(), bad.size(), NULL) == NULL);
+}